@@ -0,0 +1,373 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "netcode_util.h"
+#include "netcode_log.h"
+#include "netcode_acl.h"
+
+/* ***************************************************************** */
+#ifdef PLATFORM_Windows
+#include <winsock2.h>
+#include <windows.h>
+#include <ws2tcpip.h>
+
+#endif
+
+/* ***************************************************************** */
+#ifdef PLATFORM_POSIX
+#include <netinet/in.h>
+
+#endif
+
+#define STRIDE          (6)
+#define NONE            (UINT32_MAX)
+
+// Room for the last stride to run past the end of an address.
+#define KEY_BYTES       (16 + 2)
+
+/* While rules are added they are kept in a plain binary trie, one per
+ * family; compiling turns each into a poptrie.
+ */
+struct bnode_t {
+   uint32_t child[2];
+   int8_t   action;        // -1 when no rule ends here
+};
+
+/* A poptrie node: bit 'v' of 'vector' is set if chunk value 'v' leads to
+ * another node, which is then nodes[base1 + (set bits of 'vector' up to
+ * and including 'v') - 1]. Otherwise the answer is a leaf, found the same
+ * way from 'leafvec' and 'base0'; 'leafvec' only has a bit set where the
+ * leaf differs from the one before it, so a run of equal leaves is
+ * stored once.
+ */
+struct pnode_t {
+   uint64_t vector;
+   uint64_t leafvec;
+   uint32_t base0;
+   uint32_t base1;
+};
+
+struct trie_t {
+   struct bnode_t   *bnodes;
+   size_t            nbnodes;
+   struct pnode_t   *nodes;
+   size_t            nnodes;
+   uint8_t          *leaves;
+   size_t            nleaves;
+   size_t            bits;
+};
+
+struct netcode_acl_t {
+   uint8_t        default_action;
+   bool           compiled;
+   struct trie_t  v4;
+   struct trie_t  v6;
+};
+
+/* ***************************************************************** */
+static bool grow (void **array, size_t *count, size_t elemsize, size_t n)
+{
+   void *tmp = netcode_util_realloc (*array, (*count + n) * elemsize);
+   if (!tmp)
+      return false;
+   *array = tmp;
+   *count += n;
+   return true;
+}
+
+static uint32_t bnode_new (struct trie_t *t)
+{
+   if (!(grow ((void **)&t->bnodes, &t->nbnodes, sizeof *t->bnodes, 1)))
+      return NONE;
+   struct bnode_t *n = &t->bnodes[t->nbnodes - 1];
+   n->child[0] = n->child[1] = NONE;
+   n->action = -1;
+   return (uint32_t)(t->nbnodes - 1);
+}
+
+static unsigned key_bit (const uint8_t *key, size_t i)
+{
+   return (key[i / 8] >> (7 - i % 8)) & 1;
+}
+
+// The six bits of 'key' starting at bit 'depth'.
+static unsigned key_chunk (const uint8_t *key, size_t depth)
+{
+   unsigned w = (unsigned)key[depth / 8] << 8 | key[depth / 8 + 1];
+   return (w >> (10 - depth % 8)) & 0x3f;
+}
+
+static bool trie_insert (struct trie_t *t, const uint8_t *key, size_t prefixlen, bool allow)
+{
+   uint32_t n;
+
+   if (!t->nbnodes && bnode_new (t) == NONE)
+      return false;
+
+   n = 0;
+   for (size_t i=0; i<prefixlen; i++) {
+      unsigned bit = key_bit (key, i);
+      if (t->bnodes[n].child[bit] == NONE) {
+         uint32_t c = bnode_new (t);
+         if (c == NONE)
+            return false;
+         t->bnodes[n].child[bit] = c;
+      }
+      n = t->bnodes[n].child[bit];
+   }
+   t->bnodes[n].action = allow ? 1 : 0;
+   return true;
+}
+
+/* Fills in poptrie node 'p' for the part of the binary trie under 'b'
+ * (at 'depth' bits), where 'action' is the answer of the longest rule
+ * above it.
+ */
+static bool compile_node (struct trie_t *t, uint32_t p, uint32_t b,
+                          size_t depth, uint8_t action)
+{
+   uint32_t child_b[64];
+   uint8_t child_action[64];
+   uint64_t vector = 0, leafvec = 0;
+   size_t nchildren = 0;
+   int last = -1;
+
+   uint32_t base0 = (uint32_t)t->nleaves;
+   for (unsigned v=0; v<64; v++) {
+      uint32_t cur = b;
+      uint8_t act = action;
+      for (unsigned k=0; k<STRIDE && cur != NONE; k++) {
+         if (t->bnodes[cur].action >= 0)
+            act = (uint8_t)t->bnodes[cur].action;
+         cur = t->bnodes[cur].child[(v >> (STRIDE - 1 - k)) & 1];
+      }
+
+      // Binary nodes are only made on the way to a rule, so any node
+      // left here has rules under it.
+      if (depth + STRIDE < t->bits && cur != NONE) {
+         vector |= 1ULL << v;
+         child_b[nchildren] = cur;
+         child_action[nchildren++] = act;
+      } else if (act != last) {
+         if (!(grow ((void **)&t->leaves, &t->nleaves, 1, 1)))
+            return false;
+         t->leaves[t->nleaves - 1] = act;
+         leafvec |= 1ULL << v;
+         last = act;
+      }
+   }
+
+   uint32_t base1 = (uint32_t)t->nnodes;
+   if (nchildren && !(grow ((void **)&t->nodes, &t->nnodes, sizeof *t->nodes, nchildren)))
+      return false;
+
+   t->nodes[p].vector = vector;
+   t->nodes[p].leafvec = leafvec;
+   t->nodes[p].base0 = base0;
+   t->nodes[p].base1 = base1;
+
+   for (size_t i=0; i<nchildren; i++) {
+      if (!(compile_node (t, base1 + (uint32_t)i, child_b[i], depth + STRIDE, child_action[i])))
+         return false;
+   }
+   return true;
+}
+
+static bool trie_compile (struct trie_t *t, uint8_t default_action)
+{
+   if (!(grow ((void **)&t->nodes, &t->nnodes, sizeof *t->nodes, 1)))
+      return false;
+   if (!(compile_node (t, 0, t->nbnodes ? 0 : NONE, 0, default_action)))
+      return false;
+
+   netcode_util_free (t->bnodes);
+   t->bnodes = NULL;
+   t->nbnodes = 0;
+   return true;
+}
+
+static uint8_t trie_lookup (const struct trie_t *t, const uint8_t *key)
+{
+   const struct pnode_t *n = t->nodes;
+   size_t depth = 0;
+
+   for (;;) {
+      unsigned v = key_chunk (key, depth);
+      uint64_t upto = (2ULL << v) - 1;
+      if (!(n->vector & (1ULL << v)))
+         return t->leaves[n->base0 + __builtin_popcountll (n->leafvec & upto) - 1];
+      n = &t->nodes[n->base1 + __builtin_popcountll (n->vector & upto) - 1];
+      depth += STRIDE;
+   }
+}
+
+static void trie_free (struct trie_t *t)
+{
+   netcode_util_free (t->bnodes);
+   netcode_util_free (t->nodes);
+   netcode_util_free (t->leaves);
+}
+
+/* ***************************************************************** */
+netcode_acl_t *netcode_acl_new (bool default_allow)
+{
+   netcode_acl_t *ret = netcode_util_calloc (1, sizeof *ret);
+   if (!ret)
+      return NULL;
+
+   ret->default_action = default_allow ? 1 : 0;
+   ret->v4.bits = 32;
+   ret->v6.bits = 128;
+   return ret;
+}
+
+void netcode_acl_del (netcode_acl_t *acl)
+{
+   if (!acl)
+      return;
+   trie_free (&acl->v4);
+   trie_free (&acl->v6);
+   netcode_util_free (acl);
+}
+
+bool netcode_acl_add (netcode_acl_t *acl, const char *cidr, bool allow)
+{
+   char host[NETCODE_ADDR_STRLEN];
+   const char *slash;
+   netcode_addr_t addr;
+   size_t hostlen, prefixlen;
+   struct trie_t *t;
+   const uint8_t *key;
+
+   if (!acl || !cidr || acl->compiled)
+      return false;
+
+   slash = strchr (cidr, '/');
+   hostlen = slash ? (size_t)(slash - cidr) : strlen (cidr);
+   if (hostlen >= sizeof host)
+      return false;
+   memcpy (host, cidr, hostlen);
+   host[hostlen] = 0;
+
+   if (!(netcode_util_addr_parse (host, &addr)))
+      return false;
+
+   switch (netcode_addr_family (&addr)) {
+      case AF_INET:
+         t = &acl->v4;
+         key = (const uint8_t *)&((const struct sockaddr_in *)&addr.sa)->sin_addr;
+         break;
+      case AF_INET6:
+         t = &acl->v6;
+         key = (const uint8_t *)&((const struct sockaddr_in6 *)&addr.sa)->sin6_addr;
+         break;
+      default:
+         return false;
+   }
+
+   prefixlen = t->bits;
+   if (slash) {
+      char *endptr = NULL;
+      if (slash[1] < '0' || slash[1] > '9')
+         return false;
+      prefixlen = strtoul (&slash[1], &endptr, 10);
+      if (*endptr || prefixlen > t->bits)
+         return false;
+   }
+
+   return trie_insert (t, key, prefixlen, allow);
+}
+
+bool netcode_acl_compile (netcode_acl_t *acl)
+{
+   if (!acl || acl->compiled)
+      return false;
+
+   if (!(trie_compile (&acl->v4, acl->default_action)) ||
+       !(trie_compile (&acl->v6, acl->default_action))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM compiling ACL\n");
+      return false;
+   }
+
+   acl->compiled = true;
+   return true;
+}
+
+bool netcode_acl_check (const netcode_acl_t *acl, const struct sockaddr *sa)
+{
+   static const uint8_t v4mapped[12] = { 0,0,0,0, 0,0,0,0, 0,0,0xff,0xff };
+   uint8_t key[KEY_BYTES];
+
+   if (!acl || !sa)
+      return true;
+   if (!acl->compiled)
+      return acl->default_action;
+
+   switch (sa->sa_family) {
+      case AF_INET:
+         memcpy (key, &((const struct sockaddr_in *)sa)->sin_addr, 4);
+         key[4] = key[5] = 0;
+         return trie_lookup (&acl->v4, key);
+
+      case AF_INET6: {
+         const uint8_t *a = (const uint8_t *)&((const struct sockaddr_in6 *)sa)->sin6_addr;
+         if (memcmp (a, v4mapped, sizeof v4mapped) == 0) {
+            memcpy (key, &a[12], 4);
+            key[4] = key[5] = 0;
+            return trie_lookup (&acl->v4, key);
+         }
+         memcpy (key, a, 16);
+         key[16] = key[17] = 0;
+         return trie_lookup (&acl->v6, key);
+      }
+
+      default:
+         return true;
+   }
+}
+
+bool netcode_acl_check_addr (const netcode_acl_t *acl, const netcode_addr_t *addr)
+{
+   if (netcode_addr_family (addr) == AF_UNSPEC)
+      return true;
+   return netcode_acl_check (acl, netcode_addr_sockaddr (addr, NULL));
+}
+
+/* ***************************************************************** */
+// The installed ACL is read under an epoch, so that the installer knows
+// when the ACL it replaced can be freed.
+static netcode_acl_t *installed = NULL;
+static netcode_util_epoch_t epoch = NETCODE_UTIL_EPOCH_INIT;
+static uint64_t denied = 0;
+
+netcode_acl_t *netcode_acl_install (netcode_acl_t *acl)
+{
+   if (acl && !acl->compiled)
+      return NULL;
+
+   netcode_acl_t *old = __atomic_exchange_n (&installed, acl, __ATOMIC_SEQ_CST);
+   netcode_util_epoch_sync (&epoch);
+   return old;
+}
+
+bool netcode_acl_permits (const struct sockaddr *sa)
+{
+   if (!__atomic_load_n (&installed, __ATOMIC_RELAXED))
+      return true;
+
+   uint32_t token = netcode_util_epoch_enter (&epoch);
+   bool ret = netcode_acl_check (__atomic_load_n (&installed, __ATOMIC_SEQ_CST), sa);
+   netcode_util_epoch_exit (&epoch, token);
+
+   if (!ret)
+      __atomic_add_fetch (&denied, 1, __ATOMIC_RELAXED);
+   return ret;
+}
+
+uint64_t netcode_acl_denied (void)
+{
+   return __atomic_load_n (&denied, __ATOMIC_RELAXED);
+}
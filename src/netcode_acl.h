@@ -0,0 +1,83 @@
+
+#ifndef H_NETCODE_ACL
+#define H_NETCODE_ACL
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "netcode_addr.h"
+
+/* Allow/deny lists of IPv4 and IPv6 prefixes ("10.0.0.0/8",
+ * "2001:db8::/32"), where the longest matching prefix decides.
+ *
+ * Rules are added to a list and then compiled into a poptrie: a
+ * multibit trie that consumes six bits of the address per node, with
+ * each node's children and its (run-length compressed) leaves found by
+ * counting bits in two 64-bit maps. An IPv4 lookup reads at most six
+ * small nodes and makes no allocations.
+ *
+ * An ACL may be installed for the whole library with
+ * netcode_acl_install(). The accept and receive functions of
+ * netcode_tcp and netcode_udp then drop connections and datagrams from
+ * denied sources before allocating anything for them. Installing a new
+ * ACL does not stop the threads that are checking against the old one:
+ * the pointer is exchanged, and the old ACL is handed back once no
+ * thread can still be reading it.
+ *
+ * IPv4-mapped IPv6 addresses are checked against the IPv4 rules.
+ * Addresses of other families (such as Unix sockets) are always allowed.
+ */
+typedef struct netcode_acl_t netcode_acl_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Creates an empty ACL that allows (or denies) any address that no
+   // rule matches.
+   //
+   // RETURNS: NULL on error.
+   netcode_acl_t *netcode_acl_new (bool default_allow);
+   void netcode_acl_del (netcode_acl_t *acl);
+
+   // Adds a rule for 'cidr', an address with an optional prefix length
+   // ("192.0.2.0/24", "::1"). Bits past the prefix length are ignored.
+   // When the same prefix is added twice, the later rule wins. Rules
+   // cannot be added once the ACL is compiled.
+   //
+   // RETURNS: false if 'cidr' is not valid or the ACL is compiled.
+   bool netcode_acl_add (netcode_acl_t *acl, const char *cidr, bool allow);
+
+   // Builds the lookup structure from the rules. Must be called before
+   // the ACL is used or installed.
+   //
+   // RETURNS: false on error.
+   bool netcode_acl_compile (netcode_acl_t *acl);
+
+   // RETURNS: true if 'sa' is allowed by 'acl'.
+   bool netcode_acl_check (const netcode_acl_t *acl, const struct sockaddr *sa);
+   bool netcode_acl_check_addr (const netcode_acl_t *acl, const netcode_addr_t *addr);
+
+   // Makes the compiled 'acl' (NULL for none) the one that the library
+   // applies, and waits until no thread is using the previous one.
+   // Installing is serialised; checking never waits for it.
+   //
+   // RETURNS: the previous ACL (or NULL), which the caller may now
+   // delete.
+   netcode_acl_t *netcode_acl_install (netcode_acl_t *acl);
+
+   // RETURNS: true if 'sa' is allowed by the installed ACL, or if there
+   // is none.
+   bool netcode_acl_permits (const struct sockaddr *sa);
+
+   // RETURNS: the number of connections and datagrams that the library
+   // dropped because the installed ACL denied them.
+   uint64_t netcode_acl_denied (void);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
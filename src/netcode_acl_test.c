@@ -0,0 +1,436 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "netcode_util.h"
+#include "netcode_acl.h"
+#include "netcode_tcp.h"
+#include "netcode_udp.h"
+
+#define NRULES4         (2000)
+#define NRULES6         (500)
+#define NLOOKUPS        (100000)
+#define NINSTALLS       (200)
+
+static uint32_t rng_state = 0x55171u;
+
+static uint32_t rng (void)
+{
+   rng_state ^= rng_state << 13;
+   rng_state ^= rng_state >> 17;
+   rng_state ^= rng_state << 5;
+   return rng_state;
+}
+
+static bool check_str (const netcode_acl_t *acl, const char *str)
+{
+   netcode_addr_t addr;
+   netcode_util_addr_parse (str, &addr);
+   return netcode_acl_check_addr (acl, &addr);
+}
+
+static bool rules_test (void)
+{
+   static const char *rules[] = {
+      "+0.0.0.0/0",
+      "-10.0.0.0/8",
+      "+10.1.0.0/16",
+      "-10.1.2.3",
+      "-192.0.2.128/25",
+      "-192.0.2.128/25",
+      "+192.0.2.128/25",      // The later rule for a prefix wins
+      "-2001:db8::/32",
+      "+2001:db8:1::/48",
+      "-::1/128",
+   };
+   static const struct {
+      const char *addr;
+      bool allowed;
+   } tests[] = {
+      { "9.255.255.255",      true  },
+      { "10.0.0.1",           false },
+      { "10.1.0.1",           true  },
+      { "10.1.2.3",           false },
+      { "10.1.2.4",           true  },
+      { "10.2.0.0",           false },
+      { "192.0.2.200",        true  },
+      { "::ffff:10.1.2.3",    false },
+      { "::ffff:10.1.2.4",    true  },
+      { "2001:db8::1",        false },
+      { "2001:db8:1::1",      true  },
+      { "2001:db8:2::1",      false },
+      { "::1",                false },
+      { "::2",                false },    // No IPv6 rule: the default
+      { "unix:/tmp/acl",      true  },
+   };
+   netcode_acl_t *acl = netcode_acl_new (false);
+   bool ret = false;
+
+   for (size_t i=0; i<sizeof rules / sizeof rules[0]; i++) {
+      if (!(netcode_acl_add (acl, &rules[i][1], rules[i][0] == '+'))) {
+         NETCODE_UTIL_LOG ("Failed to add rule [%s]\n", rules[i]);
+         goto errorexit;
+      }
+   }
+   if (netcode_acl_add (acl, "10.0.0.0/33", true) ||
+       netcode_acl_add (acl, "10.0.0.0/", true) ||
+       netcode_acl_add (acl, "example.com/8", true)) {
+      NETCODE_UTIL_LOG ("Invalid rules were accepted\n");
+      goto errorexit;
+   }
+   if (!(netcode_acl_compile (acl)) || netcode_acl_add (acl, "10.0.0.0/8", true)) {
+      NETCODE_UTIL_LOG ("Failed to compile, or rules were added afterwards\n");
+      goto errorexit;
+   }
+
+   for (size_t i=0; i<sizeof tests / sizeof tests[0]; i++) {
+      if (check_str (acl, tests[i].addr) != tests[i].allowed) {
+         NETCODE_UTIL_LOG ("[%s] should be %s\n", tests[i].addr,
+                           tests[i].allowed ? "allowed" : "denied");
+         goto errorexit;
+      }
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_acl_del (acl);
+   return ret;
+}
+
+/* ***************************************************************** */
+struct rule_t {
+   uint8_t  bytes[16];
+   size_t   prefixlen;
+   bool     allow;
+};
+
+static bool prefix_match (const uint8_t *a, const uint8_t *b, size_t bits)
+{
+   size_t whole = bits / 8, rest = bits % 8;
+   if (memcmp (a, b, whole) != 0)
+      return false;
+   return !rest || ((a[whole] ^ b[whole]) >> (8 - rest)) == 0;
+}
+
+// The answer the ACL should give, found by looking at every rule.
+static bool linear_check (const struct rule_t *rules, size_t nrules,
+                          const uint8_t *addr, bool default_allow)
+{
+   bool ret = default_allow;
+   size_t best = 0;
+   bool found = false;
+
+   for (size_t i=0; i<nrules; i++) {
+      if ((!found || rules[i].prefixlen >= best) &&
+          prefix_match (rules[i].bytes, addr, rules[i].prefixlen)) {
+         best = rules[i].prefixlen;
+         ret = rules[i].allow;
+         found = true;
+      }
+   }
+   return ret;
+}
+
+static bool random_test (int family, size_t nrules)
+{
+   size_t len = family == AF_INET ? 4 : 16;
+   struct rule_t *rules = netcode_util_calloc (nrules, sizeof *rules);
+   struct sockaddr_storage *addrs = netcode_util_calloc (NLOOKUPS, sizeof *addrs);
+   netcode_acl_t *acl = netcode_acl_new (true);
+   uint64_t start, trie_ns, linear_ns;
+   size_t mismatches = 0, denied = 0;
+   bool ret = false;
+
+   if (!rules || !addrs || !acl)
+      goto errorexit;
+
+   for (size_t i=0; i<nrules; i++) {
+      char cidr[NETCODE_ADDR_STRLEN];
+      char host[INET6_ADDRSTRLEN];
+
+      // Short prefixes are rare, so that most addresses are not decided
+      // by them alone.
+      for (size_t j=0; j<len; j++) {
+         rules[i].bytes[j] = (uint8_t)rng ();
+      }
+      rules[i].bytes[0] &= 0x3f;
+      rules[i].prefixlen = (rng () % 8 == 0) ? rng () % 9 : 8 + rng () % (len * 8 - 7);
+      rules[i].allow = rng () % 2;
+
+      inet_ntop (family, rules[i].bytes, host, sizeof host);
+      snprintf (cidr, sizeof cidr, "%s/%zu", host, rules[i].prefixlen);
+      if (!(netcode_acl_add (acl, cidr, rules[i].allow))) {
+         NETCODE_UTIL_LOG ("Failed to add [%s]\n", cidr);
+         goto errorexit;
+      }
+   }
+   if (!(netcode_acl_compile (acl)))
+      goto errorexit;
+
+   // Half the addresses fall inside a rule's prefix.
+   for (size_t i=0; i<NLOOKUPS; i++) {
+      uint8_t *bytes;
+      if (family == AF_INET) {
+         struct sockaddr_in *sin = (struct sockaddr_in *)&addrs[i];
+         sin->sin_family = AF_INET;
+         bytes = (uint8_t *)&sin->sin_addr;
+      } else {
+         struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&addrs[i];
+         sin6->sin6_family = AF_INET6;
+         bytes = sin6->sin6_addr.s6_addr;
+      }
+      for (size_t j=0; j<len; j++) {
+         bytes[j] = (uint8_t)rng ();
+      }
+      if (i % 2) {
+         const struct rule_t *r = &rules[rng () % nrules];
+         memcpy (bytes, r->bytes, r->prefixlen / 8);
+         if (r->prefixlen % 8) {
+            uint8_t mask = (uint8_t)(0xff << (8 - r->prefixlen % 8));
+            size_t k = r->prefixlen / 8;
+            bytes[k] = (uint8_t)((r->bytes[k] & mask) | (bytes[k] & ~mask));
+         }
+      }
+   }
+
+   start = netcode_util_time_ns ();
+   for (size_t i=0; i<NLOOKUPS; i++) {
+      denied += !netcode_acl_check (acl, (const struct sockaddr *)&addrs[i]);
+   }
+   trie_ns = netcode_util_time_ns () - start;
+
+   start = netcode_util_time_ns ();
+   for (size_t i=0; i<NLOOKUPS; i++) {
+      const uint8_t *bytes = family == AF_INET
+         ? (const uint8_t *)&((struct sockaddr_in *)&addrs[i])->sin_addr
+         : ((struct sockaddr_in6 *)&addrs[i])->sin6_addr.s6_addr;
+      bool expected = linear_check (rules, nrules, bytes, true);
+      if (expected != netcode_acl_check (acl, (const struct sockaddr *)&addrs[i]))
+         mismatches++;
+   }
+   linear_ns = netcode_util_time_ns () - start;
+
+   printf ("ACL: %s, %zu rules: %.1f ns per lookup (linear scan %.1f ns), %zu of %i denied\n",
+           family == AF_INET ? "IPv4" : "IPv6", nrules, (double)trie_ns / NLOOKUPS,
+           (double)linear_ns / NLOOKUPS, denied, NLOOKUPS);
+
+   if (mismatches) {
+      NETCODE_UTIL_LOG ("%zu lookups differ from a linear scan of the rules\n", mismatches);
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_util_free (rules);
+   netcode_util_free (addrs);
+   netcode_acl_del (acl);
+   return ret;
+}
+
+/* ***************************************************************** */
+static bool stop_reader = false;
+
+static void *reader_fn (void *arg)
+{
+   struct sockaddr_in sin;
+   uint64_t *checks = arg;
+
+   memset (&sin, 0, sizeof sin);
+   sin.sin_family = AF_INET;
+   while (!__atomic_load_n (&stop_reader, __ATOMIC_ACQUIRE)) {
+      sin.sin_addr.s_addr = rng ();
+      netcode_acl_permits ((const struct sockaddr *)&sin);
+      (*checks)++;
+   }
+   return NULL;
+}
+
+// ACLs are swapped and freed while another thread checks against them.
+static bool install_test (void)
+{
+   pthread_t reader;
+   uint64_t checks = 0;
+
+   if (pthread_create (&reader, NULL, reader_fn, &checks) != 0) {
+      NETCODE_UTIL_LOG ("Failed to create thread\n");
+      return false;
+   }
+
+   for (size_t i=0; i<NINSTALLS; i++) {
+      netcode_acl_t *acl = netcode_acl_new (i % 2);
+      netcode_acl_add (acl, "10.0.0.0/8", false);
+      netcode_acl_add (acl, "192.168.0.0/16", true);
+      netcode_acl_compile (acl);
+      netcode_acl_del (netcode_acl_install (acl));
+      if (i % 16 == 0)
+         netcode_util_sleep_ns (100000);
+   }
+   netcode_acl_del (netcode_acl_install (NULL));
+
+   __atomic_store_n (&stop_reader, true, __ATOMIC_RELEASE);
+   pthread_join (reader, NULL);
+
+   printf ("ACL: %i installs during %" PRIu64 " checks\n", NINSTALLS, checks);
+   return true;
+}
+
+/* ***************************************************************** */
+static bool install_loopback (bool allow)
+{
+   netcode_acl_t *acl = netcode_acl_new (true);
+   if (!acl || !(netcode_acl_add (acl, "127.0.0.0/8", allow)) || !(netcode_acl_compile (acl))) {
+      netcode_acl_del (acl);
+      return false;
+   }
+   netcode_acl_del (netcode_acl_install (acl));
+   return true;
+}
+
+/* Listens on an ephemeral port rather than a fixed one: the refused
+ * connections are closed from this end, and the TIME_WAIT they leave
+ * behind would stop a rerun from binding a fixed port for a minute.
+ */
+static int tcp_server_any (uint16_t *port)
+{
+   struct sockaddr_in addr;
+   socklen_t addrlen = sizeof addr;
+   int fd = socket (AF_INET, SOCK_STREAM, 0);
+
+   memset (&addr, 0, sizeof addr);
+   addr.sin_family = AF_INET;
+   addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+   if (fd < 0 ||
+       bind (fd, (struct sockaddr *)&addr, sizeof addr) != 0 ||
+       listen (fd, 8) != 0 ||
+       getsockname (fd, (struct sockaddr *)&addr, &addrlen) != 0) {
+      if (fd >= 0)
+         netcode_util_close (fd);
+      return -1;
+   }
+   *port = ntohs (addr.sin_port);
+   return fd;
+}
+
+static bool socket_test (void)
+{
+   int rxfd = -1, txfd = -1, listenfd = -1, clientfd = -1, connfd = -1;
+   netcode_addr_t dest, from;
+   uint8_t *buf = NULL;
+   size_t buflen = 0;
+   char tmp[64];
+   uint64_t denied = netcode_acl_denied ();
+   uint16_t tcp_port = 0;
+   bool ret = false;
+
+   netcode_addr_parse (&dest, "127.0.0.1");
+   netcode_addr_set_port (&dest, NETCODE_TEST_ACL_PORT);
+
+   if ((rxfd = netcode_udp_socket (NETCODE_TEST_ACL_PORT, NULL)) < 0 ||
+       (txfd = netcode_udp_socket (0, NULL)) < 0 ||
+       (listenfd = tcp_server_any (&tcp_port)) < 0) {
+      NETCODE_UTIL_LOG ("Failed to create sockets\n");
+      goto errorexit;
+   }
+
+   if (!(install_loopback (false)))
+      goto errorexit;
+
+   // Denied datagrams look like a timeout to both receive functions.
+   netcode_udp_send_addr (txfd, &dest, "denied", (size_t)6, NULL);
+   netcode_udp_send_addr (txfd, &dest, "denied", (size_t)6, NULL);
+   if (netcode_udp_recv_into (rxfd, &from, tmp, sizeof tmp, 1) != 0 ||
+       netcode_addr_family (&from) != AF_UNSPEC ||
+       netcode_udp_wait_addr (rxfd, &from, &buf, &buflen, 1) != 0 || buf ||
+       netcode_addr_family (&from) != AF_UNSPEC) {
+      NETCODE_UTIL_LOG ("Datagram from a denied source was received\n");
+      goto errorexit;
+   }
+
+   if ((clientfd = netcode_tcp_connect ("127.0.0.1", tcp_port)) < 0 ||
+       (connfd = netcode_tcp_accept_addr (listenfd, 1, &from)) != 0 ||
+       read (clientfd, tmp, sizeof tmp) > 0) {
+      NETCODE_UTIL_LOG ("Connection from a denied source was accepted\n");
+      goto errorexit;
+   }
+   netcode_util_close (clientfd);
+   clientfd = -1;
+
+   if (netcode_acl_denied () - denied != 3) {
+      NETCODE_UTIL_LOG ("Denied count is %" PRIu64 ", not 3\n", netcode_acl_denied () - denied);
+      goto errorexit;
+   }
+
+   if (!(install_loopback (true)))
+      goto errorexit;
+
+   netcode_udp_send_addr (txfd, &dest, "allowed", (size_t)7, NULL);
+   if (netcode_udp_recv_into (rxfd, &from, tmp, sizeof tmp, 1) != 7 ||
+       netcode_addr_family (&from) != AF_INET) {
+      NETCODE_UTIL_LOG ("Datagram from an allowed source was not received\n");
+      goto errorexit;
+   }
+   if ((clientfd = netcode_tcp_connect ("127.0.0.1", tcp_port)) < 0 ||
+       (connfd = netcode_tcp_accept_addr (listenfd, 1, &from)) <= 0) {
+      NETCODE_UTIL_LOG ("Connection from an allowed source was not accepted\n");
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_acl_del (netcode_acl_install (NULL));
+   netcode_util_free (buf);
+   int fds[] = { rxfd, txfd, listenfd, clientfd, connfd };
+   for (size_t i=0; i<sizeof fds / sizeof fds[0]; i++) {
+      if (fds[i] > 0)
+         netcode_util_close (fds[i]);
+   }
+   return ret;
+}
+
+static int acl_test (void)
+{
+   if (!(rules_test ()) ||
+       !(random_test (AF_INET, NRULES4)) ||
+       !(random_test (AF_INET6, NRULES6)) ||
+       !(install_test ()) ||
+       !(socket_test ()))
+      return EXIT_FAILURE;
+
+   return EXIT_SUCCESS;
+}
+
+int main (void)
+{
+   int ret = EXIT_FAILURE;
+
+   if (!(netcode_util_init ())) {
+      NETCODE_UTIL_LOG ("Failed to initialise netcode\n");
+      goto errorexit;
+   }
+
+   if ((ret = acl_test ())!=EXIT_SUCCESS) {
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      printf ("+++ +++ acl: Test FAILED +++ +++\n");
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      goto errorexit;
+   }
+
+   printf ("*********************************\n");
+   printf ("*** *** acl: Test passed *** ***\n");
+   printf ("*********************************\n");
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   return ret;
+}
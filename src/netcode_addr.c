@@ -0,0 +1,417 @@
+
+/* This must come before any system header, otherwise strict C99 mode
+ * hides getaddrinfo() and friends from us.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "netcode_util.h"
+#include "netcode_log.h"
+#include "netcode_addr.h"
+
+/* ***************************************************************** */
+#ifdef PLATFORM_Windows
+#include <winsock2.h>
+#include <windows.h>
+#include <ws2tcpip.h>
+
+// No Unix domain sockets on this platform.
+#define AF_UNIX_SUPPORTED     (0)
+
+#endif
+
+/* ***************************************************************** */
+#ifdef PLATFORM_POSIX
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <net/if.h>
+
+#define AF_UNIX_SUPPORTED     (1)
+
+#endif
+
+#define UNIX_PREFIX           ("unix:")
+
+/* ***************************************************************** */
+static bool parse_port (const char *src, uint16_t *port)
+{
+   char *endptr = NULL;
+
+   if (!src[0] || src[0] == '-' || src[0] == '+')
+      return false;
+
+   unsigned long tmp = strtoul (src, &endptr, 10);
+   if (*endptr || tmp > 0xffff)
+      return false;
+
+   *port = (uint16_t)tmp;
+   return true;
+}
+
+static bool parse_ipv4 (netcode_addr_t *dst, const char *host, uint16_t port)
+{
+   struct sockaddr_in *sin = (struct sockaddr_in *)&dst->sa;
+
+   if (inet_pton (AF_INET, host, &sin->sin_addr) != 1)
+      return false;
+
+   sin->sin_family = AF_INET;
+   sin->sin_port = htons (port);
+   dst->salen = sizeof *sin;
+   return true;
+}
+
+static bool parse_ipv6 (netcode_addr_t *dst, const char *host, uint16_t port)
+{
+   struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&dst->sa;
+   char tmp[INET6_ADDRSTRLEN + 1];
+   const char *scope = strchr (host, '%');
+   size_t hostlen = scope ? (size_t)(scope - host) : strlen (host);
+
+   if (hostlen >= sizeof tmp)
+      return false;
+
+   memcpy (tmp, host, hostlen);
+   tmp[hostlen] = 0;
+
+   if (inet_pton (AF_INET6, tmp, &sin6->sin6_addr) != 1)
+      return false;
+
+   if (scope) {
+      char *endptr = NULL;
+      unsigned long idx = strtoul (&scope[1], &endptr, 10);
+      if (!scope[1] || *endptr) {
+         // Not a number, so it must be an interface name.
+         if ((idx = if_nametoindex (&scope[1])) == 0)
+            return false;
+      }
+      sin6->sin6_scope_id = (uint32_t)idx;
+   }
+
+   sin6->sin6_family = AF_INET6;
+   sin6->sin6_port = htons (port);
+   dst->salen = sizeof *sin6;
+   return true;
+}
+
+static bool parse_unix (netcode_addr_t *dst, const char *path)
+{
+#if AF_UNIX_SUPPORTED
+   struct sockaddr_un *sun = (struct sockaddr_un *)&dst->sa;
+   size_t pathlen = strlen (path);
+
+   if (pathlen == 0 || pathlen >= sizeof sun->sun_path)
+      return false;
+
+   sun->sun_family = AF_UNIX;
+   memcpy (sun->sun_path, path, pathlen + 1);
+   dst->salen = (uint32_t)(offsetof (struct sockaddr_un, sun_path) + pathlen + 1);
+   return true;
+#else
+   (void)dst;
+   (void)path;
+   return false;
+#endif
+}
+
+bool netcode_addr_parse (netcode_addr_t *dst, const char *src)
+{
+   char host[INET6_ADDRSTRLEN + 32];
+   uint16_t port = 0;
+
+   memset (dst, 0, sizeof *dst);
+
+   if (!src)
+      return false;
+
+   if ((strncmp (src, UNIX_PREFIX, strlen (UNIX_PREFIX))) == 0)
+      return parse_unix (dst, &src[strlen (UNIX_PREFIX)]);
+
+   if (src[0] == '/')
+      return parse_unix (dst, src);
+
+   // [ipv6]:port or [ipv6]
+   if (src[0] == '[') {
+      const char *end = strchr (src, ']');
+      if (!end || (size_t)(end - src - 1) >= sizeof host)
+         return false;
+
+      memcpy (host, &src[1], end - src - 1);
+      host[end - src - 1] = 0;
+
+      if (end[1] == ':') {
+         if (!(parse_port (&end[2], &port)))
+            return false;
+      } else if (end[1]) {
+         return false;
+      }
+      return parse_ipv6 (dst, host, port);
+   }
+
+   const char *colon = strchr (src, ':');
+
+   // Bare ipv6 address, cannot have a port.
+   if (colon && strchr (&colon[1], ':'))
+      return parse_ipv6 (dst, src, 0);
+
+   // ipv4:port or ipv4
+   if (colon) {
+      if ((size_t)(colon - src) >= sizeof host)
+         return false;
+      memcpy (host, src, colon - src);
+      host[colon - src] = 0;
+      if (!(parse_port (&colon[1], &port)))
+         return false;
+      return parse_ipv4 (dst, host, port);
+   }
+
+   return parse_ipv4 (dst, src, 0);
+}
+
+bool netcode_addr_resolve (netcode_addr_t *dst, const char *host, uint16_t port)
+{
+   struct addrinfo hints, *results = NULL, *chosen = NULL;
+   bool ret = false;
+
+   memset (dst, 0, sizeof *dst);
+
+   if (!host)
+      return false;
+
+   memset (&hints, 0, sizeof hints);
+   hints.ai_family = AF_UNSPEC;
+   hints.ai_socktype = SOCK_DGRAM;
+
+   int rc = getaddrinfo (host, NULL, &hints, &results);
+   if (rc != 0) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "getaddrinfo(%s) failure: %s\n", host, gai_strerror (rc));
+      return false;
+   }
+
+   for (struct addrinfo *ai = results; ai; ai = ai->ai_next) {
+      if (ai->ai_family == AF_INET) {
+         chosen = ai;
+         break;
+      }
+      if (ai->ai_family == AF_INET6 && !chosen) {
+         chosen = ai;
+      }
+   }
+
+   if (chosen && netcode_addr_from_sockaddr (dst, chosen->ai_addr, chosen->ai_addrlen)) {
+      netcode_addr_set_port (dst, port);
+      ret = true;
+   }
+
+   freeaddrinfo (results);
+   return ret;
+}
+
+bool netcode_addr_from_sockaddr (netcode_addr_t *dst,
+                                 const struct sockaddr *sa, size_t salen)
+{
+   memset (dst, 0, sizeof *dst);
+
+   if (!sa)
+      return false;
+
+   switch (sa->sa_family) {
+      case AF_INET: {
+         struct sockaddr_in *dst4 = (struct sockaddr_in *)&dst->sa;
+         const struct sockaddr_in *src4 = (const struct sockaddr_in *)sa;
+         if (salen < sizeof *src4)
+            return false;
+         dst4->sin_family = AF_INET;
+         dst4->sin_port = src4->sin_port;
+         dst4->sin_addr = src4->sin_addr;
+         dst->salen = sizeof *dst4;
+         return true;
+      }
+
+      case AF_INET6: {
+         struct sockaddr_in6 *dst6 = (struct sockaddr_in6 *)&dst->sa;
+         const struct sockaddr_in6 *src6 = (const struct sockaddr_in6 *)sa;
+         if (salen < sizeof *src6)
+            return false;
+         dst6->sin6_family = AF_INET6;
+         dst6->sin6_port = src6->sin6_port;
+         dst6->sin6_addr = src6->sin6_addr;
+         dst6->sin6_scope_id = src6->sin6_scope_id;
+         dst->salen = sizeof *dst6;
+         return true;
+      }
+
+#if AF_UNIX_SUPPORTED
+      case AF_UNIX: {
+         struct sockaddr_un *dstu = (struct sockaddr_un *)&dst->sa;
+         const struct sockaddr_un *srcu = (const struct sockaddr_un *)sa;
+         size_t offset = offsetof (struct sockaddr_un, sun_path);
+         size_t pathlen = 0;
+         if (salen > sizeof *srcu)
+            salen = sizeof *srcu;
+         // Unnamed sockets (from socketpair(), or unbound) have no path.
+         while (offset + pathlen < salen && srcu->sun_path[pathlen])
+            pathlen++;
+         if (pathlen >= sizeof dstu->sun_path)
+            return false;
+         dstu->sun_family = AF_UNIX;
+         memcpy (dstu->sun_path, srcu->sun_path, pathlen);
+         dst->salen = (uint32_t)(offset + pathlen + 1);
+         return true;
+      }
+#endif
+
+      default:
+         return false;
+   }
+}
+
+const struct sockaddr *netcode_addr_sockaddr (const netcode_addr_t *addr,
+                                              size_t *salen)
+{
+   if (salen)
+      *salen = addr->salen;
+   return (const struct sockaddr *)&addr->sa;
+}
+
+int netcode_addr_family (const netcode_addr_t *addr)
+{
+   return addr->salen ? addr->sa.ss_family : AF_UNSPEC;
+}
+
+uint16_t netcode_addr_port (const netcode_addr_t *addr)
+{
+   switch (netcode_addr_family (addr)) {
+      case AF_INET:  return ntohs (((const struct sockaddr_in *)&addr->sa)->sin_port);
+      case AF_INET6: return ntohs (((const struct sockaddr_in6 *)&addr->sa)->sin6_port);
+      default:       return 0;
+   }
+}
+
+void netcode_addr_set_port (netcode_addr_t *addr, uint16_t port)
+{
+   switch (netcode_addr_family (addr)) {
+      case AF_INET:  ((struct sockaddr_in *)&addr->sa)->sin_port = htons (port);     break;
+      case AF_INET6: ((struct sockaddr_in6 *)&addr->sa)->sin6_port = htons (port);   break;
+      default:       break;
+   }
+}
+
+size_t netcode_addr_format (const netcode_addr_t *addr, char *dst, size_t dstlen)
+{
+   if (netcode_addr_family (addr) == AF_UNSPEC) {
+      if (dst && dstlen)
+         dst[0] = 0;
+      return 0;
+   }
+   return netcode_util_addr_format ((const struct sockaddr *)&addr->sa, dst, dstlen);
+}
+
+/* ***************************************************************** */
+// FNV-1a; the addresses are short enough that anything fancier is
+// wasted.
+static uint32_t fnv1a (uint32_t hash, const void *data, size_t len)
+{
+   const uint8_t *bytes = data;
+   for (size_t i=0; i<len; i++) {
+      hash ^= bytes[i];
+      hash *= 16777619u;
+   }
+   return hash;
+}
+
+uint32_t netcode_addr_hash (const netcode_addr_t *addr)
+{
+   uint32_t hash = 2166136261u;
+   uint16_t family = (uint16_t)netcode_addr_family (addr);
+
+   hash = fnv1a (hash, &family, sizeof family);
+
+   switch (family) {
+      case AF_INET: {
+         const struct sockaddr_in *sin = (const struct sockaddr_in *)&addr->sa;
+         hash = fnv1a (hash, &sin->sin_addr, sizeof sin->sin_addr);
+         hash = fnv1a (hash, &sin->sin_port, sizeof sin->sin_port);
+         break;
+      }
+
+      case AF_INET6: {
+         const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)&addr->sa;
+         hash = fnv1a (hash, &sin6->sin6_addr, sizeof sin6->sin6_addr);
+         hash = fnv1a (hash, &sin6->sin6_port, sizeof sin6->sin6_port);
+         hash = fnv1a (hash, &sin6->sin6_scope_id, sizeof sin6->sin6_scope_id);
+         break;
+      }
+
+#if AF_UNIX_SUPPORTED
+      case AF_UNIX: {
+         const struct sockaddr_un *sun = (const struct sockaddr_un *)&addr->sa;
+         hash = fnv1a (hash, sun->sun_path, strlen (sun->sun_path));
+         break;
+      }
+#endif
+
+      default:
+         break;
+   }
+
+   return hash;
+}
+
+int netcode_addr_cmp (const netcode_addr_t *lhs, const netcode_addr_t *rhs)
+{
+   int lfamily = netcode_addr_family (lhs),
+       rfamily = netcode_addr_family (rhs);
+   int rc = 0;
+
+   if (lfamily != rfamily)
+      return lfamily < rfamily ? -1 : 1;
+
+   switch (lfamily) {
+      case AF_INET: {
+         const struct sockaddr_in *l = (const struct sockaddr_in *)&lhs->sa,
+                                  *r = (const struct sockaddr_in *)&rhs->sa;
+         if ((rc = memcmp (&l->sin_addr, &r->sin_addr, sizeof l->sin_addr)) != 0)
+            return rc;
+         break;
+      }
+
+      case AF_INET6: {
+         const struct sockaddr_in6 *l = (const struct sockaddr_in6 *)&lhs->sa,
+                                   *r = (const struct sockaddr_in6 *)&rhs->sa;
+         if ((rc = memcmp (&l->sin6_addr, &r->sin6_addr, sizeof l->sin6_addr)) != 0)
+            return rc;
+         if (l->sin6_scope_id != r->sin6_scope_id)
+            return l->sin6_scope_id < r->sin6_scope_id ? -1 : 1;
+         break;
+      }
+
+#if AF_UNIX_SUPPORTED
+      case AF_UNIX:
+         return strcmp (((const struct sockaddr_un *)&lhs->sa)->sun_path,
+                        ((const struct sockaddr_un *)&rhs->sa)->sun_path);
+#endif
+
+      default:
+         return 0;
+   }
+
+   uint16_t lport = netcode_addr_port (lhs),
+            rport = netcode_addr_port (rhs);
+
+   if (lport != rport)
+      return lport < rport ? -1 : 1;
+
+   return 0;
+}
@@ -0,0 +1,99 @@
+
+#ifndef H_NETCODE_ADDR
+#define H_NETCODE_ADDR
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "netcode_util.h"
+
+// Large enough for any address formatted by netcode_addr_format(),
+// including the terminating nul character.
+#define NETCODE_ADDR_STRLEN         (128)
+
+/* A binary network address: IPv4 or IPv6 (with port), or a Unix socket
+ * path. The type is fixed-size so that it can live on the stack or be
+ * embedded in other structures, and can be copied with memcpy() or a
+ * plain assignment.
+ *
+ * The fields are private; use the netcode_addr_*() functions to read
+ * and write them. All the functions in this module that fill in an
+ * address clear the unused bytes, so two equal addresses also compare
+ * equal with memcmp().
+ */
+typedef struct netcode_addr_t {
+   struct sockaddr_storage    sa;
+   uint32_t                   salen;
+} netcode_addr_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Parses a numeric address into 'dst'. No name resolution is done.
+   // Accepted forms are:
+   //    1.2.3.4              1.2.3.4:80
+   //    ::1                  [::1]:80          [fe80::1%2]:80
+   //    unix:/path/to/sock   /path/to/sock
+   // When no port is given the port is zero.
+   //
+   // RETURNS: true on success, false if 'src' is not a valid address.
+   bool netcode_addr_parse (netcode_addr_t *dst, const char *src);
+
+   // Resolves 'host' (a name or a numeric address) using getaddrinfo()
+   // and stores the first result in 'dst' with the given port. IPv4
+   // results are preferred over IPv6 results, as the sockets created by
+   // this library are IPv4 sockets.
+   //
+   // RETURNS: true on success, false if 'host' could not be resolved.
+   bool netcode_addr_resolve (netcode_addr_t *dst, const char *host, uint16_t port);
+
+   // Copies the socket address 'sa' of length 'salen' into 'dst'.
+   //
+   // RETURNS: false if the address family is not IPv4, IPv6 or Unix.
+   bool netcode_addr_from_sockaddr (netcode_addr_t *dst,
+                                    const struct sockaddr *sa, size_t salen);
+
+   // Returns a pointer to the socket address stored in 'addr', suitable
+   // for passing to bind(), connect(), sendto(), etc. The length of the
+   // socket address is stored in '*salen' if 'salen' is not NULL.
+   const struct sockaddr *netcode_addr_sockaddr (const netcode_addr_t *addr,
+                                                 size_t *salen);
+
+   // Returns the address family (AF_INET, AF_INET6 or AF_UNIX) of 'addr',
+   // or AF_UNSPEC if 'addr' has not been set.
+   int netcode_addr_family (const netcode_addr_t *addr);
+
+   // Returns the port of an IPv4 or IPv6 address in host byte order,
+   // and zero for any other address.
+   uint16_t netcode_addr_port (const netcode_addr_t *addr);
+
+   // Sets the port of an IPv4 or IPv6 address. Has no effect on any
+   // other address.
+   void netcode_addr_set_port (netcode_addr_t *addr, uint16_t port);
+
+   // Formats 'addr' into the caller-supplied buffer 'dst' of 'dstlen'
+   // bytes. IPv4 addresses are written as "1.2.3.4:80", IPv6 addresses
+   // as "[::1]:80" and Unix addresses as "unix:/path/to/sock". No
+   // memory is allocated.
+   //
+   // RETURNS: the length of the string written (excluding the nul
+   // terminator), or zero if 'dst' is too small or 'addr' is not set.
+   size_t netcode_addr_format (const netcode_addr_t *addr, char *dst, size_t dstlen);
+
+   // Returns a hash of 'addr' (address and port) suitable for hash
+   // tables. Equal addresses produce equal hashes.
+   uint32_t netcode_addr_hash (const netcode_addr_t *addr);
+
+   // Compares two addresses: first by family, then by address, then by
+   // port. Returns less than, equal to or greater than zero in the same
+   // manner as memcmp().
+   int netcode_addr_cmp (const netcode_addr_t *lhs, const netcode_addr_t *rhs);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
@@ -0,0 +1,297 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "netcode_util.h"
+#include "netcode_addr.h"
+
+#define NADDRS          (4096)
+#define NROUNDS         (100)
+
+static uint32_t rng_state = 0x55171u;
+
+static uint32_t rng (void)
+{
+   rng_state ^= rng_state << 13;
+   rng_state ^= rng_state >> 17;
+   rng_state ^= rng_state << 5;
+   return rng_state;
+}
+
+/* Random addresses, with long runs of zero words mixed in for IPv6 so
+ * that the "::" compression is exercised.
+ */
+static void random_sockaddr (struct sockaddr_storage *ss, int family)
+{
+   memset (ss, 0, sizeof *ss);
+   if (family == AF_INET) {
+      struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+      sin->sin_family = AF_INET;
+      sin->sin_port = htons ((uint16_t)rng ());
+      sin->sin_addr.s_addr = rng () >> (rng () % 4 * 8);
+   } else {
+      struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+      uint32_t zeros = rng ();
+      sin6->sin6_family = AF_INET6;
+      sin6->sin6_port = htons ((uint16_t)rng ());
+      for (size_t i=0; i<16; i+=2) {
+         uint16_t w = (zeros >> (i / 2)) & 1 ? 0 : (uint16_t)(rng () >> (rng () % 16));
+         sin6->sin6_addr.s6_addr[i] = (uint8_t)(w >> 8);
+         sin6->sin6_addr.s6_addr[i + 1] = (uint8_t)w;
+      }
+      if (zeros % 16 == 0) {
+         memset (sin6->sin6_addr.s6_addr, 0, 10);
+         sin6->sin6_addr.s6_addr[10] = sin6->sin6_addr.s6_addr[11] = zeros & 0x100 ? 0xff : 0;
+      }
+   }
+}
+
+// The text of an address as the C library writes it.
+static void libc_format (const struct sockaddr_storage *ss, char *dst, size_t len)
+{
+   char host[INET6_ADDRSTRLEN];
+   if (ss->ss_family == AF_INET) {
+      const struct sockaddr_in *sin = (const struct sockaddr_in *)ss;
+      inet_ntop (AF_INET, &sin->sin_addr, host, sizeof host);
+      snprintf (dst, len, "%s:%u", host, ntohs (sin->sin_port));
+   } else {
+      const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)ss;
+      inet_ntop (AF_INET6, &sin6->sin6_addr, host, sizeof host);
+      snprintf (dst, len, "[%s]:%u", host, ntohs (sin6->sin6_port));
+   }
+}
+
+static bool fast_test (void)
+{
+   static struct sockaddr_storage addrs[NADDRS];
+   static char text[NADDRS][NETCODE_ADDR_STRLEN];
+   static char hosts[NADDRS][INET_ADDRSTRLEN];
+   char expected[NETCODE_ADDR_STRLEN];
+   netcode_addr_t parsed;
+   struct in_addr in;
+   uint64_t start, fast_ns, libc_ns, allocs;
+   size_t sink = 0;
+
+   // Both formats and parses agree with the C library.
+   for (size_t i=0; i<NADDRS; i++) {
+      random_sockaddr (&addrs[i], i % 2 ? AF_INET6 : AF_INET);
+      libc_format (&addrs[i], expected, sizeof expected);
+      size_t len = netcode_util_addr_format ((struct sockaddr *)&addrs[i],
+                                             text[i], sizeof text[i]);
+      if (len != strlen (expected) || strcmp (text[i], expected) != 0) {
+         NETCODE_UTIL_LOG ("Formatted [%s], expected [%s]\n", text[i], expected);
+         return false;
+      }
+      if (!(netcode_util_addr_parse (text[i], &parsed)) ||
+          memcmp (netcode_addr_sockaddr (&parsed, NULL), &addrs[i], parsed.salen) != 0) {
+         NETCODE_UTIL_LOG ("Failed to parse [%s] back\n", text[i]);
+         return false;
+      }
+      in.s_addr = rng () >> (rng () % 4 * 8);
+      inet_ntop (AF_INET, &in, hosts[i], sizeof hosts[i]);
+   }
+
+   netcode_util_alloc_debug (true);
+   allocs = netcode_util_alloc_count ();
+
+   start = netcode_util_time_ns ();
+   for (size_t r=0; r<NROUNDS; r++) {
+      for (size_t i=0; i<NADDRS; i+=2) {
+         sink += netcode_util_addr_format ((struct sockaddr *)&addrs[i], expected, sizeof expected);
+      }
+   }
+   fast_ns = netcode_util_time_ns () - start;
+
+   start = netcode_util_time_ns ();
+   for (size_t r=0; r<NROUNDS; r++) {
+      for (size_t i=0; i<NADDRS; i+=2) {
+         libc_format (&addrs[i], expected, sizeof expected);
+         sink += expected[0];
+      }
+   }
+   libc_ns = netcode_util_time_ns () - start;
+   printf ("ADDR: IPv4 format %.1f ns, inet_ntop and snprintf %.1f ns\n",
+           (double)fast_ns / (NROUNDS * NADDRS / 2), (double)libc_ns / (NROUNDS * NADDRS / 2));
+
+   start = netcode_util_time_ns ();
+   for (size_t r=0; r<NROUNDS; r++) {
+      for (size_t i=0; i<NADDRS; i++) {
+         sink += netcode_util_addr_parse (hosts[i], &parsed);
+      }
+   }
+   fast_ns = netcode_util_time_ns () - start;
+
+   start = netcode_util_time_ns ();
+   for (size_t r=0; r<NROUNDS; r++) {
+      for (size_t i=0; i<NADDRS; i++) {
+         sink += inet_pton (AF_INET, hosts[i], &in);
+      }
+   }
+   libc_ns = netcode_util_time_ns () - start;
+   printf ("ADDR: IPv4 parse %.1f ns, inet_pton %.1f ns\n",
+           (double)fast_ns / (NROUNDS * NADDRS), (double)libc_ns / (NROUNDS * NADDRS));
+
+   allocs = netcode_util_alloc_count () - allocs;
+   netcode_util_alloc_debug (false);
+
+   if (allocs || !sink) {
+      NETCODE_UTIL_LOG ("Formatting and parsing made %" PRIu64 " allocations\n", allocs);
+      return false;
+   }
+   return true;
+}
+
+static int addr_test (void)
+{
+   int ret = EXIT_FAILURE;
+
+   static const struct {
+      const char *input;
+      bool valid;
+      const char *formatted;
+      uint16_t port;
+   } tests[] = {
+      { "127.0.0.1",                true,    "127.0.0.1:0",             0     },
+      { "10.1.2.3:8080",            true,    "10.1.2.3:8080",           8080  },
+      { "::1",                      true,    "[::1]:0",                 0     },
+      { "[2001:db8::1]:443",        true,    "[2001:db8::1]:443",       443   },
+      { "[fe80::1%3]:53",           true,    "[fe80::1%3]:53",          53    },
+      { "unix:/tmp/netcode.sock",   true,    "unix:/tmp/netcode.sock",  0     },
+      { "/tmp/netcode.sock",        true,    "unix:/tmp/netcode.sock",  0     },
+      { "256.1.1.1",                false,   NULL,                      0     },
+      { "1.2.3.4:65536",            false,   NULL,                      0     },
+      { "1.2.3.4:",                 false,   NULL,                      0     },
+      { "0.0.0.0:080",              true,    "0.0.0.0:80",              80    },
+      { "::ffff:192.0.2.1",         true,    "[::ffff:192.0.2.1]:0",    0     },
+      { "01.2.3.4",                 false,   NULL,                      0     },
+      { "1.2.3",                    false,   NULL,                      0     },
+      { "1.2.3.4.5",                false,   NULL,                      0     },
+      { "[::1]x",                   false,   NULL,                      0     },
+      { "example",                  false,   NULL,                      0     },
+   };
+
+   for (size_t i=0; i<sizeof tests / sizeof tests[0]; i++) {
+      netcode_addr_t addr, copy;
+      char formatted[NETCODE_ADDR_STRLEN];
+
+      bool rc = netcode_addr_parse (&addr, tests[i].input);
+      if (rc != tests[i].valid) {
+         NETCODE_UTIL_LOG ("Parsing [%s]: expected %s, got %s\n", tests[i].input,
+                           tests[i].valid ? "success" : "failure",
+                           rc ? "success" : "failure");
+         goto errorexit;
+      }
+
+      // The fast path must agree with the general one.
+      if (netcode_util_addr_parse (tests[i].input, &copy) != rc ||
+          (rc && memcmp (&addr, &copy, sizeof addr) != 0)) {
+         NETCODE_UTIL_LOG ("Fast parse of [%s] differs\n", tests[i].input);
+         goto errorexit;
+      }
+      if (!rc)
+         continue;
+
+      if (!(netcode_addr_format (&addr, formatted, sizeof formatted))) {
+         NETCODE_UTIL_LOG ("Failed to format [%s]\n", tests[i].input);
+         goto errorexit;
+      }
+      if ((strcmp (formatted, tests[i].formatted))!=0) {
+         NETCODE_UTIL_LOG ("Formatting [%s]: expected [%s], got [%s]\n",
+                           tests[i].input, tests[i].formatted, formatted);
+         goto errorexit;
+      }
+      if (netcode_addr_port (&addr) != tests[i].port) {
+         NETCODE_UTIL_LOG ("Port of [%s]: expected %u, got %u\n",
+                           tests[i].input, tests[i].port, netcode_addr_port (&addr));
+         goto errorexit;
+      }
+
+      // A copy via the socket address must be indistinguishable.
+      size_t salen = 0;
+      const struct sockaddr *sa = netcode_addr_sockaddr (&addr, &salen);
+      if (!(netcode_addr_from_sockaddr (&copy, sa, salen)) ||
+            netcode_addr_cmp (&addr, &copy) != 0 ||
+            netcode_addr_hash (&addr) != netcode_addr_hash (&copy) ||
+            memcmp (&addr, &copy, sizeof addr) != 0) {
+         NETCODE_UTIL_LOG ("Copy of [%s] differs from the original\n", tests[i].input);
+         goto errorexit;
+      }
+
+      printf ("[%s] -> [%s] hash 0x%08" PRIx32 "\n", tests[i].input, formatted,
+              netcode_addr_hash (&addr));
+   }
+
+   // Ordering: family, then address, then port.
+   netcode_addr_t a, b;
+   netcode_addr_parse (&a, "10.0.0.1:80");
+   netcode_addr_parse (&b, "10.0.0.1:81");
+   if (netcode_addr_cmp (&a, &b) >= 0 || netcode_addr_cmp (&b, &a) <= 0) {
+      NETCODE_UTIL_LOG ("Port ordering is wrong\n");
+      goto errorexit;
+   }
+   netcode_addr_parse (&b, "10.0.0.2:1");
+   if (netcode_addr_cmp (&a, &b) >= 0) {
+      NETCODE_UTIL_LOG ("Address ordering is wrong\n");
+      goto errorexit;
+   }
+   netcode_addr_set_port (&b, 80);
+   netcode_addr_parse (&a, "10.0.0.2:80");
+   if (netcode_addr_cmp (&a, &b) != 0 || netcode_addr_hash (&a) != netcode_addr_hash (&b)) {
+      NETCODE_UTIL_LOG ("Setting the port did not produce an equal address\n");
+      goto errorexit;
+   }
+
+   // A buffer that is too small must fail cleanly.
+   char small[8];
+   if (netcode_addr_format (&a, small, sizeof small) != 0 || small[0] != 0) {
+      NETCODE_UTIL_LOG ("Formatting into a short buffer did not fail\n");
+      goto errorexit;
+   }
+
+   if (!(netcode_addr_resolve (&a, "localhost", 1234)) ||
+         netcode_addr_port (&a) != 1234) {
+      NETCODE_UTIL_LOG ("Failed to resolve localhost\n");
+      goto errorexit;
+   }
+
+   if (!(fast_test ()))
+      goto errorexit;
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+
+   return ret;
+}
+
+int main (void)
+{
+   int ret = EXIT_FAILURE;
+
+   if (!(netcode_util_init ())) {
+      NETCODE_UTIL_LOG ("Failed to initialise netcode\n");
+      goto errorexit;
+   }
+
+   if ((ret = addr_test ())!=EXIT_SUCCESS) {
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      printf ("+++ +++ addr: Test FAILED +++ +++\n");
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      goto errorexit;
+   }
+
+   printf ("**********************************\n");
+   printf ("*** *** addr: Test passed *** ***\n");
+   printf ("**********************************\n");
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   return ret;
+}
+
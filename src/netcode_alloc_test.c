@@ -0,0 +1,209 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "netcode_util.h"
+#include "netcode_if.h"
+#include "netcode_udp.h"
+#include "netcode_bufpool.h"
+
+#define NDGRAMS         (8)
+#define NITERATIONS     (1000)
+
+/* An allocator that keeps count, to show that the library's memory goes
+ * through it and is all given back.
+ */
+struct counts_t {
+   size_t   allocs;
+   size_t   frees;
+};
+
+static void *counting_malloc (void *ctx, size_t size)
+{
+   ((struct counts_t *)ctx)->allocs++;
+   return malloc (size);
+}
+
+static void *counting_realloc (void *ctx, void *ptr, size_t size)
+{
+   if (!ptr)
+      ((struct counts_t *)ctx)->allocs++;
+   return realloc (ptr, size);
+}
+
+static void counting_free (void *ctx, void *ptr)
+{
+   ((struct counts_t *)ctx)->frees++;
+   free (ptr);
+}
+
+static bool allocator_test (int rxfd, int txfd, const netcode_addr_t *dest)
+{
+   struct counts_t counts = { 0, 0 };
+   bool ret = false;
+   netcode_addr_t from;
+   uint8_t *buf = NULL;
+   size_t buflen = 0;
+   char *name = NULL;
+
+   netcode_set_allocator (counting_malloc, counting_realloc, counting_free, &counts);
+
+   netcode_if_t **list = netcode_if_list_new ();
+   if (!list || !(netcode_if_extract (list[0], NULL, &name, NULL, NULL, NULL, NULL))) {
+      NETCODE_UTIL_LOG ("Failed to list interfaces\n");
+      goto errorexit;
+   }
+   netcode_util_free (name);
+   netcode_if_list_del (list);
+
+   if (netcode_udp_send_addr (txfd, dest, "x", (size_t)1, NULL) != 1 ||
+       netcode_udp_wait_addr (rxfd, &from, &buf, &buflen, 1) != 1) {
+      NETCODE_UTIL_LOG ("Failed to exchange a datagram\n");
+      goto errorexit;
+   }
+   netcode_util_free (buf);
+
+   printf ("ALLOC: %zu allocations, %zu frees through the custom allocator\n",
+           counts.allocs, counts.frees);
+   if (!counts.allocs || counts.allocs != counts.frees) {
+      NETCODE_UTIL_LOG ("The custom allocator was not used, or memory leaked\n");
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_set_allocator (NULL, NULL, NULL, NULL);
+   return ret;
+}
+
+/* The datagram hot paths must not allocate once they are warmed up. As
+ * a check on the check, netcode_udp_wait_addr(), which allocates its
+ * buffer, must be caught.
+ */
+static bool zero_alloc_test (int rxfd, int txfd, const netcode_addr_t *dest)
+{
+   uint8_t payload[NDGRAMS][100];
+   struct iovec iov[NDGRAMS];
+   uint8_t rxbuf[2048];
+   netcode_addr_t from;
+   bool ret = false;
+   netcode_bufpool_t *pool = netcode_bufpool_new (0, 0);
+
+   for (size_t i=0; i<NDGRAMS; i++) {
+      memset (payload[i], (int)i, sizeof payload[i]);
+      iov[i].iov_base = payload[i];
+      iov[i].iov_len = sizeof payload[i];
+   }
+
+   netcode_util_alloc_debug (true);
+
+   for (size_t n=0; n<NITERATIONS; n++) {
+      uint64_t before = netcode_util_alloc_count ();
+
+      if (netcode_udp_send_many_addr (txfd, dest, iov, NDGRAMS) != NDGRAMS) {
+         NETCODE_UTIL_LOG ("send_many failed\n");
+         goto errorexit;
+      }
+      for (size_t i=0; i<NDGRAMS; i++) {
+         if (netcode_udp_recv_into (rxfd, &from, rxbuf, sizeof rxbuf, 1) != sizeof payload[i] ||
+             rxbuf[0] != (uint8_t)i) {
+            NETCODE_UTIL_LOG ("recv_into returned the wrong datagram\n");
+            goto errorexit;
+         }
+      }
+
+      // The pool's first slab is reserved on the first iteration.
+      uint8_t *buf = NULL;
+      size_t buflen = 0;
+      if (netcode_udp_send_addr (txfd, dest, payload[0], sizeof payload[0], NULL)
+               != sizeof payload[0] ||
+          netcode_udp_wait_pool (rxfd, pool, &from, &buf, &buflen, 1) != sizeof payload[0]) {
+         NETCODE_UTIL_LOG ("wait_pool failed\n");
+         goto errorexit;
+      }
+      netcode_buf_release (buf);
+
+      uint64_t nallocs = netcode_util_alloc_count () - before;
+      if (nallocs) {
+         NETCODE_UTIL_LOG ("Iteration %zu made %" PRIu64 " allocations\n", n, nallocs);
+         goto errorexit;
+      }
+   }
+
+   uint64_t before = netcode_util_alloc_count ();
+   uint8_t *buf = NULL;
+   size_t buflen = 0;
+   netcode_udp_send_addr (txfd, dest, payload[0], sizeof payload[0], NULL);
+   netcode_udp_wait_addr (rxfd, &from, &buf, &buflen, 1);
+   netcode_util_free (buf);
+   if (netcode_util_alloc_count () - before != 1) {
+      NETCODE_UTIL_LOG ("The allocation in netcode_udp_wait_addr() was not counted\n");
+      goto errorexit;
+   }
+
+   printf ("ALLOC: %i iterations of send_many, recv_into and wait_pool made no allocations\n",
+           NITERATIONS);
+   ret = true;
+
+errorexit:
+   netcode_util_alloc_debug (false);
+   netcode_bufpool_del (pool);
+   return ret;
+}
+
+static int alloc_test (void)
+{
+   int ret = EXIT_FAILURE;
+   int rxfd = -1, txfd = -1;
+   netcode_addr_t dest;
+
+   netcode_addr_parse (&dest, "127.0.0.1");
+   netcode_addr_set_port (&dest, NETCODE_TEST_ALLOC_PORT);
+
+   if ((rxfd = netcode_udp_socket (NETCODE_TEST_ALLOC_PORT, NULL)) < 0 ||
+       (txfd = netcode_udp_socket (0, NULL)) < 0) {
+      NETCODE_UTIL_LOG ("Failed to create sockets\n");
+      goto errorexit;
+   }
+
+   if (!(allocator_test (rxfd, txfd, &dest)) || !(zero_alloc_test (rxfd, txfd, &dest)))
+      goto errorexit;
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   if (rxfd >= 0)
+      netcode_util_close (rxfd);
+   if (txfd >= 0)
+      netcode_util_close (txfd);
+   return ret;
+}
+
+int main (void)
+{
+   int ret = EXIT_FAILURE;
+
+   if (!(netcode_util_init ())) {
+      NETCODE_UTIL_LOG ("Failed to initialise netcode\n");
+      goto errorexit;
+   }
+
+   if ((ret = alloc_test ())!=EXIT_SUCCESS) {
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      printf ("+++ +++ alloc: Test FAILED +++ +++\n");
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      goto errorexit;
+   }
+
+   printf ("*********************************\n");
+   printf ("*** *** alloc: Test passed *** ***\n");
+   printf ("*********************************\n");
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   return ret;
+}
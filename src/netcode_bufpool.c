@@ -0,0 +1,357 @@
+
+/* This must come before any system header, otherwise strict C99 mode
+ * hides MAP_ANONYMOUS, MAP_HUGETLB and madvise() from us.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "netcode_util.h"
+#include "netcode_log.h"
+#include "netcode_bufpool.h"
+
+/* ***************************************************************** */
+#ifdef PLATFORM_Windows
+#include <windows.h>
+
+#define YIELD()            SwitchToThread ()
+
+#endif
+
+/* ***************************************************************** */
+#ifdef PLATFORM_POSIX
+#include <sched.h>
+#include <sys/mman.h>
+
+#define YIELD()            sched_yield ()
+
+#endif
+
+#define MIN_CLASS_SHIFT    (8)
+#define NCLASSES           (9)         // 256 bytes to 64 KB
+#define NCACHES            (16)
+
+// A cache holds at most CACHE_MAX buffers of each class, and moves
+// CACHE_BATCH at a time to and from the shared free list.
+#define CACHE_MAX          (64)
+#define CACHE_BATCH        (32)
+
+// Each buffer is preceded by a header, which is padded to keep the
+// buffer 16-byte aligned.
+#define HDRLEN             (16)
+#define SLAB_HDRLEN        (64)
+
+struct buf_hdr_t {
+   struct sizeclass_t   *cls;       // NULL for a malloc() fallback
+   size_t                size;
+};
+
+// Free buffers are linked through their first bytes.
+struct free_buf_t {
+   struct free_buf_t    *next;
+};
+
+struct free_list_t {
+   struct free_buf_t    *head;
+   size_t                count;
+};
+
+struct sizeclass_t {
+   netcode_bufpool_t    *pool;
+   size_t                size;
+   struct free_list_t    shared;    // Protected by the pool lock
+};
+
+struct cache_t {
+   char                  lock;
+   struct free_list_t    lists[NCLASSES];
+   size_t                allocs;
+   size_t                releases;
+   char                  pad[64];   // Keeps caches off each other's lines
+};
+
+struct slab_t {
+   struct slab_t        *next;
+   size_t                size;
+   bool                  mapped;
+};
+
+struct netcode_bufpool_t {
+   char                  lock;
+   int                   flags;
+   size_t                max_bytes;
+   struct slab_t        *slabs;
+   struct sizeclass_t    classes[NCLASSES];
+   struct cache_t        caches[NCACHES];
+   netcode_bufpool_stats_t stats;   // Protected by the pool lock, except fallbacks
+};
+
+/* ***************************************************************** */
+/* A test-and-set spinlock. Critical sections are a few pointer moves
+ * long, except when a slab is reserved; a waiter that spins for long
+ * yields in case the holder has been preempted.
+ */
+static void spin_lock (char *lock)
+{
+   unsigned spins = 0;
+
+   while (__atomic_test_and_set (lock, __ATOMIC_ACQUIRE)) {
+      while (__atomic_load_n (lock, __ATOMIC_RELAXED)) {
+         if (++spins > 100)
+            YIELD ();
+      }
+   }
+}
+
+static void spin_unlock (char *lock)
+{
+   __atomic_clear (lock, __ATOMIC_RELEASE);
+}
+
+// Threads are numbered as they first use a pool, and a thread always
+// uses the cache that its number selects.
+static __thread unsigned thread_slot = 0;
+static unsigned next_slot = 0;
+
+static struct cache_t *my_cache (netcode_bufpool_t *pool)
+{
+   if (!thread_slot)
+      thread_slot = __atomic_add_fetch (&next_slot, 1, __ATOMIC_RELAXED);
+   return &pool->caches[(thread_slot - 1) % NCACHES];
+}
+
+/* ***************************************************************** */
+static void list_push (struct free_list_t *list, void *buf)
+{
+   struct free_buf_t *fb = buf;
+   fb->next = list->head;
+   list->head = fb;
+   list->count++;
+}
+
+static void *list_pop (struct free_list_t *list)
+{
+   struct free_buf_t *fb = list->head;
+   if (fb) {
+      list->head = fb->next;
+      list->count--;
+   }
+   return fb;
+}
+
+// Moves up to 'n' buffers from 'src' to 'dst'.
+static void list_move (struct free_list_t *dst, struct free_list_t *src, size_t n)
+{
+   void *buf;
+   while (n-- && (buf = list_pop (src)))
+      list_push (dst, buf);
+}
+
+static int class_of (size_t len)
+{
+   for (int i=0; i<NCLASSES; i++) {
+      if (len <= ((size_t)1 << (MIN_CLASS_SHIFT + i)))
+         return i;
+   }
+   return -1;
+}
+
+/* ***************************************************************** */
+static void slab_free (struct slab_t *slab)
+{
+#ifdef PLATFORM_POSIX
+   if (slab->mapped) {
+      munmap (slab, slab->size);
+      return;
+   }
+#endif
+   netcode_util_free (slab);
+}
+
+// Reserves a slab for 'cls' and adds its buffers to the shared free
+// list. Called with the pool lock held.
+static bool slab_new (netcode_bufpool_t *pool, struct sizeclass_t *cls)
+{
+   struct slab_t *slab = NULL;
+   size_t size = NETCODE_BUFPOOL_SLAB_SIZE;
+   size_t stride = HDRLEN + cls->size;
+   bool huge = false;
+
+   if (pool->max_bytes && pool->stats.reserved_bytes + size > pool->max_bytes)
+      return false;
+
+#ifdef PLATFORM_POSIX
+   void *mem = MAP_FAILED;
+#ifdef MAP_HUGETLB
+   if (pool->flags & NETCODE_BUFPOOL_HUGEPAGES) {
+      mem = mmap (NULL, size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      huge = mem != MAP_FAILED;
+   }
+#endif
+   if (mem == MAP_FAILED) {
+      mem = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+      if (mem != MAP_FAILED && (pool->flags & NETCODE_BUFPOOL_HUGEPAGES))
+         madvise (mem, size, MADV_HUGEPAGE);
+#endif
+   }
+   if (mem != MAP_FAILED) {
+      slab = mem;
+      slab->mapped = true;
+   }
+#else
+   if ((slab = netcode_util_malloc (size)))
+      slab->mapped = false;
+#endif
+
+   if (!slab) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to reserve a %zu byte slab\n", size);
+      return false;
+   }
+
+   slab->size = size;
+   slab->next = pool->slabs;
+   pool->slabs = slab;
+
+   pool->stats.slabs++;
+   pool->stats.reserved_bytes += size;
+   if (huge)
+      pool->stats.hugepage_slabs++;
+
+   uint8_t *base = (uint8_t *)slab + SLAB_HDRLEN;
+   size_t n = (size - SLAB_HDRLEN) / stride;
+   for (size_t i=n; i-- > 0;) {
+      struct buf_hdr_t *hdr = (struct buf_hdr_t *)&base[i * stride];
+      hdr->cls = cls;
+      hdr->size = cls->size;
+      list_push (&cls->shared, (uint8_t *)hdr + HDRLEN);
+   }
+   return true;
+}
+
+/* ***************************************************************** */
+netcode_bufpool_t *netcode_bufpool_new (size_t max_bytes, int flags)
+{
+   netcode_bufpool_t *ret = netcode_util_calloc (1, sizeof *ret);
+
+   if (!ret) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating buffer pool\n");
+      return NULL;
+   }
+
+   ret->flags = flags;
+   ret->max_bytes = max_bytes;
+   for (int i=0; i<NCLASSES; i++) {
+      ret->classes[i].pool = ret;
+      ret->classes[i].size = (size_t)1 << (MIN_CLASS_SHIFT + i);
+   }
+   return ret;
+}
+
+void netcode_bufpool_del (netcode_bufpool_t *pool)
+{
+   if (!pool)
+      return;
+
+   while (pool->slabs) {
+      struct slab_t *slab = pool->slabs;
+      pool->slabs = slab->next;
+      slab_free (slab);
+   }
+   netcode_util_free (pool);
+}
+
+void *netcode_bufpool_alloc (netcode_bufpool_t *pool, size_t len)
+{
+   int c = class_of (len);
+   void *ret = NULL;
+
+   if (c < 0) {
+      struct buf_hdr_t *hdr = netcode_util_malloc (HDRLEN + len);
+      if (!hdr) {
+         NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating %zu byte buffer\n", len);
+         return NULL;
+      }
+      hdr->cls = NULL;
+      hdr->size = len;
+      __atomic_add_fetch (&pool->stats.fallbacks, 1, __ATOMIC_RELAXED);
+      return (uint8_t *)hdr + HDRLEN;
+   }
+
+   struct cache_t *cache = my_cache (pool);
+   struct free_list_t *list = &cache->lists[c];
+
+   spin_lock (&cache->lock);
+   if (!list->count) {
+      struct sizeclass_t *cls = &pool->classes[c];
+      spin_lock (&pool->lock);
+      if (cls->shared.count || slab_new (pool, cls))
+         list_move (list, &cls->shared, CACHE_BATCH);
+      spin_unlock (&pool->lock);
+   }
+   if ((ret = list_pop (list)))
+      cache->allocs++;
+   spin_unlock (&cache->lock);
+
+   return ret;
+}
+
+size_t netcode_buf_size (const void *buf)
+{
+   const struct buf_hdr_t *hdr = (const struct buf_hdr_t *)((const uint8_t *)buf - HDRLEN);
+   return hdr->size;
+}
+
+void netcode_buf_release (void *buf)
+{
+   if (!buf)
+      return;
+
+   struct buf_hdr_t *hdr = (struct buf_hdr_t *)((uint8_t *)buf - HDRLEN);
+   struct sizeclass_t *cls = hdr->cls;
+   if (!cls) {
+      netcode_util_free (hdr);
+      return;
+   }
+
+   netcode_bufpool_t *pool = cls->pool;
+   struct cache_t *cache = my_cache (pool);
+   struct free_list_t *list = &cache->lists[cls - pool->classes];
+
+   spin_lock (&cache->lock);
+   list_push (list, buf);
+   cache->releases++;
+   if (list->count > CACHE_MAX) {
+      spin_lock (&pool->lock);
+      list_move (&cls->shared, list, CACHE_BATCH);
+      spin_unlock (&pool->lock);
+   }
+   spin_unlock (&cache->lock);
+}
+
+void netcode_bufpool_stats (netcode_bufpool_t *pool, netcode_bufpool_stats_t *dst)
+{
+   size_t allocs = 0, releases = 0;
+
+   // A buffer may be allocated through one cache and released through
+   // another, so only the totals are meaningful.
+   for (size_t i=0; i<NCACHES; i++) {
+      spin_lock (&pool->caches[i].lock);
+      allocs += pool->caches[i].allocs;
+      releases += pool->caches[i].releases;
+      spin_unlock (&pool->caches[i].lock);
+   }
+
+   spin_lock (&pool->lock);
+   *dst = pool->stats;
+   dst->in_use = allocs - releases;
+   dst->fallbacks = __atomic_load_n (&pool->stats.fallbacks, __ATOMIC_RELAXED);
+   spin_unlock (&pool->lock);
+}
@@ -0,0 +1,82 @@
+
+#ifndef H_NETCODE_BUFPOOL
+#define H_NETCODE_BUFPOOL
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Flags for netcode_bufpool_new().
+#define NETCODE_BUFPOOL_HUGEPAGES   (1 << 0)
+
+// Requests up to this size are served from the pool's size classes
+// (powers of two from 256 bytes). Larger ones fall back to malloc().
+#define NETCODE_BUFPOOL_MAX_BUF     (65536)
+
+// The default, and minimum, size of the slabs that buffers are carved
+// from. This is the size of an x86-64 huge page.
+#define NETCODE_BUFPOOL_SLAB_SIZE   (2 * 1024 * 1024)
+
+/* A pool of packet and stream buffers.
+ *
+ * Buffers come in power-of-two size classes. Each class is carved out of
+ * large slabs that are never returned to the system until the pool is
+ * deleted, so in the steady state allocating and releasing a buffer
+ * costs a few instructions and no system call.
+ *
+ * Released buffers go to a cache belonging to the releasing thread and
+ * are handed out again by the same thread, so threads seldom contend.
+ * Caches overflow into, and refill from, a shared free list in batches.
+ * Threads are spread over a fixed number of caches; beyond that number,
+ * threads share caches (still correctly, but with some contention).
+ *
+ * A pool is thread-safe. A buffer may be released by any thread.
+ */
+typedef struct netcode_bufpool_t netcode_bufpool_t;
+
+typedef struct netcode_bufpool_stats_t {
+   size_t      slabs;            // Slabs reserved
+   size_t      hugepage_slabs;   // Slabs backed by huge pages
+   size_t      reserved_bytes;   // Memory in slabs
+   size_t      in_use;           // Buffers handed out and not released
+   uint64_t    fallbacks;        // Requests too large for the pool
+} netcode_bufpool_stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Creates a pool that reserves no more than 'max_bytes' of slabs (zero
+   // for no limit). With NETCODE_BUFPOOL_HUGEPAGES in 'flags' the slabs
+   // are backed by huge pages where possible: explicit huge pages
+   // (MAP_HUGETLB) when some are reserved on the system, otherwise
+   // transparent huge pages.
+   //
+   // RETURNS: NULL on error.
+   netcode_bufpool_t *netcode_bufpool_new (size_t max_bytes, int flags);
+
+   // Deletes the pool and all its memory. Buffers that are still in use
+   // become invalid.
+   void netcode_bufpool_del (netcode_bufpool_t *pool);
+
+   // Returns a buffer of at least 'len' bytes, aligned to 16 bytes.
+   //
+   // RETURNS: NULL if the pool has reached its limit or memory is
+   // exhausted.
+   void *netcode_bufpool_alloc (netcode_bufpool_t *pool, size_t len);
+
+   // Returns the usable size of 'buf', which may be larger than was
+   // asked for.
+   size_t netcode_buf_size (const void *buf);
+
+   // Returns 'buf' to the pool it came from. 'buf' may be NULL.
+   void netcode_buf_release (void *buf);
+
+   void netcode_bufpool_stats (netcode_bufpool_t *pool, netcode_bufpool_stats_t *dst);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
@@ -0,0 +1,322 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <pthread.h>
+
+#include "netcode_util.h"
+#include "netcode_udp.h"
+#include "netcode_bufpool.h"
+
+#define NTHREADS        (4)
+#define NITERATIONS     (200000)
+#define NHANDOFF        (1000)
+
+static bool sizes_test (netcode_bufpool_t *pool)
+{
+   static const size_t lengths[] = { 0, 1, 255, 256, 257, 1500, 9000, 65535, 65536, 70000 };
+   void *bufs[sizeof lengths / sizeof lengths[0]];
+   netcode_bufpool_stats_t stats;
+
+   for (size_t i=0; i<sizeof lengths / sizeof lengths[0]; i++) {
+      if (!(bufs[i] = netcode_bufpool_alloc (pool, lengths[i]))) {
+         NETCODE_UTIL_LOG ("Failed to allocate %zu bytes\n", lengths[i]);
+         return false;
+      }
+      if (netcode_buf_size (bufs[i]) < lengths[i] || ((uintptr_t)bufs[i] & 15)) {
+         NETCODE_UTIL_LOG ("Buffer for %zu bytes has size %zu at %p\n",
+                           lengths[i], netcode_buf_size (bufs[i]), bufs[i]);
+         return false;
+      }
+      memset (bufs[i], (int)i, lengths[i]);
+   }
+   for (size_t i=0; i<sizeof lengths / sizeof lengths[0]; i++) {
+      for (size_t j=0; j<lengths[i]; j++) {
+         if (((uint8_t *)bufs[i])[j] != (uint8_t)i) {
+            NETCODE_UTIL_LOG ("Buffers %zu overlaps another\n", i);
+            return false;
+         }
+      }
+      netcode_buf_release (bufs[i]);
+   }
+
+   netcode_bufpool_stats (pool, &stats);
+   if (stats.in_use || stats.fallbacks != 1) {
+      NETCODE_UTIL_LOG ("%zu buffers in use, %" PRIu64 " fallbacks\n",
+                        stats.in_use, stats.fallbacks);
+      return false;
+   }
+   return true;
+}
+
+/* A steady stream of allocations and releases is served from the
+ * thread's cache: the same buffer comes back, and no slab is added.
+ */
+static bool reuse_test (netcode_bufpool_t *pool)
+{
+   netcode_bufpool_stats_t before, after;
+   void *first = netcode_bufpool_alloc (pool, 1500);
+   uint64_t start, pool_ns, malloc_ns;
+
+   netcode_buf_release (first);
+   netcode_bufpool_stats (pool, &before);
+
+   start = netcode_util_time_ns ();
+   for (size_t i=0; i<NITERATIONS; i++) {
+      void *buf = netcode_bufpool_alloc (pool, 1500);
+      if (buf != first) {
+         NETCODE_UTIL_LOG ("Buffer was not reused on iteration %zu\n", i);
+         netcode_buf_release (buf);
+         return false;
+      }
+      netcode_buf_release (buf);
+   }
+   pool_ns = netcode_util_time_ns () - start;
+
+   start = netcode_util_time_ns ();
+   for (size_t i=0; i<NITERATIONS; i++) {
+      volatile char *buf = malloc (1500);
+      buf[0] = 0;
+      free ((void *)buf);
+   }
+   malloc_ns = netcode_util_time_ns () - start;
+
+   netcode_bufpool_stats (pool, &after);
+   printf ("BUFPOOL: alloc+release %.1f ns (malloc+free %.1f ns)\n",
+           (double)pool_ns / NITERATIONS, (double)malloc_ns / NITERATIONS);
+   if (after.slabs != before.slabs) {
+      NETCODE_UTIL_LOG ("Slabs were added in the steady state\n");
+      return false;
+   }
+   return true;
+}
+
+static bool limit_test (void)
+{
+   bool ret = false;
+   netcode_bufpool_t *pool = netcode_bufpool_new (NETCODE_BUFPOOL_SLAB_SIZE, 0);
+   void *bufs[64];
+   size_t n = 0;
+
+   if (!pool)
+      return false;
+
+   while (n < 64 && (bufs[n] = netcode_bufpool_alloc (pool, NETCODE_BUFPOOL_MAX_BUF)))
+      n++;
+
+   printf ("BUFPOOL: %zu of the largest buffers fit in one slab\n", n);
+   if (n == 0 || n == 64) {
+      NETCODE_UTIL_LOG ("The pool's limit was not enforced\n");
+      goto errorexit;
+   }
+
+   netcode_buf_release (bufs[--n]);
+   if (!(bufs[n] = netcode_bufpool_alloc (pool, NETCODE_BUFPOOL_MAX_BUF))) {
+      NETCODE_UTIL_LOG ("A released buffer could not be allocated again\n");
+      goto errorexit;
+   }
+   n++;
+
+   ret = true;
+
+errorexit:
+   while (n)
+      netcode_buf_release (bufs[--n]);
+   netcode_bufpool_del (pool);
+   return ret;
+}
+
+static bool hugepage_test (void)
+{
+   netcode_bufpool_stats_t stats;
+   netcode_bufpool_t *pool = netcode_bufpool_new (0, NETCODE_BUFPOOL_HUGEPAGES);
+   void *buf = pool ? netcode_bufpool_alloc (pool, 4096) : NULL;
+
+   if (!buf) {
+      NETCODE_UTIL_LOG ("Failed to allocate from a huge page pool\n");
+      netcode_bufpool_del (pool);
+      return false;
+   }
+
+   memset (buf, 0x5a, 4096);
+   netcode_bufpool_stats (pool, &stats);
+   printf ("BUFPOOL: %zu of %zu slabs on explicit huge pages\n",
+           stats.hugepage_slabs, stats.slabs);
+
+   netcode_buf_release (buf);
+   netcode_bufpool_del (pool);
+   return true;
+}
+
+/* Each thread churns through buffers of varying sizes and releases a
+ * share of the buffers that the main thread allocated.
+ */
+struct thread_arg_t {
+   netcode_bufpool_t   *pool;
+   unsigned             id;
+   void               **handoff;
+   bool                 ok;
+};
+
+static void *thread_fn (void *arg)
+{
+   struct thread_arg_t *ta = arg;
+   void *held[16];
+   uint32_t rnd = ta->id * 2654435761u + 1;
+
+   memset (held, 0, sizeof held);
+   ta->ok = true;
+
+   for (size_t i=0; i<NITERATIONS / NTHREADS; i++) {
+      rnd = rnd * 1103515245 + 12345;
+      size_t slot = (rnd >> 8) % 16;
+      size_t len = 1 + (rnd >> 12) % 4000;
+
+      if (held[slot]) {
+         if (*(unsigned *)held[slot] != ta->id) {
+            ta->ok = false;
+         }
+         netcode_buf_release (held[slot]);
+      }
+      if ((held[slot] = netcode_bufpool_alloc (ta->pool, len)))
+         *(unsigned *)held[slot] = ta->id;
+      else
+         ta->ok = false;
+   }
+
+   for (size_t i=0; i<16; i++) {
+      netcode_buf_release (held[i]);
+   }
+   for (size_t i=ta->id; i<NHANDOFF; i+=NTHREADS) {
+      netcode_buf_release (ta->handoff[i]);
+   }
+   return NULL;
+}
+
+static bool thread_test (netcode_bufpool_t *pool)
+{
+   static void *handoff[NHANDOFF];
+   pthread_t threads[NTHREADS];
+   struct thread_arg_t args[NTHREADS];
+   netcode_bufpool_stats_t stats;
+   bool ret = true;
+
+   for (size_t i=0; i<NHANDOFF; i++) {
+      if (!(handoff[i] = netcode_bufpool_alloc (pool, 64 + i))) {
+         NETCODE_UTIL_LOG ("Failed to allocate buffer %zu\n", i);
+         return false;
+      }
+   }
+
+   for (unsigned i=0; i<NTHREADS; i++) {
+      args[i].pool = pool;
+      args[i].id = i;
+      args[i].handoff = handoff;
+      if (pthread_create (&threads[i], NULL, thread_fn, &args[i]) != 0) {
+         NETCODE_UTIL_LOG ("Failed to create thread %u\n", i);
+         return false;
+      }
+   }
+   for (unsigned i=0; i<NTHREADS; i++) {
+      pthread_join (threads[i], NULL);
+      ret = ret && args[i].ok;
+   }
+
+   netcode_bufpool_stats (pool, &stats);
+   printf ("BUFPOOL: %zu slabs (%zu bytes) after %i threads\n",
+           stats.slabs, stats.reserved_bytes, NTHREADS);
+   if (!ret || stats.in_use) {
+      NETCODE_UTIL_LOG ("Threads corrupted buffers or leaked %zu\n", stats.in_use);
+      return false;
+   }
+   return true;
+}
+
+static bool udp_test (netcode_bufpool_t *pool)
+{
+   bool ret = false;
+   int rxfd = -1, txfd = -1;
+   uint8_t msg[1000];
+   uint8_t *buf = NULL;
+   size_t buflen = 0;
+   netcode_addr_t dest, from;
+
+   netcode_addr_parse (&dest, "127.0.0.1");
+   netcode_addr_set_port (&dest, NETCODE_TEST_BUFPOOL_PORT);
+   for (size_t i=0; i<sizeof msg; i++) {
+      msg[i] = (uint8_t)i;
+   }
+
+   if ((rxfd = netcode_udp_socket (NETCODE_TEST_BUFPOOL_PORT, NULL)) < 0 ||
+       (txfd = netcode_udp_socket (0, NULL)) < 0) {
+      NETCODE_UTIL_LOG ("Failed to create sockets\n");
+      goto errorexit;
+   }
+
+   if (netcode_udp_send_addr (txfd, &dest, msg, sizeof msg, NULL) != sizeof msg ||
+       netcode_udp_wait_pool (rxfd, pool, &from, &buf, &buflen, 1) != sizeof msg ||
+       netcode_buf_size (buf) < sizeof msg ||
+       memcmp (buf, msg, sizeof msg) != 0) {
+      NETCODE_UTIL_LOG ("Datagram was not received into a pool buffer\n");
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_buf_release (buf);
+   if (rxfd >= 0)
+      netcode_util_close (rxfd);
+   if (txfd >= 0)
+      netcode_util_close (txfd);
+   return ret;
+}
+
+static int bufpool_test (void)
+{
+   int ret = EXIT_FAILURE;
+   netcode_bufpool_t *pool = netcode_bufpool_new (0, 0);
+
+   if (!pool) {
+      NETCODE_UTIL_LOG ("Failed to create pool\n");
+      return EXIT_FAILURE;
+   }
+
+   if (!(sizes_test (pool)) || !(reuse_test (pool)) || !(limit_test ()) ||
+       !(hugepage_test ()) || !(thread_test (pool)) || !(udp_test (pool)))
+      goto errorexit;
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   netcode_bufpool_del (pool);
+   return ret;
+}
+
+int main (void)
+{
+   int ret = EXIT_FAILURE;
+
+   if (!(netcode_util_init ())) {
+      NETCODE_UTIL_LOG ("Failed to initialise netcode\n");
+      goto errorexit;
+   }
+
+   if ((ret = bufpool_test ())!=EXIT_SUCCESS) {
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      printf ("+++ +++ bufpool: Test FAILED +++ +++\n");
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      goto errorexit;
+   }
+
+   printf ("*********************************\n");
+   printf ("*** *** bufpool: Test passed *** ***\n");
+   printf ("*********************************\n");
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   return ret;
+}
@@ -0,0 +1,775 @@
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "netcode_util.h"
+#include "netcode_log.h"
+#include "netcode_udp.h"
+#include "netcode_fec.h"
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#include <immintrin.h>
+#define FEC_X86      (1)
+#else
+#define FEC_X86      (0)
+#endif
+
+/* ***************************************************************** */
+/* GF(256) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11d).
+ *
+ * gf_mul_table[c] multiplies any byte by c. The SIMD kernels instead
+ * split each byte into nibbles and look both up in 16-entry tables
+ * (gf_nib_lo[c] and gf_nib_hi[c]) with a byte shuffle, 16 or 32 bytes
+ * at a time.
+ */
+static uint8_t gf_exp[512];
+static uint8_t gf_log[256];
+static uint8_t gf_mul_table[256][256];
+static uint8_t gf_nib_lo[256][16];
+static uint8_t gf_nib_hi[256][16];
+static bool gf_ready = false;
+
+static uint8_t gf_mul (uint8_t a, uint8_t b)
+{
+   if (!a || !b)
+      return 0;
+   return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static uint8_t gf_inv (uint8_t a)
+{
+   return gf_exp[255 - gf_log[a]];
+}
+
+static void gf_init (void)
+{
+   if (gf_ready)
+      return;
+
+   unsigned x = 1;
+   for (unsigned i=0; i<255; i++) {
+      gf_exp[i] = (uint8_t)x;
+      gf_log[x] = (uint8_t)i;
+      x <<= 1;
+      if (x & 0x100)
+         x ^= 0x11d;
+   }
+   for (unsigned i=255; i<512; i++) {
+      gf_exp[i] = gf_exp[i - 255];
+   }
+
+   for (unsigned c=0; c<256; c++) {
+      for (unsigned v=0; v<256; v++) {
+         gf_mul_table[c][v] = gf_mul ((uint8_t)c, (uint8_t)v);
+      }
+      for (unsigned v=0; v<16; v++) {
+         gf_nib_lo[c][v] = gf_mul_table[c][v];
+         gf_nib_hi[c][v] = gf_mul_table[c][v << 4];
+      }
+   }
+
+   gf_ready = true;
+}
+
+/* ***************************************************************** */
+/* The kernels compute dst[i] ^= c * src[i] for i in [0, len). */
+typedef void (mul_add_fn_t) (uint8_t *dst, const uint8_t *src, uint8_t c, size_t len);
+
+static void mul_add_scalar (uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+   const uint8_t *table = gf_mul_table[c];
+
+   for (size_t i=0; i<len; i++) {
+      dst[i] ^= table[src[i]];
+   }
+}
+
+#if FEC_X86
+
+__attribute__ ((target ("ssse3")))
+static void mul_add_ssse3 (uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+   const __m128i lo = _mm_loadu_si128 ((const __m128i *)gf_nib_lo[c]);
+   const __m128i hi = _mm_loadu_si128 ((const __m128i *)gf_nib_hi[c]);
+   const __m128i mask = _mm_set1_epi8 (0x0f);
+   size_t i = 0;
+
+   for (; i + 16 <= len; i += 16) {
+      __m128i s = _mm_loadu_si128 ((const __m128i *)&src[i]);
+      __m128i d = _mm_loadu_si128 ((const __m128i *)&dst[i]);
+      __m128i l = _mm_shuffle_epi8 (lo, _mm_and_si128 (s, mask));
+      __m128i h = _mm_shuffle_epi8 (hi, _mm_and_si128 (_mm_srli_epi64 (s, 4), mask));
+      _mm_storeu_si128 ((__m128i *)&dst[i], _mm_xor_si128 (d, _mm_xor_si128 (l, h)));
+   }
+   mul_add_scalar (&dst[i], &src[i], c, len - i);
+}
+
+__attribute__ ((target ("avx2")))
+static void mul_add_avx2 (uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+   const __m256i lo = _mm256_broadcastsi128_si256 (
+                           _mm_loadu_si128 ((const __m128i *)gf_nib_lo[c]));
+   const __m256i hi = _mm256_broadcastsi128_si256 (
+                           _mm_loadu_si128 ((const __m128i *)gf_nib_hi[c]));
+   const __m256i mask = _mm256_set1_epi8 (0x0f);
+   size_t i = 0;
+
+   for (; i + 32 <= len; i += 32) {
+      __m256i s = _mm256_loadu_si256 ((const __m256i *)&src[i]);
+      __m256i d = _mm256_loadu_si256 ((const __m256i *)&dst[i]);
+      __m256i l = _mm256_shuffle_epi8 (lo, _mm256_and_si256 (s, mask));
+      __m256i h = _mm256_shuffle_epi8 (hi, _mm256_and_si256 (_mm256_srli_epi64 (s, 4), mask));
+      _mm256_storeu_si256 ((__m256i *)&dst[i], _mm256_xor_si256 (d, _mm256_xor_si256 (l, h)));
+   }
+   mul_add_ssse3 (&dst[i], &src[i], c, len - i);
+}
+
+#endif
+
+static mul_add_fn_t *mul_add = NULL;
+static int kernel = NETCODE_FEC_KERNEL_SCALAR;
+
+static bool kernel_supported (int k)
+{
+   switch (k) {
+      case NETCODE_FEC_KERNEL_SCALAR:  return true;
+#if FEC_X86
+      case NETCODE_FEC_KERNEL_SSSE3:   return __builtin_cpu_supports ("ssse3");
+      case NETCODE_FEC_KERNEL_AVX2:    return __builtin_cpu_supports ("avx2");
+#endif
+   }
+   return false;
+}
+
+bool netcode_fec_set_kernel (int k)
+{
+   gf_init ();
+
+   if (k == NETCODE_FEC_KERNEL_AUTO) {
+      k = kernel_supported (NETCODE_FEC_KERNEL_AVX2)  ? NETCODE_FEC_KERNEL_AVX2
+        : kernel_supported (NETCODE_FEC_KERNEL_SSSE3) ? NETCODE_FEC_KERNEL_SSSE3
+        : NETCODE_FEC_KERNEL_SCALAR;
+   }
+
+   if (!(kernel_supported (k))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "FEC kernel %i is not supported on this CPU\n", k);
+      return false;
+   }
+
+   switch (k) {
+#if FEC_X86
+      case NETCODE_FEC_KERNEL_SSSE3:   mul_add = mul_add_ssse3;   break;
+      case NETCODE_FEC_KERNEL_AVX2:    mul_add = mul_add_avx2;    break;
+#endif
+      default:                         mul_add = mul_add_scalar;  break;
+   }
+   kernel = k;
+   return true;
+}
+
+const char *netcode_fec_kernel_name (void)
+{
+   if (!mul_add)
+      netcode_fec_set_kernel (NETCODE_FEC_KERNEL_AUTO);
+
+   switch (kernel) {
+      case NETCODE_FEC_KERNEL_SSSE3:   return "ssse3";
+      case NETCODE_FEC_KERNEL_AVX2:    return "avx2";
+   }
+   return "scalar";
+}
+
+/* ***************************************************************** */
+/* The parity rows form a Cauchy matrix, C[i][j] = 1 / (x_i + y_j) with
+ * x_i = 255 - i and y_j = j, whose columns are scaled so that the first
+ * row is all ones. Every square submatrix of a Cauchy matrix is
+ * invertible, which is what lets any n_data shards rebuild the rest, and
+ * scaling columns preserves that. The rows do not depend on the number
+ * of data shards, so a codec also works for shorter groups.
+ */
+struct netcode_fec_t {
+   size_t      n_data;
+   size_t      n_parity;
+   uint8_t    *matrix;      // n_parity rows of n_data columns
+};
+
+netcode_fec_t *netcode_fec_new (size_t n_data, size_t n_parity)
+{
+   netcode_fec_t *ret = NULL;
+
+   if (!mul_add)
+      netcode_fec_set_kernel (NETCODE_FEC_KERNEL_AUTO);
+
+   if (!n_data || !n_parity || n_data + n_parity > NETCODE_FEC_MAX_SHARDS) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Invalid FEC code: %zu data, %zu parity\n", n_data, n_parity);
+      return NULL;
+   }
+
+   if (!(ret = netcode_util_calloc (1, sizeof *ret)) ||
+       !(ret->matrix = netcode_util_malloc (n_data * n_parity))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating FEC codec\n");
+      netcode_fec_del (ret);
+      return NULL;
+   }
+   ret->n_data = n_data;
+   ret->n_parity = n_parity;
+
+   for (size_t j=0; j<n_data; j++) {
+      uint8_t scale = (uint8_t)(255 ^ j);    // 1 / C[0][j]
+      for (size_t i=0; i<n_parity; i++) {
+         uint8_t c = gf_inv ((uint8_t)((255 - i) ^ j));
+         ret->matrix[i * n_data + j] = gf_mul (c, scale);
+      }
+   }
+
+   return ret;
+}
+
+void netcode_fec_del (netcode_fec_t *fec)
+{
+   if (!fec)
+      return;
+
+   netcode_util_free (fec->matrix);
+   netcode_util_free (fec);
+}
+
+void netcode_fec_encode (const netcode_fec_t *fec, size_t n_data,
+                         const uint8_t * const *data, uint8_t **parity,
+                         size_t len)
+{
+   if (n_data > fec->n_data)
+      n_data = fec->n_data;
+
+   for (size_t i=0; i<fec->n_parity; i++) {
+      const uint8_t *row = &fec->matrix[i * fec->n_data];
+      memset (parity[i], 0, len);
+      for (size_t j=0; j<n_data; j++) {
+         mul_add (parity[i], data[j], row[j], len);
+      }
+   }
+}
+
+/* Inverts the n x n matrix 'm' in place with Gauss-Jordan elimination.
+ * 'tmp' has room for another n x n matrix.
+ */
+static bool gf_invert (uint8_t *m, uint8_t *tmp, size_t n)
+{
+   memset (tmp, 0, n * n);
+   for (size_t i=0; i<n; i++) {
+      tmp[i * n + i] = 1;
+   }
+
+   for (size_t col=0; col<n; col++) {
+      size_t pivot = col;
+      while (pivot < n && !m[pivot * n + col])
+         pivot++;
+      if (pivot == n)
+         return false;
+
+      if (pivot != col) {
+         for (size_t k=0; k<n; k++) {
+            uint8_t t = m[col * n + k];
+            m[col * n + k] = m[pivot * n + k];
+            m[pivot * n + k] = t;
+            t = tmp[col * n + k];
+            tmp[col * n + k] = tmp[pivot * n + k];
+            tmp[pivot * n + k] = t;
+         }
+      }
+
+      uint8_t inv = gf_inv (m[col * n + col]);
+      for (size_t k=0; k<n; k++) {
+         m[col * n + k] = gf_mul (m[col * n + k], inv);
+         tmp[col * n + k] = gf_mul (tmp[col * n + k], inv);
+      }
+
+      for (size_t row=0; row<n; row++) {
+         uint8_t f = m[row * n + col];
+         if (row == col || !f)
+            continue;
+         for (size_t k=0; k<n; k++) {
+            m[row * n + k] ^= gf_mul (f, m[col * n + k]);
+            tmp[row * n + k] ^= gf_mul (f, tmp[col * n + k]);
+         }
+      }
+   }
+
+   memcpy (m, tmp, n * n);
+   return true;
+}
+
+bool netcode_fec_decode (const netcode_fec_t *fec, size_t n_data,
+                         uint8_t **shards, const bool *present, size_t len)
+{
+   size_t rows[NETCODE_FEC_MAX_SHARDS];
+   size_t nrows = 0, nmissing = 0;
+   uint8_t *m = NULL, *tmp = NULL;
+   bool ret = false;
+
+   if (n_data > fec->n_data)
+      return false;
+
+   // Use every data shard that is present, then as many parity shards
+   // as are needed to make up the numbers.
+   for (size_t i=0; i<n_data; i++) {
+      if (present[i])
+         rows[nrows++] = i;
+      else
+         nmissing++;
+   }
+   if (!nmissing)
+      return true;
+
+   for (size_t i=0; i<fec->n_parity && nrows < n_data; i++) {
+      if (present[n_data + i])
+         rows[nrows++] = n_data + i;
+   }
+   if (nrows < n_data)
+      return false;
+
+   if (!(m = netcode_util_malloc (n_data * n_data)) || !(tmp = netcode_util_malloc (n_data * n_data))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating FEC decode matrix\n");
+      goto errorexit;
+   }
+
+   // Row r of 'm' expresses received shard rows[r] in terms of the data.
+   for (size_t r=0; r<n_data; r++) {
+      if (rows[r] < n_data) {
+         memset (&m[r * n_data], 0, n_data);
+         m[r * n_data + rows[r]] = 1;
+      } else {
+         memcpy (&m[r * n_data], &fec->matrix[(rows[r] - n_data) * fec->n_data], n_data);
+      }
+   }
+
+   if (!(gf_invert (m, tmp, n_data))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "FEC decode matrix is singular\n");
+      goto errorexit;
+   }
+
+   for (size_t i=0; i<n_data; i++) {
+      if (present[i])
+         continue;
+      memset (shards[i], 0, len);
+      for (size_t r=0; r<n_data; r++) {
+         uint8_t c = m[i * n_data + r];
+         if (c)
+            mul_add (shards[i], shards[rows[r]], c, len);
+      }
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_util_free (m);
+   netcode_util_free (tmp);
+   return ret;
+}
+
+/* ***************************************************************** */
+/* Datagrams start with an 8-byte header:
+ *
+ *    type(1) index(1) n_data(1) n_parity(1) group(4)
+ *
+ * A data datagram (type 1) is followed by the message. Its shard, for
+ * the purpose of computing parity, is the message's length (2 bytes)
+ * followed by the message, zero-padded to the group's shard length.
+ *
+ * A parity datagram (type 2) is followed by the parity shard. Its
+ * header carries the number of data shards in the group, which may be
+ * fewer than usual if the group was flushed early.
+ */
+#define TYPE_DATA          (1)
+#define TYPE_PARITY        (2)
+#define HDRLEN             (8)
+#define SHARD_MAX          (2 + NETCODE_FEC_MAX_MSG)
+
+static void put_hdr (uint8_t *hdr, uint8_t type, uint8_t index,
+                     uint8_t n_data, uint8_t n_parity, uint32_t group)
+{
+   hdr[0] = type;
+   hdr[1] = index;
+   hdr[2] = n_data;
+   hdr[3] = n_parity;
+   hdr[4] = (uint8_t)(group >> 24);
+   hdr[5] = (uint8_t)(group >> 16);
+   hdr[6] = (uint8_t)(group >> 8);
+   hdr[7] = (uint8_t)group;
+}
+
+struct netcode_fec_tx_t {
+   int               fd;
+   netcode_addr_t    dest;
+   bool              connected;
+   netcode_fec_t    *fec;
+   uint32_t          group;
+   size_t            count;
+   size_t            shard_len;
+   uint8_t          *data;      // n_data shards of SHARD_MAX bytes
+   uint8_t          *parity;    // n_parity shards of SHARD_MAX bytes
+};
+
+netcode_fec_tx_t *netcode_fec_tx_new (int fd, const netcode_addr_t *dest,
+                                      size_t n_data, size_t n_parity)
+{
+   netcode_fec_tx_t *ret = NULL;
+
+   if (!(ret = netcode_util_calloc (1, sizeof *ret))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating FEC sender\n");
+      return NULL;
+   }
+
+   ret->fd = fd;
+   if (dest)
+      ret->dest = *dest;
+   ret->connected = dest == NULL;
+
+   if (!(ret->fec = netcode_fec_new (n_data, n_parity)))
+      goto errorexit;
+
+   if (!(ret->data = netcode_util_calloc (n_data, SHARD_MAX)) ||
+       !(ret->parity = netcode_util_calloc (n_parity, SHARD_MAX))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating FEC sender buffers\n");
+      goto errorexit;
+   }
+
+   return ret;
+
+errorexit:
+   netcode_fec_tx_del (ret);
+   return NULL;
+}
+
+void netcode_fec_tx_del (netcode_fec_tx_t *tx)
+{
+   if (!tx)
+      return;
+
+   netcode_fec_del (tx->fec);
+   netcode_util_free (tx->data);
+   netcode_util_free (tx->parity);
+   netcode_util_free (tx);
+}
+
+bool netcode_fec_tx_send (netcode_fec_tx_t *tx, const void *msg, size_t len)
+{
+   uint8_t hdr[HDRLEN];
+
+   if (len > NETCODE_FEC_MAX_MSG) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Message of %zu bytes is too large for FEC\n", len);
+      return false;
+   }
+
+   uint8_t *shard = &tx->data[tx->count * SHARD_MAX];
+   shard[0] = (uint8_t)(len >> 8);
+   shard[1] = (uint8_t)len;
+   memcpy (&shard[2], msg, len);
+   if (2 + len > tx->shard_len)
+      tx->shard_len = 2 + len;
+
+   put_hdr (hdr, TYPE_DATA, (uint8_t)tx->count, 0, 0, tx->group);
+   struct iovec iov[2] = {
+      { hdr, sizeof hdr },
+      { (void *)msg, len },
+   };
+   size_t rc = netcode_udp_sendiov_addr (tx->fd, tx->connected ? NULL : &tx->dest,
+                                         iov, len ? 2 : 1);
+   tx->count++;
+
+   if (tx->count == tx->fec->n_data && !(netcode_fec_tx_flush (tx)))
+      return false;
+
+   return rc == sizeof hdr + len;
+}
+
+bool netcode_fec_tx_flush (netcode_fec_tx_t *tx)
+{
+   const uint8_t *data[NETCODE_FEC_MAX_SHARDS];
+   uint8_t *parity[NETCODE_FEC_MAX_SHARDS];
+   uint8_t hdr[HDRLEN];
+   bool ret = true;
+
+   if (!tx->count)
+      return true;
+
+   for (size_t j=0; j<tx->count; j++) {
+      uint8_t *shard = &tx->data[j * SHARD_MAX];
+      size_t used = 2 + (((size_t)shard[0] << 8) | shard[1]);
+      memset (&shard[used], 0, tx->shard_len - used);
+      data[j] = shard;
+   }
+   for (size_t i=0; i<tx->fec->n_parity; i++) {
+      parity[i] = &tx->parity[i * SHARD_MAX];
+   }
+
+   netcode_fec_encode (tx->fec, tx->count, data, parity, tx->shard_len);
+
+   for (size_t i=0; i<tx->fec->n_parity; i++) {
+      put_hdr (hdr, TYPE_PARITY, (uint8_t)i, (uint8_t)tx->count,
+               (uint8_t)tx->fec->n_parity, tx->group);
+      struct iovec iov[2] = {
+         { hdr, sizeof hdr },
+         { parity[i], tx->shard_len },
+      };
+      if (netcode_udp_sendiov_addr (tx->fd, tx->connected ? NULL : &tx->dest, iov, 2)
+            != sizeof hdr + tx->shard_len)
+         ret = false;
+   }
+
+   tx->group++;
+   tx->count = 0;
+   tx->shard_len = 0;
+   return ret;
+}
+
+/* ***************************************************************** */
+struct msg_t {
+   struct msg_t     *next;
+   size_t            len;
+   uint8_t           data[];
+};
+
+struct group_t {
+   bool              used;
+   bool              done;
+   uint32_t          group;
+   size_t            n_data;        // Zero until a parity shard arrives
+   size_t            n_parity;
+   size_t            shard_len;
+   uint8_t          *shards[NETCODE_FEC_MAX_SHARDS];
+   bool              have[NETCODE_FEC_MAX_SHARDS];
+};
+
+struct netcode_fec_rx_t {
+   struct group_t   *groups;
+   size_t            max_groups;
+   netcode_fec_t    *codecs[NETCODE_FEC_MAX_SHARDS];   // By n_parity
+   struct msg_t     *head;
+   struct msg_t     *tail;
+   uint64_t          recovered;
+};
+
+static void group_clear (struct group_t *g)
+{
+   for (size_t i=0; i<NETCODE_FEC_MAX_SHARDS; i++) {
+      netcode_util_free (g->shards[i]);
+   }
+   memset (g, 0, sizeof *g);
+}
+
+// Frees a group's shards but keeps its slot, so that late datagrams of
+// the group are recognised and ignored instead of starting it afresh.
+static void group_finish (struct group_t *g)
+{
+   uint32_t group = g->group;
+   group_clear (g);
+   g->used = true;
+   g->done = true;
+   g->group = group;
+}
+
+static bool rx_queue (netcode_fec_rx_t *rx, const uint8_t *msg, size_t len)
+{
+   struct msg_t *tmp = netcode_util_malloc (sizeof *tmp + len);
+   if (!tmp) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM queueing FEC message\n");
+      return false;
+   }
+   tmp->next = NULL;
+   tmp->len = len;
+   memcpy (tmp->data, msg, len);
+
+   if (rx->tail)
+      rx->tail->next = tmp;
+   else
+      rx->head = tmp;
+   rx->tail = tmp;
+   return true;
+}
+
+static void rx_try_recover (netcode_fec_rx_t *rx, struct group_t *g)
+{
+   bool present[NETCODE_FEC_MAX_SHARDS];
+   uint8_t *shards[NETCODE_FEC_MAX_SHARDS];
+   size_t have = 0, missing = 0;
+
+   if (g->done || !g->n_data)
+      return;
+
+   for (size_t i=0; i<g->n_data + g->n_parity; i++) {
+      present[i] = g->have[i];
+      if (g->have[i])
+         have++;
+      else if (i < g->n_data)
+         missing++;
+   }
+   if (!missing) {
+      group_finish (g);
+      return;
+   }
+   if (have < g->n_data)
+      return;
+
+   netcode_fec_t **fec = &rx->codecs[g->n_parity];
+   if (!*fec && !(*fec = netcode_fec_new (NETCODE_FEC_MAX_SHARDS - g->n_parity, g->n_parity)))
+      return;
+
+   for (size_t i=0; i<g->n_data + g->n_parity; i++) {
+      if (!g->shards[i] && !(g->shards[i] = netcode_util_calloc (1, SHARD_MAX))) {
+         NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating FEC shard\n");
+         return;
+      }
+      shards[i] = g->shards[i];
+   }
+
+   if (!(netcode_fec_decode (*fec, g->n_data, shards, present, g->shard_len)))
+      return;
+
+   for (size_t i=0; i<g->n_data; i++) {
+      if (present[i])
+         continue;
+      size_t len = ((size_t)shards[i][0] << 8) | shards[i][1];
+      if (len + 2 > g->shard_len) {
+         NETCODE_LOG (NETCODE_LOG_ERROR, "Rebuilt FEC message has an invalid length\n");
+         continue;
+      }
+      if (rx_queue (rx, &shards[i][2], len))
+         rx->recovered++;
+   }
+
+   group_finish (g);
+}
+
+netcode_fec_rx_t *netcode_fec_rx_new (size_t max_groups)
+{
+   netcode_fec_rx_t *ret = NULL;
+
+   if (!max_groups)
+      max_groups = 1;
+
+   if (!(ret = netcode_util_calloc (1, sizeof *ret)) ||
+       !(ret->groups = netcode_util_calloc (max_groups, sizeof *ret->groups))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating FEC receiver\n");
+      netcode_fec_rx_del (ret);
+      return NULL;
+   }
+   ret->max_groups = max_groups;
+
+   return ret;
+}
+
+void netcode_fec_rx_del (netcode_fec_rx_t *rx)
+{
+   if (!rx)
+      return;
+
+   for (size_t i=0; rx->groups && i<rx->max_groups; i++) {
+      group_clear (&rx->groups[i]);
+   }
+   for (size_t i=0; i<NETCODE_FEC_MAX_SHARDS; i++) {
+      netcode_fec_del (rx->codecs[i]);
+   }
+   while (rx->head) {
+      struct msg_t *next = rx->head->next;
+      netcode_util_free (rx->head);
+      rx->head = next;
+   }
+   netcode_util_free (rx->groups);
+   netcode_util_free (rx);
+}
+
+bool netcode_fec_rx_input (netcode_fec_rx_t *rx, const void *dgram, size_t len)
+{
+   const uint8_t *pkt = dgram;
+
+   if (len < HDRLEN || (pkt[0] != TYPE_DATA && pkt[0] != TYPE_PARITY))
+      return false;
+
+   uint32_t group = ((uint32_t)pkt[4] << 24) | ((uint32_t)pkt[5] << 16) |
+                    ((uint32_t)pkt[6] << 8) | (uint32_t)pkt[7];
+   size_t payload_len = len - HDRLEN;
+   size_t index = pkt[1];
+
+   struct group_t *g = &rx->groups[group % rx->max_groups];
+   if (!g->used || g->group != group) {
+      // A newer group takes over the slot; a late datagram of an older
+      // group is too late to help.
+      if (g->used && (int32_t)(group - g->group) < 0)
+         return true;
+      group_clear (g);
+      g->used = true;
+      g->group = group;
+   }
+
+   if (pkt[0] == TYPE_DATA) {
+      if (payload_len > NETCODE_FEC_MAX_MSG || index >= NETCODE_FEC_MAX_SHARDS)
+         return false;
+      if (g->done || g->have[index])
+         return true;
+
+      if (!g->shards[index] && !(g->shards[index] = netcode_util_calloc (1, SHARD_MAX))) {
+         NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating FEC shard\n");
+         return false;
+      }
+      g->shards[index][0] = (uint8_t)(payload_len >> 8);
+      g->shards[index][1] = (uint8_t)payload_len;
+      memcpy (&g->shards[index][2], &pkt[HDRLEN], payload_len);
+      g->have[index] = true;
+
+      rx_queue (rx, &pkt[HDRLEN], payload_len);
+   } else {
+      size_t n_data = pkt[2], n_parity = pkt[3];
+      if (!n_data || !n_parity || n_data + n_parity > NETCODE_FEC_MAX_SHARDS ||
+            index >= n_parity || payload_len < 2 || payload_len > SHARD_MAX)
+         return false;
+      if (g->done)
+         return true;
+      if (g->n_data && (g->n_data != n_data || g->n_parity != n_parity ||
+                        g->shard_len != payload_len))
+         return false;
+
+      g->n_data = n_data;
+      g->n_parity = n_parity;
+      g->shard_len = payload_len;
+      index += n_data;
+      if (g->have[index])
+         return true;
+
+      if (!g->shards[index] && !(g->shards[index] = netcode_util_calloc (1, SHARD_MAX))) {
+         NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating FEC shard\n");
+         return false;
+      }
+      memcpy (g->shards[index], &pkt[HDRLEN], payload_len);
+      g->have[index] = true;
+   }
+
+   rx_try_recover (rx, g);
+   return true;
+}
+
+bool netcode_fec_rx_next (netcode_fec_rx_t *rx, void *buf, size_t *len)
+{
+   struct msg_t *msg = rx->head;
+
+   if (!msg)
+      return false;
+
+   if (!(rx->head = msg->next))
+      rx->tail = NULL;
+
+   if (*len > msg->len)
+      *len = msg->len;
+   memcpy (buf, msg->data, *len);
+   netcode_util_free (msg);
+   return true;
+}
+
+uint64_t netcode_fec_rx_recovered (const netcode_fec_rx_t *rx)
+{
+   return rx ? rx->recovered : 0;
+}
+
@@ -0,0 +1,128 @@
+
+#ifndef H_NETCODE_FEC
+#define H_NETCODE_FEC
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "netcode_addr.h"
+
+// The largest message that the datagram layer can protect.
+#define NETCODE_FEC_MAX_MSG         (1400)
+
+// Data plus parity shards in one group may not exceed this.
+#define NETCODE_FEC_MAX_SHARDS      (255)
+
+// The Galois-field kernels that can be selected with
+// netcode_fec_set_kernel().
+#define NETCODE_FEC_KERNEL_AUTO     (0)
+#define NETCODE_FEC_KERNEL_SCALAR   (1)
+#define NETCODE_FEC_KERNEL_SSSE3    (2)
+#define NETCODE_FEC_KERNEL_AVX2     (3)
+
+/* Forward error correction with a systematic Reed-Solomon erasure code
+ * over GF(256). A group of 'n_data' equal-length shards is extended with
+ * 'n_parity' parity shards; any 'n_data' of the resulting shards are
+ * enough to rebuild the rest. The first parity shard is the XOR of the
+ * data shards, so a code with one parity shard is plain XOR parity.
+ *
+ * There are two layers:
+ *    netcode_fec_t encodes and decodes shards in caller-owned buffers.
+ *    netcode_fec_tx_t/netcode_fec_rx_t carry variable-length messages
+ *       over UDP: the sender sends each message at once as a data
+ *       datagram and follows every group of messages with the parity
+ *       datagrams; the receiver hands messages on as they arrive and
+ *       rebuilds lost ones, without a round trip, once enough of their
+ *       group has arrived.
+ */
+typedef struct netcode_fec_t netcode_fec_t;
+typedef struct netcode_fec_tx_t netcode_fec_tx_t;
+typedef struct netcode_fec_rx_t netcode_fec_rx_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Selects the kernel used for the Galois-field arithmetic by every
+   // codec in the process. NETCODE_FEC_KERNEL_AUTO (the default) picks
+   // the fastest that the CPU supports.
+   //
+   // RETURNS: false if the CPU (or the build) does not support 'kernel'.
+   bool netcode_fec_set_kernel (int kernel);
+
+   // Returns the kernel in use, as a string such as "avx2".
+   const char *netcode_fec_kernel_name (void);
+
+   // Creates a codec for groups of 'n_data' data shards and 'n_parity'
+   // parity shards. Returns NULL if either is zero or their sum exceeds
+   // NETCODE_FEC_MAX_SHARDS.
+   netcode_fec_t *netcode_fec_new (size_t n_data, size_t n_parity);
+   void netcode_fec_del (netcode_fec_t *fec);
+
+   // Computes the parity shards. 'data' holds 'n_data' pointers to the
+   // data shards and 'parity' holds 'n_parity' pointers to buffers for
+   // the parity shards; every shard is 'len' bytes.
+   //
+   // Fewer data shards than the codec was created for may be passed in
+   // 'n_data'. The decoder must then be given the same 'n_data'.
+   void netcode_fec_encode (const netcode_fec_t *fec, size_t n_data,
+                            const uint8_t * const *data, uint8_t **parity,
+                            size_t len);
+
+   // Rebuilds the missing data shards. 'shards' holds pointers to the
+   // 'n_data' data shards followed by the parity shards, each 'len'
+   // bytes; 'present[i]' is true for the shards that were received. The
+   // buffers of missing data shards are overwritten with their contents.
+   // Missing parity shards are not rebuilt.
+   //
+   // RETURNS: false if fewer than 'n_data' shards are present.
+   bool netcode_fec_decode (const netcode_fec_t *fec, size_t n_data,
+                            uint8_t **shards, const bool *present, size_t len);
+
+   // Creates a sender that sends messages to 'dest' (NULL for the peer
+   // that 'fd' is connected to), adding 'n_parity' parity datagrams after
+   // every 'n_data' messages.
+   netcode_fec_tx_t *netcode_fec_tx_new (int fd, const netcode_addr_t *dest,
+                                         size_t n_data, size_t n_parity);
+   void netcode_fec_tx_del (netcode_fec_tx_t *tx);
+
+   // Sends 'msg' immediately. When it completes a group, the group's
+   // parity datagrams are sent as well.
+   //
+   // RETURNS: false on error or if 'len' exceeds NETCODE_FEC_MAX_MSG.
+   bool netcode_fec_tx_send (netcode_fec_tx_t *tx, const void *msg, size_t len);
+
+   // Closes the current group early, sending its parity datagrams. Call
+   // this when no further messages will follow for a while, so that the
+   // last messages are also protected.
+   bool netcode_fec_tx_flush (netcode_fec_tx_t *tx);
+
+   // Creates a receiver that tracks up to 'max_groups' incomplete groups
+   // at a time; the oldest is abandoned to make room for a new one.
+   netcode_fec_rx_t *netcode_fec_rx_new (size_t max_groups);
+   void netcode_fec_rx_del (netcode_fec_rx_t *rx);
+
+   // Processes one datagram received (for example with
+   // netcode_udp_wait()) from the sender.
+   //
+   // RETURNS: false if the datagram is not a valid FEC datagram.
+   bool netcode_fec_rx_input (netcode_fec_rx_t *rx, const void *dgram, size_t len);
+
+   // Removes the next message that is ready and copies it into 'buf'.
+   // On entry '*len' is the size of 'buf', which should be at least
+   // NETCODE_FEC_MAX_MSG bytes; on return it is the length of the
+   // message. Rebuilt messages come out after the rest of their group.
+   //
+   // RETURNS: false if no message is ready.
+   bool netcode_fec_rx_next (netcode_fec_rx_t *rx, void *buf, size_t *len);
+
+   // Returns the number of messages that were rebuilt from parity.
+   uint64_t netcode_fec_rx_recovered (const netcode_fec_rx_t *rx);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
@@ -0,0 +1,160 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "netcode_util.h"
+#include "netcode_fec.h"
+
+/* Measures encode and decode throughput of every FEC kernel that the CPU
+ * supports, for a few common group shapes, and checks that every kernel
+ * produces the same parity as the scalar kernel.
+ *
+ * Throughput is data bytes (not parity bytes) processed per second.
+ */
+
+#define SHARD_LEN       (1400)
+#define MIN_NS          (200000000ULL)
+
+static const struct {
+   size_t n_data;
+   size_t n_parity;
+} shapes[] = {
+   { 10, 1 },
+   { 10, 4 },
+   { 32, 8 },
+};
+
+static const struct {
+   int kernel;
+   const char *name;
+} kernels[] = {
+   { NETCODE_FEC_KERNEL_SCALAR,  "scalar" },
+   { NETCODE_FEC_KERNEL_SSSE3,   "ssse3"  },
+   { NETCODE_FEC_KERNEL_AVX2,    "avx2"   },
+};
+
+static double encode_mbps (netcode_fec_t *fec, size_t n_data,
+                           const uint8_t **data, uint8_t **parity)
+{
+   uint64_t iters = 0, start = netcode_util_time_ns (), elapsed;
+
+   do {
+      netcode_fec_encode (fec, n_data, data, parity, SHARD_LEN);
+      iters++;
+   } while ((elapsed = netcode_util_time_ns () - start) < MIN_NS);
+
+   return (double)iters * n_data * SHARD_LEN / (elapsed / 1e9) / 1e6;
+}
+
+/* Decodes with the first 'n_parity' data shards missing, the worst case
+ * that the code can recover from.
+ */
+static double decode_mbps (netcode_fec_t *fec, size_t n_data, size_t n_parity,
+                           uint8_t **shards, bool *present)
+{
+   uint64_t iters = 0, start = netcode_util_time_ns (), elapsed;
+
+   for (size_t i=0; i<n_data + n_parity; i++) {
+      present[i] = i >= n_parity;
+   }
+
+   do {
+      if (!(netcode_fec_decode (fec, n_data, shards, present, SHARD_LEN)))
+         return 0.0;
+      iters++;
+   } while ((elapsed = netcode_util_time_ns () - start) < MIN_NS);
+
+   return (double)iters * n_data * SHARD_LEN / (elapsed / 1e9) / 1e6;
+}
+
+static int fec_bench (void)
+{
+   int ret = EXIT_FAILURE;
+   size_t max_shards = 0;
+   uint8_t *buf = NULL, *ref = NULL;
+
+   for (size_t s=0; s<sizeof shapes / sizeof shapes[0]; s++) {
+      if (shapes[s].n_data + shapes[s].n_parity > max_shards)
+         max_shards = shapes[s].n_data + shapes[s].n_parity;
+   }
+
+   if (!(buf = malloc (max_shards * SHARD_LEN)) || !(ref = malloc (max_shards * SHARD_LEN))) {
+      NETCODE_UTIL_LOG ("OOM allocating benchmark buffers\n");
+      goto errorexit;
+   }
+
+   printf ("%-8s %6s %6s %12s %12s\n", "kernel", "data", "parity", "encode MB/s", "decode MB/s");
+
+   for (size_t s=0; s<sizeof shapes / sizeof shapes[0]; s++) {
+      size_t n_data = shapes[s].n_data, n_parity = shapes[s].n_parity;
+      const uint8_t *data[NETCODE_FEC_MAX_SHARDS];
+      uint8_t *parity[NETCODE_FEC_MAX_SHARDS], *shards[NETCODE_FEC_MAX_SHARDS];
+      bool present[NETCODE_FEC_MAX_SHARDS];
+      netcode_fec_t *fec = netcode_fec_new (n_data, n_parity);
+
+      if (!fec)
+         goto errorexit;
+
+      for (size_t i=0; i<n_data + n_parity; i++) {
+         shards[i] = &buf[i * SHARD_LEN];
+         if (i < n_data)
+            data[i] = shards[i];
+         else
+            parity[i - n_data] = shards[i];
+      }
+
+      for (size_t k=0; k<sizeof kernels / sizeof kernels[0]; k++) {
+         if (!(netcode_fec_set_kernel (kernels[k].kernel))) {
+            printf ("%-8s %6zu %6zu %12s %12s\n", kernels[k].name, n_data, n_parity,
+                    "n/a", "n/a");
+            continue;
+         }
+
+         for (size_t i=0; i<n_data * SHARD_LEN; i++) {
+            buf[i] = (uint8_t)(i * 2654435761u >> 13);
+         }
+         double enc = encode_mbps (fec, n_data, data, parity);
+
+         // Every kernel must agree with the scalar one.
+         if (kernels[k].kernel == NETCODE_FEC_KERNEL_SCALAR) {
+            memcpy (ref, buf, (n_data + n_parity) * SHARD_LEN);
+         } else if (memcmp (ref, buf, (n_data + n_parity) * SHARD_LEN) != 0) {
+            NETCODE_UTIL_LOG ("Kernel %s disagrees with the scalar kernel\n", kernels[k].name);
+            netcode_fec_del (fec);
+            goto errorexit;
+         }
+
+         double dec = decode_mbps (fec, n_data, n_parity, shards, present);
+         if (memcmp (ref, buf, n_data * SHARD_LEN) != 0) {
+            NETCODE_UTIL_LOG ("Kernel %s decoded incorrectly\n", kernels[k].name);
+            netcode_fec_del (fec);
+            goto errorexit;
+         }
+
+         printf ("%-8s %6zu %6zu %12.1f %12.1f\n", kernels[k].name, n_data, n_parity, enc, dec);
+      }
+
+      netcode_fec_del (fec);
+   }
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   netcode_fec_set_kernel (NETCODE_FEC_KERNEL_AUTO);
+   free (buf);
+   free (ref);
+   return ret;
+}
+
+int main (void)
+{
+   if (!(netcode_util_init ())) {
+      NETCODE_UTIL_LOG ("Failed to initialise netcode\n");
+      return EXIT_FAILURE;
+   }
+
+   return fec_bench ();
+}
+
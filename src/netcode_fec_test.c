@@ -0,0 +1,331 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "netcode_util.h"
+#include "netcode_udp.h"
+#include "netcode_fec.h"
+
+#define N_DATA          (5)
+#define N_PARITY        (3)
+#define SHARD_LEN       (97)      // Not a multiple of any vector width
+#define NMSGS           (203)     // Leaves a short group to be flushed
+
+static const int kernels[] = {
+   NETCODE_FEC_KERNEL_SCALAR,
+   NETCODE_FEC_KERNEL_SSSE3,
+   NETCODE_FEC_KERNEL_AVX2,
+};
+
+/* Erases every combination of up to N_PARITY shards and checks that the
+ * data is rebuilt exactly.
+ */
+static bool codec_test (void)
+{
+   bool ret = false;
+   static uint8_t orig[N_DATA + N_PARITY][SHARD_LEN];
+   static uint8_t work[N_DATA + N_PARITY][SHARD_LEN];
+   const uint8_t *data[N_DATA];
+   uint8_t *parity[N_PARITY], *shards[N_DATA + N_PARITY];
+   size_t ntests = 0;
+   netcode_fec_t *fec = netcode_fec_new (N_DATA, N_PARITY);
+
+   if (!fec) {
+      NETCODE_UTIL_LOG ("Failed to create codec\n");
+      return false;
+   }
+
+   for (size_t i=0; i<N_DATA; i++) {
+      for (size_t j=0; j<SHARD_LEN; j++) {
+         orig[i][j] = (uint8_t)(i * 31 + j * 7 + 1);
+      }
+      data[i] = orig[i];
+   }
+   for (size_t i=0; i<N_PARITY; i++) {
+      parity[i] = orig[N_DATA + i];
+   }
+   netcode_fec_encode (fec, N_DATA, data, parity, SHARD_LEN);
+
+   // The first parity shard is plain XOR parity.
+   for (size_t j=0; j<SHARD_LEN; j++) {
+      uint8_t x = 0;
+      for (size_t i=0; i<N_DATA; i++) {
+         x ^= orig[i][j];
+      }
+      if (x != orig[N_DATA][j]) {
+         NETCODE_UTIL_LOG ("First parity shard is not the XOR of the data\n");
+         goto errorexit;
+      }
+   }
+
+   for (size_t k=0; k<sizeof kernels / sizeof kernels[0]; k++) {
+      if (!(netcode_fec_set_kernel (kernels[k])))
+         continue;
+
+      for (unsigned mask=0; mask < (1u << (N_DATA + N_PARITY)); mask++) {
+         bool present[N_DATA + N_PARITY];
+         size_t nlost = 0;
+
+         for (size_t i=0; i<N_DATA + N_PARITY; i++) {
+            present[i] = !(mask & (1u << i));
+            nlost += present[i] ? 0 : 1;
+            if (present[i])
+               memcpy (work[i], orig[i], SHARD_LEN);
+            else
+               memset (work[i], 0xee, SHARD_LEN);
+            shards[i] = work[i];
+         }
+
+         bool rc = netcode_fec_decode (fec, N_DATA, shards, present, SHARD_LEN);
+         if (rc != (nlost <= N_PARITY)) {
+            NETCODE_UTIL_LOG ("[%s] decode of mask 0x%02x returned %i\n",
+                              netcode_fec_kernel_name (), mask, rc);
+            goto errorexit;
+         }
+         for (size_t i=0; rc && i<N_DATA; i++) {
+            if (memcmp (work[i], orig[i], SHARD_LEN) != 0) {
+               NETCODE_UTIL_LOG ("[%s] shard %zu of mask 0x%02x rebuilt incorrectly\n",
+                                 netcode_fec_kernel_name (), i, mask);
+               goto errorexit;
+            }
+         }
+         ntests++;
+      }
+      printf ("FEC: [%s] all erasure patterns checked\n", netcode_fec_kernel_name ());
+   }
+
+   ret = ntests > 0;
+
+errorexit:
+   netcode_fec_set_kernel (NETCODE_FEC_KERNEL_AUTO);
+   netcode_fec_del (fec);
+   return ret;
+}
+
+/* Sends messages through the datagram layer over loopback, discarding
+ * some datagrams before they reach the decoder: in every group one data
+ * datagram, and in every third group a second data datagram and a
+ * parity datagram.
+ */
+static bool udp_test (void)
+{
+   bool ret = false;
+   int rxfd = -1, txfd = -1;
+   netcode_fec_tx_t *tx = NULL;
+   netcode_fec_rx_t *rx = NULL;
+   netcode_addr_t dest;
+   static bool seen[NMSGS];
+   size_t nseen = 0, ndropped = 0;
+
+   netcode_addr_parse (&dest, "127.0.0.1");
+   netcode_addr_set_port (&dest, NETCODE_TEST_FEC_PORT);
+
+   if ((rxfd = netcode_udp_socket (NETCODE_TEST_FEC_PORT, NULL)) < 0 ||
+       (txfd = netcode_udp_socket (0, NULL)) < 0 ||
+       !(tx = netcode_fec_tx_new (txfd, &dest, N_DATA, N_PARITY)) ||
+       !(rx = netcode_fec_rx_new (4))) {
+      NETCODE_UTIL_LOG ("Failed to set up FEC over UDP\n");
+      goto errorexit;
+   }
+
+   for (uint32_t i=0; i<NMSGS; i++) {
+      uint8_t msg[64];
+      size_t len = 4 + i % 50;
+      memset (msg, (int)i, len);
+      memcpy (msg, &i, sizeof i);
+
+      if (!(netcode_fec_tx_send (tx, msg, len))) {
+         NETCODE_UTIL_LOG ("Failed to send message %" PRIu32 "\n", i);
+         goto errorexit;
+      }
+      if (i == NMSGS - 1 && !(netcode_fec_tx_flush (tx))) {
+         NETCODE_UTIL_LOG ("Failed to flush\n");
+         goto errorexit;
+      }
+
+      // Drain the socket as we go so that its buffer never overflows.
+      uint8_t *buf = NULL;
+      size_t buflen = 0;
+      netcode_addr_t from;
+      while (netcode_udp_wait_addr (rxfd, &from, &buf, &buflen, 0) != (size_t)-1 &&
+             netcode_addr_family (&from) != AF_UNSPEC) {
+         uint32_t group = ((uint32_t)buf[4] << 24) | ((uint32_t)buf[5] << 16) |
+                          ((uint32_t)buf[6] << 8) | buf[7];
+         bool parity = buf[0] == 2;
+         bool drop = (!parity && buf[1] == group % N_DATA) ||
+                     (group % 3 == 0 && !parity && buf[1] == (group + 2) % N_DATA) ||
+                     (group % 3 == 0 && parity && buf[1] == 0);
+         if (drop) {
+            ndropped++;
+         } else if (!(netcode_fec_rx_input (rx, buf, buflen))) {
+            NETCODE_UTIL_LOG ("Invalid FEC datagram\n");
+            free (buf);
+            goto errorexit;
+         }
+         free (buf);
+         buf = NULL;
+      }
+   }
+
+   uint8_t msg[NETCODE_FEC_MAX_MSG];
+   size_t len = sizeof msg;
+   while (netcode_fec_rx_next (rx, msg, &len)) {
+      uint32_t idx;
+      memcpy (&idx, msg, sizeof idx);
+      if (idx >= NMSGS || seen[idx] || len != 4 + idx % 50) {
+         NETCODE_UTIL_LOG ("Unexpected message %" PRIu32 " of length %zu\n", idx, len);
+         goto errorexit;
+      }
+      seen[idx] = true;
+      nseen++;
+      len = sizeof msg;
+   }
+
+   printf ("FEC: %zu of %i messages received, %zu datagrams dropped, %" PRIu64 " rebuilt\n",
+           nseen, NMSGS, ndropped, netcode_fec_rx_recovered (rx));
+   if (nseen != NMSGS) {
+      NETCODE_UTIL_LOG ("Messages were lost\n");
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_fec_tx_del (tx);
+   netcode_fec_rx_del (rx);
+   if (rxfd >= 0)
+      netcode_util_close (rxfd);
+   if (txfd >= 0)
+      netcode_util_close (txfd);
+   return ret;
+}
+
+/* Delivers two groups with every data datagram present and the parity
+ * arriving after the data, then replays every datagram of the second
+ * group. A group completed without recovery must keep its slot, or the
+ * late parity and the replayed data start it again and its messages are
+ * delivered twice.
+ */
+static bool late_parity_test (void)
+{
+   bool ret = false;
+   int rxfd = -1, txfd = -1;
+   netcode_fec_tx_t *tx = NULL;
+   netcode_fec_rx_t *rx = NULL;
+   netcode_addr_t dest, from;
+   uint8_t *dgrams[2 * (N_DATA + N_PARITY)] = { NULL };
+   size_t lens[2 * (N_DATA + N_PARITY)];
+   size_t ndgrams = 0, nseen = 0;
+   bool seen[2 * N_DATA] = { false };
+
+   netcode_addr_parse (&dest, "127.0.0.1");
+   netcode_addr_set_port (&dest, NETCODE_TEST_FEC_PORT);
+
+   if ((rxfd = netcode_udp_socket (NETCODE_TEST_FEC_PORT, NULL)) < 0 ||
+       (txfd = netcode_udp_socket (0, NULL)) < 0 ||
+       !(tx = netcode_fec_tx_new (txfd, &dest, N_DATA, N_PARITY)) ||
+       !(rx = netcode_fec_rx_new (4))) {
+      NETCODE_UTIL_LOG ("Failed to set up FEC over UDP\n");
+      goto errorexit;
+   }
+
+   for (uint32_t i=0; i<2 * N_DATA; i++) {
+      if (!(netcode_fec_tx_send (tx, &i, sizeof i))) {
+         NETCODE_UTIL_LOG ("Failed to send message %" PRIu32 "\n", i);
+         goto errorexit;
+      }
+   }
+   while (ndgrams < sizeof dgrams / sizeof dgrams[0]) {
+      if (netcode_udp_wait_addr (rxfd, &from, &dgrams[ndgrams], &lens[ndgrams], 1) == (size_t)-1 ||
+          netcode_addr_family (&from) == AF_UNSPEC) {
+         NETCODE_UTIL_LOG ("Received %zu of %zu datagrams\n", ndgrams,
+                           sizeof dgrams / sizeof dgrams[0]);
+         goto errorexit;
+      }
+      ndgrams++;
+   }
+
+   // Data is sent before parity in each group, so in-order input has the
+   // parity arriving after all of the data.
+   for (size_t i=0; i<ndgrams; i++) {
+      if (!(netcode_fec_rx_input (rx, dgrams[i], lens[i]))) {
+         NETCODE_UTIL_LOG ("Invalid FEC datagram\n");
+         goto errorexit;
+      }
+   }
+   for (size_t i=N_DATA + N_PARITY; i<ndgrams; i++) {
+      netcode_fec_rx_input (rx, dgrams[i], lens[i]);
+   }
+
+   uint8_t msg[NETCODE_FEC_MAX_MSG];
+   size_t len = sizeof msg;
+   while (netcode_fec_rx_next (rx, msg, &len)) {
+      uint32_t idx;
+      memcpy (&idx, msg, sizeof idx);
+      if (len != sizeof idx || idx >= 2 * N_DATA || seen[idx]) {
+         NETCODE_UTIL_LOG ("Unexpected or duplicate message %" PRIu32 " of length %zu\n",
+                           idx, len);
+         goto errorexit;
+      }
+      seen[idx] = true;
+      nseen++;
+      len = sizeof msg;
+   }
+
+   printf ("FEC: %zu of %i messages received once with late parity\n", nseen, 2 * N_DATA);
+   if (nseen != 2 * N_DATA) {
+      NETCODE_UTIL_LOG ("Messages were lost\n");
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   for (size_t i=0; i<ndgrams; i++) {
+      netcode_util_free (dgrams[i]);
+   }
+   netcode_fec_tx_del (tx);
+   netcode_fec_rx_del (rx);
+   if (rxfd >= 0)
+      netcode_util_close (rxfd);
+   if (txfd >= 0)
+      netcode_util_close (txfd);
+   return ret;
+}
+
+static int fec_test (void)
+{
+   if (!(codec_test ()) || !(udp_test ()) || !(late_parity_test ()))
+      return EXIT_FAILURE;
+
+   return EXIT_SUCCESS;
+}
+
+int main (void)
+{
+   int ret = EXIT_FAILURE;
+
+   if (!(netcode_util_init ())) {
+      NETCODE_UTIL_LOG ("Failed to initialise netcode\n");
+      goto errorexit;
+   }
+
+   if ((ret = fec_test ())!=EXIT_SUCCESS) {
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      printf ("+++ +++ fec: Test FAILED +++ +++\n");
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      goto errorexit;
+   }
+
+   printf ("*********************************\n");
+   printf ("*** *** fec: Test passed *** ***\n");
+   printf ("*********************************\n");
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   return ret;
+}
+
@@ -0,0 +1,522 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "netcode_util.h"
+#include "netcode_log.h"
+#include "netcode_udp.h"
+#include "netcode_if.h"
+#include "netcode_frag.h"
+
+/* ***************************************************************** */
+#ifdef PLATFORM_Windows
+#include <winsock2.h>
+#include <windows.h>
+
+typedef int socklen_t;
+
+#endif
+
+/* ***************************************************************** */
+#ifdef PLATFORM_POSIX
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#endif
+
+/* Fragment header, all fields in network byte order:
+ *
+ *    magic(1) reserved(1) index(2) count(2) frag_size(2) msg_id(4)
+ *
+ * 'frag_size' is the payload length of every fragment but the last,
+ * which may be shorter. The receiver can therefore size the reassembly
+ * buffer, and place each fragment in it, from any one fragment.
+ */
+#define MAGIC              (0xf7)
+
+#define IPV4_HDRLEN        (20)
+#define IPV6_HDRLEN        (40)
+#define UDP_HDRLEN         (8)
+#define MAX_IP_PACKET      (65535)
+
+// The smallest payload worth sending a fragment for.
+#define MIN_PAYLOAD        (64)
+
+// Fragments are assembled into a scratch buffer of up to this size, and
+// no more than MAX_BATCH at a time, and handed to the kernel a buffer at
+// a time with netcode_udp_send_many().
+#define SCRATCH_BYTES      (256 * 1024)
+#define MAX_BATCH          (64)
+
+// Incomplete messages are found through a hash table with this many
+// chains.
+#define NBUCKETS           (256)
+
+static void put_hdr (uint8_t *hdr, uint16_t index, uint16_t count,
+                     uint16_t frag_size, uint32_t msg_id)
+{
+   hdr[0] = MAGIC;
+   hdr[1] = 0;
+   hdr[2] = (uint8_t)(index >> 8);
+   hdr[3] = (uint8_t)index;
+   hdr[4] = (uint8_t)(count >> 8);
+   hdr[5] = (uint8_t)count;
+   hdr[6] = (uint8_t)(frag_size >> 8);
+   hdr[7] = (uint8_t)frag_size;
+   hdr[8] = (uint8_t)(msg_id >> 24);
+   hdr[9] = (uint8_t)(msg_id >> 16);
+   hdr[10] = (uint8_t)(msg_id >> 8);
+   hdr[11] = (uint8_t)msg_id;
+}
+
+/* ***************************************************************** */
+struct netcode_frag_tx_t {
+   int               fd;
+   netcode_addr_t    dest;
+   bool              connected;
+   bool              discover;
+   size_t            mtu;
+   size_t            payload;       // Largest payload per fragment
+   uint32_t          next_id;
+   uint8_t          *scratch;
+   size_t            batch;         // Fragments that fit in 'scratch'
+};
+
+static int tx_family (const netcode_frag_tx_t *tx)
+{
+   struct sockaddr_storage ss;
+   socklen_t sslen = sizeof ss;
+
+   if (!tx->connected)
+      return netcode_addr_family (&tx->dest);
+
+   memset (&ss, 0, sizeof ss);
+   if (getpeername (tx->fd, (struct sockaddr *)&ss, &sslen) != 0)
+      return AF_UNSPEC;
+   return ss.ss_family;
+}
+
+static size_t smallest_if_mtu (void)
+{
+   size_t ret = 0;
+   netcode_if_t **list = netcode_if_list_new ();
+
+   for (size_t i=0; list && list[i]; i++) {
+      uint64_t flags = 0;
+      netcode_if_extract (list[i], &flags, NULL, NULL, NULL, NULL, NULL);
+      if (!(flags & NETCODE_IFF_UP) || (flags & NETCODE_IFF_LOOPBACK))
+         continue;
+
+      size_t mtu = netcode_if_mtu (list[i]);
+      if (mtu && (!ret || mtu < ret))
+         ret = mtu;
+   }
+
+   netcode_if_list_del (list);
+   return ret;
+}
+
+static size_t discover_mtu (const netcode_frag_tx_t *tx)
+{
+   size_t ret = netcode_udp_path_mtu (tx->fd, tx->connected ? NULL : &tx->dest);
+
+   if (!ret)
+      ret = smallest_if_mtu ();
+   if (!ret)
+      ret = NETCODE_FRAG_DEFAULT_MTU;
+   return ret;
+}
+
+static bool tx_apply_mtu (netcode_frag_tx_t *tx, size_t mtu)
+{
+   size_t overhead = (tx_family (tx) == AF_INET6 ? IPV6_HDRLEN : IPV4_HDRLEN)
+                   + UDP_HDRLEN + NETCODE_FRAG_HDRLEN;
+
+   if (mtu > MAX_IP_PACKET)
+      mtu = MAX_IP_PACKET;
+
+   if (mtu < overhead + MIN_PAYLOAD) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "MTU of %zu leaves no room for fragments\n", mtu);
+      return false;
+   }
+
+   size_t payload = mtu - overhead;
+   size_t batch = SCRATCH_BYTES / (NETCODE_FRAG_HDRLEN + payload);
+   if (!batch)
+      batch = 1;
+   if (batch > MAX_BATCH)
+      batch = MAX_BATCH;
+
+   uint8_t *scratch = netcode_util_realloc (tx->scratch, batch * (NETCODE_FRAG_HDRLEN + payload));
+   if (!scratch) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating fragment buffer\n");
+      return false;
+   }
+
+   tx->scratch = scratch;
+   tx->batch = batch;
+   tx->mtu = mtu;
+   tx->payload = payload;
+   return true;
+}
+
+netcode_frag_tx_t *netcode_frag_tx_new (int fd, const netcode_addr_t *dest,
+                                        size_t mtu)
+{
+   netcode_frag_tx_t *ret = NULL;
+
+   if (!(ret = netcode_util_calloc (1, sizeof *ret))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating fragmenting sender\n");
+      return NULL;
+   }
+
+   ret->fd = fd;
+   if (dest)
+      ret->dest = *dest;
+   ret->connected = dest == NULL;
+   ret->next_id = (uint32_t)netcode_util_time_ns ();
+
+   if (!(netcode_frag_tx_set_mtu (ret, mtu))) {
+      netcode_frag_tx_del (ret);
+      return NULL;
+   }
+
+   return ret;
+}
+
+void netcode_frag_tx_del (netcode_frag_tx_t *tx)
+{
+   if (!tx)
+      return;
+
+   netcode_util_free (tx->scratch);
+   netcode_util_free (tx);
+}
+
+size_t netcode_frag_tx_mtu (const netcode_frag_tx_t *tx)
+{
+   return tx->mtu;
+}
+
+bool netcode_frag_tx_set_mtu (netcode_frag_tx_t *tx, size_t mtu)
+{
+   tx->discover = mtu == 0;
+   if (tx->discover) {
+      // Without DF set the kernel would fragment instead of telling us
+      // that the path MTU has dropped.
+      netcode_udp_set_pmtud (tx->fd, true);
+      mtu = discover_mtu (tx);
+   }
+
+   return tx_apply_mtu (tx, mtu);
+}
+
+// Returns zero on success, otherwise the error number of the failed send
+// (or -1 if there was none).
+static int tx_send_once (netcode_frag_tx_t *tx, const uint8_t *msg, size_t len,
+                         uint32_t msg_id)
+{
+   struct iovec iov[MAX_BATCH];
+   size_t count = len ? (len + tx->payload - 1) / tx->payload : 1;
+
+   if (count > NETCODE_FRAG_MAX_FRAGS) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Message of %zu bytes needs too many fragments\n", len);
+      return -1;
+   }
+
+   for (size_t first=0; first<count; first+=tx->batch) {
+      size_t n = count - first < tx->batch ? count - first : tx->batch;
+
+      for (size_t i=0; i<n; i++) {
+         size_t index = first + i;
+         size_t offset = index * tx->payload;
+         size_t plen = len - offset < tx->payload ? len - offset : tx->payload;
+         uint8_t *dgram = &tx->scratch[i * (NETCODE_FRAG_HDRLEN + tx->payload)];
+
+         put_hdr (dgram, (uint16_t)index, (uint16_t)count, (uint16_t)tx->payload, msg_id);
+         memcpy (&dgram[NETCODE_FRAG_HDRLEN], &msg[offset], plen);
+         iov[i].iov_base = dgram;
+         iov[i].iov_len = NETCODE_FRAG_HDRLEN + plen;
+      }
+
+      netcode_util_clear_errno ();
+      size_t nsent = netcode_udp_send_many_addr (tx->fd, tx->connected ? NULL : &tx->dest,
+                                                 iov, n);
+      if (nsent != n) {
+         int err = netcode_util_errno ();
+         NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to send fragments %zu-%zu of %zu\n",
+                                         first, first + n - 1, count);
+         return err ? err : -1;
+      }
+   }
+
+   return 0;
+}
+
+bool netcode_frag_tx_send (netcode_frag_tx_t *tx, const void *msg, size_t len)
+{
+   uint32_t msg_id = tx->next_id++;
+
+   int err = tx_send_once (tx, msg, len, msg_id);
+   if (!err)
+      return true;
+
+   if (!tx->discover || err != EMSGSIZE)
+      return false;
+
+   // The path MTU has dropped below ours. Every fragment but the last is
+   // the same size, so nothing of this message was sent: split it again
+   // and resend it.
+   size_t old_mtu = tx->mtu;
+   size_t mtu = discover_mtu (tx);
+   if (mtu >= old_mtu || !(tx_apply_mtu (tx, mtu)))
+      return false;
+
+   NETCODE_LOG (NETCODE_LOG_INFO, "Path MTU dropped from %zu to %zu\n", old_mtu, mtu);
+   return tx_send_once (tx, msg, len, msg_id) == 0;
+}
+
+/* ***************************************************************** */
+struct partial_t {
+   struct partial_t *chain;         // Next in the hash chain
+   struct partial_t *older;         // Age list, oldest first
+   struct partial_t *newer;
+   netcode_addr_t    from;
+   uint32_t          msg_id;
+   uint16_t          count;
+   uint16_t          nreceived;
+   size_t            frag_size;
+   size_t            last_len;
+   size_t            nbytes;        // Charged against the budget
+   uint64_t          deadline;
+   uint8_t          *data;
+   uint8_t           have[];        // One bit per fragment
+};
+
+struct netcode_frag_rx_t {
+   size_t            max_bytes;
+   uint64_t          timeout_ns;
+   struct partial_t *buckets[NBUCKETS];
+   struct partial_t *oldest;
+   struct partial_t *newest;
+   netcode_frag_rx_stats_t stats;
+};
+
+static size_t bucket_of (const netcode_addr_t *from, uint32_t msg_id)
+{
+   uint32_t h = netcode_addr_hash (from) ^ (msg_id * UINT32_C (0x9e3779b1));
+   return (h ^ (h >> 16)) % NBUCKETS;
+}
+
+static void partial_unlink (netcode_frag_rx_t *rx, struct partial_t *p)
+{
+   struct partial_t **pp = &rx->buckets[bucket_of (&p->from, p->msg_id)];
+   while (*pp != p)
+      pp = &(*pp)->chain;
+   *pp = p->chain;
+
+   if (p->older)
+      p->older->newer = p->newer;
+   else
+      rx->oldest = p->newer;
+   if (p->newer)
+      p->newer->older = p->older;
+   else
+      rx->newest = p->older;
+
+   rx->stats.pending--;
+   rx->stats.pending_bytes -= p->nbytes;
+}
+
+static void partial_del (struct partial_t *p)
+{
+   if (!p)
+      return;
+
+   netcode_util_free (p->data);
+   netcode_util_free (p);
+}
+
+netcode_frag_rx_t *netcode_frag_rx_new (size_t max_bytes, size_t timeout_ms)
+{
+   netcode_frag_rx_t *ret = netcode_util_calloc (1, sizeof *ret);
+
+   if (!ret) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating reassembly state\n");
+      return NULL;
+   }
+
+   ret->max_bytes = max_bytes;
+   ret->timeout_ns = (uint64_t)timeout_ms * 1000000;
+   return ret;
+}
+
+void netcode_frag_rx_del (netcode_frag_rx_t *rx)
+{
+   if (!rx)
+      return;
+
+   while (rx->oldest) {
+      struct partial_t *p = rx->oldest;
+      partial_unlink (rx, p);
+      partial_del (p);
+   }
+   netcode_util_free (rx);
+}
+
+static size_t rx_expire (netcode_frag_rx_t *rx, uint64_t now)
+{
+   size_t ret = 0;
+
+   // Deadlines are set on arrival, so the age list is also in deadline
+   // order.
+   while (rx->oldest && rx->oldest->deadline <= now) {
+      struct partial_t *p = rx->oldest;
+      partial_unlink (rx, p);
+      partial_del (p);
+      rx->stats.timed_out++;
+      ret++;
+   }
+   return ret;
+}
+
+size_t netcode_frag_rx_expire (netcode_frag_rx_t *rx)
+{
+   return rx_expire (rx, netcode_util_time_ns ());
+}
+
+static struct partial_t *partial_new (netcode_frag_rx_t *rx, const netcode_addr_t *from,
+                                      uint32_t msg_id, uint16_t count,
+                                      size_t frag_size, uint64_t now)
+{
+   size_t bitmap = ((size_t)count + 7) / 8;
+   size_t nbytes = (size_t)count * frag_size + sizeof (struct partial_t) + bitmap;
+
+   if (nbytes > rx->max_bytes) {
+      rx->stats.rejected++;
+      return NULL;
+   }
+
+   while (rx->stats.pending_bytes + nbytes > rx->max_bytes) {
+      struct partial_t *victim = rx->oldest;
+      partial_unlink (rx, victim);
+      partial_del (victim);
+      rx->stats.evicted++;
+   }
+
+   struct partial_t *ret = netcode_util_calloc (1, sizeof *ret + bitmap);
+   if (!ret || !(ret->data = netcode_util_malloc ((size_t)count * frag_size))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating %zu bytes for reassembly\n", nbytes);
+      partial_del (ret);
+      return NULL;
+   }
+
+   ret->from = *from;
+   ret->msg_id = msg_id;
+   ret->count = count;
+   ret->frag_size = frag_size;
+   ret->nbytes = nbytes;
+   ret->deadline = now + rx->timeout_ns;
+
+   size_t b = bucket_of (from, msg_id);
+   ret->chain = rx->buckets[b];
+   rx->buckets[b] = ret;
+
+   ret->older = rx->newest;
+   if (rx->newest)
+      rx->newest->newer = ret;
+   else
+      rx->oldest = ret;
+   rx->newest = ret;
+
+   rx->stats.pending++;
+   rx->stats.pending_bytes += nbytes;
+   return ret;
+}
+
+bool netcode_frag_rx_input (netcode_frag_rx_t *rx, const netcode_addr_t *from,
+                            const void *dgram, size_t len,
+                            uint8_t **msg, size_t *msglen)
+{
+   const uint8_t *d = dgram;
+   uint64_t now = netcode_util_time_ns ();
+
+   *msg = NULL;
+   *msglen = 0;
+
+   rx_expire (rx, now);
+
+   if (len < NETCODE_FRAG_HDRLEN || d[0] != MAGIC) {
+      rx->stats.rejected++;
+      return false;
+   }
+
+   uint16_t index = (uint16_t)((d[2] << 8) | d[3]);
+   uint16_t count = (uint16_t)((d[4] << 8) | d[5]);
+   size_t frag_size = (size_t)((d[6] << 8) | d[7]);
+   uint32_t msg_id = ((uint32_t)d[8] << 24) | ((uint32_t)d[9] << 16) |
+                     ((uint32_t)d[10] << 8) | d[11];
+   const uint8_t *payload = &d[NETCODE_FRAG_HDRLEN];
+   size_t plen = len - NETCODE_FRAG_HDRLEN;
+   bool last = index == count - 1;
+
+   if (!count || index >= count || !frag_size ||
+       (last ? plen > frag_size : plen != frag_size)) {
+      rx->stats.rejected++;
+      return false;
+   }
+
+   if (count == 1) {
+      // Unfragmented; no reassembly state is needed.
+      if (!(*msg = netcode_util_malloc (plen ? plen : 1))) {
+         NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating %zu byte message\n", plen);
+         return false;
+      }
+      memcpy (*msg, payload, plen);
+      *msglen = plen;
+      rx->stats.completed++;
+      return true;
+   }
+
+   struct partial_t *p = rx->buckets[bucket_of (from, msg_id)];
+   while (p && (p->msg_id != msg_id || netcode_addr_cmp (&p->from, from) != 0))
+      p = p->chain;
+
+   if (p && (p->count != count || p->frag_size != frag_size)) {
+      rx->stats.rejected++;
+      return false;
+   }
+
+   if (!p && !(p = partial_new (rx, from, msg_id, count, frag_size, now)))
+      return false;
+
+   if (p->have[index / 8] & (1 << (index % 8))) {
+      rx->stats.rejected++;
+      return false;
+   }
+
+   memcpy (&p->data[(size_t)index * frag_size], payload, plen);
+   p->have[index / 8] |= (uint8_t)(1 << (index % 8));
+   p->nreceived++;
+   if (last)
+      p->last_len = plen;
+
+   if (p->nreceived < p->count)
+      return false;
+
+   partial_unlink (rx, p);
+   *msg = p->data;
+   *msglen = (size_t)(p->count - 1) * p->frag_size + p->last_len;
+   p->data = NULL;
+   partial_del (p);
+   rx->stats.completed++;
+   return true;
+}
+
+void netcode_frag_rx_stats (const netcode_frag_rx_t *rx,
+                            netcode_frag_rx_stats_t *dst)
+{
+   *dst = rx->stats;
+}
@@ -0,0 +1,116 @@
+
+#ifndef H_NETCODE_FRAG
+#define H_NETCODE_FRAG
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "netcode_addr.h"
+
+// The header that precedes the payload of every fragment.
+#define NETCODE_FRAG_HDRLEN         (12)
+
+// A message may be split into at most this many fragments.
+#define NETCODE_FRAG_MAX_FRAGS      (65535)
+
+// The MTU assumed when neither the path nor the interfaces report one:
+// the smallest MTU that IPv6 guarantees.
+#define NETCODE_FRAG_DEFAULT_MTU    (1280)
+
+/* Application-level fragmentation of large messages over UDP.
+ *
+ * The sender splits each message into datagrams that fit the path MTU,
+ * so that IP never fragments them: a lost IP fragment loses the whole
+ * datagram, and many networks drop IP fragments altogether. Each
+ * datagram carries a NETCODE_FRAG_HDRLEN-byte header with the message
+ * number, the fragment number and the fragment count.
+ *
+ * The receiver reassembles messages from fragments that arrive in any
+ * order, using no more than a fixed amount of memory for the incomplete
+ * ones. A message that is not complete within the timeout is discarded,
+ * and when a new message does not fit in the memory budget the oldest
+ * incomplete messages are discarded to make room. There is no
+ * retransmission: a message with a lost fragment is lost.
+ */
+typedef struct netcode_frag_tx_t netcode_frag_tx_t;
+typedef struct netcode_frag_rx_t netcode_frag_rx_t;
+
+typedef struct netcode_frag_rx_stats_t {
+   uint64_t    completed;        // Messages reassembled
+   uint64_t    timed_out;        // Incomplete messages discarded on timeout
+   uint64_t    evicted;          // Incomplete messages discarded for memory
+   uint64_t    rejected;         // Invalid, duplicate or oversized fragments
+   size_t      pending;          // Incomplete messages held
+   size_t      pending_bytes;    // Memory held by incomplete messages
+} netcode_frag_rx_stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Creates a sender that sends messages over the datagram socket 'fd'
+   // to 'dest' (NULL for the peer that 'fd' is connected to). 'mtu' is
+   // the size of the IP packets to send, headers included.
+   //
+   // When 'mtu' is zero the MTU is discovered: path MTU discovery is
+   // enabled on 'fd' and the kernel's path MTU towards the destination is
+   // used; failing that, the smallest MTU of the interfaces that are up,
+   // and failing that NETCODE_FRAG_DEFAULT_MTU. When a send then fails
+   // because the path MTU has dropped, the MTU is discovered again and
+   // the message is sent once more.
+   //
+   // RETURNS: NULL on error, or if 'mtu' leaves no room for a payload.
+   netcode_frag_tx_t *netcode_frag_tx_new (int fd, const netcode_addr_t *dest,
+                                           size_t mtu);
+   void netcode_frag_tx_del (netcode_frag_tx_t *tx);
+
+   // Returns the MTU in use.
+   size_t netcode_frag_tx_mtu (const netcode_frag_tx_t *tx);
+
+   // Changes the MTU; zero discovers it again as netcode_frag_tx_new()
+   // does.
+   //
+   // RETURNS: false if 'mtu' leaves no room for a payload.
+   bool netcode_frag_tx_set_mtu (netcode_frag_tx_t *tx, size_t mtu);
+
+   // Sends the message 'msg' of 'len' bytes as one or more datagrams.
+   //
+   // RETURNS: false on error or if the message needs more than
+   // NETCODE_FRAG_MAX_FRAGS fragments.
+   bool netcode_frag_tx_send (netcode_frag_tx_t *tx, const void *msg, size_t len);
+
+   // Creates a receiver that holds at most 'max_bytes' of incomplete
+   // messages and discards those that are not complete within
+   // 'timeout_ms' milliseconds of their first fragment arriving. A
+   // message larger than 'max_bytes' can never be received.
+   netcode_frag_rx_t *netcode_frag_rx_new (size_t max_bytes, size_t timeout_ms);
+   void netcode_frag_rx_del (netcode_frag_rx_t *rx);
+
+   // Processes one datagram received from 'from' (for example with
+   // netcode_udp_wait_addr()). Fragments from different senders are
+   // kept apart. Timed-out messages are discarded first.
+   //
+   // RETURNS: true when the datagram completes a message, which is
+   // stored in '*msg' (to be freed by the caller with
+   // netcode_util_free()) and its length in '*msglen'. Otherwise false,
+   // and '*msg' is NULL.
+   bool netcode_frag_rx_input (netcode_frag_rx_t *rx, const netcode_addr_t *from,
+                               const void *dgram, size_t len,
+                               uint8_t **msg, size_t *msglen);
+
+   // Discards the incomplete messages that have timed out. Call this
+   // when no datagrams are arriving, to release their memory.
+   //
+   // RETURNS: the number of messages discarded.
+   size_t netcode_frag_rx_expire (netcode_frag_rx_t *rx);
+
+   void netcode_frag_rx_stats (const netcode_frag_rx_t *rx,
+                               netcode_frag_rx_stats_t *dst);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
@@ -0,0 +1,383 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "netcode_util.h"
+#include "netcode_if.h"
+#include "netcode_udp.h"
+#include "netcode_frag.h"
+
+#define TEST_MTU        (1400)
+#define SMALL_MTU       (576)
+#define MAX_DGRAMS      (32)
+
+static int rxfd = -1, txfd = -1;
+static netcode_addr_t dest;
+
+static void fill (uint8_t *dst, size_t len, uint32_t seed)
+{
+   for (size_t i=0; i<len; i++) {
+      dst[i] = (uint8_t)(i * 7 + seed);
+   }
+}
+
+static bool check (const uint8_t *msg, size_t len, size_t expected_len, uint32_t seed)
+{
+   if (len != expected_len) {
+      NETCODE_UTIL_LOG ("Expected %zu bytes, got %zu\n", expected_len, len);
+      return false;
+   }
+   for (size_t i=0; i<len; i++) {
+      if (msg[i] != (uint8_t)(i * 7 + seed)) {
+         NETCODE_UTIL_LOG ("Byte %zu of %zu is wrong\n", i, len);
+         return false;
+      }
+   }
+   return true;
+}
+
+/* Sends a message and collects its datagrams from the receiving socket
+ * without reassembling them, so that they can be fed to a receiver in
+ * any order.
+ */
+struct capture_t {
+   size_t      n;
+   uint8_t    *dgram[MAX_DGRAMS];
+   size_t      len[MAX_DGRAMS];
+};
+
+static void capture_clear (struct capture_t *c)
+{
+   for (size_t i=0; i<c->n; i++) {
+      free (c->dgram[i]);
+   }
+   memset (c, 0, sizeof *c);
+}
+
+static bool capture (netcode_frag_tx_t *tx, size_t len, uint32_t seed,
+                     struct capture_t *dst)
+{
+   static uint8_t msg[MAX_DGRAMS * TEST_MTU];
+   netcode_addr_t from;
+   uint8_t *buf = NULL;
+   size_t buflen = 0;
+
+   memset (dst, 0, sizeof *dst);
+   fill (msg, len, seed);
+   if (!(netcode_frag_tx_send (tx, msg, len))) {
+      NETCODE_UTIL_LOG ("Failed to send %zu bytes\n", len);
+      return false;
+   }
+
+   while (netcode_udp_wait_addr (rxfd, &from, &buf, &buflen, 0) != (size_t)-1 &&
+          netcode_addr_family (&from) != AF_UNSPEC) {
+      if (dst->n == MAX_DGRAMS) {
+         free (buf);
+         NETCODE_UTIL_LOG ("Too many datagrams\n");
+         return false;
+      }
+      dst->dgram[dst->n] = buf;
+      dst->len[dst->n] = buflen;
+      dst->n++;
+      buf = NULL;
+   }
+   return true;
+}
+
+// Feeds datagram 'i' of 'c'; returns true if it completed a message,
+// which must then be the expected one.
+static bool feed (netcode_frag_rx_t *rx, const struct capture_t *c, size_t i,
+                  size_t expected_len, uint32_t seed, bool *ok)
+{
+   uint8_t *msg = NULL;
+   size_t msglen = 0;
+
+   bool done = netcode_frag_rx_input (rx, &dest, c->dgram[i], c->len[i], &msg, &msglen);
+   if (done && !(check (msg, msglen, expected_len, seed)))
+      *ok = false;
+   netcode_util_free (msg);
+   return done;
+}
+
+static bool mtu_test (void)
+{
+   netcode_if_t **list = netcode_if_list_new ();
+   bool ret = false;
+
+   for (size_t i=0; list && list[i]; i++) {
+      uint64_t flags = 0;
+      char *name = NULL;
+      if (!(netcode_if_extract (list[i], &flags, &name, NULL, NULL, NULL, NULL)))
+         continue;
+
+      uint32_t mtu = netcode_if_mtu (list[i]);
+      printf ("FRAG: interface %s has MTU %" PRIu32 "\n", name, mtu);
+      if ((flags & NETCODE_IFF_LOOPBACK) && !mtu) {
+         NETCODE_UTIL_LOG ("No MTU for the loopback interface %s\n", name);
+         free (name);
+         goto errorexit;
+      }
+      free (name);
+   }
+
+   size_t path_mtu = netcode_udp_path_mtu (txfd, &dest);
+   printf ("FRAG: path MTU to 127.0.0.1 is %zu\n", path_mtu);
+   if (!path_mtu) {
+      NETCODE_UTIL_LOG ("No path MTU for the loopback address\n");
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_if_list_del (list);
+   return ret;
+}
+
+/* Sends messages either side of the fragment boundaries over loopback
+ * and reassembles them in the order they arrive.
+ */
+static bool udp_test (void)
+{
+   static const size_t lengths[] = { 0, 1, 1359, 1360, 1361, 2720, 20000 };
+   static uint8_t msg[50000];
+   bool ret = false;
+   netcode_frag_tx_t *tx = NULL, *auto_tx = NULL;
+   netcode_frag_rx_t *rx = NULL;
+
+   if (!(tx = netcode_frag_tx_new (txfd, &dest, TEST_MTU)) ||
+       !(auto_tx = netcode_frag_tx_new (txfd, &dest, 0)) ||
+       !(rx = netcode_frag_rx_new (1024 * 1024, 1000))) {
+      NETCODE_UTIL_LOG ("Failed to set up fragmentation over UDP\n");
+      goto errorexit;
+   }
+
+   printf ("FRAG: discovered MTU of %zu\n", netcode_frag_tx_mtu (auto_tx));
+   if (netcode_frag_tx_mtu (tx) != TEST_MTU ||
+       netcode_frag_tx_mtu (auto_tx) <= TEST_MTU) {
+      NETCODE_UTIL_LOG ("Unexpected MTU\n");
+      goto errorexit;
+   }
+
+   for (size_t i=0; i<sizeof lengths / sizeof lengths[0] + 1; i++) {
+      bool last = i == sizeof lengths / sizeof lengths[0];
+      netcode_frag_tx_t *sender = last ? auto_tx : tx;
+      size_t len = last ? sizeof msg : lengths[i];
+      size_t ndgrams = 0, ncompleted = 0;
+      netcode_addr_t from;
+      uint8_t *buf = NULL;
+      size_t buflen = 0;
+
+      fill (msg, len, (uint32_t)i);
+      if (!(netcode_frag_tx_send (sender, msg, len))) {
+         NETCODE_UTIL_LOG ("Failed to send %zu bytes\n", len);
+         goto errorexit;
+      }
+
+      while (netcode_udp_wait_addr (rxfd, &from, &buf, &buflen, 0) != (size_t)-1 &&
+             netcode_addr_family (&from) != AF_UNSPEC) {
+         uint8_t *out = NULL;
+         size_t outlen = 0;
+         ndgrams++;
+         if (buflen + 28 > netcode_frag_tx_mtu (sender)) {
+            NETCODE_UTIL_LOG ("Datagram of %zu bytes exceeds the MTU\n", buflen);
+            free (buf);
+            goto errorexit;
+         }
+         if (netcode_frag_rx_input (rx, &from, buf, buflen, &out, &outlen)) {
+            ncompleted++;
+            if (!(check (out, outlen, len, (uint32_t)i))) {
+               netcode_util_free (out);
+               free (buf);
+               goto errorexit;
+            }
+         }
+         netcode_util_free (out);
+         free (buf);
+         buf = NULL;
+      }
+
+      printf ("FRAG: %zu bytes sent in %zu datagrams\n", len, ndgrams);
+      if (ncompleted != 1) {
+         NETCODE_UTIL_LOG ("Message of %zu bytes was not reassembled\n", len);
+         goto errorexit;
+      }
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_frag_tx_del (tx);
+   netcode_frag_tx_del (auto_tx);
+   netcode_frag_rx_del (rx);
+   return ret;
+}
+
+/* Feeds captured fragments to receivers out of order, with duplicates,
+ * with one missing until the timeout, and with too little memory for
+ * all of the incomplete messages.
+ */
+static bool reassembly_test (void)
+{
+   bool ret = false, ok = true;
+   netcode_frag_tx_t *tx = NULL;
+   netcode_frag_rx_t *rx = NULL;
+   struct capture_t c[3];
+   netcode_frag_rx_stats_t stats;
+   size_t len = 5000;
+
+   memset (c, 0, sizeof c);
+
+   if (!(tx = netcode_frag_tx_new (txfd, &dest, SMALL_MTU)) ||
+       !(rx = netcode_frag_rx_new (1024 * 1024, 50))) {
+      NETCODE_UTIL_LOG ("Failed to set up fragmentation\n");
+      goto errorexit;
+   }
+
+   // Reversed, with every fragment but the last delivered twice. (A
+   // duplicate of the last would start the message again.)
+   if (!(capture (tx, len, 1, &c[0])) || c[0].n < 3) {
+      NETCODE_UTIL_LOG ("Failed to capture fragments\n");
+      goto errorexit;
+   }
+   for (size_t i=c[0].n; i-- > 0;) {
+      bool done = feed (rx, &c[0], i, len, 1, &ok);
+      if (done != (i == 0) || (i && feed (rx, &c[0], i, len, 1, &ok)) || !ok) {
+         NETCODE_UTIL_LOG ("Reversed fragment %zu mishandled\n", i);
+         goto errorexit;
+      }
+   }
+   netcode_frag_rx_stats (rx, &stats);
+   if (stats.completed != 1 || stats.rejected != c[0].n - 1 || stats.pending) {
+      NETCODE_UTIL_LOG ("Unexpected statistics after reordering\n");
+      goto errorexit;
+   }
+
+   // One fragment held back past the timeout.
+   if (!(capture (tx, len, 2, &c[1]))) {
+      goto errorexit;
+   }
+   for (size_t i=1; i<c[1].n; i++) {
+      feed (rx, &c[1], i, len, 2, &ok);
+   }
+   netcode_util_sleep_ns (100 * 1000000);
+   if (netcode_frag_rx_expire (rx) != 1) {
+      NETCODE_UTIL_LOG ("Incomplete message did not time out\n");
+      goto errorexit;
+   }
+   if (feed (rx, &c[1], 0, len, 2, &ok)) {
+      NETCODE_UTIL_LOG ("Timed-out message was completed\n");
+      goto errorexit;
+   }
+   netcode_frag_rx_stats (rx, &stats);
+   if (stats.timed_out != 1 || stats.pending != 1) {
+      NETCODE_UTIL_LOG ("Unexpected statistics after timeout\n");
+      goto errorexit;
+   }
+   netcode_frag_rx_del (rx);
+   capture_clear (&c[0]);
+   capture_clear (&c[1]);
+
+   // Room for two incomplete messages: starting a third evicts the
+   // oldest.
+   if (!(rx = netcode_frag_rx_new (3 * len, 1000))) {
+      goto errorexit;
+   }
+   for (uint32_t m=0; m<3; m++) {
+      if (!(capture (tx, len, 10 + m, &c[m]))) {
+         goto errorexit;
+      }
+      for (size_t i=1; i<c[m].n; i++) {
+         feed (rx, &c[m], i, len, 10 + m, &ok);
+      }
+   }
+   netcode_frag_rx_stats (rx, &stats);
+   printf ("FRAG: %zu incomplete messages in %zu bytes, %" PRIu64 " evicted\n",
+           stats.pending, stats.pending_bytes, stats.evicted);
+   if (stats.evicted != 1 || stats.pending != 2 || stats.pending_bytes > 3 * len) {
+      NETCODE_UTIL_LOG ("Unexpected statistics after eviction\n");
+      goto errorexit;
+   }
+   if (!(feed (rx, &c[2], 0, len, 12, &ok)) || !ok ||
+       !(feed (rx, &c[1], 0, len, 11, &ok)) || !ok ||
+       feed (rx, &c[0], 0, len, 10, &ok)) {
+      NETCODE_UTIL_LOG ("Wrong messages survived eviction\n");
+      goto errorexit;
+   }
+   netcode_frag_rx_del (rx);
+
+   // A message that can never fit is refused outright.
+   if (!(rx = netcode_frag_rx_new (len / 2, 1000))) {
+      goto errorexit;
+   }
+   feed (rx, &c[0], 1, len, 10, &ok);
+   netcode_frag_rx_stats (rx, &stats);
+   if (stats.rejected != 1 || stats.pending) {
+      NETCODE_UTIL_LOG ("Oversized message was accepted\n");
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   for (size_t m=0; m<3; m++) {
+      capture_clear (&c[m]);
+   }
+   netcode_frag_tx_del (tx);
+   netcode_frag_rx_del (rx);
+   return ret;
+}
+
+static int frag_test (void)
+{
+   int ret = EXIT_FAILURE;
+
+   netcode_addr_parse (&dest, "127.0.0.1");
+   netcode_addr_set_port (&dest, NETCODE_TEST_FRAG_PORT);
+
+   if ((rxfd = netcode_udp_socket (NETCODE_TEST_FRAG_PORT, NULL)) < 0 ||
+       (txfd = netcode_udp_socket (0, NULL)) < 0) {
+      NETCODE_UTIL_LOG ("Failed to create sockets\n");
+      goto errorexit;
+   }
+
+   if (!(mtu_test ()) || !(udp_test ()) || !(reassembly_test ()))
+      goto errorexit;
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   if (rxfd >= 0)
+      netcode_util_close (rxfd);
+   if (txfd >= 0)
+      netcode_util_close (txfd);
+   return ret;
+}
+
+int main (void)
+{
+   int ret = EXIT_FAILURE;
+
+   if (!(netcode_util_init ())) {
+      NETCODE_UTIL_LOG ("Failed to initialise netcode\n");
+      goto errorexit;
+   }
+
+   if ((ret = frag_test ())!=EXIT_SUCCESS) {
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      printf ("+++ +++ frag: Test FAILED +++ +++\n");
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      goto errorexit;
+   }
+
+   printf ("*********************************\n");
+   printf ("*** *** frag: Test passed *** ***\n");
+   printf ("*********************************\n");
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   return ret;
+}
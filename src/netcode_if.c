@@ -5,76 +5,164 @@
 #include <inttypes.h>
 
 #include "netcode_util.h"
+#include "netcode_log.h"
 #include "netcode_if.h"
 
+#ifdef PLATFORM_Windows
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+
+#ifdef PLATFORM_POSIX
+#include <netinet/in.h>
+#endif
+
 /* ***************************************************************** */
 static char *lstrdup (const char *src)
 {
    if (!src)
       return NULL;
 
-   char *ret = malloc (strlen (src) + 1);
+   char *ret = netcode_util_malloc (strlen (src) + 1);
    if (ret)
       strcpy (ret, src);
    return ret;
 }
 
 /* ***************************************************************** */
+/* A list is built in a single allocation (an arena): the NULL-terminated
+ * array of entry pointers, then the entries, then the names that they
+ * point to. Addresses are kept in binary form and only formatted by
+ * netcode_if_extract().
+ */
+#define IF_HWADDRLEN       (32)
+
+struct if_sa_t {
+   union {
+      struct sockaddr   sa;
+      uint64_t          align;
+      uint8_t           raw[32];    // Large enough for a sockaddr_in6
+   } u;
+   uint32_t             len;        // Zero when absent
+};
+
 struct netcode_if_t {
-   uint64_t   if_flags;
-   char      *if_name;
-   char      *if_addr;
-   char      *if_netmask;
-   char      *if_broadcast;
-   char      *if_p2paddr;
+   uint64_t          if_flags;
+   const char       *if_name;
+   uint32_t          if_index;
+   uint32_t          if_mtu;
+   uint8_t           prefixlen;
+   uint8_t           hwlen;
+   uint8_t           hwaddr[IF_HWADDRLEN];
+   struct if_sa_t    addr;
+   struct if_sa_t    netmask;
+   struct if_sa_t    broadcast;
+   struct if_sa_t    p2paddr;
 };
 
-static void netcode_if_del (netcode_if_t *iface)
+static netcode_if_t **if_arena_new (size_t nentries, size_t namebytes,
+                                    netcode_if_t **entries, char **names)
 {
-   if (!iface)
+   size_t ptrbytes = ((nentries + 1) * sizeof (netcode_if_t *) + 15) & ~(size_t)15;
+   uint8_t *arena = netcode_util_calloc (1, ptrbytes + nentries * sizeof **entries + namebytes);
+
+   if (!arena) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating list of %zu interfaces\n", nentries);
+      return NULL;
+   }
+
+   *entries = (netcode_if_t *)&arena[ptrbytes];
+   *names = (char *)&(*entries)[nentries];
+   return (netcode_if_t **)arena;
+}
+
+// Copies 'name' into the arena's names and advances '*names' past it.
+static const char *if_arena_name (char **names, const char *name)
+{
+   char *ret = *names;
+   size_t len = strlen (name) + 1;
+
+   memcpy (ret, name, len);
+   *names += len;
+   return ret;
+}
+
+static void if_set_sa (struct if_sa_t *dst, const struct sockaddr *sa, size_t salen)
+{
+   memset (dst, 0, sizeof *dst);
+   if (!sa)
       return;
 
-   free (iface->if_name);
-   free (iface->if_addr);
-   free (iface->if_netmask);
-   free (iface->if_broadcast);
-   free (iface->if_p2paddr);
+   if (salen > sizeof dst->u.raw)
+      salen = sizeof dst->u.raw;
+   memcpy (dst->u.raw, sa, salen);
+   dst->len = (uint32_t)salen;
+}
 
-   free (iface);
+static const struct sockaddr *if_get_sa (const struct if_sa_t *src, size_t *salen)
+{
+   if (salen)
+      *salen = src->len;
+   return src->len ? &src->u.sa : NULL;
 }
 
-static netcode_if_t *netcode_if_new (uint64_t if_flags,
-                                     const char *if_name,
-                                     const char *if_addr,
-                                     const char *if_netmask,
-                                     const char *if_broadcast,
-                                     const char *if_p2paddr)
+static void if_set_netmask (struct if_sa_t *dst, int family, uint8_t prefixlen)
 {
-   netcode_if_t *ret = calloc (1, sizeof *ret);
-   if (!ret)
-      return NULL;
+   struct sockaddr_in sin;
+   struct sockaddr_in6 sin6;
+   uint8_t mask[16];
+   size_t nbits = family == AF_INET ? 32 : 128;
+
+   memset (mask, 0, sizeof mask);
+   for (size_t i=0; i<prefixlen && i<nbits; i++) {
+      mask[i / 8] |= (uint8_t)(0x80 >> (i % 8));
+   }
+
+   if (family == AF_INET) {
+      memset (&sin, 0, sizeof sin);
+      sin.sin_family = AF_INET;
+      memcpy (&sin.sin_addr, mask, 4);
+      if_set_sa (dst, (struct sockaddr *)&sin, sizeof sin);
+   } else if (family == AF_INET6) {
+      memset (&sin6, 0, sizeof sin6);
+      sin6.sin6_family = AF_INET6;
+      memcpy (&sin6.sin6_addr, mask, 16);
+      if_set_sa (dst, (struct sockaddr *)&sin6, sizeof sin6);
+   } else {
+      if_set_sa (dst, NULL, 0);
+   }
+}
 
-   ret->if_flags     = if_flags;
-   ret->if_name      = lstrdup (if_name);
-   ret->if_addr      = lstrdup (if_addr);
-   ret->if_netmask   = lstrdup (if_netmask);
-   ret->if_broadcast = lstrdup (if_broadcast);
-   ret->if_p2paddr   = lstrdup (if_p2paddr);
+static uint8_t if_prefixlen (const struct sockaddr *netmask)
+{
+   const uint8_t *bytes = NULL;
+   size_t n = 0;
+   uint8_t ret = 0;
 
-   if (!ret->if_name      ||
-       !ret->if_addr      ||
-       !ret->if_netmask   ||
-       !ret->if_broadcast ||
-       !ret->if_p2paddr) {
+   if (netmask && netmask->sa_family == AF_INET) {
+      bytes = (const uint8_t *)&((const struct sockaddr_in *)netmask)->sin_addr;
+      n = 4;
+   }
+   if (netmask && netmask->sa_family == AF_INET6) {
+      bytes = (const uint8_t *)&((const struct sockaddr_in6 *)netmask)->sin6_addr;
+      n = 16;
+   }
 
-      netcode_if_del (ret);
-      ret = NULL;
+   for (size_t i=0; i<n; i++) {
+      uint8_t b = bytes[i];
+      while (b & 0x80) {
+         ret++;
+         b = (uint8_t)(b << 1);
+      }
+      if (bytes[i] != 0xff)
+         break;
    }
    return ret;
 }
 /* ***************************************************************** */
 
 
+
 /* ***************************************************************** */
 /* ***************************************************************** */
 #if defined (OSTYPE_Darwin)
@@ -188,63 +276,17 @@ typedef struct _IP_ADAPTER_UNICAST_ADDRESS_LH {
 
 #endif
 
-static char *nmprefix_to_string (ULONG prefix, USHORT addr_family)
-{
-   struct sockaddr *sa = NULL;
-
-   struct sockaddr_in sa4;
-   struct sockaddr_in6 sa6;
-
-   // Warning, this won't work on Windows/ARM
-   if (addr_family == AF_INET) {
-      uint32_t nm4 = 0;
-      for (size_t i=0; i<prefix; i++) {
-         nm4 |= (1 << i);
-      }
-
-      memset (&sa4, 0, sizeof sa4);
-      sa = (struct sockaddr *)&sa4;
-      sa4.sin_family = AF_INET;
-      memcpy (&sa4.sin_addr, &nm4, sizeof sa4.sin_addr);
-   }
-
-   // Warning, this won't work on Windows/ARM
-   if (addr_family == AF_INET6) {
-      uint8_t nm6[16];
-      memset (nm6, 0, sizeof nm6);
-      for (size_t i=0; i<prefix; i++) {
-         size_t bytenum = i / 8;
-         size_t bitnum = i % 8;
-         nm6[bytenum] |= (1 << bitnum);
-      }
-
-      memset (&sa6, 0, sizeof sa6);
-      sa = (struct sockaddr *)&sa6;
-      sa6.sin6_family = AF_INET6;
-      memcpy (&sa6.sin6_addr, &nm6, sizeof sa6.sin6_addr);
-   }
-
-   if (!sa) {
-      return lstrdup ("Unknown Address Family");
-   }
-
-   return netcode_util_sockaddr_to_str (sa);
-}
-
 netcode_if_t **netcode_if_list_new (void)
 {
    bool error = true;
-   netcode_if_t **ret = NULL;
-   size_t nitems = 0;
-   uint64_t if_flags = 0;
-   char *if_name = NULL,
-        *if_addr = NULL,
-        *if_netmask = NULL,
-        *if_broadcast = NULL,
-        *if_p2paddr = NULL;
+   netcode_if_t **ret = NULL,
+                 *entries = NULL;
+   char *names = NULL;
+   size_t nitems = 0,
+          namebytes = 0;
 
    ULONG outbuflen = 15 * 1024;
-   PIP_ADAPTER_ADDRESSES addresses = malloc (outbuflen),
+   PIP_ADAPTER_ADDRESSES addresses = netcode_util_malloc (outbuflen),
                          tmp = NULL;
 
    size_t attempts = 0;
@@ -255,26 +297,29 @@ netcode_if_t **netcode_if_list_new (void)
                                       addresses,
                                       &outbuflen)) == ERROR_BUFFER_OVERFLOW) {
       if (attempts++ > 5) {
-         NETCODE_UTIL_LOG ("Failed after five attempts to allocate memory [%lu]\n", outbuflen);
+         NETCODE_LOG (NETCODE_LOG_ERROR, "Failed after five attempts to allocate memory [%lu]\n", outbuflen);
          break;
       }
       outbuflen *= 2;
-      PIP_ADAPTER_ADDRESSES tmp = realloc (addresses, outbuflen);
+      PIP_ADAPTER_ADDRESSES tmp = netcode_util_realloc (addresses, outbuflen);
       if (!tmp) {
-         NETCODE_UTIL_LOG ("Out of memory realloc (%lu)\n", outbuflen);
+         NETCODE_LOG (NETCODE_LOG_ERROR, "Out of memory realloc (%lu)\n", outbuflen);
          break;
       }
       addresses = tmp;
    }
 
    if (rc != NO_ERROR)  {
-      NETCODE_UTIL_LOG ("Failed rc = [%lu]\n", rc);
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Failed rc = [%lu]\n", rc);
       goto errorexit;
    }
 
+   // All the addresses of an adapter share one copy of its name.
    tmp = addresses;
    while (tmp) {
       PIP_ADAPTER_UNICAST_ADDRESS ip = tmp->FirstUnicastAddress;
+      size_t namelen = wcstombs (NULL, tmp->FriendlyName, 0);
+      namebytes += (namelen == (size_t)-1 ? 0 : namelen) + 1;
       while (ip) {
          nitems++;
          ip = ip->Next;
@@ -282,8 +327,7 @@ netcode_if_t **netcode_if_list_new (void)
       tmp = tmp->Next;
    }
 
-   if (!(ret = calloc (nitems + 1, sizeof *ret))) {
-      NETCODE_UTIL_LOG ("Out of memory\n");
+   if (!(ret = if_arena_new (nitems, namebytes, &entries, &names))) {
       goto errorexit;
    }
 
@@ -292,36 +336,35 @@ netcode_if_t **netcode_if_list_new (void)
    while (tmp) {
 
       PIP_ADAPTER_UNICAST_ADDRESS ip = tmp->FirstUnicastAddress;
+      const char *if_name = names;
+      size_t namelen = wcstombs (NULL, tmp->FriendlyName, 0);
+
+      if (namelen == (size_t)-1) {
+         names[0] = 0;
+         namelen = 0;
+      } else {
+         wcstombs (names, tmp->FriendlyName, namelen + 1);
+      }
+      names += namelen + 1;
 
       while (ip) {
 
+         netcode_if_t *e = &entries[idx];
          USHORT af = ip->Address.lpSockaddr->sa_family;
 
-         size_t dstlen = (wcslen (tmp->FriendlyName) * 6) + 1;
-         char *dst = malloc (dstlen);
-         if (!dst) {
-            // TODO: Handle error
-            goto errorexit;
-         }
-         wcstombs (dst, tmp->FriendlyName, dstlen);
-
-         if_flags = 0;
-         if_name = lstrdup (dst); free (dst); dst = NULL;
-         if_addr = netcode_util_sockaddr_to_str (ip->Address.lpSockaddr);
-         if_netmask = nmprefix_to_string (ip->OnLinkPrefixLength, af);
-         if_broadcast = "";
-         if_p2paddr = "";
-
-         ret[idx] = netcode_if_new (if_flags, if_name,
-                                              if_addr,
-                                              if_netmask,
-                                              if_broadcast,
-                                              if_p2paddr);
-         if (!(ret[idx])) {
-            NETCODE_UTIL_LOG ("OOM creating interface object\n");
-            goto errorexit;
-         }
-         idx++;
+         e->if_flags = 0;
+         e->if_name = if_name;
+         e->if_index = af == AF_INET6 ? tmp->Ipv6IfIndex : tmp->IfIndex;
+         e->if_mtu = tmp->Mtu;
+         e->hwlen = (uint8_t)(tmp->PhysicalAddressLength > IF_HWADDRLEN
+                              ? IF_HWADDRLEN : tmp->PhysicalAddressLength);
+         memcpy (e->hwaddr, tmp->PhysicalAddress, e->hwlen);
+
+         e->prefixlen = ip->OnLinkPrefixLength;
+         if_set_sa (&e->addr, ip->Address.lpSockaddr, ip->Address.iSockaddrLength);
+         if_set_netmask (&e->netmask, af, e->prefixlen);
+
+         ret[idx++] = e;
          ip = ip->Next;
       }
       tmp = tmp->Next;
@@ -331,7 +374,7 @@ netcode_if_t **netcode_if_list_new (void)
 
 errorexit:
 
-   free (addresses);
+   netcode_util_free (addresses);
    if (error) {
      netcode_if_list_del (ret);
      ret = NULL;
@@ -342,15 +385,23 @@ errorexit:
 
 #endif
 
+
 /* ***************************************************************** */
 /* ***************************************************************** */
 #ifdef PLATFORM_POSIX
 
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
 #include <net/if.h>
 #include <sys/ioctl.h>
 #include <linux/netdevice.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <netinet/in.h>
 #include <ifaddrs.h>
+#include <limits.h>
+#include <poll.h>
 
 static uint64_t if_reflag (uint64_t flags)
 {
@@ -381,94 +432,118 @@ static uint64_t if_reflag (uint64_t flags)
    return ret;
 }
 
-netcode_if_t **netcode_if_list_new (void)
+static size_t if_salen (const struct sockaddr *sa)
 {
-   bool error = true;
+   if (!sa)
+      return 0;
+
+   switch (sa->sa_family) {
+      case AF_INET:     return sizeof (struct sockaddr_in);
+      case AF_INET6:    return sizeof (struct sockaddr_in6);
+      case AF_PACKET:   return sizeof (struct sockaddr_ll);
+      default:          return sizeof (struct sockaddr);
+   }
+}
+
+static uint32_t if_query_mtu (int *fd, const char *if_name)
+{
+   struct ifreq ifr;
+
+   if (*fd < 0 && (*fd = socket (AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to create a socket for the MTU query\n");
+      return 0;
+   }
+
+   memset (&ifr, 0, sizeof ifr);
+   strncpy (ifr.ifr_name, if_name, sizeof ifr.ifr_name - 1);
+   if (ioctl (*fd, SIOCGIFMTU, &ifr) == 0 && ifr.ifr_mtu > 0)
+      return (uint32_t)ifr.ifr_mtu;
+   return 0;
+}
+
+// getifaddrs() lists the links (AF_PACKET) before their addresses, so
+// the link details for an address are found among the earlier entries.
+static const netcode_if_t *if_find_link (const netcode_if_t *entries, size_t n,
+                                         const char *if_name)
+{
+   for (size_t i=0; i<n; i++) {
+      if (entries[i].addr.len && entries[i].addr.u.sa.sa_family == AF_PACKET &&
+          strcmp (entries[i].if_name, if_name) == 0)
+         return &entries[i];
+   }
+   return NULL;
+}
 
-   netcode_if_t **ret = NULL;
+netcode_if_t **netcode_if_list_new (void)
+{
+   netcode_if_t **ret = NULL,
+                 *entries = NULL;
    struct ifaddrs *if_head = NULL,
                   *if_tmp = NULL;
-   size_t nelems = 0;
-
-   char *laddr       = NULL,
-        *lnetmask    = NULL,
-        *lbroadcast  = NULL,
-        *lp2p        = NULL;
+   size_t nelems = 0,
+          namebytes = 0;
+   char *names = NULL;
+   int fd = -1;
 
    if ((getifaddrs (&if_head))!=0) {
-      // TODO: We need to record the error here.
-      goto errorexit;
+      NETCODE_LOG (NETCODE_LOG_ERROR, "getifaddrs() failure: %i\n", errno);
+      return NULL;
    }
 
-   for (if_tmp = if_head; if_tmp != NULL; if_tmp = if_tmp->ifa_next)
+   for (if_tmp = if_head; if_tmp != NULL; if_tmp = if_tmp->ifa_next) {
       nelems++;
+      namebytes += strlen (if_tmp->ifa_name) + 1;
+   }
 
-   if (!(ret = calloc (nelems + 1, sizeof *ret))) {
-      // TODO: Record the error here
+   if (!(ret = if_arena_new (nelems, namebytes, &entries, &names)))
       goto errorexit;
-   }
 
    size_t idx = 0;
    for (if_tmp = if_head; if_tmp != NULL; if_tmp = if_tmp->ifa_next) {
 
-      free (laddr);        laddr       = NULL;
-      free (lnetmask);     lnetmask    = NULL;
-      free (lbroadcast);   lbroadcast  = NULL;
-      free (lp2p);         lp2p        = NULL;
-
-      uint64_t lflags = if_reflag (if_tmp->ifa_flags);
-      const char *lname = if_tmp->ifa_name;
+      netcode_if_t *e = &entries[idx];
+      const struct sockaddr *sa = if_tmp->ifa_addr;
+      const netcode_if_t *link = NULL;
 
-      laddr    = netcode_util_sockaddr_to_str (if_tmp->ifa_addr);
-      lnetmask = netcode_util_sockaddr_to_str (if_tmp->ifa_netmask);
+      e->if_flags = if_reflag (if_tmp->ifa_flags);
+      e->if_name = if_arena_name (&names, if_tmp->ifa_name);
+      e->prefixlen = if_prefixlen (if_tmp->ifa_netmask);
 
+      if_set_sa (&e->addr, sa, if_salen (sa));
+      if_set_sa (&e->netmask, if_tmp->ifa_netmask, if_salen (if_tmp->ifa_netmask));
       if (if_tmp->ifa_flags & IFF_BROADCAST) {
-         lbroadcast = netcode_util_sockaddr_to_str (if_tmp->ifa_ifu.ifu_broadaddr);
-      } else {
-         lbroadcast = lstrdup ("");
+         if_set_sa (&e->broadcast, if_tmp->ifa_ifu.ifu_broadaddr,
+                    if_salen (if_tmp->ifa_ifu.ifu_broadaddr));
       }
-
       if (if_tmp->ifa_flags & IFF_POINTOPOINT) {
-         lp2p = netcode_util_sockaddr_to_str (if_tmp->ifa_ifu.ifu_dstaddr);
-      } else {
-         lp2p = lstrdup ("");
+         if_set_sa (&e->p2paddr, if_tmp->ifa_ifu.ifu_dstaddr,
+                    if_salen (if_tmp->ifa_ifu.ifu_dstaddr));
       }
 
-      if (!laddr || !lnetmask ||! lbroadcast || !lp2p) {
-         // TODO: Record error here
-         goto errorexit;
+      if (sa && sa->sa_family == AF_PACKET) {
+         const struct sockaddr_ll *sll = (const struct sockaddr_ll *)sa;
+         e->if_index = (uint32_t)sll->sll_ifindex;
+         e->hwlen = sll->sll_halen > IF_HWADDRLEN ? IF_HWADDRLEN : sll->sll_halen;
+         memcpy (e->hwaddr, sll->sll_addr, e->hwlen);
+         e->if_mtu = if_query_mtu (&fd, e->if_name);
+      } else if ((link = if_find_link (entries, idx, e->if_name))) {
+         e->if_index = link->if_index;
+         e->if_mtu = link->if_mtu;
+         e->hwlen = link->hwlen;
+         memcpy (e->hwaddr, link->hwaddr, link->hwlen);
+      } else {
+         e->if_index = (uint32_t)if_nametoindex (e->if_name);
+         e->if_mtu = if_query_mtu (&fd, e->if_name);
       }
 
-#if 0
-      ifr->if_flags = if_tmp->ifa_flags;
-      ifr->if_name      = lstrdup (if_name);
-      ifr->if_addr      = lstrdup (if_addr);
-      ifr->if_netmask   = lstrdup (if_netmask);
-      ifr->if_broadcast = lstrdup (if_broadcast);
-      ifr->if_p2paddr   = lstrdup (if_p2paddr);
-#endif
-
-      if (!(ret[idx++] = netcode_if_new (lflags, lname, laddr, lnetmask, lbroadcast, lp2p))) {
-         // TODO: Record the error here
-         goto errorexit;
-      }
+      ret[idx++] = e;
    }
 
-   error = false;
-
 errorexit:
    if (if_head)
       freeifaddrs (if_head);
-
-   free (laddr);
-   free (lnetmask);
-   free (lbroadcast);
-   free (lp2p);
-
-   if (error) {
-      netcode_if_list_del (ret);
-      ret = NULL;
-   }
+   if (fd >= 0)
+      close (fd);
 
    return ret;
 }
@@ -477,12 +552,62 @@ errorexit:
 
 
 
+const char *netcode_if_name_view (const netcode_if_t *iface)
+{
+   return iface ? iface->if_name : NULL;
+}
+
+uint64_t netcode_if_flags (const netcode_if_t *iface)
+{
+   return iface ? iface->if_flags : 0;
+}
+
+uint32_t netcode_if_index (const netcode_if_t *iface)
+{
+   return iface ? iface->if_index : 0;
+}
+
+uint32_t netcode_if_mtu (const netcode_if_t *iface)
+{
+   return iface ? iface->if_mtu : 0;
+}
+
+uint8_t netcode_if_prefixlen (const netcode_if_t *iface)
+{
+   return iface ? iface->prefixlen : 0;
+}
+
+const uint8_t *netcode_if_hwaddr (const netcode_if_t *iface, size_t *len)
+{
+   if (len)
+      *len = iface ? iface->hwlen : 0;
+   return iface && iface->hwlen ? iface->hwaddr : NULL;
+}
+
+const struct sockaddr *netcode_if_addr_sa (const netcode_if_t *iface, size_t *salen)
+{
+   return iface ? if_get_sa (&iface->addr, salen) : NULL;
+}
+
+const struct sockaddr *netcode_if_netmask_sa (const netcode_if_t *iface, size_t *salen)
+{
+   return iface ? if_get_sa (&iface->netmask, salen) : NULL;
+}
+
+const struct sockaddr *netcode_if_broadcast_sa (const netcode_if_t *iface, size_t *salen)
+{
+   return iface ? if_get_sa (&iface->broadcast, salen) : NULL;
+}
+
+const struct sockaddr *netcode_if_p2paddr_sa (const netcode_if_t *iface, size_t *salen)
+{
+   return iface ? if_get_sa (&iface->p2paddr, salen) : NULL;
+}
+
 void netcode_if_list_del (netcode_if_t **list)
 {
-   for (size_t i=0; list && list[i]; i++) {
-      netcode_if_del (list[i]);
-   }
-   free (list);
+   // The entries and their names live in the same allocation.
+   netcode_util_free (list);
 }
 
 bool netcode_if_extract (const netcode_if_t *iface,
@@ -501,26 +626,934 @@ bool netcode_if_extract (const netcode_if_t *iface,
    if (dst_if_flags)
       *dst_if_flags = iface->if_flags;
 
-#define CONDITIONAL_STRCPY(dst,src)      do {\
+   if (dst_if_name) {
+      if (((*dst_if_name) = lstrdup (iface->if_name))==NULL) {
+         NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to copy [%s]\n", iface->if_name);
+         goto errorexit;
+      }
+   }
+
+#define CONDITIONAL_FORMAT(dst,src)      do {\
    if (dst) {\
-      if (((*dst) = lstrdup (src))==NULL) {\
-         NETCODE_UTIL_LOG ("Failed to copy [%s]\n", src);\
+      (*dst) = (src)->len ? netcode_util_sockaddr_to_str (&(src)->u.sa) : lstrdup ("");\
+      if ((*dst)==NULL) {\
+         NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to format address of [%s]\n", iface->if_name);\
          goto errorexit;\
       }\
    }\
 } while (0)
 
-   CONDITIONAL_STRCPY (dst_if_name,       iface->if_name);
-   CONDITIONAL_STRCPY (dst_if_addr,       iface->if_addr);
-   CONDITIONAL_STRCPY (dst_if_netmask,    iface->if_netmask);
-   CONDITIONAL_STRCPY (dst_if_broadcast,  iface->if_broadcast);
-   CONDITIONAL_STRCPY (dst_if_p2paddr,    iface->if_p2paddr);
+   CONDITIONAL_FORMAT (dst_if_addr,       &iface->addr);
+   CONDITIONAL_FORMAT (dst_if_netmask,    &iface->netmask);
+   CONDITIONAL_FORMAT (dst_if_broadcast,  &iface->broadcast);
+   CONDITIONAL_FORMAT (dst_if_p2paddr,    &iface->p2paddr);
 
-#undef CONDITIONAL_STRCPY
+#undef CONDITIONAL_FORMAT
 
    error = false;
 errorexit:
    return !error;
 }
 
+/* ***************************************************************** */
+/* ***************************************************************** */
+#define STATS_COUNTERS        \
+   COUNTER (rx_bytes)         \
+   COUNTER (rx_packets)       \
+   COUNTER (rx_errors)        \
+   COUNTER (rx_dropped)       \
+   COUNTER (rx_missed)        \
+   COUNTER (rx_fifo_errors)   \
+   COUNTER (tx_bytes)         \
+   COUNTER (tx_packets)       \
+   COUNTER (tx_errors)        \
+   COUNTER (tx_dropped)       \
+   COUNTER (tx_fifo_errors)
+
+#ifdef PLATFORM_Windows
+
+bool netcode_if_stats (const char *name, uint32_t ifindex, netcode_if_stats_t *dst)
+{
+   MIB_IF_ROW2 row;
+
+   memset (dst, 0, sizeof *dst);
+   memset (&row, 0, sizeof row);
 
+   row.InterfaceIndex = name ? if_nametoindex (name) : ifindex;
+   if (!row.InterfaceIndex || GetIfEntry2 (&row) != NO_ERROR) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to read counters of [%s:%u]\n", name ? name : "", ifindex);
+      return false;
+   }
+
+   dst->timestamp_ns = netcode_util_time_ns ();
+   dst->rx_bytes = row.InOctets;
+   dst->rx_packets = row.InUcastPkts + row.InNUcastPkts;
+   dst->rx_errors = row.InErrors;
+   dst->rx_dropped = row.InDiscards;
+   dst->tx_bytes = row.OutOctets;
+   dst->tx_packets = row.OutUcastPkts + row.OutNUcastPkts;
+   dst->tx_errors = row.OutErrors;
+   dst->tx_dropped = row.OutDiscards;
+   return true;
+}
+
+#endif
+
+#ifdef PLATFORM_POSIX
+
+// Large enough for a single link's RTM_NEWLINK, including its per-family
+// configuration.
+#define STATS_BUFSIZE      (16 * 1024)
+
+static bool stats_netlink (const char *name, uint32_t ifindex, netcode_if_stats_t *dst)
+{
+   struct {
+      struct nlmsghdr   nh;
+      struct ifinfomsg  ifi;
+      char              attrs[RTA_SPACE (IF_NAMESIZE)];
+   } req;
+   union {
+      struct nlmsghdr   nh;
+      uint8_t           buf[STATS_BUFSIZE];
+   } resp;
+   bool ret = false;
+   int fd = -1;
+
+   memset (&req, 0, sizeof req);
+   req.nh.nlmsg_len = NLMSG_LENGTH (sizeof req.ifi);
+   req.nh.nlmsg_type = RTM_GETLINK;
+   req.nh.nlmsg_flags = NLM_F_REQUEST;
+   req.nh.nlmsg_seq = 1;
+   req.ifi.ifi_family = AF_UNSPEC;
+   req.ifi.ifi_index = (int)ifindex;
+
+   if (name) {
+      size_t len = strlen (name) + 1;
+      if (len > IF_NAMESIZE)
+         return false;
+
+      struct rtattr *rta = (struct rtattr *)((char *)&req + NLMSG_ALIGN (req.nh.nlmsg_len));
+      rta->rta_type = IFLA_IFNAME;
+      rta->rta_len = RTA_LENGTH (len);
+      memcpy (RTA_DATA (rta), name, len);
+      req.nh.nlmsg_len = NLMSG_ALIGN (req.nh.nlmsg_len) + RTA_ALIGN (rta->rta_len);
+      req.ifi.ifi_index = 0;
+   }
+
+   if ((fd = socket (AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) < 0)
+      return false;
+
+   ssize_t r = -1;
+   if (send (fd, &req, req.nh.nlmsg_len, 0) < 0 ||
+       (r = recv (fd, resp.buf, sizeof resp.buf, MSG_TRUNC)) < 0 ||
+       r > (ssize_t)sizeof resp.buf)
+      goto errorexit;
+
+   int len = (int)r;
+   for (struct nlmsghdr *nh = &resp.nh; NLMSG_OK (nh, len); nh = NLMSG_NEXT (nh, len)) {
+      if (nh->nlmsg_type != RTM_NEWLINK)
+         continue;
+
+      const struct ifinfomsg *ifi = NLMSG_DATA (nh);
+      int alen = (int)nh->nlmsg_len - NLMSG_LENGTH (sizeof *ifi);
+      for (struct rtattr *rta = IFLA_RTA (ifi); RTA_OK (rta, alen); rta = RTA_NEXT (rta, alen)) {
+         struct rtnl_link_stats64 st;
+
+         if (rta->rta_type != IFLA_STATS64)
+            continue;
+
+         // Newer kernels append counters; older ones may send fewer.
+         memset (&st, 0, sizeof st);
+         memcpy (&st, RTA_DATA (rta), RTA_PAYLOAD (rta) < sizeof st ? RTA_PAYLOAD (rta)
+                                                                      : sizeof st);
+         dst->rx_bytes        = st.rx_bytes;
+         dst->rx_packets      = st.rx_packets;
+         dst->rx_errors       = st.rx_errors;
+         dst->rx_dropped      = st.rx_dropped;
+         dst->rx_missed       = st.rx_missed_errors;
+         dst->rx_fifo_errors  = st.rx_fifo_errors;
+         dst->tx_bytes        = st.tx_bytes;
+         dst->tx_packets      = st.tx_packets;
+         dst->tx_errors       = st.tx_errors;
+         dst->tx_dropped      = st.tx_dropped;
+         dst->tx_fifo_errors  = st.tx_fifo_errors;
+         ret = true;
+      }
+   }
+
+errorexit:
+   close (fd);
+   return ret;
+}
+
+static bool stats_sysfs (const char *name, netcode_if_stats_t *dst)
+{
+#define COUNTER(x)      { #x, offsetof (netcode_if_stats_t, x) },
+   static const struct {
+      const char  *file;
+      size_t       offset;
+   } counters[] = {
+      STATS_COUNTERS
+   };
+#undef COUNTER
+   char path[128];
+
+   if (strchr (name, '/'))
+      return false;
+
+   for (size_t i=0; i<sizeof counters / sizeof counters[0]; i++) {
+      // The file for rx_missed is named after the kernel's field.
+      const char *file = strcmp (counters[i].file, "rx_missed") == 0
+                       ? "rx_missed_errors" : counters[i].file;
+      uint64_t value = 0;
+
+      snprintf (path, sizeof path, "/sys/class/net/%s/statistics/%s", name, file);
+      FILE *inf = fopen (path, "r");
+      if (!inf) {
+         if (i == 0)
+            return false;
+         continue;
+      }
+      if (fscanf (inf, "%" SCNu64, &value) == 1)
+         memcpy ((uint8_t *)dst + counters[i].offset, &value, sizeof value);
+      fclose (inf);
+   }
+   return true;
+}
+
+bool netcode_if_stats (const char *name, uint32_t ifindex, netcode_if_stats_t *dst)
+{
+   char namebuf[IF_NAMESIZE];
+
+   memset (dst, 0, sizeof *dst);
+   if (!name && !ifindex)
+      return false;
+
+   dst->timestamp_ns = netcode_util_time_ns ();
+   if (stats_netlink (name, ifindex, dst))
+      return true;
+
+   if (!name && !(name = if_indextoname (ifindex, namebuf))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "No interface has index %u\n", ifindex);
+      return false;
+   }
+   if (!(stats_sysfs (name, dst))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to read counters of [%s]\n", name);
+      return false;
+   }
+   return true;
+}
+
+#endif
+
+bool netcode_if_stats_rates (const netcode_if_stats_t *prev,
+                             const netcode_if_stats_t *cur,
+                             netcode_if_rates_t *dst)
+{
+   memset (dst, 0, sizeof *dst);
+   if (cur->timestamp_ns <= prev->timestamp_ns)
+      return false;
+
+   dst->interval_secs = (double)(cur->timestamp_ns - prev->timestamp_ns) / 1e9;
+
+#define COUNTER(x)   dst->x = (double)(cur->x >= prev->x ? cur->x - prev->x : cur->x) \
+                              / dst->interval_secs;
+   STATS_COUNTERS
+#undef COUNTER
+
+   return true;
+}
+
+
+
+/* ***************************************************************** */
+/* ***************************************************************** */
+#ifdef PLATFORM_POSIX
+
+#define MON_BUFSIZE        (64 * 1024)
+#define MON_RCVBUF         (1024 * 1024)
+#define MON_DUMP_ATTEMPTS  (5)
+
+struct mon_link_t {
+   uint32_t   index;
+   uint64_t   flags;               // NETCODE_IFF_*
+   uint32_t   mtu;
+   char       name[IF_NAMESIZE];
+   uint8_t    hwaddr[IF_HWADDRLEN];
+   uint8_t    hwlen;
+   bool       seen;
+};
+
+struct mon_addr_t {
+   uint32_t   index;
+   uint8_t    family;
+   uint8_t    prefixlen;
+   uint8_t    local[16];
+   uint8_t    peer[16];            // Point-to-point links only
+   uint8_t    brd[4];              // IPv4 only
+   bool       has_peer;
+   bool       has_brd;
+   bool       seen;
+};
+
+struct mon_sub_t {
+   netcode_if_monitor_fn_t   *fn;
+   void                      *ctx;
+};
+
+struct netcode_if_monitor_t {
+   int                  fd;
+   uint32_t             portid;
+   uint32_t             seq;
+   bool                 dump_done;
+   struct mon_link_t   *links;
+   size_t               nlinks;
+   size_t               links_cap;
+   struct mon_addr_t   *addrs;
+   size_t               naddrs;
+   size_t               addrs_cap;
+   int                  nevents;   // Changes seen by the current poll
+   uint64_t             generation;
+   netcode_if_t       **list;
+   struct mon_sub_t     subs[NETCODE_IF_MONITOR_SUBSCRIBERS];
+   uint8_t             *buf;
+};
+
+static bool mon_grow (void **array, size_t *cap, size_t n, size_t elsize)
+{
+   if (n < *cap)
+      return true;
+
+   size_t newcap = *cap ? *cap * 2 : 16;
+   void *tmp = netcode_util_realloc (*array, newcap * elsize);
+   if (!tmp) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM growing interface table to %zu entries\n", newcap);
+      return false;
+   }
+   *array = tmp;
+   *cap = newcap;
+   return true;
+}
+
+static size_t mon_addrlen (int family)
+{
+   return family == AF_INET ? 4 : 16;
+}
+
+static socklen_t mon_sockaddr (struct sockaddr_storage *ss, int family,
+                               const uint8_t *bytes, uint32_t index)
+{
+   memset (ss, 0, sizeof *ss);
+   if (family == AF_INET) {
+      struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+      sin->sin_family = AF_INET;
+      memcpy (&sin->sin_addr, bytes, 4);
+      return sizeof *sin;
+   }
+
+   struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+   sin6->sin6_family = AF_INET6;
+   memcpy (&sin6->sin6_addr, bytes, 16);
+   if (IN6_IS_ADDR_LINKLOCAL (&sin6->sin6_addr))
+      sin6->sin6_scope_id = index;
+   return sizeof *sin6;
+}
+
+static struct mon_link_t *mon_find_link (netcode_if_monitor_t *mon, uint32_t index)
+{
+   for (size_t i=0; i<mon->nlinks; i++) {
+      if (mon->links[i].index == index)
+         return &mon->links[i];
+   }
+   return NULL;
+}
+
+static struct mon_addr_t *mon_find_addr (netcode_if_monitor_t *mon,
+                                         const struct mon_addr_t *key)
+{
+   for (size_t i=0; i<mon->naddrs; i++) {
+      struct mon_addr_t *a = &mon->addrs[i];
+      if (a->index == key->index && a->family == key->family &&
+          a->prefixlen == key->prefixlen &&
+          memcmp (a->local, key->local, mon_addrlen (key->family)) == 0)
+         return a;
+   }
+   return NULL;
+}
+
+static void mon_notify (netcode_if_monitor_t *mon, int type,
+                        const struct mon_link_t *link, const struct mon_addr_t *addr)
+{
+   netcode_if_event_t ev;
+   netcode_addr_t na;
+
+   memset (&ev, 0, sizeof ev);
+   ev.type = type;
+   ev.ifindex = link ? link->index : addr->index;
+   ev.name = "";
+
+   if (!link)
+      link = mon_find_link (mon, addr->index);
+   if (link) {
+      ev.name = link->name;
+      ev.flags = link->flags;
+      ev.mtu = link->mtu;
+   }
+
+   if (addr) {
+      struct sockaddr_storage ss;
+      socklen_t sslen = mon_sockaddr (&ss, addr->family, addr->local, addr->index);
+      if (netcode_addr_from_sockaddr (&na, (struct sockaddr *)&ss, sslen))
+         ev.addr = &na;
+      ev.prefixlen = addr->prefixlen;
+   }
+
+   mon->nevents++;
+   for (size_t i=0; i<NETCODE_IF_MONITOR_SUBSCRIBERS; i++) {
+      if (mon->subs[i].fn)
+         mon->subs[i].fn (mon->subs[i].ctx, &ev);
+   }
+}
+
+static void mon_remove_addr (netcode_if_monitor_t *mon, size_t i)
+{
+   struct mon_addr_t old = mon->addrs[i];
+
+   memmove (&mon->addrs[i], &mon->addrs[i + 1], (mon->naddrs - i - 1) * sizeof old);
+   mon->naddrs--;
+   mon_notify (mon, NETCODE_IF_EVENT_ADDR_DEL, NULL, &old);
+}
+
+static void mon_remove_link (netcode_if_monitor_t *mon, size_t i)
+{
+   struct mon_link_t old = mon->links[i];
+
+   // The kernel reports the addresses of a deleted link separately, but
+   // not always before the link itself.
+   for (size_t j=mon->naddrs; j-- > 0;) {
+      if (mon->addrs[j].index == old.index)
+         mon_remove_addr (mon, j);
+   }
+
+   memmove (&mon->links[i], &mon->links[i + 1], (mon->nlinks - i - 1) * sizeof old);
+   mon->nlinks--;
+   mon_notify (mon, NETCODE_IF_EVENT_LINK_DEL, &old, NULL);
+}
+
+static bool mon_link_msg (netcode_if_monitor_t *mon, const struct nlmsghdr *nh)
+{
+   const struct ifinfomsg *ifi = NLMSG_DATA (nh);
+   int len = (int)nh->nlmsg_len - NLMSG_LENGTH (sizeof *ifi);
+   struct mon_link_t rec;
+
+   if (len < 0)
+      return true;
+
+   memset (&rec, 0, sizeof rec);
+   rec.index = (uint32_t)ifi->ifi_index;
+   rec.flags = if_reflag (ifi->ifi_flags);
+   rec.seen = true;
+
+   for (struct rtattr *rta = IFLA_RTA (ifi); RTA_OK (rta, len); rta = RTA_NEXT (rta, len)) {
+      size_t plen = RTA_PAYLOAD (rta);
+      switch (rta->rta_type) {
+         case IFLA_IFNAME:
+            if (plen > sizeof rec.name - 1)
+               plen = sizeof rec.name - 1;
+            memcpy (rec.name, RTA_DATA (rta), plen);
+            rec.name[plen] = 0;
+            break;
+
+         case IFLA_MTU:
+            if (plen >= sizeof rec.mtu)
+               memcpy (&rec.mtu, RTA_DATA (rta), sizeof rec.mtu);
+            break;
+
+         case IFLA_ADDRESS:
+            rec.hwlen = (uint8_t)(plen > sizeof rec.hwaddr ? sizeof rec.hwaddr : plen);
+            memcpy (rec.hwaddr, RTA_DATA (rta), rec.hwlen);
+            break;
+      }
+   }
+
+   struct mon_link_t *link = mon_find_link (mon, rec.index);
+
+   if (nh->nlmsg_type == RTM_DELLINK) {
+      if (link)
+         mon_remove_link (mon, (size_t)(link - mon->links));
+      return true;
+   }
+
+   if (link) {
+      link->seen = true;
+      if (link->flags == rec.flags && link->mtu == rec.mtu &&
+          strcmp (link->name, rec.name) == 0 && link->hwlen == rec.hwlen &&
+          memcmp (link->hwaddr, rec.hwaddr, rec.hwlen) == 0)
+         return true;
+      *link = rec;
+   } else {
+      if (!(mon_grow ((void **)&mon->links, &mon->links_cap, mon->nlinks, sizeof rec)))
+         return false;
+      link = &mon->links[mon->nlinks++];
+      *link = rec;
+   }
+
+   mon_notify (mon, NETCODE_IF_EVENT_LINK_NEW, link, NULL);
+   return true;
+}
+
+static bool mon_addr_msg (netcode_if_monitor_t *mon, const struct nlmsghdr *nh)
+{
+   const struct ifaddrmsg *ifa = NLMSG_DATA (nh);
+   int len = (int)nh->nlmsg_len - NLMSG_LENGTH (sizeof *ifa);
+   const uint8_t *address = NULL, *local = NULL;
+   struct mon_addr_t rec;
+
+   if (len < 0 || (ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6))
+      return true;
+
+   memset (&rec, 0, sizeof rec);
+   rec.index = ifa->ifa_index;
+   rec.family = ifa->ifa_family;
+   rec.prefixlen = ifa->ifa_prefixlen;
+   rec.seen = true;
+
+   size_t alen = mon_addrlen (rec.family);
+   for (struct rtattr *rta = IFA_RTA (ifa); RTA_OK (rta, len); rta = RTA_NEXT (rta, len)) {
+      if (RTA_PAYLOAD (rta) < (rta->rta_type == IFA_BROADCAST ? 4 : alen))
+         continue;
+      switch (rta->rta_type) {
+         case IFA_ADDRESS:    address = RTA_DATA (rta);                    break;
+         case IFA_LOCAL:      local = RTA_DATA (rta);                      break;
+         case IFA_BROADCAST:  memcpy (rec.brd, RTA_DATA (rta), 4);
+                              rec.has_brd = rec.family == AF_INET;         break;
+      }
+   }
+
+   // IFA_LOCAL is the interface's own address; when both are present and
+   // differ, IFA_ADDRESS is the other end of a point-to-point link.
+   if (!local)
+      local = address;
+   if (!local)
+      return true;
+   memcpy (rec.local, local, alen);
+   if (address && memcmp (address, local, alen) != 0) {
+      memcpy (rec.peer, address, alen);
+      rec.has_peer = true;
+   }
+
+   struct mon_addr_t *addr = mon_find_addr (mon, &rec);
+
+   if (nh->nlmsg_type == RTM_DELADDR) {
+      if (addr)
+         mon_remove_addr (mon, (size_t)(addr - mon->addrs));
+      return true;
+   }
+
+   if (addr) {
+      addr->seen = true;
+      if (addr->has_peer == rec.has_peer && addr->has_brd == rec.has_brd &&
+          memcmp (addr->peer, rec.peer, sizeof rec.peer) == 0 &&
+          memcmp (addr->brd, rec.brd, sizeof rec.brd) == 0)
+         return true;
+      *addr = rec;
+   } else {
+      if (!(mon_grow ((void **)&mon->addrs, &mon->addrs_cap, mon->naddrs, sizeof rec)))
+         return false;
+      addr = &mon->addrs[mon->naddrs++];
+      *addr = rec;
+   }
+
+   mon_notify (mon, NETCODE_IF_EVENT_ADDR_NEW, NULL, addr);
+   return true;
+}
+
+/* Reads one datagram of netlink messages and applies them.
+ *
+ * RETURNS: 1 if a datagram was read, 0 if none was waiting, -1 on error
+ * and -2 if the kernel dropped notifications (ENOBUFS).
+ */
+static int mon_read (netcode_if_monitor_t *mon, int flags)
+{
+   struct sockaddr_nl sa;
+   struct iovec iov = { mon->buf, MON_BUFSIZE };
+   struct msghdr msg;
+
+   memset (&msg, 0, sizeof msg);
+   msg.msg_name = &sa;
+   msg.msg_namelen = sizeof sa;
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+
+   ssize_t r = recvmsg (mon->fd, &msg, flags);
+   if (r < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+         return 0;
+      if (errno == ENOBUFS)
+         return -2;
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Netlink recvmsg() failure: %i\n", errno);
+      return -1;
+   }
+   if (msg.msg_flags & MSG_TRUNC) {
+      // Messages were lost, which is no different from an overrun.
+      return -2;
+   }
+   if (sa.nl_pid != 0)
+      return 1;   // Not from the kernel
+
+   int len = (int)r;
+   for (struct nlmsghdr *nh = (struct nlmsghdr *)mon->buf; NLMSG_OK (nh, len);
+        nh = NLMSG_NEXT (nh, len)) {
+
+      bool ours = nh->nlmsg_seq == mon->seq && nh->nlmsg_pid == mon->portid;
+
+      switch (nh->nlmsg_type) {
+         case NLMSG_DONE:
+            if (ours)
+               mon->dump_done = true;
+            break;
+
+         case NLMSG_ERROR: {
+            const struct nlmsgerr *err = NLMSG_DATA (nh);
+            if (ours && err->error) {
+               NETCODE_LOG (NETCODE_LOG_ERROR, "Netlink request failed: %i\n", -err->error);
+               return -1;
+            }
+            break;
+         }
+
+         case RTM_NEWLINK:
+         case RTM_DELLINK:
+            if (!(mon_link_msg (mon, nh)))
+               return -1;
+            break;
+
+         case RTM_NEWADDR:
+         case RTM_DELADDR:
+            if (!(mon_addr_msg (mon, nh)))
+               return -1;
+            break;
+      }
+   }
+   return 1;
+}
+
+static bool mon_dump (netcode_if_monitor_t *mon, uint16_t type)
+{
+   struct {
+      struct nlmsghdr   nh;
+      union {
+         struct ifinfomsg  ifi;
+         struct ifaddrmsg  ifa;
+      } u;
+   } req;
+
+   for (size_t attempt=0; attempt<MON_DUMP_ATTEMPTS; attempt++) {
+      memset (&req, 0, sizeof req);
+      req.nh.nlmsg_len = NLMSG_LENGTH (type == RTM_GETLINK ? sizeof req.u.ifi
+                                                            : sizeof req.u.ifa);
+      req.nh.nlmsg_type = type;
+      req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+      req.nh.nlmsg_seq = ++mon->seq;
+      req.u.ifi.ifi_family = AF_UNSPEC;
+
+      if (send (mon->fd, &req, req.nh.nlmsg_len, 0) < 0) {
+         NETCODE_LOG (NETCODE_LOG_ERROR, "Netlink send() failure: %i\n", errno);
+         return false;
+      }
+
+      int rc = 0;
+      mon->dump_done = false;
+      while (!mon->dump_done && (rc = mon_read (mon, 0)) >= 0)
+         ;
+      if (rc == -1)
+         return false;
+      if (mon->dump_done)
+         return true;
+      // Overrun during the dump: ask again.
+   }
+
+   NETCODE_LOG (NETCODE_LOG_ERROR, "Netlink dump kept overrunning\n");
+   return false;
+}
+
+/* Reloads the tables from the kernel: whatever the dump does not
+ * mention has gone away without our being told.
+ */
+static bool mon_resync (netcode_if_monitor_t *mon)
+{
+   for (size_t i=0; i<mon->nlinks; i++) {
+      mon->links[i].seen = false;
+   }
+   for (size_t i=0; i<mon->naddrs; i++) {
+      mon->addrs[i].seen = false;
+   }
+
+   if (!(mon_dump (mon, RTM_GETLINK)) || !(mon_dump (mon, RTM_GETADDR)))
+      return false;
+
+   for (size_t i=mon->naddrs; i-- > 0;) {
+      if (!mon->addrs[i].seen)
+         mon_remove_addr (mon, i);
+   }
+   for (size_t i=mon->nlinks; i-- > 0;) {
+      if (!mon->links[i].seen)
+         mon_remove_link (mon, i);
+   }
+   return true;
+}
+
+// Builds the list that netcode_if_monitor_list() returns: like
+// getifaddrs(), an entry for each link followed by one for each of its
+// addresses, which share the link's name.
+static bool mon_rebuild (netcode_if_monitor_t *mon)
+{
+   netcode_if_t **list = NULL,
+                 *entries = NULL;
+   char *names = NULL;
+   size_t namebytes = 0,
+          idx = 0;
+
+   for (size_t i=0; i<mon->nlinks; i++) {
+      namebytes += strlen (mon->links[i].name) + 1;
+   }
+
+   if (!(list = if_arena_new (mon->nlinks + mon->naddrs, namebytes, &entries, &names)))
+      return false;
+
+   for (size_t i=0; i<mon->nlinks; i++) {
+      const struct mon_link_t *link = &mon->links[i];
+      netcode_if_t *e = &entries[idx];
+      struct sockaddr_ll sll;
+
+      e->if_flags = link->flags;
+      e->if_name = if_arena_name (&names, link->name);
+      e->if_index = link->index;
+      e->if_mtu = link->mtu;
+      e->hwlen = link->hwlen;
+      memcpy (e->hwaddr, link->hwaddr, link->hwlen);
+
+      memset (&sll, 0, sizeof sll);
+      sll.sll_family = AF_PACKET;
+      sll.sll_ifindex = (int)link->index;
+      sll.sll_halen = link->hwlen > sizeof sll.sll_addr ? sizeof sll.sll_addr : link->hwlen;
+      memcpy (sll.sll_addr, link->hwaddr, sll.sll_halen);
+      if_set_sa (&e->addr, (struct sockaddr *)&sll, sizeof sll);
+      list[idx++] = e;
+
+      for (size_t j=0; j<mon->naddrs; j++) {
+         const struct mon_addr_t *a = &mon->addrs[j];
+         netcode_if_t *ae = &entries[idx];
+         struct sockaddr_storage ss;
+         socklen_t sslen;
+
+         if (a->index != link->index)
+            continue;
+
+         *ae = *e;
+         ae->prefixlen = a->prefixlen;
+         sslen = mon_sockaddr (&ss, a->family, a->local, a->index);
+         if_set_sa (&ae->addr, (struct sockaddr *)&ss, sslen);
+         if_set_netmask (&ae->netmask, a->family, a->prefixlen);
+         if (a->has_brd) {
+            sslen = mon_sockaddr (&ss, a->family, a->brd, 0);
+            if_set_sa (&ae->broadcast, (struct sockaddr *)&ss, sslen);
+         }
+         if (a->has_peer) {
+            sslen = mon_sockaddr (&ss, a->family, a->peer, a->index);
+            if_set_sa (&ae->p2paddr, (struct sockaddr *)&ss, sslen);
+         }
+         list[idx++] = ae;
+      }
+   }
+
+   netcode_if_list_del (mon->list);
+   mon->list = list;
+   mon->generation++;
+   return true;
+}
+
+netcode_if_monitor_t *netcode_if_monitor_new (void)
+{
+   netcode_if_monitor_t *ret = netcode_util_calloc (1, sizeof *ret);
+   struct sockaddr_nl sa;
+   socklen_t salen = sizeof sa;
+   int rcvbuf = MON_RCVBUF;
+
+   if (!ret) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating interface monitor\n");
+      return NULL;
+   }
+
+   ret->fd = -1;
+   if (!(ret->buf = netcode_util_malloc (MON_BUFSIZE))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating netlink buffer\n");
+      goto errorexit;
+   }
+
+   if ((ret->fd = socket (AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) < 0) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to create netlink socket: %i\n", errno);
+      goto errorexit;
+   }
+   setsockopt (ret->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf);
+
+   // Subscribe before loading, so that nothing is missed in between.
+   memset (&sa, 0, sizeof sa);
+   sa.nl_family = AF_NETLINK;
+   sa.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+   if (bind (ret->fd, (struct sockaddr *)&sa, sizeof sa) != 0 ||
+       getsockname (ret->fd, (struct sockaddr *)&sa, &salen) != 0) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to bind netlink socket: %i\n", errno);
+      goto errorexit;
+   }
+   ret->portid = sa.nl_pid;
+
+   if (!(mon_resync (ret)) || !(mon_rebuild (ret)))
+      goto errorexit;
+
+   return ret;
+
+errorexit:
+   netcode_if_monitor_del (ret);
+   return NULL;
+}
+
+void netcode_if_monitor_del (netcode_if_monitor_t *monitor)
+{
+   if (!monitor)
+      return;
+
+   if (monitor->fd >= 0)
+      close (monitor->fd);
+   netcode_if_list_del (monitor->list);
+   netcode_util_free (monitor->links);
+   netcode_util_free (monitor->addrs);
+   netcode_util_free (monitor->buf);
+   netcode_util_free (monitor);
+}
+
+bool netcode_if_monitor_subscribe (netcode_if_monitor_t *monitor,
+                                   netcode_if_monitor_fn_t *fn, void *ctx)
+{
+   for (size_t i=0; i<NETCODE_IF_MONITOR_SUBSCRIBERS; i++) {
+      if (!monitor->subs[i].fn) {
+         monitor->subs[i].fn = fn;
+         monitor->subs[i].ctx = ctx;
+         return true;
+      }
+   }
+   NETCODE_LOG (NETCODE_LOG_ERROR, "Too many interface monitor subscribers\n");
+   return false;
+}
+
+void netcode_if_monitor_unsubscribe (netcode_if_monitor_t *monitor,
+                                     netcode_if_monitor_fn_t *fn, void *ctx)
+{
+   for (size_t i=0; i<NETCODE_IF_MONITOR_SUBSCRIBERS; i++) {
+      if (monitor->subs[i].fn == fn && monitor->subs[i].ctx == ctx) {
+         memmove (&monitor->subs[i], &monitor->subs[i + 1],
+                  (NETCODE_IF_MONITOR_SUBSCRIBERS - i - 1) * sizeof monitor->subs[i]);
+         memset (&monitor->subs[NETCODE_IF_MONITOR_SUBSCRIBERS - 1], 0,
+                 sizeof monitor->subs[i]);
+         return;
+      }
+   }
+}
+
+int netcode_if_monitor_fd (const netcode_if_monitor_t *monitor)
+{
+   return monitor ? monitor->fd : -1;
+}
+
+int netcode_if_monitor_poll (netcode_if_monitor_t *monitor, size_t timeout_ms)
+{
+   struct pollfd pfd = { monitor->fd, POLLIN, 0 };
+   int rc;
+
+   monitor->nevents = 0;
+
+   if (poll (&pfd, 1, timeout_ms > INT_MAX ? INT_MAX : (int)timeout_ms) < 0 &&
+       errno != EINTR) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "poll() failure: %i\n", errno);
+      return -1;
+   }
+
+   while ((rc = mon_read (monitor, MSG_DONTWAIT)) != 0) {
+      if (rc == -1)
+         return -1;
+      if (rc == -2 && !(mon_resync (monitor)))
+         return -1;
+   }
+
+   if (monitor->nevents && !(mon_rebuild (monitor)))
+      return -1;
+
+   return monitor->nevents;
+}
+
+netcode_if_t *const *netcode_if_monitor_list (const netcode_if_monitor_t *monitor)
+{
+   return monitor ? monitor->list : NULL;
+}
+
+uint64_t netcode_if_monitor_generation (const netcode_if_monitor_t *monitor)
+{
+   return monitor ? monitor->generation : 0;
+}
+
+#else
+
+netcode_if_monitor_t *netcode_if_monitor_new (void)
+{
+   NETCODE_LOG (NETCODE_LOG_ERROR, "Interface monitoring is not supported on this platform\n");
+   return NULL;
+}
+
+void netcode_if_monitor_del (netcode_if_monitor_t *monitor)
+{
+   (void)monitor;
+}
+
+bool netcode_if_monitor_subscribe (netcode_if_monitor_t *monitor,
+                                   netcode_if_monitor_fn_t *fn, void *ctx)
+{
+   (void)monitor;
+   (void)fn;
+   (void)ctx;
+   return false;
+}
+
+void netcode_if_monitor_unsubscribe (netcode_if_monitor_t *monitor,
+                                     netcode_if_monitor_fn_t *fn, void *ctx)
+{
+   (void)monitor;
+   (void)fn;
+   (void)ctx;
+}
+
+int netcode_if_monitor_fd (const netcode_if_monitor_t *monitor)
+{
+   (void)monitor;
+   return -1;
+}
+
+int netcode_if_monitor_poll (netcode_if_monitor_t *monitor, size_t timeout_ms)
+{
+   (void)monitor;
+   (void)timeout_ms;
+   return -1;
+}
+
+netcode_if_t *const *netcode_if_monitor_list (const netcode_if_monitor_t *monitor)
+{
+   (void)monitor;
+   return NULL;
+}
+
+uint64_t netcode_if_monitor_generation (const netcode_if_monitor_t *monitor)
+{
+   (void)monitor;
+   return 0;
+}
+
+#endif
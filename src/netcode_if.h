@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "netcode_addr.h"
+
 typedef struct netcode_if_t netcode_if_t;
 
 #define NETCODE_IFF_UP              (1 << 0)
@@ -26,14 +28,87 @@ typedef struct netcode_if_t netcode_if_t;
 #define NETCODE_IFF_DORMANT         (1 << 17)
 #define NETCODE_IFF_ECHO            (1 << 18)
 
+/* Traffic counters of an interface since it was created. Counters that
+ * the platform does not provide are zero.
+ */
+typedef struct netcode_if_stats_t {
+   uint64_t    timestamp_ns;     // When the counters were read
+   uint64_t    rx_bytes;
+   uint64_t    rx_packets;
+   uint64_t    rx_errors;
+   uint64_t    rx_dropped;       // Dropped by the kernel
+   uint64_t    rx_missed;        // Dropped by the NIC (no buffer space)
+   uint64_t    rx_fifo_errors;
+   uint64_t    tx_bytes;
+   uint64_t    tx_packets;
+   uint64_t    tx_errors;
+   uint64_t    tx_dropped;
+   uint64_t    tx_fifo_errors;
+} netcode_if_stats_t;
+
+// The same counters as rates, per second.
+typedef struct netcode_if_rates_t {
+   double      interval_secs;
+   double      rx_bytes;
+   double      rx_packets;
+   double      rx_errors;
+   double      rx_dropped;
+   double      rx_missed;
+   double      rx_fifo_errors;
+   double      tx_bytes;
+   double      tx_packets;
+   double      tx_errors;
+   double      tx_dropped;
+   double      tx_fifo_errors;
+} netcode_if_rates_t;
+
+/* An interface monitor loads the interfaces and their addresses once
+ * over rtnetlink and then follows the kernel's change notifications,
+ * keeping a snapshot of the list up to date and calling its subscribers
+ * for every link or address that appears, changes or goes away.
+ *
+ * The monitor is driven by netcode_if_monitor_poll(), which may be
+ * called with a zero timeout when netcode_if_monitor_fd() is readable.
+ * Between calls to netcode_if_monitor_poll(), reading the current list
+ * is a pointer read. A monitor is not thread-safe. Only Linux is
+ * supported; elsewhere netcode_if_monitor_new() returns NULL.
+ */
+typedef struct netcode_if_monitor_t netcode_if_monitor_t;
+
+#define NETCODE_IF_EVENT_LINK_NEW      (1)   // Link added or changed
+#define NETCODE_IF_EVENT_LINK_DEL      (2)
+#define NETCODE_IF_EVENT_ADDR_NEW      (3)   // Address added or changed
+#define NETCODE_IF_EVENT_ADDR_DEL      (4)
+
+// The most subscribers a monitor calls.
+#define NETCODE_IF_MONITOR_SUBSCRIBERS (8)
+
+typedef struct netcode_if_event_t {
+   int                     type;       // NETCODE_IF_EVENT_*
+   uint32_t                ifindex;
+   const char             *name;       // "" if the link is not known
+   uint64_t                flags;      // NETCODE_IFF_* of the link
+   uint32_t                mtu;
+   const netcode_addr_t   *addr;       // Address events only, else NULL
+   uint8_t                 prefixlen;  // Address events only
+} netcode_if_event_t;
+
+// The event and everything it points to are only valid during the call.
+typedef void (netcode_if_monitor_fn_t) (void *ctx, const netcode_if_event_t *event);
+
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+   // Returns a NULL-terminated list of the interfaces' addresses, built
+   // in a single allocation, or NULL on error.
    netcode_if_t **netcode_if_list_new (void);
    void netcode_if_list_del (netcode_if_t **list);
 
+   // Copies the entry's details into newly allocated strings, which the
+   // caller must free. Use the accessors below to avoid the copies.
+
    bool netcode_if_extract (const netcode_if_t *iface,
                             uint64_t   *dst_if_flags,
                             char      **dst_if_name,
@@ -42,6 +117,91 @@ extern "C" {
                             char      **dst_if_broadcast,
                             char      **dst_if_p2paddr);
 
+   // Returns the system's index for the interface, as used by the
+   // multicast and IPv6 scope functions, or zero if it is unknown.
+   uint32_t netcode_if_index (const netcode_if_t *iface);
+
+   // Returns the MTU of the interface (the largest IP packet it sends,
+   // headers included), or zero if it is unknown.
+   uint32_t netcode_if_mtu (const netcode_if_t *iface);
+
+   // The accessors below allocate nothing; the pointers they return
+   // point into the list and are valid until the list is deleted.
+   const char *netcode_if_name_view (const netcode_if_t *iface);
+   uint64_t netcode_if_flags (const netcode_if_t *iface);
+
+   // Return the entry's address, netmask, broadcast address or the other
+   // end of a point-to-point link, with the length of the socket address
+   // in '*salen' if 'salen' is not NULL. On Linux, the entry for a link
+   // itself has an AF_PACKET address.
+   //
+   // RETURNS: NULL if the entry has no such address.
+   const struct sockaddr *netcode_if_addr_sa (const netcode_if_t *iface, size_t *salen);
+   const struct sockaddr *netcode_if_netmask_sa (const netcode_if_t *iface, size_t *salen);
+   const struct sockaddr *netcode_if_broadcast_sa (const netcode_if_t *iface, size_t *salen);
+   const struct sockaddr *netcode_if_p2paddr_sa (const netcode_if_t *iface, size_t *salen);
+
+   // Returns the length of the netmask's prefix, in bits.
+   uint8_t netcode_if_prefixlen (const netcode_if_t *iface);
+
+   // Returns the link's hardware address and stores its length in
+   // '*len', or NULL if the link has none.
+   const uint8_t *netcode_if_hwaddr (const netcode_if_t *iface, size_t *len);
+
+   // Reads the counters of the interface named 'name', or when 'name'
+   // is NULL, of the interface with index 'ifindex'. On Linux the
+   // counters come from a single rtnetlink request (IFLA_STATS64), with
+   // /sys/class/net/<name>/statistics as the fallback.
+   //
+   // RETURNS: false if the interface does not exist or its counters
+   // could not be read.
+   bool netcode_if_stats (const char *name, uint32_t ifindex, netcode_if_stats_t *dst);
+
+   // Computes the rates between two samples of the same interface. A
+   // counter that went backwards (the interface was reset) is taken to
+   // have restarted from zero.
+   //
+   // RETURNS: false if 'cur' was not taken after 'prev'.
+   bool netcode_if_stats_rates (const netcode_if_stats_t *prev,
+                                const netcode_if_stats_t *cur,
+                                netcode_if_rates_t *dst);
+
+   // Creates a monitor and loads the current interfaces and addresses.
+   //
+   // RETURNS: NULL on error, or if the platform is not supported.
+   netcode_if_monitor_t *netcode_if_monitor_new (void);
+   void netcode_if_monitor_del (netcode_if_monitor_t *monitor);
+
+   // Adds or removes a subscriber. Subscribers are called from
+   // netcode_if_monitor_poll(), once per change, in the order they were
+   // added.
+   //
+   // RETURNS: false if NETCODE_IF_MONITOR_SUBSCRIBERS are already added.
+   bool netcode_if_monitor_subscribe (netcode_if_monitor_t *monitor,
+                                      netcode_if_monitor_fn_t *fn, void *ctx);
+   void netcode_if_monitor_unsubscribe (netcode_if_monitor_t *monitor,
+                                        netcode_if_monitor_fn_t *fn, void *ctx);
+
+   // Returns the descriptor that becomes readable when notifications
+   // are waiting, for use in the caller's event loop.
+   int netcode_if_monitor_fd (const netcode_if_monitor_t *monitor);
+
+   // Waits up to 'timeout_ms' milliseconds for notifications and applies
+   // all that are waiting. If the kernel dropped notifications because
+   // they were not read quickly enough, the monitor reloads everything
+   // and reports the differences.
+   //
+   // RETURNS: the number of changes, or -1 on error.
+   int netcode_if_monitor_poll (netcode_if_monitor_t *monitor, size_t timeout_ms);
+
+   // Returns the current list, in the same form as netcode_if_list_new().
+   // The list belongs to the monitor and stays valid until the next call
+   // to netcode_if_monitor_poll() that reports changes.
+   netcode_if_t *const *netcode_if_monitor_list (const netcode_if_monitor_t *monitor);
+
+   // Returns a counter that increases whenever the list changes.
+   uint64_t netcode_if_monitor_generation (const netcode_if_monitor_t *monitor);
+
 #ifdef __cplusplus
 };
 #endif
@@ -3,10 +3,19 @@
 #include <string.h>
 #include <inttypes.h>
 
+#ifdef __linux__
+#include <errno.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
 #include "netcode_util.h"
 #include "netcode_if.h"
+#include "netcode_test_util.h"
 
-static int if_test (void)
+static int list_test (void)
 {
    int ret = EXIT_FAILURE;
 
@@ -75,6 +84,261 @@ errorexit:
    return ret;
 }
 
+#ifdef __linux__
+// Added to and removed from the loopback interface by the monitor test.
+#define TEST_ADDR          ("127.55.171.1")
+static const uint8_t test_addr_bytes[] = { 127, 55, 171, 1 };
+
+/* The list is one allocation, and walking it through the accessors
+ * makes none.
+ */
+static int view_test (void)
+{
+   int ret = EXIT_FAILURE;
+   uint64_t before, built, walked;
+   netcode_if_t **list = NULL;
+   bool found_lo = false;
+
+   netcode_util_alloc_debug (true);
+   before = netcode_util_alloc_count ();
+   list = netcode_if_list_new ();
+   built = netcode_util_alloc_count ();
+
+   for (size_t i=0; list && list[i]; i++) {
+      size_t salen = 0, hwlen = 0;
+      const struct sockaddr *sa = netcode_if_addr_sa (list[i], &salen);
+      const char *name = netcode_if_name_view (list[i]);
+
+      netcode_if_hwaddr (list[i], &hwlen);
+      if (!name || (sa && !salen)) {
+         NETCODE_UTIL_LOG ("Entry %zu is incomplete\n", i);
+         goto errorexit;
+      }
+
+      if (sa && sa->sa_family == AF_INET &&
+          ((const struct sockaddr_in *)sa)->sin_addr.s_addr == htonl (INADDR_LOOPBACK)) {
+         found_lo = netcode_if_prefixlen (list[i]) == 8 &&
+                    netcode_if_index (list[i]) == if_nametoindex (name) &&
+                    netcode_if_mtu (list[i]) > 0 &&
+                    netcode_if_netmask_sa (list[i], NULL) != NULL &&
+                    netcode_if_broadcast_sa (list[i], NULL) == NULL &&
+                    netcode_if_p2paddr_sa (list[i], NULL) == NULL;
+      }
+   }
+   walked = netcode_util_alloc_count ();
+
+   NETCODE_UTIL_LOG ("Built list in %" PRIu64 " allocations, walked it in %" PRIu64 "\n",
+                     built - before, walked - built);
+   if (!list || built - before != 1 || walked != built || !found_lo) {
+      NETCODE_UTIL_LOG ("Unexpected allocations or loopback details\n");
+      goto errorexit;
+   }
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   netcode_util_alloc_debug (false);
+   netcode_if_list_del (list);
+   return ret;
+}
+
+/* Loopback traffic shows up in the loopback interface's counters, read
+ * by name and by index.
+ */
+static int stats_test (void)
+{
+   netcode_if_stats_t before, after, synth_prev, synth_cur;
+   netcode_if_rates_t rates;
+   struct sockaddr_in sin;
+   uint8_t payload[100];
+   uint64_t start;
+   int fd;
+
+   if (!(netcode_if_stats ("lo", 0, &before))) {
+      NETCODE_UTIL_LOG ("Failed to read loopback counters\n");
+      return EXIT_FAILURE;
+   }
+
+   memset (&sin, 0, sizeof sin);
+   memset (payload, 0, sizeof payload);
+   sin.sin_family = AF_INET;
+   sin.sin_port = htons (9);
+   sin.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+   if ((fd = socket (AF_INET, SOCK_DGRAM, 0)) < 0) {
+      NETCODE_UTIL_LOG ("Failed to create a socket\n");
+      return EXIT_FAILURE;
+   }
+   for (size_t i=0; i<100; i++) {
+      sendto (fd, payload, sizeof payload, 0, (struct sockaddr *)&sin, sizeof sin);
+   }
+   close (fd);
+
+   if (!(netcode_if_stats (NULL, if_nametoindex ("lo"), &after)) ||
+       netcode_if_stats ("no-such-if0", 0, &synth_cur)) {
+      NETCODE_UTIL_LOG ("Counters by index, or of a missing interface, are wrong\n");
+      return EXIT_FAILURE;
+   }
+
+   netcode_if_stats_rates (&before, &after, &rates);
+   NETCODE_UTIL_LOG ("lo: %" PRIu64 " packets, %" PRIu64 " bytes sent in %.6fs\n",
+                     after.tx_packets - before.tx_packets,
+                     after.tx_bytes - before.tx_bytes, rates.interval_secs);
+   if (after.tx_packets - before.tx_packets < 100 ||
+       after.tx_bytes - before.tx_bytes < 100 * sizeof payload) {
+      NETCODE_UTIL_LOG ("Loopback traffic was not counted\n");
+      return EXIT_FAILURE;
+   }
+
+   start = netcode_util_time_ns ();
+   for (size_t i=0; i<1000; i++) {
+      netcode_if_stats ("lo", 0, &after);
+   }
+   NETCODE_UTIL_LOG ("netcode_if_stats() takes %.1f us\n",
+                     (double)(netcode_util_time_ns () - start) / 1000 / 1000);
+
+   // Two seconds apart, with a counter that was reset in between.
+   memset (&synth_prev, 0, sizeof synth_prev);
+   memset (&synth_cur, 0, sizeof synth_cur);
+   synth_prev.timestamp_ns = 1000000000;
+   synth_prev.rx_bytes = 1000;
+   synth_prev.tx_packets = 500;
+   synth_cur.timestamp_ns = 3000000000;
+   synth_cur.rx_bytes = 5000;
+   synth_cur.tx_packets = 20;
+   if (!(netcode_if_stats_rates (&synth_prev, &synth_cur, &rates)) ||
+       rates.rx_bytes != 2000.0 || rates.tx_packets != 10.0 ||
+       netcode_if_stats_rates (&synth_cur, &synth_prev, &rates)) {
+      NETCODE_UTIL_LOG ("Rates are wrong\n");
+      return EXIT_FAILURE;
+   }
+
+   return EXIT_SUCCESS;
+}
+
+struct events_t {
+   size_t   added;
+   size_t   deleted;
+};
+
+static void on_event (void *ctx, const netcode_if_event_t *event)
+{
+   struct events_t *events = ctx;
+   char addr[NETCODE_ADDR_STRLEN] = "";
+   netcode_addr_t test_addr;
+
+   netcode_addr_parse (&test_addr, TEST_ADDR);
+   if (event->addr)
+      netcode_addr_format (event->addr, addr, sizeof addr);
+
+   NETCODE_UTIL_LOG ("Event %i on [%u:%s]: [%s/%u]\n", event->type, event->ifindex,
+                     event->name, addr, event->prefixlen);
+
+   if (event->addr && netcode_addr_cmp (event->addr, &test_addr) == 0) {
+      if (event->type == NETCODE_IF_EVENT_ADDR_NEW)
+         events->added++;
+      if (event->type == NETCODE_IF_EVENT_ADDR_DEL)
+         events->deleted++;
+   }
+}
+
+static bool list_has (netcode_if_t *const *list, const char *addr)
+{
+   for (size_t i=0; list[i]; i++) {
+      char *if_addr = NULL;
+      bool found = netcode_if_extract (list[i], NULL, NULL, &if_addr, NULL, NULL, NULL) &&
+                   strcmp (if_addr, addr) == 0;
+      free (if_addr);
+      if (found)
+         return true;
+   }
+   return false;
+}
+
+static int monitor_test (void)
+{
+   int ret = EXIT_FAILURE;
+   struct events_t events = { 0, 0 };
+   netcode_if_monitor_t *mon = netcode_if_monitor_new ();
+   netcode_if_t *const *list = netcode_if_monitor_list (mon);
+   uint64_t generation = netcode_if_monitor_generation (mon);
+   uint64_t start;
+
+   if (!mon || !list || !list_has (list, "127.0.0.1")) {
+      NETCODE_UTIL_LOG ("Monitor did not load the loopback address\n");
+      goto errorexit;
+   }
+
+   if (!(netcode_if_monitor_subscribe (mon, on_event, &events)) ||
+       netcode_if_monitor_poll (mon, 0) < 0) {
+      NETCODE_UTIL_LOG ("Failed to subscribe to the monitor\n");
+      goto errorexit;
+   }
+
+   int rc = netcode_test_lo_addr (test_addr_bytes, true);
+   if (rc == EPERM || rc == EACCES) {
+      NETCODE_UTIL_LOG ("Not permitted to change addresses, skipping the change test\n");
+      ret = EXIT_SUCCESS;
+      goto errorexit;
+   }
+   if (rc != 0) {
+      NETCODE_UTIL_LOG ("Failed to add %s: %i\n", TEST_ADDR, rc);
+      goto errorexit;
+   }
+
+   start = netcode_util_time_ns ();
+   while (!events.added && netcode_util_time_ns () - start < 2000000000) {
+      if (netcode_if_monitor_poll (mon, 100) < 0)
+         break;
+   }
+   list = netcode_if_monitor_list (mon);
+   if (events.added != 1 || netcode_if_monitor_generation (mon) == generation ||
+       !list_has (list, TEST_ADDR)) {
+      NETCODE_UTIL_LOG ("Added address was not reported\n");
+      netcode_test_lo_addr (test_addr_bytes, false);
+      goto errorexit;
+   }
+
+   if ((rc = netcode_test_lo_addr (test_addr_bytes, false)) != 0) {
+      NETCODE_UTIL_LOG ("Failed to delete %s: %i\n", TEST_ADDR, rc);
+      goto errorexit;
+   }
+
+   start = netcode_util_time_ns ();
+   while (!events.deleted && netcode_util_time_ns () - start < 2000000000) {
+      if (netcode_if_monitor_poll (mon, 100) < 0)
+         break;
+   }
+   list = netcode_if_monitor_list (mon);
+   if (events.deleted != 1 || list_has (list, TEST_ADDR)) {
+      NETCODE_UTIL_LOG ("Deleted address was not reported\n");
+      goto errorexit;
+   }
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   netcode_if_monitor_del (mon);
+   return ret;
+}
+
+#endif
+
+static int if_test (void)
+{
+   if (list_test () != EXIT_SUCCESS)
+      return EXIT_FAILURE;
+
+   // The remaining tests rely on the loopback interface being "lo" and
+   // on netlink to change its addresses.
+#ifdef __linux__
+   if (view_test () != EXIT_SUCCESS || stats_test () != EXIT_SUCCESS)
+      return EXIT_FAILURE;
+   return monitor_test ();
+#else
+   return EXIT_SUCCESS;
+#endif
+}
+
 int main (void)
 {
    int ret = EXIT_FAILURE;
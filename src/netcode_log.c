@@ -0,0 +1,305 @@
+/* This must come before any system header, otherwise strict C99 mode
+ * hides the pthread functions from us.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "netcode_util.h"
+#include "netcode_log.h"
+
+/* ***************************************************************** */
+#ifdef PLATFORM_Windows
+#include <windows.h>
+
+#define YIELD()            SwitchToThread ()
+
+#endif
+
+/* ***************************************************************** */
+#ifdef PLATFORM_POSIX
+#include <sched.h>
+#include <pthread.h>
+
+#define YIELD()            sched_yield ()
+
+#endif
+
+#define RING_MASK       (NETCODE_LOG_RING_SLOTS - 1)
+
+#if (NETCODE_LOG_RING_SLOTS & RING_MASK) != 0
+#error NETCODE_LOG_RING_SLOTS must be a power of two
+#endif
+
+/* A single-producer, single-consumer ring: only the owning thread
+ * advances 'head' and only the (single) draining thread advances 'tail'.
+ * They are kept on separate cache lines so that the two do not contend.
+ *
+ * Rings are never freed. When a thread exits its ring is released, and
+ * the next thread to log takes it over.
+ */
+struct ring_t {
+   struct ring_t          *next;
+   int                     owned;
+   uint32_t                thread;
+   uint64_t                dropped;    // Written by the owner
+   uint64_t                reported;   // Drops already passed to the sink
+   uint8_t                 pad0[64];
+   uint64_t                head;
+   uint8_t                 pad1[64];
+   uint64_t                tail;
+   uint8_t                 pad2[64];
+   netcode_log_record_t    slots[NETCODE_LOG_RING_SLOTS];
+};
+
+static struct ring_t *rings = NULL;
+static __thread struct ring_t *my_ring = NULL;
+static uint32_t next_thread = 0;
+
+static int started = 0;
+static int min_level = NETCODE_LOG_TRACE;
+static uint64_t total_dropped = 0;
+static char drain_lock = 0;
+
+static netcode_log_fn_t *sink_fn = NULL;
+static void *sink_ctx = NULL;
+
+#ifdef PLATFORM_POSIX
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+static pthread_t drain_thread;
+static bool drain_running = false;
+static int drain_stop = 0;
+
+static void ring_release (void *ring)
+{
+   __atomic_store_n (&((struct ring_t *)ring)->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void key_create (void)
+{
+   pthread_key_create (&ring_key, ring_release);
+}
+#endif
+
+/* ***************************************************************** */
+static struct ring_t *ring_claim (void)
+{
+   struct ring_t *ring;
+
+   for (ring = __atomic_load_n (&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+      int expected = 0;
+      if (__atomic_compare_exchange_n (&ring->owned, &expected, 1, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+         break;
+   }
+
+   if (!ring) {
+      if (!(ring = netcode_util_calloc (1, sizeof *ring)))
+         return NULL;
+      ring->owned = 1;
+      ring->next = __atomic_load_n (&rings, __ATOMIC_RELAXED);
+      while (!__atomic_compare_exchange_n (&rings, &ring->next, ring, false,
+                                           __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+         ;
+   }
+
+   __atomic_store_n (&ring->thread, __atomic_add_fetch (&next_thread, 1, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+
+#ifdef PLATFORM_POSIX
+   pthread_once (&key_once, key_create);
+   pthread_setspecific (ring_key, ring);
+#endif
+
+   my_ring = ring;
+   return ring;
+}
+
+static void stdout_sink (void *ctx, const netcode_log_record_t *record)
+{
+   (void)ctx;
+   printf ("[%s:%i] %s", record->file, record->line, record->msg);
+}
+
+void netcode_log_write (int level, const char *file, int line, const char *fmt, ...)
+{
+   va_list ap;
+
+   if (level < __atomic_load_n (&min_level, __ATOMIC_RELAXED))
+      return;
+
+   if (!__atomic_load_n (&started, __ATOMIC_ACQUIRE)) {
+      printf ("[%s:%i] ", file, line);
+      va_start (ap, fmt);
+      vprintf (fmt, ap);
+      va_end (ap);
+      return;
+   }
+
+   struct ring_t *ring = my_ring ? my_ring : ring_claim ();
+   if (!ring) {
+      __atomic_add_fetch (&total_dropped, 1, __ATOMIC_RELAXED);
+      return;
+   }
+
+   uint64_t head = ring->head;
+   if (head - __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE) >= NETCODE_LOG_RING_SLOTS) {
+      __atomic_store_n (&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+      __atomic_add_fetch (&total_dropped, 1, __ATOMIC_RELAXED);
+      return;
+   }
+
+   netcode_log_record_t *record = &ring->slots[head & RING_MASK];
+   record->timestamp_ns = netcode_util_time_ns ();
+   record->thread = ring->thread;
+   record->level = level;
+   record->file = file;
+   record->line = line;
+
+   va_start (ap, fmt);
+   int rc = vsnprintf (record->msg, sizeof record->msg, fmt, ap);
+   va_end (ap);
+   if (rc < 0) {
+      record->msg[0] = 0;
+      rc = 0;
+   }
+   record->len = (size_t)rc < sizeof record->msg ? (size_t)rc : sizeof record->msg - 1;
+
+   __atomic_store_n (&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Must be called with drain_lock held.
+static size_t drain_rings (void)
+{
+   netcode_log_fn_t *fn = sink_fn ? sink_fn : stdout_sink;
+   size_t count = 0;
+
+   for (struct ring_t *ring = __atomic_load_n (&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+      uint64_t head = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+      uint64_t tail = ring->tail;
+
+      while (tail != head) {
+         fn (sink_ctx, &ring->slots[tail & RING_MASK]);
+         __atomic_store_n (&ring->tail, ++tail, __ATOMIC_RELEASE);
+         count++;
+      }
+
+      // The drops happened after the records that were waiting.
+      uint64_t dropped = __atomic_load_n (&ring->dropped, __ATOMIC_RELAXED);
+      if (dropped != ring->reported) {
+         netcode_log_record_t record;
+         record.timestamp_ns = netcode_util_time_ns ();
+         record.thread = __atomic_load_n (&ring->thread, __ATOMIC_RELAXED);
+         record.level = NETCODE_LOG_WARN;
+         record.file = __FILE__;
+         record.line = __LINE__;
+         int rc = snprintf (record.msg, sizeof record.msg, "%" PRIu64 " records dropped\n",
+                            dropped - ring->reported);
+         record.len = rc < 0 ? 0 : (size_t)rc;
+         ring->reported = dropped;
+         fn (sink_ctx, &record);
+         count++;
+      }
+   }
+
+   return count;
+}
+
+size_t netcode_log_drain (void)
+{
+   if (__atomic_test_and_set (&drain_lock, __ATOMIC_ACQUIRE))
+      return 0;
+
+   size_t count = drain_rings ();
+
+   __atomic_clear (&drain_lock, __ATOMIC_RELEASE);
+   return count;
+}
+
+/* ***************************************************************** */
+#ifdef PLATFORM_POSIX
+static void *drain_loop (void *arg)
+{
+   (void)arg;
+   while (!__atomic_load_n (&drain_stop, __ATOMIC_ACQUIRE)) {
+      netcode_log_drain ();
+      netcode_util_sleep_ns (NETCODE_LOG_DRAIN_MS * 1000000ULL);
+   }
+   return NULL;
+}
+#endif
+
+bool netcode_log_start (netcode_log_fn_t *fn, void *ctx, bool background)
+{
+   if (__atomic_load_n (&started, __ATOMIC_ACQUIRE))
+      return false;
+
+   sink_fn = fn;
+   sink_ctx = ctx;
+
+   if (background) {
+#ifdef PLATFORM_POSIX
+      __atomic_store_n (&drain_stop, 0, __ATOMIC_RELEASE);
+      if (pthread_create (&drain_thread, NULL, drain_loop, NULL) != 0) {
+         NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to start the log thread\n");
+         return false;
+      }
+      drain_running = true;
+#else
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Background draining is not supported on this platform\n");
+      return false;
+#endif
+   }
+
+   __atomic_store_n (&started, 1, __ATOMIC_RELEASE);
+   return true;
+}
+
+void netcode_log_stop (void)
+{
+   __atomic_store_n (&started, 0, __ATOMIC_RELEASE);
+
+#ifdef PLATFORM_POSIX
+   if (drain_running) {
+      __atomic_store_n (&drain_stop, 1, __ATOMIC_RELEASE);
+      pthread_join (drain_thread, NULL);
+      drain_running = false;
+   }
+#endif
+
+   // Another thread may be draining. Wait for it rather than skipping the
+   // last drain, so that nothing is left in the rings when the sink is
+   // taken away.
+   while (__atomic_test_and_set (&drain_lock, __ATOMIC_ACQUIRE))
+      YIELD ();
+
+   drain_rings ();
+   sink_fn = NULL;
+   sink_ctx = NULL;
+
+   __atomic_clear (&drain_lock, __ATOMIC_RELEASE);
+}
+
+void netcode_log_set_level (int level)
+{
+   __atomic_store_n (&min_level, level, __ATOMIC_RELAXED);
+}
+
+uint64_t netcode_log_dropped (void)
+{
+   return __atomic_load_n (&total_dropped, __ATOMIC_RELAXED);
+}
+
+const char *netcode_log_level_name (int level)
+{
+   static const char *names[] = { "TRACE", "DEBUG", "INFO", "WARN", "ERROR" };
+   if (level < 0 || level >= (int)(sizeof names / sizeof names[0]))
+      return "NONE";
+   return names[level];
+}
@@ -0,0 +1,110 @@
+
+#ifndef H_NETCODE_LOG
+#define H_NETCODE_LOG
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define NETCODE_LOG_TRACE           (0)
+#define NETCODE_LOG_DEBUG           (1)
+#define NETCODE_LOG_INFO            (2)
+#define NETCODE_LOG_WARN            (3)
+#define NETCODE_LOG_ERROR           (4)
+#define NETCODE_LOG_NONE            (5)
+
+// Calls below this level are removed by the compiler, arguments and
+// all. Define it on the command line to change it.
+#ifndef NETCODE_LOG_LEVEL
+#define NETCODE_LOG_LEVEL           NETCODE_LOG_INFO
+#endif
+
+// Longest message kept in a record, including the terminator; longer
+// messages are truncated.
+#define NETCODE_LOG_MSG_MAX         (200)
+
+// Records that each thread can have waiting to be drained (a power of
+// two).
+#define NETCODE_LOG_RING_SLOTS      (256)
+
+// How often the background thread drains the rings.
+#define NETCODE_LOG_DRAIN_MS        (5)
+
+#define NETCODE_LOG(level, ...)     do {\
+   if ((level) >= NETCODE_LOG_LEVEL)\
+      netcode_log_write ((level), __FILE__, __LINE__, __VA_ARGS__);\
+} while (0)
+
+/* Leveled, asynchronous logging.
+ *
+ * Each thread that logs gets a ring of records of its own, so writing a
+ * record formats the message into the ring and takes no lock and makes
+ * no system call. The rings are drained into a sink function, either by
+ * a background thread or by the caller through netcode_log_drain().
+ * When a ring is full, records are dropped and counted; the sink is told
+ * how many were lost, in a record of their own, when it next reads from
+ * that ring.
+ *
+ * Until netcode_log_start() is called, records are written to stdout as
+ * they are made, as NETCODE_UTIL_LOG does.
+ */
+typedef struct netcode_log_record_t {
+   uint64_t    timestamp_ns;     // From netcode_util_time_ns()
+   uint32_t    thread;           // Numbered in the order threads first log
+   int         level;
+   const char *file;
+   int         line;
+   size_t      len;
+   char        msg[NETCODE_LOG_MSG_MAX];
+} netcode_log_record_t;
+
+// Called for each record, on the thread that is draining. The record is
+// only valid during the call.
+typedef void (netcode_log_fn_t) (void *ctx, const netcode_log_record_t *record);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Sends records to 'fn' (NULL for one that writes them to stdout). If
+   // 'background' is set, a thread is started that drains the rings
+   // every NETCODE_LOG_DRAIN_MS; otherwise the caller must call
+   // netcode_log_drain().
+   //
+   // RETURNS: false if the logger was already started or the thread
+   // could not be created.
+   bool netcode_log_start (netcode_log_fn_t *fn, void *ctx, bool background);
+
+   // Stops the background thread, if any, drains what is left and goes
+   // back to writing records directly.
+   void netcode_log_stop (void);
+
+   // Passes every waiting record to the sink. Only one thread drains at
+   // a time; a call made while another is draining returns at once.
+   //
+   // RETURNS: the number of records passed to the sink.
+   size_t netcode_log_drain (void);
+
+   // Records below 'level' are discarded at run time as well.
+   void netcode_log_set_level (int level);
+
+   // RETURNS: the number of records dropped because a ring was full,
+   // since the program started.
+   uint64_t netcode_log_dropped (void);
+
+   // Use NETCODE_LOG() rather than calling this directly.
+   void netcode_log_write (int level, const char *file, int line,
+                           const char *fmt, ...)
+#ifdef __GNUC__
+      __attribute__ ((format (printf, 4, 5)))
+#endif
+      ;
+
+   const char *netcode_log_level_name (int level);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
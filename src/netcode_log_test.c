@@ -0,0 +1,256 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <pthread.h>
+
+#include "netcode_util.h"
+#include "netcode_log.h"
+
+#define NTHREADS        (4)
+#define NRECORDS        (20000)
+
+// Filled in by the sink, on whichever thread drains.
+static struct {
+   uint32_t next[NTHREADS];
+   uint64_t received;
+   uint64_t dropped;
+   bool     out_of_order;
+} seen;
+
+static void sink (void *ctx, const netcode_log_record_t *record)
+{
+   unsigned writer, seq;
+   uint64_t n;
+
+   (void)ctx;
+   if (sscanf (record->msg, "writer %u seq %u", &writer, &seq) == 2 && writer < NTHREADS) {
+      // Records may be missing (dropped), but never reordered.
+      if (seq < seen.next[writer])
+         seen.out_of_order = true;
+      seen.next[writer] = seq + 1;
+      seen.received++;
+   } else if (sscanf (record->msg, "%" SCNu64 " records dropped", &n) == 1 &&
+              record->level == NETCODE_LOG_WARN) {
+      seen.dropped += n;
+   }
+}
+
+static int evaluated = 0;
+
+static int side_effect (void)
+{
+   return ++evaluated;
+}
+
+static bool threshold_test (void)
+{
+   // Below the compile-time threshold: not even the arguments are
+   // evaluated.
+   NETCODE_LOG (NETCODE_LOG_DEBUG, "Should not appear: %i\n", side_effect ());
+   if (evaluated) {
+      NETCODE_UTIL_LOG ("A call below the threshold was compiled in\n");
+      return false;
+   }
+
+   netcode_log_set_level (NETCODE_LOG_ERROR);
+   NETCODE_LOG (NETCODE_LOG_WARN, "Should not appear: %i\n", side_effect ());
+   netcode_log_set_level (NETCODE_LOG_TRACE);
+   if (evaluated != 1) {
+      NETCODE_UTIL_LOG ("The call above the threshold was not made\n");
+      return false;
+   }
+   return true;
+}
+
+static bool overflow_test (void)
+{
+   uint64_t dropped = netcode_log_dropped (), start, elapsed;
+   bool ret = false;
+
+   memset (&seen, 0, sizeof seen);
+   if (!(netcode_log_start (sink, NULL, false))) {
+      NETCODE_UTIL_LOG ("Failed to start the logger\n");
+      return false;
+   }
+
+   // Nothing drains, so all but the first ring-full are dropped.
+   start = netcode_util_time_ns ();
+   for (unsigned i=0; i<NETCODE_LOG_RING_SLOTS * 4; i++) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "writer %u seq %u\n", 0u, i);
+   }
+   elapsed = netcode_util_time_ns () - start;
+
+   size_t drained = netcode_log_drain ();
+   printf ("LOG: %.1f ns per record; %zu drained, %" PRIu64 " dropped\n",
+           (double)elapsed / (NETCODE_LOG_RING_SLOTS * 4), drained, seen.dropped);
+
+   if (seen.received != NETCODE_LOG_RING_SLOTS || seen.out_of_order ||
+       seen.dropped != NETCODE_LOG_RING_SLOTS * 3 ||
+       netcode_log_dropped () - dropped != seen.dropped ||
+       drained != NETCODE_LOG_RING_SLOTS + 1) {
+      NETCODE_UTIL_LOG ("Overflow was not counted correctly\n");
+      goto errorexit;
+   }
+
+   // Once drained, there is room again.
+   NETCODE_LOG (NETCODE_LOG_ERROR, "writer %u seq %u\n", 0u, NETCODE_LOG_RING_SLOTS * 4);
+   if (netcode_log_drain () != 1 || seen.received != NETCODE_LOG_RING_SLOTS + 1) {
+      NETCODE_UTIL_LOG ("Ring did not accept records after being drained\n");
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_log_stop ();
+   return ret;
+}
+
+static void *writer_fn (void *arg)
+{
+   unsigned writer = (unsigned)(uintptr_t)arg;
+
+   for (unsigned i=0; i<NRECORDS; i++) {
+      NETCODE_LOG (NETCODE_LOG_WARN, "writer %u seq %u\n", writer, i);
+      if (i % 64 == 0)
+         netcode_util_sleep_ns (100000);
+   }
+   return NULL;
+}
+
+static bool threads_test (void)
+{
+   pthread_t threads[NTHREADS];
+   uint64_t dropped = netcode_log_dropped ();
+   size_t nthreads = 0;
+   bool ret = false;
+
+   memset (&seen, 0, sizeof seen);
+   if (!(netcode_log_start (sink, NULL, true))) {
+      NETCODE_UTIL_LOG ("Failed to start the logger\n");
+      return false;
+   }
+
+   for (; nthreads<NTHREADS; nthreads++) {
+      if (pthread_create (&threads[nthreads], NULL, writer_fn,
+                          (void *)(uintptr_t)nthreads) != 0) {
+         NETCODE_UTIL_LOG ("Failed to create thread\n");
+         goto errorexit;
+      }
+   }
+
+   ret = true;
+
+errorexit:
+   for (size_t i=0; i<nthreads; i++) {
+      pthread_join (threads[i], NULL);
+   }
+   netcode_log_stop ();
+
+   printf ("LOG: %i threads wrote %i records; %" PRIu64 " received, %" PRIu64 " dropped\n",
+           NTHREADS, NTHREADS * NRECORDS, seen.received, seen.dropped);
+
+   if (ret && (seen.out_of_order ||
+               seen.received + seen.dropped != NTHREADS * NRECORDS ||
+               netcode_log_dropped () - dropped != seen.dropped)) {
+      NETCODE_UTIL_LOG ("Records were lost, duplicated or reordered\n");
+      ret = false;
+   }
+   return ret;
+}
+
+static int in_sink = 0;
+
+// Holds up the first drain, so that records are written behind it.
+static void slow_sink (void *ctx, const netcode_log_record_t *record)
+{
+   if (!__atomic_exchange_n (&in_sink, 1, __ATOMIC_ACQ_REL))
+      netcode_util_sleep_ns (50000000);
+   sink (ctx, record);
+}
+
+static void *drain_fn (void *arg)
+{
+   (void)arg;
+   netcode_log_drain ();
+   return NULL;
+}
+
+/* Stopping while another thread is draining must still pass the records
+ * written behind that drain to the sink before the sink is removed.
+ */
+static bool stop_test (void)
+{
+   pthread_t drainer;
+   const unsigned nrecords = 10;
+
+   memset (&seen, 0, sizeof seen);
+   if (!(netcode_log_start (slow_sink, NULL, false))) {
+      NETCODE_UTIL_LOG ("Failed to start the logger\n");
+      return false;
+   }
+
+   NETCODE_LOG (NETCODE_LOG_ERROR, "writer %u seq %u\n", 0u, 0u);
+   if (pthread_create (&drainer, NULL, drain_fn, NULL) != 0) {
+      NETCODE_UTIL_LOG ("Failed to create thread\n");
+      netcode_log_stop ();
+      return false;
+   }
+   while (!__atomic_load_n (&in_sink, __ATOMIC_ACQUIRE)) {
+      netcode_util_sleep_ns (1000000);
+   }
+   for (unsigned i=1; i<nrecords; i++) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "writer %u seq %u\n", 0u, i);
+   }
+
+   netcode_log_stop ();
+   pthread_join (drainer, NULL);
+
+   printf ("LOG: %" PRIu64 " of %u records received when stopped during a drain\n",
+           seen.received, nrecords);
+   if (seen.received != nrecords || seen.out_of_order) {
+      NETCODE_UTIL_LOG ("Records were lost when stopping\n");
+      return false;
+   }
+   return true;
+}
+
+static int log_test (void)
+{
+   if (!(threshold_test ()) || !(overflow_test ()) || !(threads_test ()) ||
+       !(stop_test ()))
+      return EXIT_FAILURE;
+
+   // Stopped again, so records are written directly.
+   NETCODE_LOG (NETCODE_LOG_INFO, "Logger stopped\n");
+   return EXIT_SUCCESS;
+}
+
+int main (void)
+{
+   int ret = EXIT_FAILURE;
+
+   if (!(netcode_util_init ())) {
+      NETCODE_UTIL_LOG ("Failed to initialise netcode\n");
+      goto errorexit;
+   }
+
+   if ((ret = log_test ())!=EXIT_SUCCESS) {
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      printf ("+++ +++ log: Test FAILED +++ +++\n");
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      goto errorexit;
+   }
+
+   printf ("*********************************\n");
+   printf ("*** *** log: Test passed *** ***\n");
+   printf ("*********************************\n");
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   return ret;
+}
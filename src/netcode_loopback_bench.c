@@ -0,0 +1,212 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "netcode_util.h"
+#include "netcode_tcp.h"
+#include "netcode_udp.h"
+
+/* Measures round trips and throughput over loopback TCP and UDP using the
+ * library's write, read, send and receive functions, all from a single
+ * thread so that the numbers are mostly library and syscall overhead.
+ *
+ * A single short run is mostly noise, so each benchmark is run ROUNDS
+ * times, the rounds taking the benchmarks in alternating order so that
+ * none of them always runs first or last. The median rate is printed
+ * with the spread of the rounds (the range as a percentage of the
+ * median).
+ *
+ * This is also the training workload for 'make release-pgo', which
+ * compares the rates printed here between builds; keep the output to one
+ * line per measurement with the name and the rate in the first two
+ * columns.
+ */
+
+#define SMALL_LEN       (64)
+#define BULK_LEN        (16384)
+#define BURST           (32)
+#define ROUNDS          (5)
+#define MIN_NS          (100000000ULL)
+
+typedef struct bench_t {
+   int tcp_client;
+   int tcp_server;
+   int udp_a;
+   int udp_b;
+   netcode_addr_t addr_b;
+   uint8_t buf[BULK_LEN];
+} bench_t;
+
+typedef bool (bench_fn_t) (bench_t *b);
+
+static bool tcp_pingpong (bench_t *b)
+{
+   return netcode_tcp_write (b->tcp_client, b->buf, SMALL_LEN) == SMALL_LEN &&
+          netcode_tcp_read (b->tcp_server, b->buf, SMALL_LEN, 1) == SMALL_LEN &&
+          netcode_tcp_write (b->tcp_server, b->buf, SMALL_LEN) == SMALL_LEN &&
+          netcode_tcp_read (b->tcp_client, b->buf, SMALL_LEN, 1) == SMALL_LEN;
+}
+
+static bool tcp_bulk (bench_t *b)
+{
+   return netcode_tcp_write (b->tcp_client, b->buf, BULK_LEN) == BULK_LEN &&
+          netcode_tcp_read (b->tcp_server, b->buf, BULK_LEN, 1) == BULK_LEN;
+}
+
+static bool udp_pingpong (bench_t *b)
+{
+   netcode_addr_t from;
+
+   return netcode_udp_send_addr (b->udp_a, &b->addr_b, b->buf, (size_t)SMALL_LEN, NULL) == SMALL_LEN &&
+          netcode_udp_recv_into (b->udp_b, &from, b->buf, sizeof b->buf, 1) == SMALL_LEN &&
+          netcode_udp_send_addr (b->udp_b, &from, b->buf, (size_t)SMALL_LEN, NULL) == SMALL_LEN &&
+          netcode_udp_recv_into (b->udp_a, &from, b->buf, sizeof b->buf, 1) == SMALL_LEN;
+}
+
+// The allocating receive, as used by callers of netcode_udp_wait_addr().
+static bool udp_wait (bench_t *b)
+{
+   netcode_addr_t from;
+   uint8_t *rx = NULL;
+   size_t rxlen = 0;
+
+   if (netcode_udp_send_addr (b->udp_a, &b->addr_b, b->buf, (size_t)SMALL_LEN, NULL) != SMALL_LEN ||
+       netcode_udp_wait_addr (b->udp_b, &from, &rx, &rxlen, 1) != SMALL_LEN) {
+      netcode_util_free (rx);
+      return false;
+   }
+   netcode_util_free (rx);
+   return true;
+}
+
+static bool udp_burst (bench_t *b)
+{
+   for (size_t i=0; i<BURST; i++) {
+      if (netcode_udp_send_addr (b->udp_a, &b->addr_b, b->buf, (size_t)SMALL_LEN, NULL) != SMALL_LEN)
+         return false;
+   }
+   for (size_t i=0; i<BURST; i++) {
+      if (netcode_udp_recv_into (b->udp_b, NULL, b->buf, sizeof b->buf, 1) != SMALL_LEN)
+         return false;
+   }
+   return true;
+}
+
+static const struct {
+   const char *name;
+   bench_fn_t *fn;
+   size_t msgs;            // Messages per call
+   size_t bytes;           // Payload bytes per call
+} benches[] = {
+   { "tcp_pingpong",    tcp_pingpong,  2,       2 * SMALL_LEN       },
+   { "tcp_bulk",        tcp_bulk,      1,       BULK_LEN            },
+   { "udp_pingpong",    udp_pingpong,  2,       2 * SMALL_LEN       },
+   { "udp_wait",        udp_wait,      1,       SMALL_LEN           },
+   { "udp_burst",       udp_burst,     BURST,   BURST * SMALL_LEN   },
+};
+
+#define NBENCHES        (sizeof benches / sizeof benches[0])
+
+// Calls per second of benchmark 'i' over at least MIN_NS, or a negative
+// value if it failed.
+static double run (bench_t *b, size_t i)
+{
+   uint64_t calls = 0, start = netcode_util_time_ns (), elapsed;
+
+   do {
+      if (!(benches[i].fn (b))) {
+         NETCODE_UTIL_LOG ("Benchmark %s failed\n", benches[i].name);
+         return -1.0;
+      }
+      calls++;
+   } while ((elapsed = netcode_util_time_ns () - start) < MIN_NS);
+
+   return calls / (elapsed / 1e9);
+}
+
+static double median (double *v, size_t n)
+{
+   for (size_t i=1; i<n; i++) {
+      double tmp = v[i];
+      size_t j = i;
+      for (; j>0 && v[j - 1] > tmp; j--) {
+         v[j] = v[j - 1];
+      }
+      v[j] = tmp;
+   }
+   return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+static int loopback_bench (void)
+{
+   int ret = EXIT_FAILURE;
+   int listenfd = -1;
+   bench_t *b = NULL;
+   static double rates[NBENCHES][ROUNDS];
+
+   if (!(b = netcode_util_calloc (1, sizeof *b))) {
+      NETCODE_UTIL_LOG ("OOM allocating benchmark state\n");
+      goto errorexit;
+   }
+   b->tcp_client = b->tcp_server = b->udp_a = b->udp_b = -1;
+
+   if ((listenfd = netcode_tcp_server (NETCODE_TEST_BENCH_PORT)) < 0 ||
+       (b->tcp_client = netcode_tcp_connect ("127.0.0.1", NETCODE_TEST_BENCH_PORT)) < 0 ||
+       (b->tcp_server = netcode_tcp_accept_addr (listenfd, 1, NULL)) <= 0 ||
+       (b->udp_a = netcode_udp_socket (NETCODE_TEST_BENCH_PORT, NULL)) < 0 ||
+       (b->udp_b = netcode_udp_socket (NETCODE_TEST_BENCH_PORT2, NULL)) < 0) {
+      NETCODE_UTIL_LOG ("Failed to create loopback sockets\n");
+      goto errorexit;
+   }
+
+   if (!(netcode_addr_parse (&b->addr_b, "127.0.0.1"))) {
+      NETCODE_UTIL_LOG ("Failed to parse loopback address\n");
+      goto errorexit;
+   }
+   netcode_addr_set_port (&b->addr_b, NETCODE_TEST_BENCH_PORT2);
+
+   memset (b->buf, 0x5a, sizeof b->buf);
+
+   for (size_t round=0; round<ROUNDS; round++) {
+      for (size_t n=0; n<NBENCHES; n++) {
+         size_t i = round % 2 ? NBENCHES - 1 - n : n;
+         if ((rates[i][round] = run (b, i)) < 0)
+            goto errorexit;
+      }
+   }
+
+   printf ("%-14s %12s %12s %8s\n", "bench", "msgs/s", "MB/s", "spread");
+
+   for (size_t i=0; i<NBENCHES; i++) {
+      double mid = median (rates[i], ROUNDS);
+      printf ("%-14s %12.0f %12.1f %7.1f%%\n", benches[i].name,
+              mid * benches[i].msgs, mid * benches[i].bytes / 1e6,
+              (rates[i][ROUNDS - 1] - rates[i][0]) / mid * 100);
+   }
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   if (b) {
+      int fds[] = { b->tcp_client, b->tcp_server, b->udp_a, b->udp_b };
+      for (size_t i=0; i<sizeof fds / sizeof fds[0]; i++) {
+         if (fds[i] > 0)
+            netcode_util_close (fds[i]);
+      }
+   }
+   if (listenfd > 0)
+      netcode_util_close (listenfd);
+   netcode_util_free (b);
+   return ret;
+}
+
+int main (void)
+{
+   if (!(netcode_util_init ())) {
+      NETCODE_UTIL_LOG ("Failed to initialise netcode\n");
+      return EXIT_FAILURE;
+   }
+
+   return loopback_bench ();
+}
@@ -0,0 +1,193 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "netcode_util.h"
+#include "netcode_if.h"
+#include "netcode_udp.h"
+
+#define TIMEOUT         (2)
+
+/* The test prefers the loopback interface so that it runs on machines
+ * with no network. Linux does not mark lo as multicast-capable, but a
+ * group joined on it with IP_MULTICAST_IF set to it still loops the
+ * datagrams back, so the loopback interface is used regardless of that
+ * flag. Failing that, any multicast-capable interface with an IPv4
+ * address is used; the datagrams still never leave the host because the
+ * TTL is zero and they are looped back to the receiver.
+ *
+ * The interface's address is stored in 'if_addr' (caller must free) for
+ * use as the source of the source-specific membership.
+ */
+static const netcode_if_t *find_mcast_iface (netcode_if_t **list, char **if_addr)
+{
+   const netcode_if_t *ret = NULL;
+   bool loopback = false;
+
+   for (size_t i=0; list[i]; i++) {
+      uint64_t if_flags = 0;
+      char *addr = NULL;
+      netcode_addr_t tmp;
+
+      if (!(netcode_if_extract (list[i], &if_flags, NULL, &addr, NULL, NULL, NULL)) ||
+            !(if_flags & NETCODE_IFF_UP) ||
+            !(if_flags & (NETCODE_IFF_LOOPBACK | NETCODE_IFF_MULTICAST)) ||
+            !(netcode_addr_parse (&tmp, addr)) ||
+            netcode_addr_family (&tmp) != AF_INET) {
+         free (addr);
+         continue;
+      }
+
+      if (!ret || (!loopback && (if_flags & NETCODE_IFF_LOOPBACK))) {
+         free (*if_addr);
+         *if_addr = addr;
+         ret = list[i];
+         loopback = (if_flags & NETCODE_IFF_LOOPBACK) != 0;
+      } else {
+         free (addr);
+      }
+   }
+   return ret;
+}
+
+static bool mcast_roundtrip (int rxfd, int txfd, const char *group)
+{
+   netcode_addr_t dest, sender;
+   uint8_t *rxdata = NULL;
+   size_t rxlen = 0;
+   bool ret = false;
+
+   if (!(netcode_addr_parse (&dest, group))) {
+      NETCODE_UTIL_LOG ("Failed to parse [%s]\n", group);
+      return false;
+   }
+   netcode_addr_set_port (&dest, NETCODE_TEST_MCAST_PORT);
+
+   size_t txlen = strlen (NETCODE_TEST_MCAST_DATA) + 1;
+   if (netcode_udp_send_addr (txfd, &dest, NETCODE_TEST_MCAST_DATA, txlen, NULL) != txlen) {
+      NETCODE_UTIL_LOG ("Failed to send to [%s]: %s\n", group,
+                        netcode_util_strerror (netcode_util_errno ()));
+      return false;
+   }
+
+   size_t rc = netcode_udp_wait_addr (rxfd, &sender, &rxdata, &rxlen, TIMEOUT);
+   if (rc == (size_t)-1 || rc == 0) {
+      NETCODE_UTIL_LOG ("Nothing received from group [%s]\n", group);
+      goto errorexit;
+   }
+
+   if (rxlen != txlen || memcmp (rxdata, NETCODE_TEST_MCAST_DATA, txlen) != 0) {
+      NETCODE_UTIL_LOG ("Incorrect data received from group [%s]\n", group);
+      goto errorexit;
+   }
+
+   char sender_str[NETCODE_ADDR_STRLEN];
+   netcode_addr_format (&sender, sender_str, sizeof sender_str);
+   printf ("MCAST: [%s] received %zu bytes from [%s]\n", group, rxlen, sender_str);
+
+   ret = true;
+
+errorexit:
+   free (rxdata);
+   return ret;
+}
+
+static int mcast_test (void)
+{
+   int ret = EXIT_FAILURE;
+   int rxfd = -1, txfd = -1;
+   netcode_if_t **list = NULL;
+   const netcode_if_t *iface = NULL;
+   char *if_addr = NULL;
+
+   if (!(list = netcode_if_list_new ())) {
+      NETCODE_UTIL_LOG ("Failed to get list of ifaces\n");
+      goto errorexit;
+   }
+
+   if (!(iface = find_mcast_iface (list, &if_addr))) {
+      NETCODE_UTIL_LOG ("No multicast-capable interface found\n");
+      goto errorexit;
+   }
+   printf ("MCAST: using interface address [%s]\n", if_addr);
+
+   if ((rxfd = netcode_udp_socket (NETCODE_TEST_MCAST_PORT, NULL)) < 0 ||
+       (txfd = netcode_udp_socket (0, NULL)) < 0) {
+      NETCODE_UTIL_LOG ("Failed to create sockets: %s\n",
+                        netcode_util_strerror (netcode_util_errno ()));
+      goto errorexit;
+   }
+
+   if (!(netcode_udp_multicast_if (txfd, iface)) ||
+       !(netcode_udp_multicast_ttl (txfd, 0)) ||
+       !(netcode_udp_multicast_loop (txfd, true))) {
+      goto errorexit;
+   }
+
+   // Any-source membership
+   if (!(netcode_udp_join_group (rxfd, NETCODE_TEST_MCAST_GROUP, NULL, iface))) {
+      goto errorexit;
+   }
+   if (!(mcast_roundtrip (rxfd, txfd, NETCODE_TEST_MCAST_GROUP))) {
+      goto errorexit;
+   }
+   if (!(netcode_udp_leave_group (rxfd, NETCODE_TEST_MCAST_GROUP, NULL, iface))) {
+      goto errorexit;
+   }
+
+   // Source-specific membership
+   if (!(netcode_udp_join_group (rxfd, NETCODE_TEST_MCAST_SSM_GROUP,
+                                 if_addr, iface))) {
+      goto errorexit;
+   }
+   if (!(mcast_roundtrip (rxfd, txfd, NETCODE_TEST_MCAST_SSM_GROUP))) {
+      goto errorexit;
+   }
+   if (!(netcode_udp_leave_group (rxfd, NETCODE_TEST_MCAST_SSM_GROUP,
+                                  if_addr, iface))) {
+      goto errorexit;
+   }
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   if (rxfd >= 0) {
+      netcode_util_close (rxfd);
+   }
+   if (txfd >= 0) {
+      netcode_util_close (txfd);
+   }
+   netcode_if_list_del (list);
+   free (if_addr);
+
+   return ret;
+}
+
+int main (void)
+{
+   int ret = EXIT_FAILURE;
+
+   if (!(netcode_util_init ())) {
+      NETCODE_UTIL_LOG ("Failed to initialise netcode\n");
+      goto errorexit;
+   }
+
+   if ((ret = mcast_test ())!=EXIT_SUCCESS) {
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      printf ("+++ +++ mcast: Test FAILED +++ +++\n");
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      goto errorexit;
+   }
+
+   printf ("***********************************\n");
+   printf ("*** *** mcast: Test passed *** ***\n");
+   printf ("***********************************\n");
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   return ret;
+}
+
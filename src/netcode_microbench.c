@@ -0,0 +1,595 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include "netcode_util.h"
+#include "netcode_addr.h"
+#include "netcode_if.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <linux/if_addr.h>
+#endif
+
+/* Measures the time and the allocations per call of the utility and
+ * interface functions, so that changes to them can be compared.
+ *
+ * Each benchmark runs its function in batches that are sized to take at
+ * least BATCH_NS, after WARMUP_NS of unmeasured batches. The time of each
+ * of SAMPLES batches is taken with the TSC where there is one (and the
+ * clock otherwise), and the median and the median absolute deviation of
+ * the per-call times are reported, since both ignore the odd batch that
+ * is interrupted. Allocations are counted over one further batch with
+ * netcode_util_alloc_debug().
+ *
+ * The interface functions are measured against the host's interfaces
+ * and then, when the process is allowed to create a network namespace,
+ * against a namespace holding NS_LINKS links with an IPv4 and an IPv6
+ * address each. Without the privilege those are skipped.
+ */
+
+#define BATCH_NS        (50000ULL)
+#define WARMUP_NS       (20000000ULL)
+#define SAMPLES         (31)
+#define MAX_BATCH       ((size_t)1 << 20)
+#define NS_LINKS        (256)
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#include <x86intrin.h>
+#define HAVE_TSC        (1)
+#else
+#define HAVE_TSC        (0)
+#endif
+
+// Runs 'n' calls of the function being measured.
+typedef bool (bench_fn_t) (void *ctx, size_t n);
+
+static double ns_per_tick = 1.0;
+
+// Keeps results that the benchmarks would otherwise discard from being
+// optimised away.
+static volatile uintptr_t sink;
+
+/* ***************************************************************** */
+/* The harness. */
+
+static uint64_t ticks (void)
+{
+#if HAVE_TSC
+   return __rdtsc ();
+#else
+   return netcode_util_time_ns ();
+#endif
+}
+
+// The TSC is assumed to be invariant, as on every x86 CPU of the last
+// decade, so one measurement of its rate against the clock is enough.
+static void calibrate (void)
+{
+#if HAVE_TSC
+   uint64_t t0 = netcode_util_time_ns (), c0 = ticks ();
+   netcode_util_sleep_ns (50000000);
+   uint64_t t1 = netcode_util_time_ns (), c1 = ticks ();
+
+   if (c1 > c0)
+      ns_per_tick = (double)(t1 - t0) / (c1 - c0);
+#endif
+}
+
+static int cmp_double (const void *lhs, const void *rhs)
+{
+   double a = *(const double *)lhs, b = *(const double *)rhs;
+   return (a > b) - (a < b);
+}
+
+static double median (double *values, size_t n)
+{
+   qsort (values, n, sizeof *values, cmp_double);
+   return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+static bool measure (const char *name, bench_fn_t *fn, void *ctx)
+{
+   double samples[SAMPLES];
+   size_t batch = 1;
+   uint64_t start, elapsed;
+
+   // Double the batch until it takes long enough to time accurately.
+   for (;;) {
+      start = ticks ();
+      if (!(fn (ctx, batch)))
+         goto errorexit;
+      elapsed = ticks () - start;
+      if (elapsed * ns_per_tick >= BATCH_NS || batch >= MAX_BATCH)
+         break;
+      batch *= 2;
+   }
+
+   start = netcode_util_time_ns ();
+   while (netcode_util_time_ns () - start < WARMUP_NS) {
+      if (!(fn (ctx, batch)))
+         goto errorexit;
+   }
+
+   for (size_t i=0; i<SAMPLES; i++) {
+      start = ticks ();
+      if (!(fn (ctx, batch)))
+         goto errorexit;
+      elapsed = ticks () - start;
+      samples[i] = elapsed * ns_per_tick / batch;
+   }
+
+   netcode_util_alloc_debug (true);
+   uint64_t allocs = netcode_util_alloc_count ();
+   bool ok = fn (ctx, batch);
+   allocs = netcode_util_alloc_count () - allocs;
+   netcode_util_alloc_debug (false);
+   if (!ok)
+      goto errorexit;
+
+   double med = median (samples, SAMPLES);
+   for (size_t i=0; i<SAMPLES; i++) {
+      samples[i] = samples[i] > med ? samples[i] - med : med - samples[i];
+   }
+   double mad = median (samples, SAMPLES);
+
+   printf ("%-36s %12.1f %10.1f %12.2f %9zu\n", name, med, mad, (double)allocs / batch, batch);
+   return true;
+
+errorexit:
+   NETCODE_UTIL_LOG ("Benchmark %s failed\n", name);
+   return false;
+}
+
+static void print_header (const char *title)
+{
+   printf ("\n%s\n", title);
+   printf ("%-36s %12s %10s %12s %9s\n", "function", "ns/op", "MAD", "allocs/op", "batch");
+}
+
+/* ***************************************************************** */
+/* The utility functions. */
+
+struct util_ctx_t {
+   netcode_addr_t v4;
+   netcode_addr_t v6;
+   const char *v4_str;
+   const char *v6_str;
+};
+
+static bool sockaddr_to_str (const netcode_addr_t *addr, size_t n)
+{
+   for (size_t i=0; i<n; i++) {
+      char *str = netcode_util_sockaddr_to_str ((const struct sockaddr *)&addr->sa);
+      if (!str)
+         return false;
+      sink += (uintptr_t)str[0];
+      netcode_util_free (str);
+   }
+   return true;
+}
+
+static bool sockaddr_to_str_v4 (void *ctx, size_t n)
+{
+   return sockaddr_to_str (&((struct util_ctx_t *)ctx)->v4, n);
+}
+
+static bool sockaddr_to_str_v6 (void *ctx, size_t n)
+{
+   return sockaddr_to_str (&((struct util_ctx_t *)ctx)->v6, n);
+}
+
+static bool addr_format (const netcode_addr_t *addr, size_t n)
+{
+   char str[NETCODE_ADDR_STRLEN];
+
+   for (size_t i=0; i<n; i++) {
+      if (!(netcode_util_addr_format ((const struct sockaddr *)&addr->sa, str, sizeof str)))
+         return false;
+      sink += (uintptr_t)str[0];
+   }
+   return true;
+}
+
+static bool addr_format_v4 (void *ctx, size_t n)
+{
+   return addr_format (&((struct util_ctx_t *)ctx)->v4, n);
+}
+
+static bool addr_format_v6 (void *ctx, size_t n)
+{
+   return addr_format (&((struct util_ctx_t *)ctx)->v6, n);
+}
+
+static bool addr_parse (const char *str, size_t n)
+{
+   netcode_addr_t addr;
+
+   for (size_t i=0; i<n; i++) {
+      if (!(netcode_util_addr_parse (str, &addr)))
+         return false;
+      sink += addr.salen;
+   }
+   return true;
+}
+
+static bool addr_parse_v4 (void *ctx, size_t n)
+{
+   return addr_parse (((struct util_ctx_t *)ctx)->v4_str, n);
+}
+
+static bool addr_parse_v6 (void *ctx, size_t n)
+{
+   return addr_parse (((struct util_ctx_t *)ctx)->v6_str, n);
+}
+
+static bool time_ns (void *ctx, size_t n)
+{
+   (void)ctx;
+   for (size_t i=0; i<n; i++) {
+      sink += netcode_util_time_ns ();
+   }
+   return true;
+}
+
+static bool malloc_free (void *ctx, size_t n)
+{
+   (void)ctx;
+   for (size_t i=0; i<n; i++) {
+      void *p = netcode_util_malloc (64);
+      if (!p)
+         return false;
+      sink += (uintptr_t)p;
+      netcode_util_free (p);
+   }
+   return true;
+}
+
+static bool util_bench (void)
+{
+   struct util_ctx_t ctx = { .v4_str = "192.0.2.123:8080", .v6_str = "[2001:db8:55::1]:8080" };
+
+   if (!(netcode_addr_parse (&ctx.v4, ctx.v4_str)) ||
+       !(netcode_addr_parse (&ctx.v6, ctx.v6_str))) {
+      NETCODE_UTIL_LOG ("Failed to parse the benchmark addresses\n");
+      return false;
+   }
+
+   print_header ("Utility functions");
+
+   return measure ("netcode_util_sockaddr_to_str (v4)", sockaddr_to_str_v4, &ctx) &&
+          measure ("netcode_util_sockaddr_to_str (v6)", sockaddr_to_str_v6, &ctx) &&
+          measure ("netcode_util_addr_format (v4)", addr_format_v4, &ctx) &&
+          measure ("netcode_util_addr_format (v6)", addr_format_v6, &ctx) &&
+          measure ("netcode_util_addr_parse (v4)", addr_parse_v4, &ctx) &&
+          measure ("netcode_util_addr_parse (v6)", addr_parse_v6, &ctx) &&
+          measure ("netcode_util_time_ns", time_ns, NULL) &&
+          measure ("netcode_util_malloc/free (64)", malloc_free, NULL);
+}
+
+/* ***************************************************************** */
+/* The interface functions. The per-entry benchmarks take one entry per
+ * call, cycling through the list.
+ */
+
+struct if_ctx_t {
+   netcode_if_t **list;
+   size_t count;
+   size_t next;
+   uint32_t ifindex;          // Of the first entry that has one
+};
+
+static const netcode_if_t *next_entry (struct if_ctx_t *ctx)
+{
+   const netcode_if_t *ret = ctx->list[ctx->next++];
+   if (ctx->next == ctx->count)
+      ctx->next = 0;
+   return ret;
+}
+
+static bool if_list_new (void *ctx, size_t n)
+{
+   (void)ctx;
+   for (size_t i=0; i<n; i++) {
+      netcode_if_t **list = netcode_if_list_new ();
+      if (!list)
+         return false;
+      sink += (uintptr_t)list[0];
+      netcode_if_list_del (list);
+   }
+   return true;
+}
+
+static bool if_extract (void *ctx, size_t n)
+{
+   for (size_t i=0; i<n; i++) {
+      uint64_t flags = 0;
+      char *name = NULL, *addr = NULL, *netmask = NULL, *broadcast = NULL, *p2paddr = NULL;
+
+      bool ok = netcode_if_extract (next_entry (ctx), &flags,
+                                    &name, &addr, &netmask, &broadcast, &p2paddr);
+      sink += flags;
+      netcode_util_free (name);
+      netcode_util_free (addr);
+      netcode_util_free (netmask);
+      netcode_util_free (broadcast);
+      netcode_util_free (p2paddr);
+      if (!ok)
+         return false;
+   }
+   return true;
+}
+
+static bool if_accessors (void *ctx, size_t n)
+{
+   for (size_t i=0; i<n; i++) {
+      const netcode_if_t *iface = next_entry (ctx);
+      size_t salen = 0;
+
+      sink += (uintptr_t)netcode_if_name_view (iface) +
+              netcode_if_flags (iface) +
+              (uintptr_t)netcode_if_addr_sa (iface, &salen) + salen +
+              netcode_if_prefixlen (iface) +
+              netcode_if_index (iface) +
+              netcode_if_mtu (iface);
+   }
+   return true;
+}
+
+static bool if_stats (void *ctx, size_t n)
+{
+   for (size_t i=0; i<n; i++) {
+      netcode_if_stats_t stats;
+      if (!(netcode_if_stats (NULL, ((struct if_ctx_t *)ctx)->ifindex, &stats)))
+         return false;
+      sink += stats.rx_packets;
+   }
+   return true;
+}
+
+static bool if_monitor_new (void *ctx, size_t n)
+{
+   (void)ctx;
+   for (size_t i=0; i<n; i++) {
+      netcode_if_monitor_t *monitor = netcode_if_monitor_new ();
+      if (!monitor)
+         return false;
+      sink += netcode_if_monitor_generation (monitor);
+      netcode_if_monitor_del (monitor);
+   }
+   return true;
+}
+
+static bool if_bench (const char *where)
+{
+   struct if_ctx_t ctx = { NULL, 0, 0, 0 };
+   char title[128];
+   bool ret = false;
+
+   if (!(ctx.list = netcode_if_list_new ())) {
+      NETCODE_UTIL_LOG ("Failed to list the interfaces\n");
+      return false;
+   }
+   for (ctx.count = 0; ctx.list[ctx.count]; ctx.count++) {
+      if (!ctx.ifindex)
+         ctx.ifindex = netcode_if_index (ctx.list[ctx.count]);
+   }
+   if (!ctx.count) {
+      NETCODE_UTIL_LOG ("No interfaces to measure\n");
+      goto errorexit;
+   }
+
+   snprintf (title, sizeof title, "Interface functions (%s, %zu entries)", where, ctx.count);
+   print_header (title);
+
+   ret = measure ("netcode_if_list_new/del", if_list_new, NULL) &&
+         measure ("netcode_if_extract (per entry)", if_extract, &ctx) &&
+         measure ("netcode_if_* accessors (per entry)", if_accessors, &ctx) &&
+         (!ctx.ifindex || measure ("netcode_if_stats", if_stats, &ctx)) &&
+         measure ("netcode_if_monitor_new/del", if_monitor_new, NULL);
+
+errorexit:
+   netcode_if_list_del (ctx.list);
+   return ret;
+}
+
+/* ***************************************************************** */
+/* The network namespace. */
+
+#ifdef __linux__
+
+struct nl_req_t {
+   struct nlmsghdr   nh;
+   uint8_t           body[512];
+};
+
+static struct rtattr *nl_attr (struct nl_req_t *req, uint16_t type, const void *data, size_t len)
+{
+   struct rtattr *rta = (struct rtattr *)((uint8_t *)req + NLMSG_ALIGN (req->nh.nlmsg_len));
+   rta->rta_type = type;
+   rta->rta_len = RTA_LENGTH (len);
+   if (len)
+      memcpy (RTA_DATA (rta), data, len);
+   req->nh.nlmsg_len = NLMSG_ALIGN (req->nh.nlmsg_len) + RTA_ALIGN (rta->rta_len);
+   return rta;
+}
+
+// RETURNS: zero, or the errno that the kernel replied with.
+static int nl_send (int fd, struct nl_req_t *req)
+{
+   struct {
+      struct nlmsghdr   nh;
+      struct nlmsgerr   err;
+   } resp;
+
+   req->nh.nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+   if (send (fd, req, req->nh.nlmsg_len, 0) != (ssize_t)req->nh.nlmsg_len ||
+       recv (fd, &resp, sizeof resp, 0) < (ssize_t)sizeof resp ||
+       resp.nh.nlmsg_type != NLMSG_ERROR)
+      return EIO;
+
+   return -resp.err.error;
+}
+
+static int ns_add_link (int fd, const char *kind, const char *name)
+{
+   struct nl_req_t req;
+   struct ifinfomsg ifi;
+
+   memset (&req, 0, sizeof req);
+   memset (&ifi, 0, sizeof ifi);
+   ifi.ifi_family = AF_UNSPEC;
+   ifi.ifi_flags = IFF_UP;
+   ifi.ifi_change = IFF_UP;
+
+   req.nh.nlmsg_len = NLMSG_LENGTH (sizeof ifi);
+   req.nh.nlmsg_type = RTM_NEWLINK;
+   req.nh.nlmsg_flags = NLM_F_CREATE | NLM_F_EXCL;
+   memcpy (NLMSG_DATA (&req.nh), &ifi, sizeof ifi);
+
+   nl_attr (&req, IFLA_IFNAME, name, strlen (name) + 1);
+   struct rtattr *linkinfo = nl_attr (&req, IFLA_LINKINFO, NULL, 0);
+   nl_attr (&req, IFLA_INFO_KIND, kind, strlen (kind));
+   linkinfo->rta_len = (uint16_t)((uint8_t *)&req + req.nh.nlmsg_len - (uint8_t *)linkinfo);
+
+   return nl_send (fd, &req);
+}
+
+static int ns_add_addr (int fd, uint32_t ifindex, int family, const void *addr, size_t len,
+                        uint8_t prefixlen)
+{
+   struct nl_req_t req;
+   struct ifaddrmsg ifa;
+
+   memset (&req, 0, sizeof req);
+   memset (&ifa, 0, sizeof ifa);
+   ifa.ifa_family = (uint8_t)family;
+   ifa.ifa_prefixlen = prefixlen;
+   ifa.ifa_flags = IFA_F_NODAD;
+   ifa.ifa_index = ifindex;
+
+   req.nh.nlmsg_len = NLMSG_LENGTH (sizeof ifa);
+   req.nh.nlmsg_type = RTM_NEWADDR;
+   req.nh.nlmsg_flags = NLM_F_CREATE | NLM_F_EXCL;
+   memcpy (NLMSG_DATA (&req.nh), &ifa, sizeof ifa);
+
+   nl_attr (&req, IFA_LOCAL, addr, len);
+   nl_attr (&req, IFA_ADDRESS, addr, len);
+
+   return nl_send (fd, &req);
+}
+
+/* Moves the process into a new network namespace and creates 'nlinks'
+ * links in it, each with an address in 10.55.0.0/16 and its own /64 in
+ * fd55::/48.
+ * The links are dummies; kernels built without the dummy driver get
+ * bridges, which list the same way. '*kind' is set to the one used.
+ *
+ * RETURNS: zero, or an errno value.
+ */
+static int ns_populate (size_t nlinks, const char **kind)
+{
+   static const char *kinds[] = { "dummy", "bridge" };
+   size_t k = 0;
+   int ret = 0;
+   int fd = -1;
+
+   if (unshare (CLONE_NEWNET) != 0)
+      return errno;
+
+   if ((fd = socket (AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) < 0)
+      return errno;
+
+   for (size_t i=0; i<nlinks; i++) {
+      char name[IF_NAMESIZE];
+      snprintf (name, sizeof name, "ncbench%hu", (unsigned short)i);
+
+      while ((ret = ns_add_link (fd, kinds[k], name)) == EOPNOTSUPP &&
+             k + 1 < sizeof kinds / sizeof kinds[0]) {
+         k++;
+      }
+      if (ret != 0)
+         goto errorexit;
+
+      uint32_t ifindex = if_nametoindex (name);
+      uint8_t v4[4] = { 10, 55, (uint8_t)(1 + i / 250), (uint8_t)(1 + i % 250) };
+      uint8_t v6[16] = { 0xfd, 0x55 };
+      v6[6] = (uint8_t)(i >> 8);
+      v6[7] = (uint8_t)i;
+      v6[15] = 1;
+
+      if ((ret = ns_add_addr (fd, ifindex, AF_INET, v4, sizeof v4, 16)) != 0 ||
+          (ret = ns_add_addr (fd, ifindex, AF_INET6, v6, sizeof v6, 64)) != 0)
+         goto errorexit;
+   }
+
+   *kind = kinds[k];
+
+errorexit:
+   close (fd);
+   return ret;
+}
+
+#endif
+
+static bool ns_bench (void)
+{
+#ifdef __linux__
+   const char *kind = NULL;
+   char where[64];
+
+   int rc = ns_populate (NS_LINKS, &kind);
+   if (rc == EPERM || rc == EACCES) {
+      printf ("\nSkipping the namespace benchmarks: not permitted to create a "
+              "network namespace\n");
+      return true;
+   }
+   if (rc == EOPNOTSUPP) {
+      printf ("\nSkipping the namespace benchmarks: the kernel cannot create "
+              "dummy or bridge links\n");
+      return true;
+   }
+   if (rc != 0) {
+      NETCODE_UTIL_LOG ("Failed to populate the network namespace: %s\n",
+                        netcode_util_strerror (rc));
+      return false;
+   }
+
+   snprintf (where, sizeof where, "namespace with %i %s links", NS_LINKS, kind);
+   return if_bench (where);
+#else
+   printf ("\nSkipping the namespace benchmarks: not supported on this platform\n");
+   return true;
+#endif
+}
+
+int main (void)
+{
+   if (!(netcode_util_init ())) {
+      NETCODE_UTIL_LOG ("Failed to initialise netcode\n");
+      return EXIT_FAILURE;
+   }
+
+   calibrate ();
+   printf ("Timer: %s, %.3f ns per tick\n", HAVE_TSC ? "TSC" : "clock", ns_per_tick);
+
+   if (!(util_bench ()) ||
+       !(if_bench ("host")) ||
+       !(ns_bench ()))
+      return EXIT_FAILURE;
+
+   return EXIT_SUCCESS;
+}
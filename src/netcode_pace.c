@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "netcode_util.h"
+#include "netcode_log.h"
+#include "netcode_pace.h"
+
+/* ***************************************************************** */
+#ifdef PLATFORM_Windows
+#include <winsock2.h>
+#include <windows.h>
+
+typedef int socklen_t;
+
+#endif
+
+/* ***************************************************************** */
+#ifdef PLATFORM_POSIX
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#ifdef __linux__
+#ifndef SO_MAX_PACING_RATE
+#define SO_MAX_PACING_RATE    (47)
+#endif
+#endif
+
+#endif
+
+// Number of destinations that a user-mode pacer tracks, and how many
+// slots are probed to find a destination before the least recently used
+// of them is reused.
+#define PACE_SLOTS            (256)
+#define PACE_PROBES           (8)
+
+#define NSEC_PER_SEC          (1000000000ULL)
+
+struct bucket_t {
+   netcode_addr_t    dest;
+   uint64_t          last;       // ns; zero for an unused slot
+   double            tokens;     // bytes; negative when in debt
+};
+
+struct netcode_pace_t {
+   int               fd;
+   int               mode;
+   uint64_t          rate;
+   double            burst;
+   struct bucket_t  *buckets;
+};
+
+/* ***************************************************************** */
+static bool set_kernel_rate (int fd, uint64_t rate)
+{
+#ifdef SO_MAX_PACING_RATE
+   // The option is 32 bits wide on kernels before 4.20, and ~0U means
+   // unlimited. Rates that fit are always set as 32 bits, which every
+   // kernel takes. Older kernels also accept a 64-bit value, but they
+   // silently read only its first 32 bits. Larger rates are therefore
+   // read back, and are clamped to just under ~0U if the kernel did not
+   // keep all of them.
+   uint32_t rate32 = rate >= UINT32_MAX ? UINT32_MAX - 1 : (uint32_t)rate;
+
+   if (rate < UINT32_MAX) {
+      if (setsockopt (fd, SOL_SOCKET, SO_MAX_PACING_RATE,
+                      (const void *)&rate32, sizeof rate32) == 0)
+         return true;
+      goto errorexit;
+   }
+
+   uint64_t rate64 = rate, readback = 0;
+   socklen_t len = sizeof readback;
+   if (setsockopt (fd, SOL_SOCKET, SO_MAX_PACING_RATE,
+                   (const void *)&rate64, sizeof rate64) == 0 &&
+       getsockopt (fd, SOL_SOCKET, SO_MAX_PACING_RATE, (void *)&readback, &len) == 0 &&
+       len == sizeof readback && readback == rate64)
+      return true;
+
+   NETCODE_LOG (NETCODE_LOG_WARN, "Kernel pacing rate is 32 bits; clamping %" PRIu64
+                                  " to %" PRIu32 " bytes/s\n", rate, rate32);
+   if (setsockopt (fd, SOL_SOCKET, SO_MAX_PACING_RATE,
+                   (const void *)&rate32, sizeof rate32) == 0)
+      return true;
+
+errorexit:
+   NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to set SO_MAX_PACING_RATE: %s\n",
+                                   netcode_util_strerror (netcode_util_errno ()));
+   return false;
+#else
+   (void)fd;
+   (void)rate;
+   NETCODE_LOG (NETCODE_LOG_ERROR, "Kernel pacing is not supported on this platform\n");
+   return false;
+#endif
+}
+
+static bool socket_is_stream (int fd)
+{
+   int type = 0;
+   socklen_t len = sizeof type;
+
+   if (getsockopt (fd, SOL_SOCKET, SO_TYPE, (void *)&type, &len) != 0)
+      return false;
+   return type == SOCK_STREAM;
+}
+
+/* UDP sockets are only paced by the kernel when their packets go through
+ * the 'fq' qdisc. Checking the qdisc of every interface that a socket
+ * might use is expensive, so this settles for the system default, which
+ * is what new interfaces get.
+ */
+static bool default_qdisc_is_fq (void)
+{
+   bool ret = false;
+#ifdef __linux__
+   char qdisc[16] = "";
+   FILE *inf = fopen ("/proc/sys/net/core/default_qdisc", "r");
+   if (inf) {
+      ret = fgets (qdisc, sizeof qdisc, inf) && strncmp (qdisc, "fq\n", 3) == 0;
+      fclose (inf);
+   }
+#endif
+   return ret;
+}
+
+/* Finds the bucket for 'dest', claiming a free or the least recently
+ * used slot in its probe window when it has none.
+ */
+static struct bucket_t *find_bucket (netcode_pace_t *pace, const netcode_addr_t *dest,
+                                     uint64_t now)
+{
+   static const netcode_addr_t connected;
+   struct bucket_t *victim = NULL;
+
+   if (!dest)
+      dest = &connected;
+
+   uint32_t hash = netcode_addr_hash (dest);
+   for (size_t i=0; i<PACE_PROBES; i++) {
+      struct bucket_t *b = &pace->buckets[(hash + i) % PACE_SLOTS];
+      if (b->last && netcode_addr_cmp (&b->dest, dest) == 0)
+         return b;
+      if (!victim || b->last < victim->last)
+         victim = b;
+   }
+
+   victim->dest = *dest;
+   victim->last = now;
+   victim->tokens = pace->burst;
+   return victim;
+}
+
+/* ***************************************************************** */
+netcode_pace_t *netcode_pace_new (int fd, uint64_t rate, size_t burst, int mode)
+{
+   netcode_pace_t *ret = NULL;
+
+   if (rate == 0) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Pacing rate must be greater than zero\n");
+      return NULL;
+   }
+
+   if (mode == NETCODE_PACE_AUTO) {
+#ifdef SO_MAX_PACING_RATE
+      mode = socket_is_stream (fd) || default_qdisc_is_fq ()
+           ? NETCODE_PACE_KERNEL
+           : NETCODE_PACE_USER;
+#else
+      mode = NETCODE_PACE_USER;
+#endif
+   }
+
+   if (mode != NETCODE_PACE_KERNEL && mode != NETCODE_PACE_USER) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Invalid pacing mode %i\n", mode);
+      return NULL;
+   }
+
+   if (!(ret = netcode_util_calloc (1, sizeof *ret))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating pacer\n");
+      return NULL;
+   }
+
+   ret->fd = fd;
+   ret->mode = mode;
+   ret->rate = rate;
+   ret->burst = burst ? (double)burst : (double)rate / 100.0;
+   if (ret->burst < 1500.0)
+      ret->burst = 1500.0;
+
+   if (mode == NETCODE_PACE_KERNEL) {
+      if (!(set_kernel_rate (fd, rate)))
+         goto errorexit;
+   } else {
+      if (!(ret->buckets = netcode_util_calloc (PACE_SLOTS, sizeof *ret->buckets))) {
+         NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating %i pacing buckets\n", PACE_SLOTS);
+         goto errorexit;
+      }
+   }
+
+   return ret;
+
+errorexit:
+   netcode_pace_del (ret);
+   return NULL;
+}
+
+void netcode_pace_del (netcode_pace_t *pace)
+{
+   if (!pace)
+      return;
+
+   netcode_util_free (pace->buckets);
+   netcode_util_free (pace);
+}
+
+int netcode_pace_mode (const netcode_pace_t *pace)
+{
+   return pace ? pace->mode : NETCODE_PACE_USER;
+}
+
+bool netcode_pace_set_rate (netcode_pace_t *pace, uint64_t rate)
+{
+   if (!pace || rate == 0)
+      return false;
+
+   if (pace->mode == NETCODE_PACE_KERNEL && !(set_kernel_rate (pace->fd, rate)))
+      return false;
+
+   pace->rate = rate;
+   return true;
+}
+
+uint64_t netcode_pace_delay (netcode_pace_t *pace, const netcode_addr_t *dest,
+                             size_t len)
+{
+   if (!pace || pace->mode == NETCODE_PACE_KERNEL)
+      return 0;
+
+   uint64_t now = netcode_util_time_ns ();
+   struct bucket_t *b = find_bucket (pace, dest, now);
+
+   b->tokens += (double)(now - b->last) * pace->rate / NSEC_PER_SEC;
+   if (b->tokens > pace->burst)
+      b->tokens = pace->burst;
+   b->last = now;
+
+   // Sends larger than the burst are let through once the bucket is
+   // full, leaving it in debt, so that they do not wait forever.
+   double need = (double)len < pace->burst ? (double)len : pace->burst;
+   if (b->tokens >= need) {
+      b->tokens -= (double)len;
+      return 0;
+   }
+
+   uint64_t ret = (uint64_t)((need - b->tokens) * NSEC_PER_SEC / pace->rate);
+   return ret ? ret : 1;
+}
+
+void netcode_pace_wait (netcode_pace_t *pace, const netcode_addr_t *dest, size_t len)
+{
+   uint64_t delay;
+
+   while ((delay = netcode_pace_delay (pace, dest, len)) != 0)
+      netcode_util_sleep_ns (delay);
+}
+
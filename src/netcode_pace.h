@@ -0,0 +1,83 @@
+
+#ifndef H_NETCODE_PACE
+#define H_NETCODE_PACE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "netcode_addr.h"
+
+// How a pacer limits the sending rate. See netcode_pace_new().
+#define NETCODE_PACE_AUTO           (0)
+#define NETCODE_PACE_KERNEL         (1)
+#define NETCODE_PACE_USER           (2)
+
+/* Smooths bursts of sends on a socket down to a configured rate, so that
+ * a burst does not overflow the queues of switches along the path.
+ *
+ * In kernel mode the rate is set on the socket with SO_MAX_PACING_RATE
+ * (Linux) and the kernel spaces out the packets itself; the wait and
+ * delay functions then always return immediately.
+ *
+ * In user mode every destination has its own token bucket of 'burst'
+ * bytes that refills at 'rate' bytes per second, and the caller must
+ * call netcode_pace_wait() (or netcode_pace_delay()) before each send.
+ * The pacer holds buckets for a bounded number of destinations; the
+ * least recently used bucket is reused when the table is full.
+ *
+ * A pacer is not thread-safe. Use one per sending thread.
+ */
+typedef struct netcode_pace_t netcode_pace_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Creates a pacer for the UDP or TCP socket 'fd' that limits sends
+   // to 'rate' bytes per second with bursts of at most 'burst' bytes
+   // (zero selects a burst of 10ms worth of data, and at least 1500
+   // bytes).
+   //
+   // 'mode' is one of:
+   //    NETCODE_PACE_KERNEL: use SO_MAX_PACING_RATE. Only UDP sockets
+   //       that send through an 'fq' qdisc are paced by the kernel; TCP
+   //       sockets are paced by TCP itself on Linux 4.13 and later.
+   //    NETCODE_PACE_USER: use userspace token buckets, one per
+   //       destination.
+   //    NETCODE_PACE_AUTO: kernel mode for TCP sockets and for UDP
+   //       sockets when the system's default qdisc is 'fq', otherwise
+   //       user mode.
+   //
+   // RETURNS: NULL on error, or if kernel mode was requested and the
+   // platform does not support it.
+   netcode_pace_t *netcode_pace_new (int fd, uint64_t rate, size_t burst, int mode);
+   void netcode_pace_del (netcode_pace_t *pace);
+
+   // Returns NETCODE_PACE_KERNEL or NETCODE_PACE_USER.
+   int netcode_pace_mode (const netcode_pace_t *pace);
+
+   // Changes the rate of the pacer, keeping the burst size.
+   //
+   // RETURNS: true on success, false on error.
+   bool netcode_pace_set_rate (netcode_pace_t *pace, uint64_t rate);
+
+   // Returns the number of nanoseconds that must pass before 'len'
+   // bytes may be sent to 'dest' (NULL for a connected socket's peer).
+   // When zero is returned the bytes are taken from the destination's
+   // bucket and the caller should send immediately; otherwise nothing
+   // is taken and the caller should try again after the delay. This
+   // suits callers with their own event loop.
+   uint64_t netcode_pace_delay (netcode_pace_t *pace, const netcode_addr_t *dest,
+                                size_t len);
+
+   // Sleeps until 'len' bytes may be sent to 'dest' and takes them from
+   // the destination's bucket.
+   void netcode_pace_wait (netcode_pace_t *pace, const netcode_addr_t *dest, size_t len);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
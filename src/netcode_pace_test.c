@@ -0,0 +1,210 @@
+#ifdef PLATFORM_POSIX
+#define _GNU_SOURCE
+#include <time.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#ifndef SO_MAX_PACING_RATE
+#define SO_MAX_PACING_RATE    (47)
+#endif
+#endif
+
+#include "netcode_util.h"
+#include "netcode_tcp.h"
+#include "netcode_udp.h"
+#include "netcode_pace.h"
+
+#define RATE            (200000)
+#define BURST           (2000)
+#define DGRAM_SIZE      (1000)
+#define NDGRAMS         (20)
+
+static double now (void)
+{
+#ifdef PLATFORM_POSIX
+   struct timespec ts;
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+   return (double)clock () / CLOCKS_PER_SEC;
+#endif
+}
+
+static bool user_test (void)
+{
+   bool ret = false;
+   int rxfd = -1, txfd = -1;
+   netcode_pace_t *pace = NULL;
+   netcode_addr_t dest, other, alias;
+   static uint8_t payload[DGRAM_SIZE];
+
+   netcode_addr_parse (&dest, "127.0.0.1");
+   netcode_addr_set_port (&dest, NETCODE_TEST_PACE_PORT);
+   netcode_addr_parse (&other, "127.0.0.1");
+   netcode_addr_set_port (&other, NETCODE_TEST_PACE_PORT + 1);
+
+   if ((rxfd = netcode_udp_socket (NETCODE_TEST_PACE_PORT, NULL)) < 0 ||
+       (txfd = netcode_udp_socket (0, NULL)) < 0) {
+      NETCODE_UTIL_LOG ("Failed to create sockets\n");
+      goto errorexit;
+   }
+
+   if (!(pace = netcode_pace_new (txfd, RATE, BURST, NETCODE_PACE_USER))) {
+      NETCODE_UTIL_LOG ("Failed to create pacer\n");
+      goto errorexit;
+   }
+
+   // The burst goes out immediately, the rest at the configured rate.
+   double start = now ();
+   for (size_t i=0; i<NDGRAMS; i++) {
+      netcode_pace_wait (pace, &dest, DGRAM_SIZE);
+      if (netcode_udp_send_addr (txfd, &dest, payload, (size_t)DGRAM_SIZE, NULL) != DGRAM_SIZE) {
+         NETCODE_UTIL_LOG ("Failed to send datagram %zu\n", i);
+         goto errorexit;
+      }
+   }
+   double elapsed = now () - start;
+   double expected = (double)(NDGRAMS * DGRAM_SIZE - BURST) / RATE;
+   printf ("PACE: sent %i bytes in %.3fs, expected %.3fs\n",
+           NDGRAMS * DGRAM_SIZE, elapsed, expected);
+   if (elapsed < expected * 0.9) {
+      NETCODE_UTIL_LOG ("Sends were not paced\n");
+      goto errorexit;
+   }
+
+   for (size_t i=0; i<NDGRAMS; i++) {
+      uint8_t *buf = NULL;
+      size_t buflen = 0;
+      netcode_addr_t from;
+      size_t rc = netcode_udp_wait_addr (rxfd, &from, &buf, &buflen, 1);
+      free (buf);
+      if (rc != DGRAM_SIZE) {
+         NETCODE_UTIL_LOG ("Datagram %zu was lost\n", i);
+         goto errorexit;
+      }
+   }
+
+   // The first destination's bucket is empty; another destination
+   // must not be held back by it.
+   if (netcode_pace_delay (pace, &dest, DGRAM_SIZE) == 0) {
+      NETCODE_UTIL_LOG ("Empty bucket did not delay the send\n");
+      goto errorexit;
+   }
+   // The same destination with junk in the unused part of the address
+   // storage shares the bucket.
+   alias = dest;
+   memset ((uint8_t *)&alias.sa + sizeof alias.sa - 16, 0xa5, 16);
+   if (netcode_pace_delay (pace, &alias, DGRAM_SIZE) == 0) {
+      NETCODE_UTIL_LOG ("Destination with junk padding got its own bucket\n");
+      goto errorexit;
+   }
+   if (netcode_pace_delay (pace, &other, DGRAM_SIZE) != 0) {
+      NETCODE_UTIL_LOG ("Second destination was delayed\n");
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_pace_del (pace);
+   if (rxfd >= 0)
+      netcode_util_close (rxfd);
+   if (txfd >= 0)
+      netcode_util_close (txfd);
+   return ret;
+}
+
+static bool kernel_test (void)
+{
+   bool ret = false;
+   netcode_pace_t *pace = NULL;
+   int fd = netcode_tcp_server (NETCODE_TEST_PACE_PORT);
+
+   if (fd < 0) {
+      NETCODE_UTIL_LOG ("Failed to create TCP socket\n");
+      return false;
+   }
+
+   if (!(pace = netcode_pace_new (fd, RATE, 0, NETCODE_PACE_AUTO))) {
+      NETCODE_UTIL_LOG ("Failed to create pacer\n");
+      goto errorexit;
+   }
+
+#ifdef __linux__
+   if (netcode_pace_mode (pace) != NETCODE_PACE_KERNEL) {
+      NETCODE_UTIL_LOG ("TCP socket was not paced by the kernel\n");
+      goto errorexit;
+   }
+#endif
+   printf ("PACE: TCP socket paced in %s mode\n",
+           netcode_pace_mode (pace) == NETCODE_PACE_KERNEL ? "kernel" : "user");
+
+   if (!(netcode_pace_set_rate (pace, RATE * 2)) ||
+       netcode_pace_delay (pace, NULL, DGRAM_SIZE) != 0) {
+      NETCODE_UTIL_LOG ("Failed to change the rate\n");
+      goto errorexit;
+   }
+
+#ifdef __linux__
+   // A rate over 4 GB/s is kept whole, or clamped on kernels where the
+   // option is 32 bits; it must never wrap around to a small rate.
+   uint64_t fast = 10000000000ULL, readback = 0;
+   socklen_t len = sizeof readback;
+   if (!(netcode_pace_set_rate (pace, fast)) ||
+       getsockopt (fd, SOL_SOCKET, SO_MAX_PACING_RATE, &readback, &len) != 0 ||
+       (len == sizeof readback ? readback != fast : (uint32_t)readback != UINT32_MAX - 1)) {
+      NETCODE_UTIL_LOG ("A 64-bit rate was not kept or clamped (read back %" PRIu64 ")\n",
+                        readback);
+      goto errorexit;
+   }
+   printf ("PACE: 64-bit rate read back as %" PRIu64 "\n", readback);
+#endif
+
+   ret = true;
+
+errorexit:
+   netcode_pace_del (pace);
+   netcode_util_close (fd);
+   return ret;
+}
+
+static int pace_test (void)
+{
+   if (!(user_test ()) || !(kernel_test ()))
+      return EXIT_FAILURE;
+
+   return EXIT_SUCCESS;
+}
+
+int main (void)
+{
+   int ret = EXIT_FAILURE;
+
+   if (!(netcode_util_init ())) {
+      NETCODE_UTIL_LOG ("Failed to initialise netcode\n");
+      goto errorexit;
+   }
+
+   if ((ret = pace_test ())!=EXIT_SUCCESS) {
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      printf ("+++ +++ pace: Test FAILED +++ +++\n");
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      goto errorexit;
+   }
+
+   printf ("**********************************\n");
+   printf ("*** *** pace: Test passed *** ***\n");
+   printf ("**********************************\n");
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   return ret;
+}
+
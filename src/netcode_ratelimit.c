@@ -0,0 +1,463 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "netcode_util.h"
+#include "netcode_log.h"
+#include "netcode_ratelimit.h"
+
+/* ***************************************************************** */
+#ifdef PLATFORM_Windows
+#include <winsock2.h>
+#include <windows.h>
+#include <ws2tcpip.h>
+
+#define YIELD()            SwitchToThread ()
+
+#endif
+
+/* ***************************************************************** */
+#ifdef PLATFORM_POSIX
+#include <sched.h>
+#include <netinet/in.h>
+
+#define YIELD()            sched_yield ()
+
+#endif
+
+/* A bucket is one 64-bit word, so that it can be updated with a single
+ * compare-and-swap: the tokens (in sixteenths) in the top 24 bits and
+ * the time they were last topped up (in microseconds, wrapping every 12
+ * days) in the bottom 40. Zero is a bucket that has never been used,
+ * which is full.
+ */
+#define TIME_BITS       (40)
+#define TIME_MASK       ((1ULL << TIME_BITS) - 1)
+#define UNIT            (16)
+#define MAX_UNITS       ((1ULL << (64 - TIME_BITS)) - 1)
+
+#define SKETCH_DEPTH    (4)
+#define SKETCH_BITS     (12)
+#define SKETCH_WIDTH    (1u << SKETCH_BITS)
+
+struct slot_t {
+   uint64_t key;           // Hash of the source; zero when never used
+   uint64_t state;
+};
+
+struct top_t {
+   uint64_t key;
+   uint64_t count;
+   int      family;
+   uint8_t  bytes[16];
+};
+
+struct netcode_ratelimit_t {
+   double            units_per_us;
+   uint64_t          burst_units;
+
+   struct slot_t    *slots;
+   size_t            mask;
+
+   uint64_t          allowed;
+   uint64_t          limited;
+   uint64_t          untracked;
+
+   uint32_t          sketch[SKETCH_DEPTH][SKETCH_WIDTH];
+
+   char              top_lock;
+   size_t            ntop;
+   uint64_t          top_min;    // Smallest count in a full list
+   struct top_t      top[NETCODE_RATELIMIT_TOP];
+};
+
+static void spin_lock (char *lock)
+{
+   unsigned spins = 0;
+
+   while (__atomic_test_and_set (lock, __ATOMIC_ACQUIRE)) {
+      while (__atomic_load_n (lock, __ATOMIC_RELAXED)) {
+         if (++spins > 100)
+            YIELD ();
+      }
+   }
+}
+
+static void spin_unlock (char *lock)
+{
+   __atomic_clear (lock, __ATOMIC_RELEASE);
+}
+
+/* ***************************************************************** */
+/* The part of the address that identifies the source, and its hash
+ * (never zero).
+ */
+static bool source_key (const struct sockaddr *sa, int *family, uint8_t *bytes,
+                        uint64_t *hash)
+{
+   static const uint8_t v4mapped[12] = { 0,0,0,0, 0,0,0,0, 0,0,0xff,0xff };
+   uint64_t h = 14695981039346656037ULL;
+
+   memset (bytes, 0, 16);
+   switch (sa->sa_family) {
+      case AF_INET:
+         *family = AF_INET;
+         memcpy (bytes, &((const struct sockaddr_in *)sa)->sin_addr, 4);
+         break;
+
+      case AF_INET6: {
+         const uint8_t *a = (const uint8_t *)&((const struct sockaddr_in6 *)sa)->sin6_addr;
+         if (memcmp (a, v4mapped, sizeof v4mapped) == 0) {
+            *family = AF_INET;
+            memcpy (bytes, &a[12], 4);
+         } else {
+            *family = AF_INET6;
+            memcpy (bytes, a, 8);
+         }
+         break;
+      }
+
+      default:
+         return false;
+   }
+
+   h ^= (uint64_t)*family;
+   h *= 1099511628211ULL;
+   for (size_t i=0; i<16; i++) {
+      h ^= bytes[i];
+      h *= 1099511628211ULL;
+   }
+
+   // FNV leaves the low bits poorly mixed, and the table index uses them.
+   h ^= h >> 33;
+   h *= 0xff51afd7ed558ccdULL;
+   h ^= h >> 33;
+
+   *hash = h ? h : 1;
+   return true;
+}
+
+// Tops up the bucket in 'state' as of 'now'.
+static uint64_t bucket_refill (const netcode_ratelimit_t *rl, uint64_t state,
+                               uint64_t now, uint64_t *units)
+{
+   if (state == 0) {
+      *units = rl->burst_units;
+      return now;
+   }
+
+   uint64_t t = state & TIME_MASK;
+   uint64_t elapsed = (now - t) & TIME_MASK;
+   *units = state >> TIME_BITS;
+
+   // Another thread stored a slightly later time than ours.
+   if (elapsed > TIME_MASK / 2)
+      return t;
+
+   double add = (double)elapsed * rl->units_per_us;
+   if ((double)*units + add >= (double)rl->burst_units) {
+      *units = rl->burst_units;
+      return now;
+   }
+
+   // Only the time that earned whole units is used up, so that frequent
+   // checks of a slow bucket do not lose the fractions.
+   uint64_t whole = (uint64_t)add;
+   *units += whole;
+   return (t + (uint64_t)((double)whole / rl->units_per_us)) & TIME_MASK;
+}
+
+static bool bucket_idle (const netcode_ratelimit_t *rl, uint64_t state, uint64_t now)
+{
+   uint64_t units;
+   bucket_refill (rl, state, now, &units);
+   return units >= rl->burst_units;
+}
+
+static bool bucket_take (const netcode_ratelimit_t *rl, uint64_t *state, uint64_t now)
+{
+   uint64_t old = __atomic_load_n (state, __ATOMIC_RELAXED);
+
+   for (;;) {
+      uint64_t units, t = bucket_refill (rl, old, now, &units);
+      bool ret = units >= UNIT;
+      if (ret)
+         units -= UNIT;
+
+      uint64_t new = units << TIME_BITS | t;
+      if (new == 0)
+         new = 1;
+      if (__atomic_compare_exchange_n (state, &old, new, true,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+         return ret;
+   }
+}
+
+static uint64_t *bucket_find (netcode_ratelimit_t *rl, uint64_t key, uint64_t now)
+{
+   struct slot_t *victim = NULL;
+   uint64_t victim_key = 0;
+
+   for (size_t p=0; p<NETCODE_RATELIMIT_PROBES; p++) {
+      struct slot_t *slot = &rl->slots[(key + p) & rl->mask];
+      uint64_t k = __atomic_load_n (&slot->key, __ATOMIC_ACQUIRE);
+
+      if (k == 0) {
+         if (__atomic_compare_exchange_n (&slot->key, &k, key, false,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return &slot->state;
+      }
+      if (k == key)
+         return &slot->state;
+
+      if (!victim && bucket_idle (rl, __atomic_load_n (&slot->state, __ATOMIC_RELAXED), now)) {
+         victim = slot;
+         victim_key = k;
+      }
+   }
+
+   // A full bucket can be given to another source without anyone
+   // noticing.
+   if (victim && __atomic_compare_exchange_n (&victim->key, &victim_key, key, false,
+                                              __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+      __atomic_store_n (&victim->state, 0, __ATOMIC_RELAXED);
+      return &victim->state;
+   }
+   return NULL;
+}
+
+/* ***************************************************************** */
+static uint64_t sketch_add (netcode_ratelimit_t *rl, uint64_t key)
+{
+   static const uint64_t seeds[SKETCH_DEPTH] = {
+      0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL,
+      0x165667b19e3779f9ULL, 0xd6e8feb86659fd93ULL,
+   };
+   uint64_t est = UINT64_MAX;
+
+   for (size_t d=0; d<SKETCH_DEPTH; d++) {
+      size_t idx = (size_t)((key * seeds[d]) >> (64 - SKETCH_BITS));
+      uint64_t v = __atomic_add_fetch (&rl->sketch[d][idx], 1, __ATOMIC_RELAXED);
+      if (v < est)
+         est = v;
+   }
+   return est;
+}
+
+static void top_recompute_min (netcode_ratelimit_t *rl)
+{
+   uint64_t min = 0;
+
+   if (rl->ntop == NETCODE_RATELIMIT_TOP) {
+      min = UINT64_MAX;
+      for (size_t i=0; i<rl->ntop; i++) {
+         if (rl->top[i].count < min)
+            min = rl->top[i].count;
+      }
+   }
+   __atomic_store_n (&rl->top_min, min, __ATOMIC_RELAXED);
+}
+
+static void top_update (netcode_ratelimit_t *rl, uint64_t key, uint64_t est,
+                        int family, const uint8_t *bytes)
+{
+   // Most limited sources are not in the running, and never take the
+   // lock.
+   if (est <= __atomic_load_n (&rl->top_min, __ATOMIC_RELAXED))
+      return;
+
+   spin_lock (&rl->top_lock);
+
+   size_t i, victim = 0;
+   for (i=0; i<rl->ntop; i++) {
+      if (rl->top[i].key == key)
+         break;
+      if (rl->top[i].count < rl->top[victim].count)
+         victim = i;
+   }
+
+   if (i < rl->ntop) {
+      if (est > rl->top[i].count)
+         rl->top[i].count = est;
+   } else {
+      if (rl->ntop < NETCODE_RATELIMIT_TOP)
+         victim = rl->ntop++;
+      else if (est <= rl->top[victim].count)
+         victim = NETCODE_RATELIMIT_TOP;
+
+      if (victim < NETCODE_RATELIMIT_TOP) {
+         rl->top[victim].key = key;
+         rl->top[victim].count = est;
+         rl->top[victim].family = family;
+         memcpy (rl->top[victim].bytes, bytes, sizeof rl->top[victim].bytes);
+      }
+   }
+
+   top_recompute_min (rl);
+   spin_unlock (&rl->top_lock);
+}
+
+/* ***************************************************************** */
+netcode_ratelimit_t *netcode_ratelimit_new (double rate, double burst, size_t slots)
+{
+   netcode_ratelimit_t *ret = NULL;
+   size_t nslots = 1;
+
+   if (!(rate > 0) || burst < 1 || burst * UNIT > (double)MAX_UNITS) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Invalid rate (%f) or burst (%f)\n", rate, burst);
+      return NULL;
+   }
+
+   if (!slots)
+      slots = NETCODE_RATELIMIT_SLOTS;
+   while (nslots < slots)
+      nslots <<= 1;
+
+   if (!(ret = netcode_util_calloc (1, sizeof *ret)) ||
+       !(ret->slots = netcode_util_calloc (nslots, sizeof *ret->slots))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating rate limiter of %zu slots\n", nslots);
+      netcode_util_free (ret);
+      return NULL;
+   }
+
+   ret->mask = nslots - 1;
+   ret->units_per_us = rate * UNIT / 1e6;
+   ret->burst_units = (uint64_t)(burst * UNIT);
+   return ret;
+}
+
+void netcode_ratelimit_del (netcode_ratelimit_t *rl)
+{
+   if (!rl)
+      return;
+   netcode_util_free (rl->slots);
+   netcode_util_free (rl);
+}
+
+bool netcode_ratelimit_check (netcode_ratelimit_t *rl, const struct sockaddr *sa)
+{
+   uint8_t bytes[16];
+   uint64_t key, *state;
+   int family;
+
+   if (!rl || !sa || !(source_key (sa, &family, bytes, &key)))
+      return true;
+
+   uint64_t now = (netcode_util_time_ns () / 1000) & TIME_MASK;
+   if (!(state = bucket_find (rl, key, now))) {
+      __atomic_add_fetch (&rl->untracked, 1, __ATOMIC_RELAXED);
+      return true;
+   }
+
+   if (bucket_take (rl, state, now)) {
+      __atomic_add_fetch (&rl->allowed, 1, __ATOMIC_RELAXED);
+      return true;
+   }
+
+   __atomic_add_fetch (&rl->limited, 1, __ATOMIC_RELAXED);
+   top_update (rl, key, sketch_add (rl, key), family, bytes);
+   return false;
+}
+
+bool netcode_ratelimit_check_addr (netcode_ratelimit_t *rl, const netcode_addr_t *addr)
+{
+   if (netcode_addr_family (addr) == AF_UNSPEC)
+      return true;
+   return netcode_ratelimit_check (rl, netcode_addr_sockaddr (addr, NULL));
+}
+
+size_t netcode_ratelimit_top (netcode_ratelimit_t *rl,
+                              netcode_ratelimit_offender_t *dst, size_t n)
+{
+   struct top_t top[NETCODE_RATELIMIT_TOP];
+   size_t ntop;
+
+   spin_lock (&rl->top_lock);
+   ntop = rl->ntop;
+   memcpy (top, rl->top, ntop * sizeof top[0]);
+   spin_unlock (&rl->top_lock);
+
+   // Insertion sort, most limited first; there are only a few.
+   for (size_t i=1; i<ntop; i++) {
+      struct top_t tmp = top[i];
+      size_t j = i;
+      for (; j>0 && top[j - 1].count < tmp.count; j--) {
+         top[j] = top[j - 1];
+      }
+      top[j] = tmp;
+   }
+
+   if (n > ntop)
+      n = ntop;
+   for (size_t i=0; i<n; i++) {
+      memset (&dst[i].addr, 0, sizeof dst[i].addr);
+      if (top[i].family == AF_INET) {
+         struct sockaddr_in *sin = (struct sockaddr_in *)&dst[i].addr.sa;
+         sin->sin_family = AF_INET;
+         memcpy (&sin->sin_addr, top[i].bytes, 4);
+         dst[i].addr.salen = sizeof *sin;
+      } else {
+         struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&dst[i].addr.sa;
+         sin6->sin6_family = AF_INET6;
+         memcpy (&sin6->sin6_addr, top[i].bytes, 16);
+         dst[i].addr.salen = sizeof *sin6;
+      }
+      dst[i].limited = top[i].count;
+   }
+   return n;
+}
+
+void netcode_ratelimit_decay (netcode_ratelimit_t *rl)
+{
+   for (size_t d=0; d<SKETCH_DEPTH; d++) {
+      for (size_t i=0; i<SKETCH_WIDTH; i++) {
+         uint32_t v = __atomic_load_n (&rl->sketch[d][i], __ATOMIC_RELAXED);
+         if (v)
+            __atomic_store_n (&rl->sketch[d][i], v / 2, __ATOMIC_RELAXED);
+      }
+   }
+
+   spin_lock (&rl->top_lock);
+   size_t n = 0;
+   for (size_t i=0; i<rl->ntop; i++) {
+      rl->top[i].count /= 2;
+      if (rl->top[i].count)
+         rl->top[n++] = rl->top[i];
+   }
+   rl->ntop = n;
+   top_recompute_min (rl);
+   spin_unlock (&rl->top_lock);
+}
+
+void netcode_ratelimit_stats (const netcode_ratelimit_t *rl,
+                              netcode_ratelimit_stats_t *dst)
+{
+   dst->allowed = __atomic_load_n (&rl->allowed, __ATOMIC_RELAXED);
+   dst->limited = __atomic_load_n (&rl->limited, __ATOMIC_RELAXED);
+   dst->untracked = __atomic_load_n (&rl->untracked, __ATOMIC_RELAXED);
+}
+
+/* ***************************************************************** */
+// The installed limiter is read under an epoch, as the ACL is.
+static netcode_ratelimit_t *installed = NULL;
+static netcode_util_epoch_t epoch = NETCODE_UTIL_EPOCH_INIT;
+
+netcode_ratelimit_t *netcode_ratelimit_install (netcode_ratelimit_t *rl)
+{
+   netcode_ratelimit_t *old = __atomic_exchange_n (&installed, rl, __ATOMIC_SEQ_CST);
+   netcode_util_epoch_sync (&epoch);
+   return old;
+}
+
+bool netcode_ratelimit_permits (const struct sockaddr *sa)
+{
+   if (!__atomic_load_n (&installed, __ATOMIC_RELAXED))
+      return true;
+
+   uint32_t token = netcode_util_epoch_enter (&epoch);
+   bool ret = netcode_ratelimit_check (__atomic_load_n (&installed, __ATOMIC_SEQ_CST), sa);
+   netcode_util_epoch_exit (&epoch, token);
+   return ret;
+}
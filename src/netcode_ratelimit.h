@@ -0,0 +1,105 @@
+
+#ifndef H_NETCODE_RATELIMIT
+#define H_NETCODE_RATELIMIT
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "netcode_addr.h"
+
+// Sources tracked when a limiter is created with zero slots.
+#define NETCODE_RATELIMIT_SLOTS     (65536)
+
+// Slots examined for a source before it is treated as untracked.
+#define NETCODE_RATELIMIT_PROBES    (8)
+
+// Offenders remembered by netcode_ratelimit_top().
+#define NETCODE_RATELIMIT_TOP       (16)
+
+/* Per-source rate limiting: every source address has a token bucket
+ * that refills at 'rate' per second up to 'burst', and each connection
+ * or datagram takes one token. IPv6 sources are limited per /64, since
+ * a single host usually has a whole /64 to pick addresses from;
+ * IPv4-mapped IPv6 addresses count as their IPv4 address.
+ *
+ * The buckets live in a fixed-size open-addressed table that is updated
+ * with compare-and-swap, so checks from many threads take no lock and
+ * make no allocations. A source whose bucket has refilled completely is
+ * indistinguishable from one never seen, so its slot may be taken over
+ * by another; a source that finds no slot at all is allowed and counted
+ * as untracked.
+ *
+ * Sources that are limited are counted in a count-min sketch, and the
+ * ones with the highest estimates are kept as the top offenders. Call
+ * netcode_ratelimit_decay() periodically so that old offences fade.
+ *
+ * A limiter may be installed for the whole library with
+ * netcode_ratelimit_install(), in the same way as an ACL (see
+ * netcode_acl.h): netcode_tcp_accept*() and the netcode_udp receive
+ * functions then drop the connections and datagrams of sources over
+ * their limit before allocating anything for them.
+ */
+typedef struct netcode_ratelimit_t netcode_ratelimit_t;
+
+typedef struct netcode_ratelimit_stats_t {
+   uint64_t    allowed;
+   uint64_t    limited;
+   uint64_t    untracked;        // Allowed because no slot was free
+} netcode_ratelimit_stats_t;
+
+typedef struct netcode_ratelimit_offender_t {
+   netcode_addr_t    addr;       // Port zero; for IPv6, the /64
+   uint64_t          limited;    // Estimated, since the last decay
+} netcode_ratelimit_offender_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Creates a limiter that allows each source 'rate' connections or
+   // datagrams per second with bursts of up to 'burst' (at most a
+   // million), tracking up to 'slots' sources at once (rounded up to a
+   // power of two; zero for NETCODE_RATELIMIT_SLOTS).
+   //
+   // RETURNS: NULL on error.
+   netcode_ratelimit_t *netcode_ratelimit_new (double rate, double burst, size_t slots);
+   void netcode_ratelimit_del (netcode_ratelimit_t *rl);
+
+   // Takes a token from the bucket of the source 'sa'.
+   //
+   // RETURNS: false if the source is over its limit. Addresses other
+   // than IPv4 and IPv6 are always allowed.
+   bool netcode_ratelimit_check (netcode_ratelimit_t *rl, const struct sockaddr *sa);
+   bool netcode_ratelimit_check_addr (netcode_ratelimit_t *rl, const netcode_addr_t *addr);
+
+   // Copies up to 'n' of the top offenders into 'dst', most limited
+   // first.
+   //
+   // RETURNS: the number copied.
+   size_t netcode_ratelimit_top (netcode_ratelimit_t *rl,
+                                 netcode_ratelimit_offender_t *dst, size_t n);
+
+   // Halves every offence count.
+   void netcode_ratelimit_decay (netcode_ratelimit_t *rl);
+
+   void netcode_ratelimit_stats (const netcode_ratelimit_t *rl,
+                                 netcode_ratelimit_stats_t *dst);
+
+   // Makes 'rl' (NULL for none) the limiter that the library applies,
+   // and waits until no thread is using the previous one.
+   //
+   // RETURNS: the previous limiter (or NULL), which the caller may now
+   // delete.
+   netcode_ratelimit_t *netcode_ratelimit_install (netcode_ratelimit_t *rl);
+
+   // RETURNS: true if 'sa' is within its limit in the installed limiter,
+   // or if there is none.
+   bool netcode_ratelimit_permits (const struct sockaddr *sa);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
@@ -0,0 +1,325 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "netcode_util.h"
+#include "netcode_ratelimit.h"
+#include "netcode_tcp.h"
+#include "netcode_udp.h"
+
+#define NTHREADS        (4)
+#define NCHECKS         (20000)
+#define NSOURCES        (1000)
+
+static netcode_addr_t source (const char *fmt, unsigned n)
+{
+   char str[NETCODE_ADDR_STRLEN];
+   netcode_addr_t ret;
+
+   snprintf (str, sizeof str, fmt, n / 256, n % 256);
+   netcode_util_addr_parse (str, &ret);
+   return ret;
+}
+
+static size_t take (netcode_ratelimit_t *rl, const netcode_addr_t *addr, size_t n)
+{
+   size_t allowed = 0;
+   for (size_t i=0; i<n; i++) {
+      allowed += netcode_ratelimit_check_addr (rl, addr);
+   }
+   return allowed;
+}
+
+static bool bucket_test (void)
+{
+   netcode_ratelimit_t *rl = netcode_ratelimit_new (100, 10, 0);
+   netcode_addr_t a = source ("10.0.%u.%u", 1), b = source ("10.0.%u.%u", 2);
+   netcode_addr_t c, d;
+   bool ret = false;
+
+   // Different IPv6 addresses in one /64 share a bucket.
+   netcode_util_addr_parse ("[2001:db8::1]:1000", &c);
+   netcode_util_addr_parse ("[2001:db8::2]:2000", &d);
+
+   if (!rl)
+      return false;
+
+   size_t first = take (rl, &a, 50), other = take (rl, &b, 50);
+   size_t v6 = take (rl, &c, 5) + take (rl, &d, 50);
+   netcode_util_sleep_ns (100000000);
+   size_t refilled = take (rl, &a, 50);
+
+   printf ("RATELIMIT: burst %zu, other source %zu, one /64 %zu, after 100 ms %zu\n",
+           first, other, v6, refilled);
+
+   // A little time passes during the checks, so allow a token or two.
+   if (first < 10 || first > 12 || other < 10 || other > 12 || v6 < 10 || v6 > 12 ||
+       refilled < 9 || refilled > 13) {
+      NETCODE_UTIL_LOG ("Buckets did not hold and refill as configured\n");
+      goto errorexit;
+   }
+
+   // A slow bucket still refills when it is checked far more often than
+   // it earns a token.
+   netcode_ratelimit_del (rl);
+   rl = netcode_ratelimit_new (20, 1, 0);
+   size_t slow = 0;
+   uint64_t start = netcode_util_time_ns ();
+   while (netcode_util_time_ns () - start < 200000000) {
+      slow += netcode_ratelimit_check_addr (rl, &a);
+   }
+   if (slow < 4 || slow > 6) {
+      NETCODE_UTIL_LOG ("Slow bucket allowed %zu in 200 ms, not 5\n", slow);
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_ratelimit_del (rl);
+   return ret;
+}
+
+static bool offenders_test (void)
+{
+   netcode_ratelimit_t *rl = netcode_ratelimit_new (1, 1, 4096);
+   netcode_ratelimit_offender_t top[NETCODE_RATELIMIT_TOP];
+   netcode_ratelimit_stats_t stats;
+   char str[NETCODE_ADDR_STRLEN];
+   bool ret = false;
+
+   if (!rl)
+      return false;
+
+   // Many sources offend a little, and three offend a lot.
+   for (unsigned i=0; i<NSOURCES; i++) {
+      netcode_addr_t addr = source ("172.16.%u.%u", i);
+      take (rl, &addr, 1 + i % 3);
+   }
+   for (unsigned i=0; i<3; i++) {
+      netcode_addr_t addr = source ("192.0.%u.%u", i);
+      take (rl, &addr, 1000 * (3 - i));
+   }
+
+   size_t n = netcode_ratelimit_top (rl, top, sizeof top / sizeof top[0]);
+   netcode_ratelimit_stats (rl, &stats);
+   printf ("RATELIMIT: %" PRIu64 " allowed, %" PRIu64 " limited, %" PRIu64 " untracked\n",
+           stats.allowed, stats.limited, stats.untracked);
+   for (size_t i=0; i<n && i<5; i++) {
+      netcode_addr_format (&top[i].addr, str, sizeof str);
+      printf ("RATELIMIT: offender %zu: %s, %" PRIu64 "\n", i, str, top[i].limited);
+   }
+
+   for (unsigned i=0; i<3; i++) {
+      netcode_addr_t addr = source ("192.0.%u.%u", i);
+      if (n < 3 || netcode_addr_cmp (&top[i].addr, &addr) != 0 ||
+          top[i].limited < 1000 * (3 - i) - 1) {
+         NETCODE_UTIL_LOG ("Offender %u is not the expected source\n", i);
+         goto errorexit;
+      }
+   }
+
+   netcode_ratelimit_decay (rl);
+   netcode_ratelimit_offender_t decayed;
+   if (netcode_ratelimit_top (rl, &decayed, 1) != 1 ||
+       decayed.limited != top[0].limited / 2) {
+      NETCODE_UTIL_LOG ("Decay did not halve the offence counts\n");
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_ratelimit_del (rl);
+   return ret;
+}
+
+/* ***************************************************************** */
+struct thread_arg_t {
+   netcode_ratelimit_t *rl;
+   size_t allowed;
+};
+
+static void *thread_fn (void *arg)
+{
+   struct thread_arg_t *ta = arg;
+   netcode_addr_t addr = source ("198.51.%u.%u", 100);
+   ta->allowed = take (ta->rl, &addr, NCHECKS);
+   return NULL;
+}
+
+// Threads racing on one bucket take exactly its tokens between them.
+static bool threads_test (void)
+{
+   netcode_ratelimit_t *rl = netcode_ratelimit_new (1, 1000, 0);
+   struct thread_arg_t args[NTHREADS];
+   pthread_t threads[NTHREADS];
+   size_t nthreads = 0, allowed = 0;
+   uint64_t start = netcode_util_time_ns ();
+   bool ret = false;
+
+   if (!rl)
+      return false;
+
+   for (; nthreads<NTHREADS; nthreads++) {
+      args[nthreads].rl = rl;
+      if (pthread_create (&threads[nthreads], NULL, thread_fn, &args[nthreads]) != 0) {
+         NETCODE_UTIL_LOG ("Failed to create thread\n");
+         goto errorexit;
+      }
+   }
+
+   ret = true;
+
+errorexit:
+   for (size_t i=0; i<nthreads; i++) {
+      pthread_join (threads[i], NULL);
+      allowed += args[i].allowed;
+   }
+   uint64_t elapsed = netcode_util_time_ns () - start;
+   netcode_ratelimit_del (rl);
+
+   printf ("RATELIMIT: %i threads allowed %zu of %i in %.1f ms (%.1f ns per check)\n",
+           NTHREADS, allowed, NTHREADS * NCHECKS, elapsed / 1e6,
+           (double)elapsed / (NTHREADS * NCHECKS));
+   if (ret && (allowed < 1000 || allowed > 1000 + 1 + elapsed / 1000000000)) {
+      NETCODE_UTIL_LOG ("Tokens were lost or taken twice\n");
+      ret = false;
+   }
+   return ret;
+}
+
+/* ***************************************************************** */
+/* Listens on an ephemeral port rather than a fixed one: the refused
+ * connections are closed from this end, and the TIME_WAIT they leave
+ * behind would stop a rerun from binding a fixed port for a minute.
+ */
+static int tcp_server_any (uint16_t *port)
+{
+   struct sockaddr_in addr;
+   socklen_t addrlen = sizeof addr;
+   int fd = socket (AF_INET, SOCK_STREAM, 0);
+
+   memset (&addr, 0, sizeof addr);
+   addr.sin_family = AF_INET;
+   addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+   if (fd < 0 ||
+       bind (fd, (struct sockaddr *)&addr, sizeof addr) != 0 ||
+       listen (fd, 8) != 0 ||
+       getsockname (fd, (struct sockaddr *)&addr, &addrlen) != 0) {
+      if (fd >= 0)
+         netcode_util_close (fd);
+      return -1;
+   }
+   *port = ntohs (addr.sin_port);
+   return fd;
+}
+
+static bool socket_test (void)
+{
+   netcode_ratelimit_t *rl = netcode_ratelimit_new (0.1, 5, 0);
+   int rxfd = -1, txfd = -1, listenfd = -1;
+   int conns[8] = { -1, -1, -1, -1, -1, -1, -1, -1 };
+   size_t received = 0, accepted = 0;
+   netcode_addr_t dest, from;
+   uint8_t buf[64];
+   uint16_t tcp_port = 0;
+   bool ret = false;
+
+   netcode_addr_parse (&dest, "127.0.0.1");
+   netcode_addr_set_port (&dest, NETCODE_TEST_RATELIMIT_PORT);
+
+   if (!rl ||
+       (rxfd = netcode_udp_socket (NETCODE_TEST_RATELIMIT_PORT, NULL)) < 0 ||
+       (txfd = netcode_udp_socket (0, NULL)) < 0 ||
+       (listenfd = tcp_server_any (&tcp_port)) < 0) {
+      NETCODE_UTIL_LOG ("Failed to create sockets\n");
+      goto errorexit;
+   }
+
+   netcode_ratelimit_install (rl);
+
+   // Of twenty datagrams, only the burst gets through.
+   for (size_t i=0; i<20; i++) {
+      netcode_udp_send_addr (txfd, &dest, "flood", (size_t)5, NULL);
+   }
+   for (size_t i=0; i<20; i++) {
+      if (netcode_udp_recv_into (rxfd, &from, buf, sizeof buf, 0) == 5)
+         received++;
+   }
+
+   // The bucket is empty, so connections are closed as they arrive.
+   for (size_t i=0; i<sizeof conns / sizeof conns[0]; i++) {
+      conns[i] = netcode_tcp_connect ("127.0.0.1", tcp_port);
+      int fd = netcode_tcp_accept_addr (listenfd, 1, &from);
+      if (fd > 0) {
+         accepted++;
+         netcode_util_close (fd);
+      }
+   }
+
+   printf ("RATELIMIT: %zu of 20 datagrams received, %zu of %zu connections accepted\n",
+           received, accepted, sizeof conns / sizeof conns[0]);
+   if (received != 5 || accepted != 0) {
+      NETCODE_UTIL_LOG ("Sources over their limit were not dropped\n");
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_ratelimit_del (netcode_ratelimit_install (NULL));
+   int fds[] = { rxfd, txfd, listenfd };
+   for (size_t i=0; i<sizeof fds / sizeof fds[0]; i++) {
+      if (fds[i] > 0)
+         netcode_util_close (fds[i]);
+   }
+   for (size_t i=0; i<sizeof conns / sizeof conns[0]; i++) {
+      if (conns[i] > 0)
+         netcode_util_close (conns[i]);
+   }
+   return ret;
+}
+
+static int ratelimit_test (void)
+{
+   if (!(bucket_test ()) ||
+       !(offenders_test ()) ||
+       !(threads_test ()) ||
+       !(socket_test ()))
+      return EXIT_FAILURE;
+
+   return EXIT_SUCCESS;
+}
+
+int main (void)
+{
+   int ret = EXIT_FAILURE;
+
+   if (!(netcode_util_init ())) {
+      NETCODE_UTIL_LOG ("Failed to initialise netcode\n");
+      goto errorexit;
+   }
+
+   if ((ret = ratelimit_test ())!=EXIT_SUCCESS) {
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      printf ("+++ +++ ratelimit: Test FAILED +++ +++\n");
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      goto errorexit;
+   }
+
+   printf ("*********************************\n");
+   printf ("*** *** ratelimit: Test passed *** ***\n");
+   printf ("*********************************\n");
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   return ret;
+}
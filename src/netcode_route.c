@@ -0,0 +1,541 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "netcode_util.h"
+#include "netcode_log.h"
+#include "netcode_route.h"
+
+/* ***************************************************************** */
+#ifdef PLATFORM_Windows
+#include <winsock2.h>
+#include <windows.h>
+
+netcode_route_cache_t *netcode_route_cache_new (size_t capacity)
+{
+   (void)capacity;
+   NETCODE_LOG (NETCODE_LOG_ERROR, "Route lookup is not supported on this platform\n");
+   return NULL;
+}
+
+void netcode_route_cache_del (netcode_route_cache_t *cache)
+{
+   (void)cache;
+}
+
+int netcode_route_cache_fd (const netcode_route_cache_t *cache)
+{
+   (void)cache;
+   return -1;
+}
+
+bool netcode_route_cache_poll (netcode_route_cache_t *cache)
+{
+   (void)cache;
+   return false;
+}
+
+void netcode_route_cache_stats (const netcode_route_cache_t *cache,
+                                netcode_route_stats_t *dst)
+{
+   (void)cache;
+   memset (dst, 0, sizeof *dst);
+}
+
+bool netcode_route_lookup (netcode_route_cache_t *cache,
+                           const netcode_addr_t *dest,
+                           netcode_addr_t *src,
+                           uint32_t *ifindex,
+                           uint32_t *mtu)
+{
+   (void)cache;
+   (void)dest;
+   (void)src;
+   (void)ifindex;
+   (void)mtu;
+   NETCODE_LOG (NETCODE_LOG_ERROR, "Route lookup is not supported on this platform\n");
+   return false;
+}
+
+#endif
+
+/* ***************************************************************** */
+#ifdef PLATFORM_POSIX
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+// Large enough for the reply to a single RTM_GETROUTE or RTM_GETLINK.
+#define REPLY_BUFSIZE      (16 * 1024)
+#define EVENT_BUFSIZE      (8 * 1024)
+
+#define NONE               (UINT32_MAX)
+
+struct route_t {
+   netcode_addr_t    src;
+   uint32_t          ifindex;
+   uint32_t          mtu;
+};
+
+struct entry_t {
+   netcode_addr_t    dest;
+   struct route_t    route;
+   uint32_t          hash_next;
+   uint32_t          lru_prev;      // Towards the most recently used
+   uint32_t          lru_next;
+};
+
+struct netcode_route_cache_t {
+   int                     query_fd;
+   int                     event_fd;
+   uint32_t                seq;
+   uint64_t                last_check;    // ns
+   size_t                  capacity;
+   size_t                  count;
+   size_t                  nbuckets;
+   uint32_t               *buckets;
+   struct entry_t         *entries;
+   uint32_t                lru_head;
+   uint32_t                lru_tail;
+   netcode_route_stats_t   stats;
+};
+
+/* ***************************************************************** */
+static void nl_addattr (struct nlmsghdr *nh, uint16_t type, const void *data, size_t len)
+{
+   struct rtattr *rta = (struct rtattr *)((char *)nh + NLMSG_ALIGN (nh->nlmsg_len));
+
+   rta->rta_type = type;
+   rta->rta_len = RTA_LENGTH (len);
+   memcpy (RTA_DATA (rta), data, len);
+   nh->nlmsg_len = NLMSG_ALIGN (nh->nlmsg_len) + RTA_ALIGN (rta->rta_len);
+}
+
+/* Sends the request 'req' and reads the reply into 'buf'.
+ *
+ * RETURNS: the first message of the reply, or NULL on error (with errno
+ * set from the kernel's error reply, if there was one).
+ */
+static struct nlmsghdr *nl_request (int fd, struct nlmsghdr *req, void *buf, int *len)
+{
+   ssize_t r;
+
+   if (send (fd, req, req->nlmsg_len, 0) < 0)
+      return NULL;
+
+   // Skip any stale replies to earlier requests that timed out.
+   do {
+      if ((r = recv (fd, buf, REPLY_BUFSIZE, 0)) < 0)
+         return NULL;
+   } while (r >= (ssize_t)sizeof (struct nlmsghdr) &&
+            ((struct nlmsghdr *)buf)->nlmsg_seq != req->nlmsg_seq);
+
+   struct nlmsghdr *nh = buf;
+   *len = (int)r;
+   if (!NLMSG_OK (nh, *len)) {
+      errno = EIO;
+      return NULL;
+   }
+   if (nh->nlmsg_type == NLMSG_ERROR) {
+      const struct nlmsgerr *err = NLMSG_DATA (nh);
+      errno = err->error ? -err->error : EIO;
+      return NULL;
+   }
+   return nh;
+}
+
+static uint32_t link_mtu (int fd, uint32_t seq, uint32_t ifindex)
+{
+   struct {
+      struct nlmsghdr   nh;
+      struct ifinfomsg  ifi;
+   } req;
+   union {
+      struct nlmsghdr   nh;
+      uint8_t           buf[REPLY_BUFSIZE];
+   } reply;
+   uint32_t ret = 0;
+   int len = 0;
+
+   memset (&req, 0, sizeof req);
+   req.nh.nlmsg_len = NLMSG_LENGTH (sizeof req.ifi);
+   req.nh.nlmsg_type = RTM_GETLINK;
+   req.nh.nlmsg_flags = NLM_F_REQUEST;
+   req.nh.nlmsg_seq = seq;
+   req.ifi.ifi_family = AF_UNSPEC;
+   req.ifi.ifi_index = (int)ifindex;
+
+   struct nlmsghdr *nh = nl_request (fd, &req.nh, reply.buf, &len);
+   if (!nh || nh->nlmsg_type != RTM_NEWLINK)
+      return 0;
+
+   const struct ifinfomsg *ifi = NLMSG_DATA (nh);
+   int alen = (int)nh->nlmsg_len - NLMSG_LENGTH (sizeof *ifi);
+   for (struct rtattr *rta = IFLA_RTA (ifi); RTA_OK (rta, alen); rta = RTA_NEXT (rta, alen)) {
+      if (rta->rta_type == IFLA_MTU && RTA_PAYLOAD (rta) >= sizeof ret)
+         memcpy (&ret, RTA_DATA (rta), sizeof ret);
+   }
+   return ret;
+}
+
+// The kernel reports no preferred source for some routes; the address
+// that a connected datagram socket is given is the one it would use.
+static bool connected_src (const netcode_addr_t *dest, netcode_addr_t *src)
+{
+   struct sockaddr_storage ss;
+   socklen_t sslen = sizeof ss;
+   size_t salen = 0;
+   const struct sockaddr *sa = netcode_addr_sockaddr (dest, &salen);
+   bool ret = false;
+   int fd = socket (sa->sa_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+   if (fd < 0)
+      return false;
+
+   memset (&ss, 0, sizeof ss);
+   if (connect (fd, sa, (socklen_t)salen) == 0 &&
+       getsockname (fd, (struct sockaddr *)&ss, &sslen) == 0 &&
+       netcode_addr_from_sockaddr (src, (struct sockaddr *)&ss, sslen)) {
+      netcode_addr_set_port (src, 0);
+      ret = true;
+   }
+
+   close (fd);
+   return ret;
+}
+
+static bool route_query (int fd, uint32_t *seq, const netcode_addr_t *dest,
+                         struct route_t *dst)
+{
+   struct {
+      struct nlmsghdr   nh;
+      struct rtmsg      rtm;
+      char              attrs[RTA_SPACE (16) + RTA_SPACE (4)];
+   } req;
+   union {
+      struct nlmsghdr   nh;
+      uint8_t           buf[REPLY_BUFSIZE];
+   } reply;
+   const uint8_t *prefsrc = NULL;
+   uint32_t oif = 0, scope_id = 0;
+   size_t salen = 0;
+   int family = netcode_addr_family (dest);
+   int len = 0;
+   bool own_fd = fd < 0;
+   bool ret = false;
+
+   const struct sockaddr *sa = netcode_addr_sockaddr (dest, &salen);
+   const void *addr = NULL;
+   size_t alen = 0;
+
+   if (family == AF_INET) {
+      addr = &((const struct sockaddr_in *)sa)->sin_addr;
+      alen = 4;
+   } else if (family == AF_INET6) {
+      addr = &((const struct sockaddr_in6 *)sa)->sin6_addr;
+      alen = 16;
+      scope_id = ((const struct sockaddr_in6 *)sa)->sin6_scope_id;
+   } else {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Cannot route address family %i\n", family);
+      return false;
+   }
+
+   memset (&req, 0, sizeof req);
+   req.nh.nlmsg_len = NLMSG_LENGTH (sizeof req.rtm);
+   req.nh.nlmsg_type = RTM_GETROUTE;
+   req.nh.nlmsg_flags = NLM_F_REQUEST;
+   req.nh.nlmsg_seq = ++(*seq);
+   req.rtm.rtm_family = (unsigned char)family;
+   req.rtm.rtm_dst_len = (unsigned char)(alen * 8);
+   nl_addattr (&req.nh, RTA_DST, addr, alen);
+   if (scope_id)
+      nl_addattr (&req.nh, RTA_OIF, &scope_id, sizeof scope_id);
+
+   if (own_fd && (fd = socket (AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) < 0) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to create netlink socket: %i\n", errno);
+      return false;
+   }
+
+   struct nlmsghdr *nh = nl_request (fd, &req.nh, reply.buf, &len);
+   if (!nh || nh->nlmsg_type != RTM_NEWROUTE) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "No route to destination: %i\n", errno);
+      goto errorexit;
+   }
+
+   const struct rtmsg *rtm = NLMSG_DATA (nh);
+   int rlen = (int)nh->nlmsg_len - NLMSG_LENGTH (sizeof *rtm);
+   memset (dst, 0, sizeof *dst);
+   for (struct rtattr *rta = RTM_RTA (rtm); RTA_OK (rta, rlen); rta = RTA_NEXT (rta, rlen)) {
+      switch (rta->rta_type) {
+         case RTA_PREFSRC:
+            if (RTA_PAYLOAD (rta) >= alen)
+               prefsrc = RTA_DATA (rta);
+            break;
+
+         case RTA_OIF:
+            if (RTA_PAYLOAD (rta) >= sizeof oif)
+               memcpy (&oif, RTA_DATA (rta), sizeof oif);
+            break;
+
+         case RTA_METRICS: {
+            int mlen = (int)RTA_PAYLOAD (rta);
+            for (struct rtattr *m = RTA_DATA (rta); RTA_OK (m, mlen); m = RTA_NEXT (m, mlen)) {
+               if (m->rta_type == RTAX_MTU && RTA_PAYLOAD (m) >= sizeof dst->mtu)
+                  memcpy (&dst->mtu, RTA_DATA (m), sizeof dst->mtu);
+            }
+            break;
+         }
+      }
+   }
+
+   dst->ifindex = oif;
+   if (!dst->mtu && oif)
+      dst->mtu = link_mtu (fd, ++(*seq), oif);
+
+   if (prefsrc) {
+      struct sockaddr_storage ss;
+      memset (&ss, 0, sizeof ss);
+      if (family == AF_INET) {
+         struct sockaddr_in *sin = (struct sockaddr_in *)&ss;
+         sin->sin_family = AF_INET;
+         memcpy (&sin->sin_addr, prefsrc, alen);
+         salen = sizeof *sin;
+      } else {
+         struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&ss;
+         sin6->sin6_family = AF_INET6;
+         memcpy (&sin6->sin6_addr, prefsrc, alen);
+         if (IN6_IS_ADDR_LINKLOCAL (&sin6->sin6_addr))
+            sin6->sin6_scope_id = oif;
+         salen = sizeof *sin6;
+      }
+      ret = netcode_addr_from_sockaddr (&dst->src, (struct sockaddr *)&ss, salen);
+   } else {
+      ret = connected_src (dest, &dst->src);
+   }
+
+errorexit:
+   if (own_fd && fd >= 0)
+      close (fd);
+   return ret;
+}
+
+/* ***************************************************************** */
+static void cache_clear (netcode_route_cache_t *cache)
+{
+   for (size_t i=0; i<cache->nbuckets; i++) {
+      cache->buckets[i] = NONE;
+   }
+   cache->count = 0;
+   cache->lru_head = cache->lru_tail = NONE;
+}
+
+static void lru_unlink (netcode_route_cache_t *cache, uint32_t i)
+{
+   struct entry_t *e = &cache->entries[i];
+
+   if (e->lru_prev != NONE)
+      cache->entries[e->lru_prev].lru_next = e->lru_next;
+   else
+      cache->lru_head = e->lru_next;
+
+   if (e->lru_next != NONE)
+      cache->entries[e->lru_next].lru_prev = e->lru_prev;
+   else
+      cache->lru_tail = e->lru_prev;
+}
+
+static void lru_push (netcode_route_cache_t *cache, uint32_t i)
+{
+   struct entry_t *e = &cache->entries[i];
+
+   e->lru_prev = NONE;
+   e->lru_next = cache->lru_head;
+   if (cache->lru_head != NONE)
+      cache->entries[cache->lru_head].lru_prev = i;
+   cache->lru_head = i;
+   if (cache->lru_tail == NONE)
+      cache->lru_tail = i;
+}
+
+static uint32_t *bucket_of (netcode_route_cache_t *cache, const netcode_addr_t *dest)
+{
+   return &cache->buckets[netcode_addr_hash (dest) & (cache->nbuckets - 1)];
+}
+
+// Takes the least recently used entry out of the cache and returns it.
+static uint32_t evict (netcode_route_cache_t *cache)
+{
+   uint32_t i = cache->lru_tail;
+   uint32_t *link = bucket_of (cache, &cache->entries[i].dest);
+
+   while (*link != i)
+      link = &cache->entries[*link].hash_next;
+   *link = cache->entries[i].hash_next;
+
+   lru_unlink (cache, i);
+   return i;
+}
+
+static bool drain_events (netcode_route_cache_t *cache)
+{
+   uint8_t buf[EVENT_BUFSIZE];
+   bool changed = false;
+   ssize_t r;
+
+   // The content does not matter: any change empties the cache.
+   while ((r = recv (cache->event_fd, buf, sizeof buf, MSG_DONTWAIT)) > 0 ||
+          (r < 0 && errno == ENOBUFS)) {
+      changed = true;
+   }
+
+   if (changed && cache->count) {
+      cache_clear (cache);
+      cache->stats.invalidations++;
+   }
+   cache->last_check = netcode_util_time_ns ();
+   return changed;
+}
+
+/* ***************************************************************** */
+netcode_route_cache_t *netcode_route_cache_new (size_t capacity)
+{
+   netcode_route_cache_t *ret = netcode_util_calloc (1, sizeof *ret);
+   struct sockaddr_nl sa;
+
+   if (!ret) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating route cache\n");
+      return NULL;
+   }
+
+   ret->query_fd = ret->event_fd = -1;
+   ret->capacity = capacity ? capacity : NETCODE_ROUTE_CACHE_SIZE;
+   if (ret->capacity >= NONE)
+      ret->capacity = NONE - 1;
+   for (ret->nbuckets = 16; ret->nbuckets < ret->capacity * 2; ret->nbuckets *= 2)
+      ;
+
+   if (!(ret->buckets = netcode_util_calloc (ret->nbuckets, sizeof *ret->buckets)) ||
+       !(ret->entries = netcode_util_calloc (ret->capacity, sizeof *ret->entries))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating %zu route cache entries\n", ret->capacity);
+      goto errorexit;
+   }
+   cache_clear (ret);
+
+   if ((ret->query_fd = socket (AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) < 0 ||
+       (ret->event_fd = socket (AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)) < 0) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to create netlink sockets: %i\n", errno);
+      goto errorexit;
+   }
+
+   memset (&sa, 0, sizeof sa);
+   sa.nl_family = AF_NETLINK;
+   sa.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR |
+                  RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+   if (bind (ret->event_fd, (struct sockaddr *)&sa, sizeof sa) != 0) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to subscribe to routing changes: %i\n", errno);
+      goto errorexit;
+   }
+
+   ret->last_check = netcode_util_time_ns ();
+   return ret;
+
+errorexit:
+   netcode_route_cache_del (ret);
+   return NULL;
+}
+
+void netcode_route_cache_del (netcode_route_cache_t *cache)
+{
+   if (!cache)
+      return;
+
+   if (cache->query_fd >= 0)
+      close (cache->query_fd);
+   if (cache->event_fd >= 0)
+      close (cache->event_fd);
+   netcode_util_free (cache->buckets);
+   netcode_util_free (cache->entries);
+   netcode_util_free (cache);
+}
+
+int netcode_route_cache_fd (const netcode_route_cache_t *cache)
+{
+   return cache ? cache->event_fd : -1;
+}
+
+bool netcode_route_cache_poll (netcode_route_cache_t *cache)
+{
+   return drain_events (cache);
+}
+
+void netcode_route_cache_stats (const netcode_route_cache_t *cache,
+                                netcode_route_stats_t *dst)
+{
+   *dst = cache->stats;
+   dst->entries = cache->count;
+}
+
+bool netcode_route_lookup (netcode_route_cache_t *cache,
+                           const netcode_addr_t *dest,
+                           netcode_addr_t *src,
+                           uint32_t *ifindex,
+                           uint32_t *mtu)
+{
+   netcode_addr_t key;
+   struct route_t route;
+   uint32_t seq = 0;
+
+   // Routes are per host, so the port is cleared for the key.
+   key = *dest;
+   netcode_addr_set_port (&key, 0);
+
+   if (!cache) {
+      if (!(route_query (-1, &seq, &key, &route)))
+         return false;
+      goto found;
+   }
+
+   if (netcode_util_time_ns () - cache->last_check >= NETCODE_ROUTE_CHECK_MS * 1000000ull)
+      drain_events (cache);
+
+   cache->stats.lookups++;
+
+   uint32_t *bucket = bucket_of (cache, &key);
+   for (uint32_t i = *bucket; i != NONE; i = cache->entries[i].hash_next) {
+      struct entry_t *e = &cache->entries[i];
+      if (netcode_addr_cmp (&e->dest, &key) == 0) {
+         lru_unlink (cache, i);
+         lru_push (cache, i);
+         cache->stats.hits++;
+         route = e->route;
+         goto found;
+      }
+   }
+
+   if (!(route_query (cache->query_fd, &cache->seq, &key, &route)))
+      return false;
+
+   uint32_t i = cache->count < cache->capacity ? (uint32_t)cache->count++ : evict (cache);
+   struct entry_t *e = &cache->entries[i];
+   memcpy (&e->dest, &key, sizeof key);
+   e->route = route;
+   e->hash_next = *bucket;
+   *bucket = i;
+   lru_push (cache, i);
+
+found:
+   if (src)
+      *src = route.src;
+   if (ifindex)
+      *ifindex = route.ifindex;
+   if (mtu)
+      *mtu = route.mtu;
+   return true;
+}
+
+#endif
@@ -0,0 +1,84 @@
+
+#ifndef H_NETCODE_ROUTE
+#define H_NETCODE_ROUTE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "netcode_addr.h"
+
+// Destinations a cache holds when it is created with a capacity of zero.
+#define NETCODE_ROUTE_CACHE_SIZE    (1024)
+
+// A cache that is never polled checks for routing changes at most this
+// often, so its answers are never staler than this.
+#define NETCODE_ROUTE_CHECK_MS      (10)
+
+/* Route lookup: which interface and local address the kernel would use
+ * to send to a destination, and the MTU of that path, as reported by
+ * `ip route get`.
+ *
+ * Each lookup asks the kernel with an RTM_GETROUTE request. A cache
+ * remembers the answers for the most recently used destinations and
+ * forgets all of them whenever the kernel reports a change to the
+ * routes, addresses or links, so that a hit costs a hash lookup.
+ * Change notifications are read by netcode_route_cache_poll(), which
+ * may be called when netcode_route_cache_fd() is readable, and by the
+ * lookups themselves every NETCODE_ROUTE_CHECK_MS.
+ *
+ * A cache is not thread-safe. Only Linux is supported; elsewhere the
+ * lookups fail.
+ */
+typedef struct netcode_route_cache_t netcode_route_cache_t;
+
+typedef struct netcode_route_stats_t {
+   uint64_t    lookups;
+   uint64_t    hits;
+   uint64_t    invalidations;    // Times the cache was emptied
+   size_t      entries;
+} netcode_route_stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Creates a cache for 'capacity' destinations (zero for
+   // NETCODE_ROUTE_CACHE_SIZE).
+   //
+   // RETURNS: NULL on error.
+   netcode_route_cache_t *netcode_route_cache_new (size_t capacity);
+   void netcode_route_cache_del (netcode_route_cache_t *cache);
+
+   // Returns the descriptor that becomes readable when the kernel reports
+   // a change, for use in the caller's event loop.
+   int netcode_route_cache_fd (const netcode_route_cache_t *cache);
+
+   // Reads any change notifications and empties the cache if there were
+   // any.
+   //
+   // RETURNS: true if the cache was emptied.
+   bool netcode_route_cache_poll (netcode_route_cache_t *cache);
+
+   void netcode_route_cache_stats (const netcode_route_cache_t *cache,
+                                   netcode_route_stats_t *dst);
+
+   // Looks up the route to 'dest' (its port is ignored), through 'cache'
+   // if it is not NULL. The local address is stored in 'src' (with port
+   // zero), the index of the outgoing interface in '*ifindex' and the
+   // path MTU (the route's MTU if it has one, else the interface's) in
+   // '*mtu'. Any of the results may be NULL.
+   //
+   // RETURNS: false if there is no route to 'dest', or on error.
+   bool netcode_route_lookup (netcode_route_cache_t *cache,
+                              const netcode_addr_t *dest,
+                              netcode_addr_t *src,
+                              uint32_t *ifindex,
+                              uint32_t *mtu);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
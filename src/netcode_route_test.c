@@ -0,0 +1,266 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <net/if.h>
+#endif
+
+#include "netcode_util.h"
+#include "netcode_route.h"
+#include "netcode_test_util.h"
+
+#define NLOOKUPS        (100000)
+
+#ifdef __linux__
+
+// Added to the loopback interface to make the kernel report a change.
+static const uint8_t test_addr_bytes[] = { 127, 55, 171, 2 };
+
+static bool lookup_test (netcode_route_cache_t *cache, const char *dest_str,
+                         const char *expected_src)
+{
+   netcode_addr_t dest, src, expected;
+   uint32_t ifindex = 0, mtu = 0;
+   char srcbuf[NETCODE_ADDR_STRLEN] = "";
+
+   netcode_addr_parse (&dest, dest_str);
+   netcode_addr_parse (&expected, expected_src);
+   netcode_addr_set_port (&dest, 4321);
+
+   if (!(netcode_route_lookup (cache, &dest, &src, &ifindex, &mtu))) {
+      NETCODE_UTIL_LOG ("No route to %s\n", dest_str);
+      return false;
+   }
+
+   netcode_addr_format (&src, srcbuf, sizeof srcbuf);
+   printf ("ROUTE: %s via %s, interface %u, mtu %u\n", dest_str, srcbuf, ifindex, mtu);
+   if (netcode_addr_cmp (&src, &expected) != 0 ||
+       ifindex != if_nametoindex ("lo") || mtu == 0) {
+      NETCODE_UTIL_LOG ("Expected %s through the loopback interface\n", expected_src);
+      return false;
+   }
+   return true;
+}
+
+static bool cached_test (netcode_route_cache_t *cache)
+{
+   netcode_route_stats_t before, after;
+   netcode_addr_t dest, src;
+   uint64_t start, cached_ns, uncached_ns;
+
+   netcode_addr_parse (&dest, "127.0.0.1");
+   netcode_route_cache_stats (cache, &before);
+
+   start = netcode_util_time_ns ();
+   for (size_t i=0; i<NLOOKUPS; i++) {
+      if (!(netcode_route_lookup (cache, &dest, &src, NULL, NULL))) {
+         NETCODE_UTIL_LOG ("Cached lookup %zu failed\n", i);
+         return false;
+      }
+   }
+   cached_ns = netcode_util_time_ns () - start;
+
+   start = netcode_util_time_ns ();
+   for (size_t i=0; i<NLOOKUPS / 100; i++) {
+      netcode_route_lookup (NULL, &dest, &src, NULL, NULL);
+   }
+   uncached_ns = netcode_util_time_ns () - start;
+
+   netcode_route_cache_stats (cache, &after);
+   printf ("ROUTE: cached lookup %.1f ns, uncached %.1f ns; %" PRIu64 " of %" PRIu64
+           " lookups were hits\n",
+           (double)cached_ns / NLOOKUPS, (double)uncached_ns / (NLOOKUPS / 100),
+           after.hits - before.hits, after.lookups - before.lookups);
+
+   // A poll may have emptied the cache once because of unrelated changes.
+   if (after.lookups - before.lookups != NLOOKUPS ||
+       after.hits - before.hits < NLOOKUPS - 1 - (after.invalidations - before.invalidations)) {
+      NETCODE_UTIL_LOG ("Repeated lookups were not served from the cache\n");
+      return false;
+   }
+   return true;
+}
+
+/* The same destination with junk in the unused part of the address
+ * storage must hit the entry cached for it.
+ */
+static bool alias_test (netcode_route_cache_t *cache)
+{
+   netcode_route_stats_t before, after;
+   netcode_addr_t dest, alias, src;
+
+   netcode_addr_parse (&dest, "127.0.0.1");
+   alias = dest;
+   memset ((uint8_t *)&alias.sa + sizeof alias.sa - 16, 0xa5, 16);
+
+   netcode_route_lookup (cache, &dest, &src, NULL, NULL);
+   netcode_route_cache_stats (cache, &before);
+   if (!(netcode_route_lookup (cache, &alias, &src, NULL, NULL))) {
+      NETCODE_UTIL_LOG ("Lookup of a destination with junk padding failed\n");
+      return false;
+   }
+   netcode_route_cache_stats (cache, &after);
+
+   // Unless an address change emptied the cache in between.
+   if (after.hits == before.hits && after.invalidations == before.invalidations) {
+      NETCODE_UTIL_LOG ("Destination with junk padding was not found in the cache\n");
+      return false;
+   }
+   return true;
+}
+
+static bool eviction_test (void)
+{
+   netcode_route_cache_t *cache = netcode_route_cache_new (4);
+   netcode_route_stats_t stats;
+   netcode_addr_t dest, src;
+   char addr[32];
+   bool ret = false;
+
+   if (!cache)
+      return false;
+
+   for (int round=0; round<2; round++) {
+      for (int i=1; i<=8; i++) {
+         snprintf (addr, sizeof addr, "127.0.0.%i", i);
+         netcode_addr_parse (&dest, addr);
+         if (!(netcode_route_lookup (cache, &dest, &src, NULL, NULL)))
+            goto errorexit;
+      }
+   }
+
+   netcode_route_cache_stats (cache, &stats);
+   if (stats.entries != 4) {
+      NETCODE_UTIL_LOG ("Cache holds %zu entries, not 4\n", stats.entries);
+      goto errorexit;
+   }
+
+   // The four most recent destinations are cached, unless an address
+   // change emptied the cache while they were looked up.
+   uint64_t hits = stats.hits, invalidations = stats.invalidations;
+   for (int i=5; i<=8; i++) {
+      snprintf (addr, sizeof addr, "127.0.0.%i", i);
+      netcode_addr_parse (&dest, addr);
+      netcode_route_lookup (cache, &dest, &src, NULL, NULL);
+   }
+   netcode_route_cache_stats (cache, &stats);
+   if (stats.hits - hits != 4 && stats.invalidations == invalidations) {
+      NETCODE_UTIL_LOG ("Least recently used entries were not the ones evicted\n");
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_route_cache_del (cache);
+   return ret;
+}
+
+static bool invalidate_test (netcode_route_cache_t *cache)
+{
+   netcode_route_stats_t before, after;
+   netcode_addr_t dest, src;
+   uint64_t start;
+   bool ret = false;
+
+   netcode_addr_parse (&dest, "127.0.0.1");
+   netcode_route_lookup (cache, &dest, &src, NULL, NULL);
+   netcode_route_cache_stats (cache, &before);
+
+   int rc = netcode_test_lo_addr (test_addr_bytes, true);
+   if (rc == EPERM || rc == EACCES) {
+      NETCODE_UTIL_LOG ("Not permitted to change addresses, skipping the change test\n");
+      return true;
+   }
+   if (rc != 0) {
+      NETCODE_UTIL_LOG ("Failed to add an address: %i\n", rc);
+      return false;
+   }
+
+   // Lookups notice the change without the cache being polled.
+   start = netcode_util_time_ns ();
+   do {
+      netcode_util_sleep_ns (1000000);
+      netcode_route_lookup (cache, &dest, &src, NULL, NULL);
+      netcode_route_cache_stats (cache, &after);
+   } while (after.invalidations == before.invalidations &&
+            netcode_util_time_ns () - start < 1000000000);
+
+   if (after.invalidations == before.invalidations) {
+      NETCODE_UTIL_LOG ("The cache was not emptied by an address change\n");
+      goto errorexit;
+   }
+
+   if (!(lookup_test (cache, "127.55.171.2", "127.55.171.2")))
+      goto errorexit;
+
+   ret = true;
+
+errorexit:
+   netcode_test_lo_addr (test_addr_bytes, false);
+   return ret;
+}
+
+#endif
+
+static int route_test (void)
+{
+#ifdef __linux__
+   int ret = EXIT_FAILURE;
+   netcode_route_cache_t *cache = netcode_route_cache_new (0);
+
+   if (!cache) {
+      NETCODE_UTIL_LOG ("Failed to create route cache\n");
+      return EXIT_FAILURE;
+   }
+
+   if (!(lookup_test (NULL, "127.0.0.1", "127.0.0.1")) ||
+       !(lookup_test (cache, "127.0.0.1", "127.0.0.1")) ||
+       !(lookup_test (cache, "127.1.2.3", "127.0.0.1")) ||
+       !(lookup_test (cache, "::1", "::1")) ||
+       !(cached_test (cache)) ||
+       !(alias_test (cache)) ||
+       !(eviction_test ()) ||
+       !(invalidate_test (cache)))
+      goto errorexit;
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   netcode_route_cache_del (cache);
+   return ret;
+#else
+   printf ("ROUTE: route lookups are only supported on Linux, skipping\n");
+   return EXIT_SUCCESS;
+#endif
+}
+
+int main (void)
+{
+   int ret = EXIT_FAILURE;
+
+   if (!(netcode_util_init ())) {
+      NETCODE_UTIL_LOG ("Failed to initialise netcode\n");
+      goto errorexit;
+   }
+
+   if ((ret = route_test ())!=EXIT_SUCCESS) {
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      printf ("+++ +++ route: Test FAILED +++ +++\n");
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      goto errorexit;
+   }
+
+   printf ("*********************************\n");
+   printf ("*** *** route: Test passed *** ***\n");
+   printf ("*********************************\n");
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   return ret;
+}
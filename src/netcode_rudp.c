@@ -0,0 +1,648 @@
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "netcode_util.h"
+#include "netcode_log.h"
+#include "netcode_udp.h"
+#include "netcode_rudp.h"
+
+/* ***************************************************************** */
+#ifdef PLATFORM_Windows
+#include <winsock2.h>
+#include <windows.h>
+
+typedef int socklen_t;
+
+#endif
+
+/* ***************************************************************** */
+#ifdef PLATFORM_POSIX
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+
+#endif
+
+/* Wire format, all fields in network byte order:
+ *
+ *    DATA: type(1) stream(1) reserved(2) seq(4) sseq(4) payload
+ *    ACK:  type(1) reserved(3) cumulative(4) sack(8)
+ *
+ * 'seq' numbers every message on the channel and is what is
+ * acknowledged; 'sseq' numbers the messages on their stream and is what
+ * ordering uses. An ACK acknowledges every seq before 'cumulative', and
+ * seq 'cumulative + 1 + i' for every bit 'i' set in 'sack'.
+ */
+#define TYPE_DATA          (1)
+#define TYPE_ACK           (2)
+#define DATA_HDRLEN        (12)
+#define ACK_HDRLEN         (16)
+#define SACK_BITS          (64)
+
+#define NSEC_PER_MSEC      (1000000ULL)
+#define RTO_INIT_NS        (200 * NSEC_PER_MSEC)
+#define RTO_MIN_NS         (10 * NSEC_PER_MSEC)
+#define RTO_MAX_NS         (2000 * NSEC_PER_MSEC)
+#define CWND_INIT          (10.0)
+#define CWND_MIN           (2.0)
+
+// A message is retransmitted early once this many later messages have
+// been acknowledged ahead of it.
+#define DUPTHRESH          (3)
+
+// Received messages that the application has not yet taken. Further
+// messages are dropped (and so retransmitted later by the peer) until
+// the application catches up.
+#define MAX_DELIVERABLE    (4 * NETCODE_RUDP_WINDOW)
+
+#define SEQ_LT(a,b)        ((int32_t)((uint32_t)(a) - (uint32_t)(b)) < 0)
+
+struct msg_t {
+   struct msg_t     *next;
+   uint32_t          seq;
+   uint32_t          sseq;
+   uint8_t           stream;
+   uint16_t          len;
+   uint8_t           data[];
+};
+
+struct txslot_t {
+   struct msg_t     *msg;          // NULL when the slot is free
+   uint64_t          sent_at;
+   uint64_t          deadline;
+   uint32_t          nsent;
+   bool              acked;
+   bool              fast_rexmit;  // Already retransmitted early
+};
+
+struct netcode_rudp_t {
+   int                  fd;
+   netcode_addr_t       peer;
+
+   // Sender. Messages [snd_una, snd_nxt) are in 'tx'; those before
+   // 'snd_tx' have been transmitted at least once.
+   struct txslot_t      tx[NETCODE_RUDP_WINDOW];
+   uint32_t             snd_una;
+   uint32_t             snd_tx;
+   uint32_t             snd_nxt;
+   uint32_t             snd_sseq[NETCODE_RUDP_STREAMS];
+   size_t               inflight;
+
+   double               cwnd;
+   double               ssthresh;
+   uint32_t             recover;
+   uint64_t             srtt;
+   uint64_t             rttvar;
+   uint64_t             rto;
+
+   // Receiver. Every seq before 'rcv_nxt' has been received; rx_have
+   // marks those received after it.
+   uint32_t             rcv_nxt;
+   bool                 rx_have[NETCODE_RUDP_WINDOW];
+   bool                 ack_pending;
+   bool                 ordered[NETCODE_RUDP_STREAMS];
+   uint32_t             rcv_sseq[NETCODE_RUDP_STREAMS];
+   struct msg_t        *held[NETCODE_RUDP_STREAMS][NETCODE_RUDP_WINDOW];
+
+   struct msg_t        *deliver_head;
+   struct msg_t        *deliver_tail;
+   size_t               deliverable;
+
+   netcode_rudp_stats_t stats;
+
+   // Fault injection, for testing.
+   double               loss;
+   double               reorder;
+   uint32_t             rng;
+   uint8_t              delayed[DATA_HDRLEN + NETCODE_RUDP_MAX_MSG];
+   size_t               delayed_len;
+};
+
+/* ***************************************************************** */
+static void put32 (uint8_t *dst, uint32_t v)
+{
+   dst[0] = (uint8_t)(v >> 24);
+   dst[1] = (uint8_t)(v >> 16);
+   dst[2] = (uint8_t)(v >> 8);
+   dst[3] = (uint8_t)v;
+}
+
+static uint32_t get32 (const uint8_t *src)
+{
+   return ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) |
+          ((uint32_t)src[2] << 8) | (uint32_t)src[3];
+}
+
+static double rng_next (netcode_rudp_t *rudp)
+{
+   // xorshift32
+   uint32_t x = rudp->rng;
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+   rudp->rng = x;
+   return (double)(x >> 8) / 16777216.0;
+}
+
+static bool wire_send (netcode_rudp_t *rudp, const uint8_t *hdr, size_t hdrlen,
+                       const void *payload, size_t len)
+{
+   struct iovec iov[2] = {
+      { (void *)hdr, hdrlen },
+      { (void *)payload, len },
+   };
+
+   if (rudp->loss > 0.0 && rng_next (rudp) < rudp->loss)
+      return true;
+
+   if (rudp->reorder > 0.0 && !rudp->delayed_len && rng_next (rudp) < rudp->reorder) {
+      memcpy (rudp->delayed, hdr, hdrlen);
+      if (len)
+         memcpy (&rudp->delayed[hdrlen], payload, len);
+      rudp->delayed_len = hdrlen + len;
+      return true;
+   }
+
+   size_t rc = netcode_udp_sendiov_addr (rudp->fd, &rudp->peer, iov, len ? 2 : 1);
+
+   if (rudp->delayed_len) {
+      iov[0].iov_base = rudp->delayed;
+      iov[0].iov_len = rudp->delayed_len;
+      rudp->delayed_len = 0;
+      netcode_udp_sendiov_addr (rudp->fd, &rudp->peer, iov, 1);
+   }
+
+   return rc == hdrlen + len;
+}
+
+static void flush_delayed (netcode_rudp_t *rudp)
+{
+   if (rudp->delayed_len) {
+      struct iovec iov = { rudp->delayed, rudp->delayed_len };
+      rudp->delayed_len = 0;
+      netcode_udp_sendiov_addr (rudp->fd, &rudp->peer, &iov, 1);
+   }
+}
+
+static void send_ack (netcode_rudp_t *rudp)
+{
+   uint8_t hdr[ACK_HDRLEN];
+   uint64_t sack = 0;
+
+   for (uint32_t i=0; i<SACK_BITS; i++) {
+      if (rudp->rx_have[(rudp->rcv_nxt + 1 + i) % NETCODE_RUDP_WINDOW])
+         sack |= (uint64_t)1 << i;
+   }
+
+   memset (hdr, 0, sizeof hdr);
+   hdr[0] = TYPE_ACK;
+   put32 (&hdr[4], rudp->rcv_nxt);
+   put32 (&hdr[8], (uint32_t)(sack >> 32));
+   put32 (&hdr[12], (uint32_t)sack);
+
+   wire_send (rudp, hdr, sizeof hdr, NULL, 0);
+   rudp->ack_pending = false;
+}
+
+static void transmit (netcode_rudp_t *rudp, struct txslot_t *slot, uint64_t now)
+{
+   uint8_t hdr[DATA_HDRLEN];
+   struct msg_t *msg = slot->msg;
+
+   memset (hdr, 0, sizeof hdr);
+   hdr[0] = TYPE_DATA;
+   hdr[1] = msg->stream;
+   put32 (&hdr[4], msg->seq);
+   put32 (&hdr[8], msg->sseq);
+
+   wire_send (rudp, hdr, sizeof hdr, msg->data, msg->len);
+
+   // Exponential backoff: each retransmission doubles the timeout.
+   uint32_t shift = slot->nsent < 6 ? slot->nsent : 6;
+   uint64_t rto = rudp->rto << shift;
+   slot->deadline = now + (rto < RTO_MAX_NS ? rto : RTO_MAX_NS);
+   slot->sent_at = now;
+   if (slot->nsent++)
+      rudp->stats.retransmitted++;
+}
+
+/* Halves the congestion window, at most once per window of data. */
+static void on_loss (netcode_rudp_t *rudp, uint32_t seq)
+{
+   if (SEQ_LT (seq, rudp->recover))
+      return;
+
+   rudp->ssthresh = rudp->cwnd / 2.0;
+   if (rudp->ssthresh < CWND_MIN)
+      rudp->ssthresh = CWND_MIN;
+   rudp->cwnd = rudp->ssthresh;
+   rudp->recover = rudp->snd_tx;
+}
+
+/* Retransmits timed-out messages, then transmits new messages while the
+ * congestion window allows. Returns the earliest retransmission deadline.
+ */
+static uint64_t run_timers (netcode_rudp_t *rudp, uint64_t now)
+{
+   uint64_t next = UINT64_MAX;
+
+   for (uint32_t seq=rudp->snd_una; SEQ_LT (seq, rudp->snd_tx); seq++) {
+      struct txslot_t *slot = &rudp->tx[seq % NETCODE_RUDP_WINDOW];
+      if (slot->acked)
+         continue;
+      if (slot->deadline <= now) {
+         on_loss (rudp, seq);
+         transmit (rudp, slot, now);
+      }
+      if (slot->deadline < next)
+         next = slot->deadline;
+   }
+
+   while (SEQ_LT (rudp->snd_tx, rudp->snd_nxt) && (double)rudp->inflight < rudp->cwnd) {
+      struct txslot_t *slot = &rudp->tx[rudp->snd_tx % NETCODE_RUDP_WINDOW];
+      transmit (rudp, slot, now);
+      rudp->inflight++;
+      rudp->snd_tx++;
+      if (slot->deadline < next)
+         next = slot->deadline;
+   }
+
+   flush_delayed (rudp);
+   return next;
+}
+
+static void rtt_sample (netcode_rudp_t *rudp, uint64_t rtt)
+{
+   // RFC 6298
+   if (!rudp->srtt) {
+      rudp->srtt = rtt;
+      rudp->rttvar = rtt / 2;
+   } else {
+      uint64_t delta = rtt > rudp->srtt ? rtt - rudp->srtt : rudp->srtt - rtt;
+      rudp->rttvar = (3 * rudp->rttvar + delta) / 4;
+      rudp->srtt = (7 * rudp->srtt + rtt) / 8;
+   }
+   rudp->rto = rudp->srtt + 4 * rudp->rttvar;
+   if (rudp->rto < RTO_MIN_NS)
+      rudp->rto = RTO_MIN_NS;
+   if (rudp->rto > RTO_MAX_NS)
+      rudp->rto = RTO_MAX_NS;
+}
+
+static bool ack_one (netcode_rudp_t *rudp, uint32_t seq, uint64_t now, uint64_t *rtt)
+{
+   if (SEQ_LT (seq, rudp->snd_una) || !SEQ_LT (seq, rudp->snd_tx))
+      return false;
+
+   struct txslot_t *slot = &rudp->tx[seq % NETCODE_RUDP_WINDOW];
+   if (slot->acked)
+      return false;
+
+   slot->acked = true;
+   rudp->inflight--;
+   // Karn's algorithm: only messages sent once give an unambiguous RTT.
+   if (slot->nsent == 1)
+      *rtt = now - slot->sent_at;
+
+   if (rudp->cwnd < rudp->ssthresh)
+      rudp->cwnd += 1.0;
+   else
+      rudp->cwnd += 1.0 / rudp->cwnd;
+   if (rudp->cwnd > NETCODE_RUDP_WINDOW)
+      rudp->cwnd = NETCODE_RUDP_WINDOW;
+
+   return true;
+}
+
+static void process_ack (netcode_rudp_t *rudp, const uint8_t *pkt, uint64_t now)
+{
+   uint32_t cum = get32 (&pkt[4]);
+   uint64_t sack = ((uint64_t)get32 (&pkt[8]) << 32) | get32 (&pkt[12]);
+   uint64_t rtt = 0;
+   uint32_t highest = cum;
+
+   // Ignore acknowledgements of messages that were never sent, and keep
+   // only the SACK bits for messages in flight, so that a corrupt or
+   // forged ACK cannot drive the fast retransmission below.
+   if (SEQ_LT (rudp->snd_tx, cum))
+      return;
+   uint32_t nsent_after = rudp->snd_tx - cum;
+   if (nsent_after <= SACK_BITS)
+      sack &= nsent_after ? ((uint64_t)1 << (nsent_after - 1)) - 1 : 0;
+
+   for (uint32_t seq=rudp->snd_una; SEQ_LT (seq, cum); seq++) {
+      ack_one (rudp, seq, now, &rtt);
+   }
+   for (uint32_t i=0; i<SACK_BITS; i++) {
+      if (sack & ((uint64_t)1 << i)) {
+         uint32_t seq = cum + 1 + i;
+         ack_one (rudp, seq, now, &rtt);
+         highest = seq;
+      }
+   }
+   if (rtt)
+      rtt_sample (rudp, rtt);
+
+   while (SEQ_LT (rudp->snd_una, rudp->snd_tx) &&
+          rudp->tx[rudp->snd_una % NETCODE_RUDP_WINDOW].acked) {
+      struct txslot_t *slot = &rudp->tx[rudp->snd_una % NETCODE_RUDP_WINDOW];
+      netcode_util_free (slot->msg);
+      memset (slot, 0, sizeof *slot);
+      rudp->snd_una++;
+   }
+
+   // Messages with DUPTHRESH or more acknowledged messages after them
+   // are presumed lost and are retransmitted without waiting for their
+   // timers.
+   for (uint32_t seq=rudp->snd_una; SEQ_LT (seq + DUPTHRESH - 1, highest); seq++) {
+      struct txslot_t *slot = &rudp->tx[seq % NETCODE_RUDP_WINDOW];
+      if (slot->acked || slot->fast_rexmit || !slot->msg)
+         continue;
+      slot->fast_rexmit = true;
+      on_loss (rudp, seq);
+      transmit (rudp, slot, now);
+   }
+}
+
+static void deliver (netcode_rudp_t *rudp, struct msg_t *msg)
+{
+   msg->next = NULL;
+   if (rudp->deliver_tail)
+      rudp->deliver_tail->next = msg;
+   else
+      rudp->deliver_head = msg;
+   rudp->deliver_tail = msg;
+   rudp->deliverable++;
+   rudp->stats.received++;
+}
+
+static void process_data (netcode_rudp_t *rudp, const uint8_t *pkt, size_t len)
+{
+   uint8_t stream = pkt[1];
+   uint32_t seq = get32 (&pkt[4]);
+   uint32_t sseq = get32 (&pkt[8]);
+   struct msg_t *msg = NULL;
+
+   if (stream >= NETCODE_RUDP_STREAMS || len - DATA_HDRLEN > NETCODE_RUDP_MAX_MSG)
+      return;
+
+   // Always acknowledge, even duplicates: the peer's copy of the
+   // previous acknowledgement may have been lost.
+   rudp->ack_pending = true;
+
+   if (SEQ_LT (seq, rudp->rcv_nxt) ||
+         rudp->rx_have[seq % NETCODE_RUDP_WINDOW]) {
+      rudp->stats.duplicates++;
+      return;
+   }
+   if (!SEQ_LT (seq, rudp->rcv_nxt + NETCODE_RUDP_WINDOW))
+      return;
+   if (rudp->deliverable >= MAX_DELIVERABLE)
+      return;
+
+   if (!(msg = netcode_util_malloc (sizeof *msg + len - DATA_HDRLEN))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating received message\n");
+      return;
+   }
+   msg->seq = seq;
+   msg->sseq = sseq;
+   msg->stream = stream;
+   msg->len = (uint16_t)(len - DATA_HDRLEN);
+   memcpy (msg->data, &pkt[DATA_HDRLEN], msg->len);
+
+   rudp->rx_have[seq % NETCODE_RUDP_WINDOW] = true;
+   while (rudp->rx_have[rudp->rcv_nxt % NETCODE_RUDP_WINDOW]) {
+      rudp->rx_have[rudp->rcv_nxt % NETCODE_RUDP_WINDOW] = false;
+      rudp->rcv_nxt++;
+   }
+
+   if (!rudp->ordered[stream]) {
+      deliver (rudp, msg);
+      return;
+   }
+
+   // The sender never has more than a window of messages outstanding,
+   // so an undelivered message is always within a window of the next
+   // expected one.
+   struct msg_t **held = rudp->held[stream];
+   if (!SEQ_LT (sseq - rudp->rcv_sseq[stream], NETCODE_RUDP_WINDOW) ||
+         SEQ_LT (sseq, rudp->rcv_sseq[stream])) {
+      netcode_util_free (msg);
+      return;
+   }
+   netcode_util_free (held[sseq % NETCODE_RUDP_WINDOW]);
+   held[sseq % NETCODE_RUDP_WINDOW] = msg;
+
+   while ((msg = held[rudp->rcv_sseq[stream] % NETCODE_RUDP_WINDOW]) != NULL) {
+      held[rudp->rcv_sseq[stream] % NETCODE_RUDP_WINDOW] = NULL;
+      rudp->rcv_sseq[stream]++;
+      deliver (rudp, msg);
+   }
+}
+
+/* ***************************************************************** */
+netcode_rudp_t *netcode_rudp_new (int fd, const netcode_addr_t *peer)
+{
+   netcode_rudp_t *ret = NULL;
+
+   if (!peer || netcode_addr_family (peer) == AF_UNSPEC) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "A peer address is required\n");
+      return NULL;
+   }
+
+   if (!(ret = netcode_util_calloc (1, sizeof *ret))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating reliable UDP channel\n");
+      return NULL;
+   }
+
+   ret->fd = fd;
+   ret->peer = *peer;
+   ret->cwnd = CWND_INIT;
+   ret->ssthresh = NETCODE_RUDP_WINDOW;
+   ret->rto = RTO_INIT_NS;
+   ret->rng = 1;
+   for (size_t i=0; i<NETCODE_RUDP_STREAMS; i++) {
+      ret->ordered[i] = true;
+   }
+
+   return ret;
+}
+
+void netcode_rudp_del (netcode_rudp_t *rudp)
+{
+   if (!rudp)
+      return;
+
+   for (size_t i=0; i<NETCODE_RUDP_WINDOW; i++) {
+      netcode_util_free (rudp->tx[i].msg);
+      for (size_t j=0; j<NETCODE_RUDP_STREAMS; j++) {
+         netcode_util_free (rudp->held[j][i]);
+      }
+   }
+   while (rudp->deliver_head) {
+      struct msg_t *next = rudp->deliver_head->next;
+      netcode_util_free (rudp->deliver_head);
+      rudp->deliver_head = next;
+   }
+   netcode_util_free (rudp);
+}
+
+bool netcode_rudp_set_ordered (netcode_rudp_t *rudp, uint8_t stream, bool ordered)
+{
+   if (!rudp || stream >= NETCODE_RUDP_STREAMS)
+      return false;
+
+   rudp->ordered[stream] = ordered;
+   return true;
+}
+
+bool netcode_rudp_send (netcode_rudp_t *rudp, uint8_t stream,
+                        const void *msg, size_t len)
+{
+   struct msg_t *tmp = NULL;
+
+   if (!rudp || stream >= NETCODE_RUDP_STREAMS || len > NETCODE_RUDP_MAX_MSG) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Invalid stream (%u) or message length (%zu)\n", stream, len);
+      return false;
+   }
+
+   if (rudp->snd_nxt - rudp->snd_una >= NETCODE_RUDP_WINDOW)
+      return false;
+
+   if (!(tmp = netcode_util_malloc (sizeof *tmp + len))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating message of %zu bytes\n", len);
+      return false;
+   }
+   tmp->next = NULL;
+   tmp->seq = rudp->snd_nxt++;
+   tmp->sseq = rudp->snd_sseq[stream]++;
+   tmp->stream = stream;
+   tmp->len = (uint16_t)len;
+   memcpy (tmp->data, msg, len);
+
+   rudp->tx[tmp->seq % NETCODE_RUDP_WINDOW].msg = tmp;
+   rudp->stats.sent++;
+
+   run_timers (rudp, netcode_util_time_ns ());
+   return true;
+}
+
+size_t netcode_rudp_poll (netcode_rudp_t *rudp, size_t timeout_ms)
+{
+   uint8_t pkt[DATA_HDRLEN + NETCODE_RUDP_MAX_MSG + 1];
+   uint64_t now = netcode_util_time_ns ();
+   uint64_t end = now + timeout_ms * NSEC_PER_MSEC;
+
+   if (!rudp)
+      return (size_t)-1;
+
+   for (;;) {
+      uint64_t next = run_timers (rudp, now);
+      if (next > end)
+         next = end;
+
+      uint64_t wait = (rudp->deliverable || next <= now) ? 0 : next - now;
+      struct timeval tv = { (long)(wait / 1000000000ULL), (long)(wait % 1000000000ULL / 1000) };
+      fd_set fds;
+      int rc;
+
+      FD_ZERO (&fds);
+      FD_SET (rudp->fd, &fds);
+      while ((rc = select (rudp->fd + 1, &fds, NULL, NULL, &tv)) > 0) {
+         struct sockaddr_storage from;
+         socklen_t fromlen = sizeof from;
+         netcode_addr_t addr;
+
+         ssize_t len = recvfrom (rudp->fd, (void *)pkt, sizeof pkt, 0,
+                                 (struct sockaddr *)&from, &fromlen);
+         if (len < 0) {
+            NETCODE_LOG (NETCODE_LOG_ERROR, "recvfrom() failure: %s\n",
+                                            netcode_util_strerror (netcode_util_errno ()));
+            return (size_t)-1;
+         }
+
+         now = netcode_util_time_ns ();
+         if (netcode_addr_from_sockaddr (&addr, (struct sockaddr *)&from, fromlen) &&
+               netcode_addr_cmp (&addr, &rudp->peer) == 0) {
+            if (len >= DATA_HDRLEN && pkt[0] == TYPE_DATA)
+               process_data (rudp, pkt, (size_t)len);
+            if (len == ACK_HDRLEN && pkt[0] == TYPE_ACK)
+               process_ack (rudp, pkt, now);
+         }
+
+         tv.tv_sec = tv.tv_usec = 0;
+         FD_ZERO (&fds);
+         FD_SET (rudp->fd, &fds);
+      }
+      if (rc < 0) {
+         NETCODE_LOG (NETCODE_LOG_ERROR, "select() failure: %s\n",
+                                         netcode_util_strerror (netcode_util_errno ()));
+         return (size_t)-1;
+      }
+
+      if (rudp->ack_pending)
+         send_ack (rudp);
+
+      now = netcode_util_time_ns ();
+      if (rudp->deliverable || now >= end)
+         break;
+   }
+
+   run_timers (rudp, now);
+   return rudp->deliverable;
+}
+
+bool netcode_rudp_recv (netcode_rudp_t *rudp, uint8_t *stream,
+                        void *buf, size_t *len)
+{
+   struct msg_t *msg = NULL;
+
+   if (!rudp || !(msg = rudp->deliver_head))
+      return false;
+
+   if (!(rudp->deliver_head = msg->next))
+      rudp->deliver_tail = NULL;
+   rudp->deliverable--;
+
+   if (stream)
+      *stream = msg->stream;
+   if (*len > msg->len)
+      *len = msg->len;
+   memcpy (buf, msg->data, *len);
+   netcode_util_free (msg);
+   return true;
+}
+
+size_t netcode_rudp_unacked (const netcode_rudp_t *rudp)
+{
+   return rudp ? (size_t)(rudp->snd_nxt - rudp->snd_una) : 0;
+}
+
+void netcode_rudp_stats (const netcode_rudp_t *rudp, netcode_rudp_stats_t *dst)
+{
+   memset (dst, 0, sizeof *dst);
+   if (!rudp)
+      return;
+
+   *dst = rudp->stats;
+   dst->srtt_ns = rudp->srtt;
+   dst->rto_ns = rudp->rto;
+   dst->cwnd = rudp->cwnd;
+}
+
+void netcode_rudp_inject_faults (netcode_rudp_t *rudp, double loss, double reorder,
+                                 uint32_t seed)
+{
+   if (!rudp)
+      return;
+
+   rudp->loss = loss;
+   rudp->reorder = reorder;
+   rudp->rng = seed ? seed : 1;
+   flush_delayed (rudp);
+}
+
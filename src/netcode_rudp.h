@@ -0,0 +1,117 @@
+
+#ifndef H_NETCODE_RUDP
+#define H_NETCODE_RUDP
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "netcode_addr.h"
+
+// The largest message that can be sent; each message travels in a single
+// datagram, so this keeps datagrams below the common 1280-byte minimum
+// IPv6 MTU.
+#define NETCODE_RUDP_MAX_MSG        (1200)
+
+// Messages are sent on one of this many streams. Ordering (when enabled)
+// is per stream, so a lost message only holds back its own stream.
+#define NETCODE_RUDP_STREAMS        (16)
+
+// The most messages that may be sent and not yet acknowledged.
+#define NETCODE_RUDP_WINDOW         (256)
+
+/* A reliable, message-oriented channel between this socket and a single
+ * peer over UDP. Messages are numbered and acknowledged selectively; lost
+ * messages are retransmitted after a timeout derived from the measured
+ * round-trip time, or sooner when later messages are acknowledged ahead
+ * of them. A congestion window (slow start, then additive increase,
+ * halved on loss) limits the number of messages in flight.
+ *
+ * Both ends must use a netcode_rudp_t. The channel has no connection
+ * set-up or teardown: it is up to the application to agree on the peer
+ * and on when it is finished.
+ *
+ * All work (reading datagrams, acknowledging, retransmitting) is done in
+ * netcode_rudp_poll(), which must be called regularly, and
+ * netcode_rudp_send(). A channel is not thread-safe.
+ */
+typedef struct netcode_rudp_t netcode_rudp_t;
+
+typedef struct netcode_rudp_stats_t {
+   uint64_t    sent;             // Messages sent, excluding retransmissions
+   uint64_t    retransmitted;    // Retransmitted messages
+   uint64_t    received;         // Messages delivered to the application
+   uint64_t    duplicates;       // Messages received more than once
+   uint64_t    srtt_ns;          // Smoothed round-trip time
+   uint64_t    rto_ns;           // Current retransmission timeout
+   double      cwnd;             // Congestion window, in messages
+} netcode_rudp_stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Creates a channel that exchanges messages with 'peer' over the
+   // datagram socket 'fd' (for example, from netcode_udp_socket()).
+   // Datagrams on 'fd' from any other address are discarded, so 'fd'
+   // must not be shared with other users. The channel does not take
+   // ownership of 'fd'.
+   //
+   // RETURNS: NULL on error.
+   netcode_rudp_t *netcode_rudp_new (int fd, const netcode_addr_t *peer);
+   void netcode_rudp_del (netcode_rudp_t *rudp);
+
+   // Enables (the default) or disables in-order delivery on 'stream'.
+   // Messages on an unordered stream are delivered as soon as they
+   // arrive. This is a receive-side setting: it controls how messages
+   // received on the stream are delivered.
+   //
+   // RETURNS: false if 'stream' is out of range.
+   bool netcode_rudp_set_ordered (netcode_rudp_t *rudp, uint8_t stream, bool ordered);
+
+   // Queues the message 'msg' of 'len' bytes for reliable delivery on
+   // 'stream', sending it immediately if the congestion window allows.
+   //
+   // RETURNS: true on success, false if the message is too large, the
+   // stream is out of range, or NETCODE_RUDP_WINDOW messages are still
+   // unacknowledged (call netcode_rudp_poll() and try again).
+   bool netcode_rudp_send (netcode_rudp_t *rudp, uint8_t stream,
+                           const void *msg, size_t len);
+
+   // Waits up to 'timeout_ms' milliseconds for datagrams, processes
+   // those received, sends acknowledgements and retransmits messages
+   // whose timers have expired. Returns early when a message becomes
+   // available to netcode_rudp_recv().
+   //
+   // RETURNS: the number of messages waiting to be received, or
+   // (size_t)-1 on a socket error.
+   size_t netcode_rudp_poll (netcode_rudp_t *rudp, size_t timeout_ms);
+
+   // Removes the next delivered message and copies it into 'buf'. On
+   // entry '*len' is the size of 'buf'; on return it is the length of
+   // the message, which is truncated if 'buf' is too small. The stream
+   // of the message is stored in '*stream' if 'stream' is not NULL.
+   //
+   // RETURNS: false if no message is waiting.
+   bool netcode_rudp_recv (netcode_rudp_t *rudp, uint8_t *stream,
+                           void *buf, size_t *len);
+
+   // Returns the number of messages sent and not yet acknowledged.
+   size_t netcode_rudp_unacked (const netcode_rudp_t *rudp);
+
+   void netcode_rudp_stats (const netcode_rudp_t *rudp, netcode_rudp_stats_t *dst);
+
+   // For testing: drops each outgoing datagram (messages and
+   // acknowledgements) with probability 'loss', and holds back each
+   // outgoing datagram with probability 'reorder' so that it is sent
+   // after the next one. 'seed' makes the sequence of faults repeatable.
+   // Pass zero probabilities to turn the injector off.
+   void netcode_rudp_inject_faults (netcode_rudp_t *rudp, double loss, double reorder,
+                                    uint32_t seed);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
@@ -0,0 +1,234 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "netcode_util.h"
+#include "netcode_udp.h"
+#include "netcode_rudp.h"
+
+#define NMSGS           (2000)
+#define ORDERED         (0)
+#define UNORDERED       (1)
+#define LOSS            (0.10)
+#define REORDER         (0.10)
+#define TIMEOUT_NS      (60ULL * 1000000000ULL)
+
+/* Each message carries its stream and its index on that stream, padded
+ * to a length that varies with the index.
+ */
+static size_t make_msg (uint8_t *dst, uint8_t stream, uint32_t idx)
+{
+   size_t len = 8 + idx % 200;
+   memset (dst, (int)(idx & 0xff), len);
+   dst[0] = stream;
+   memcpy (&dst[4], &idx, sizeof idx);
+   return len;
+}
+
+static netcode_rudp_t *make_channel (int *fd, uint16_t port, uint16_t peer_port)
+{
+   netcode_addr_t peer;
+
+   netcode_addr_parse (&peer, "127.0.0.1");
+   netcode_addr_set_port (&peer, peer_port);
+
+   if ((*fd = netcode_udp_socket (port, NULL)) < 0) {
+      NETCODE_UTIL_LOG ("Failed to create socket on port %u\n", port);
+      return NULL;
+   }
+   return netcode_rudp_new (*fd, &peer);
+}
+
+/* An ACK that selectively acknowledges messages that were never sent
+ * must not make the sender presume earlier messages lost. Two messages
+ * are sent to a plain socket, which replies with a forged ACK that
+ * acknowledges the second and sets every other SACK bit; the first stays
+ * unacknowledged and nothing is retransmitted.
+ */
+static bool forged_ack_test (void)
+{
+   int fda = -1, fdb = -1;
+   netcode_rudp_t *a = NULL;
+   netcode_addr_t peer;
+   uint8_t msg[16] = { 0 }, ack[16] = { 2, 0, 0, 0,  0, 0, 0, 0 };
+   netcode_rudp_stats_t stats;
+   bool ret = false;
+
+   netcode_addr_parse (&peer, "127.0.0.1");
+   netcode_addr_set_port (&peer, NETCODE_TEST_RUDP_PORT1);
+   memset (&ack[8], 0xff, 8);
+
+   if (!(a = make_channel (&fda, NETCODE_TEST_RUDP_PORT1, NETCODE_TEST_RUDP_PORT2)) ||
+       (fdb = netcode_udp_socket (NETCODE_TEST_RUDP_PORT2, NULL)) < 0) {
+      NETCODE_UTIL_LOG ("Failed to create the channel\n");
+      goto errorexit;
+   }
+
+   if (!(netcode_rudp_send (a, ORDERED, msg, sizeof msg)) ||
+       !(netcode_rudp_send (a, ORDERED, msg, sizeof msg)) ||
+       netcode_rudp_poll (a, 0) == (size_t)-1 ||
+       netcode_udp_send_addr (fdb, &peer, ack, sizeof ack, NULL) != sizeof ack ||
+       netcode_rudp_poll (a, 10) == (size_t)-1) {
+      NETCODE_UTIL_LOG ("Failed to exchange the forged ACK\n");
+      goto errorexit;
+   }
+
+   netcode_rudp_stats (a, &stats);
+   printf ("RUDP: forged ACK left %zu unacked, %" PRIu64 " retransmitted\n",
+           netcode_rudp_unacked (a), stats.retransmitted);
+   if (netcode_rudp_unacked (a) != 2 || stats.retransmitted != 0) {
+      NETCODE_UTIL_LOG ("SACK bits for unsent messages were trusted\n");
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_rudp_del (a);
+   if (fda >= 0)
+      netcode_util_close (fda);
+   if (fdb >= 0)
+      netcode_util_close (fdb);
+   return ret;
+}
+
+static bool transfer_test (void)
+{
+   bool ret = false;
+   int fda = -1, fdb = -1;
+   netcode_rudp_t *a = NULL, *b = NULL;
+   uint32_t next_send[2] = { 0, 0 };
+   uint32_t next_recv_ordered = 0;
+   static bool seen_unordered[NMSGS / 2];
+   size_t nreceived = 0, out_of_order = 0;
+   uint8_t msg[NETCODE_RUDP_MAX_MSG], expected[NETCODE_RUDP_MAX_MSG];
+
+   if (!(a = make_channel (&fda, NETCODE_TEST_RUDP_PORT1, NETCODE_TEST_RUDP_PORT2)) ||
+       !(b = make_channel (&fdb, NETCODE_TEST_RUDP_PORT2, NETCODE_TEST_RUDP_PORT1))) {
+      NETCODE_UTIL_LOG ("Failed to create channels\n");
+      goto errorexit;
+   }
+
+   netcode_rudp_set_ordered (b, UNORDERED, false);
+   netcode_rudp_inject_faults (a, LOSS, REORDER, 12345);
+   netcode_rudp_inject_faults (b, LOSS, REORDER, 67890);
+
+   uint64_t start = netcode_util_time_ns ();
+   while (nreceived < NMSGS || netcode_rudp_unacked (a)) {
+      if (netcode_util_time_ns () - start > TIMEOUT_NS) {
+         NETCODE_UTIL_LOG ("Timed out with %zu of %i messages received\n",
+                           nreceived, NMSGS);
+         goto errorexit;
+      }
+
+      // Alternate between the streams until the window is full.
+      while (next_send[0] + next_send[1] < NMSGS) {
+         uint8_t stream = (next_send[0] + next_send[1]) % 2;
+         size_t len = make_msg (msg, stream, next_send[stream]);
+         if (!(netcode_rudp_send (a, stream, msg, len)))
+            break;
+         next_send[stream]++;
+      }
+
+      if (netcode_rudp_poll (a, 0) == (size_t)-1 ||
+          netcode_rudp_poll (b, 1) == (size_t)-1) {
+         NETCODE_UTIL_LOG ("Poll failed\n");
+         goto errorexit;
+      }
+
+      uint8_t stream;
+      size_t len = sizeof msg;
+      while (netcode_rudp_recv (b, &stream, msg, &len)) {
+         uint32_t idx;
+         memcpy (&idx, &msg[4], sizeof idx);
+
+         if (stream == ORDERED) {
+            if (idx != next_recv_ordered) {
+               NETCODE_UTIL_LOG ("Ordered stream: expected %" PRIu32 ", got %" PRIu32 "\n",
+                                 next_recv_ordered, idx);
+               goto errorexit;
+            }
+            next_recv_ordered++;
+         } else {
+            if (idx >= NMSGS / 2 || seen_unordered[idx]) {
+               NETCODE_UTIL_LOG ("Unordered stream: unexpected message %" PRIu32 "\n", idx);
+               goto errorexit;
+            }
+            if (idx && !seen_unordered[idx - 1])
+               out_of_order++;
+            seen_unordered[idx] = true;
+         }
+
+         if (len != make_msg (expected, stream, idx) || memcmp (msg, expected, len) != 0) {
+            NETCODE_UTIL_LOG ("Message %" PRIu32 " on stream %u is corrupt\n", idx, stream);
+            goto errorexit;
+         }
+
+         nreceived++;
+         len = sizeof msg;
+      }
+   }
+
+   netcode_rudp_stats_t stats;
+   netcode_rudp_stats (a, &stats);
+   printf ("RUDP: %zu messages in %.3fs, %zu unordered arrived early\n",
+           nreceived, (netcode_util_time_ns () - start) / 1e9, out_of_order);
+   printf ("RUDP: sent %" PRIu64 ", retransmitted %" PRIu64 ", srtt %" PRIu64 "us, "
+           "rto %" PRIu64 "us, cwnd %.1f\n",
+           stats.sent, stats.retransmitted, stats.srtt_ns / 1000, stats.rto_ns / 1000,
+           stats.cwnd);
+
+   if (stats.sent != NMSGS || stats.retransmitted == 0) {
+      NETCODE_UTIL_LOG ("Unexpected sender statistics\n");
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_rudp_del (a);
+   netcode_rudp_del (b);
+   if (fda >= 0)
+      netcode_util_close (fda);
+   if (fdb >= 0)
+      netcode_util_close (fdb);
+   return ret;
+}
+
+static int rudp_test (void)
+{
+   if (!(transfer_test ()) ||
+       !(forged_ack_test ()))
+      return EXIT_FAILURE;
+
+   return EXIT_SUCCESS;
+}
+
+int main (void)
+{
+   int ret = EXIT_FAILURE;
+
+   if (!(netcode_util_init ())) {
+      NETCODE_UTIL_LOG ("Failed to initialise netcode\n");
+      goto errorexit;
+   }
+
+   if ((ret = rudp_test ())!=EXIT_SUCCESS) {
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      printf ("+++ +++ rudp: Test FAILED +++ +++\n");
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      goto errorexit;
+   }
+
+   printf ("**********************************\n");
+   printf ("*** *** rudp: Test passed *** ***\n");
+   printf ("**********************************\n");
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   return ret;
+}
+
@@ -0,0 +1,343 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT        (103)
+#endif
+#endif
+
+#include "netcode_util.h"
+#include "netcode_udp.h"
+
+#define MAX_DGRAM       (65536)
+#define MAX_SEND        (2 * 65536)
+
+// Byte 'i' of every payload, so that a datagram's offset in the buffer
+// can be checked from its contents.
+static uint8_t pattern (size_t i)
+{
+   return (uint8_t)(i * 2654435761u >> 11);
+}
+
+/* Receives the datagrams that a buffer of 'len' bytes sent in segments
+ * of 'segment_size' should arrive as, checking the length and contents
+ * of each, and that nothing follows them.
+ */
+static bool expect_segments (int rxfd, const uint8_t *sent, size_t len, size_t segment_size,
+                             uint8_t *rxbuf)
+{
+   size_t offset = 0, n = 0;
+
+   while (offset < len) {
+      size_t expected = len - offset < segment_size ? len - offset : segment_size;
+      size_t got = netcode_udp_recv_into (rxfd, NULL, rxbuf, MAX_DGRAM, 1);
+
+      if (got != expected || memcmp (rxbuf, &sent[offset], expected) != 0) {
+         NETCODE_UTIL_LOG ("Datagram %zu: received %zu bytes, expected %zu at offset %zu\n",
+                           n, got, expected, offset);
+         return false;
+      }
+      offset += expected;
+      n++;
+   }
+
+   if (netcode_udp_recv_into (rxfd, NULL, rxbuf, MAX_DGRAM, 0) != 0) {
+      NETCODE_UTIL_LOG ("More datagrams arrived than were sent\n");
+      return false;
+   }
+   return true;
+}
+
+static bool segmented_test (int rxfd, int txfd, const netcode_addr_t *dest,
+                            uint8_t *txbuf, uint8_t *rxbuf)
+{
+   static const struct {
+      size_t len;
+      size_t segment_size;
+   } cases[] = {
+      { 3000,           1000  },     // An exact multiple
+      { 3001,           1000  },     // A one-byte tail
+      { 500,            1000  },     // Shorter than one segment
+      { 1000,           1000  },     // Exactly one segment
+      { 70 * 200 + 7,   200   },     // More segments than one GSO send takes
+      { 2 * 60000 + 10, 60000 },     // Too large for two segments per GSO send
+      { 2 * 65100,      65100 },     // Larger than a whole GSO send
+      { 65507,          65507 },     // The largest datagram
+   };
+
+   for (size_t i=0; i<sizeof cases / sizeof cases[0]; i++) {
+      size_t len = cases[i].len, segment_size = cases[i].segment_size;
+      size_t sent = netcode_udp_send_segmented_addr (txfd, dest, txbuf, len,
+                                                     (uint16_t)segment_size);
+      if (sent != len) {
+         NETCODE_UTIL_LOG ("Sent %zu of %zu bytes in segments of %zu\n", sent, len, segment_size);
+         return false;
+      }
+      if (!(expect_segments (rxfd, txbuf, len, segment_size, rxbuf)))
+         return false;
+      printf ("SEGMENT: %zu bytes in segments of %zu received intact\n", len, segment_size);
+   }
+
+   // Segments larger than a UDP datagram can carry are refused.
+   if (netcode_udp_send_segmented_addr (txfd, dest, txbuf, 2 * 65535, 65535) != (size_t)-1 ||
+       netcode_udp_send_segmented_addr (txfd, dest, txbuf, 100, 0) != (size_t)-1) {
+      NETCODE_UTIL_LOG ("An invalid segment size was accepted\n");
+      return false;
+   }
+   if (netcode_udp_recv_into (rxfd, NULL, rxbuf, MAX_DGRAM, 0) != 0) {
+      NETCODE_UTIL_LOG ("A refused send put datagrams on the wire\n");
+      return false;
+   }
+
+   return true;
+}
+
+static bool many_test (int rxfd, int txfd, const netcode_addr_t *dest,
+                       uint8_t *txbuf, uint8_t *rxbuf)
+{
+   static const size_t lengths[] = { 1, 100, 1400, 9000, 1 };
+   struct iovec iov[sizeof lengths / sizeof lengths[0]];
+   size_t n = sizeof lengths / sizeof lengths[0], offset = 0;
+
+   for (size_t i=0; i<n; i++) {
+      iov[i].iov_base = &txbuf[offset];
+      iov[i].iov_len = lengths[i];
+      offset += lengths[i];
+   }
+
+   if (netcode_udp_send_many_addr (txfd, dest, iov, n) != n) {
+      NETCODE_UTIL_LOG ("send_many did not send every datagram\n");
+      return false;
+   }
+
+   for (size_t i=0; i<n; i++) {
+      if (netcode_udp_recv_into (rxfd, NULL, rxbuf, MAX_DGRAM, 1) != lengths[i] ||
+          memcmp (rxbuf, iov[i].iov_base, lengths[i]) != 0) {
+         NETCODE_UTIL_LOG ("send_many datagram %zu arrived wrong\n", i);
+         return false;
+      }
+   }
+
+   printf ("SEGMENT: %zu datagrams from send_many received intact\n", n);
+   return true;
+}
+
+// Whether the kernel takes UDP_SEGMENT, without which loopback has
+// nothing for GRO to coalesce.
+static bool gso_available (int fd)
+{
+#ifdef __linux__
+   int gso_size = 0;
+   socklen_t len = sizeof gso_size;
+   return getsockopt (fd, SOL_UDP, UDP_SEGMENT, &gso_size, &len) == 0;
+#else
+   (void)fd;
+   return false;
+#endif
+}
+
+/* A GSO send to a GRO socket over loopback arrives as one coalesced
+ * buffer, which netcode_udp_wait_segmented() returns with the segment
+ * size it was sent with.
+ */
+static bool gro_test (int txfd, uint8_t *txbuf)
+{
+   const size_t len = 10 * 1000 + 300, segment_size = 1000;
+   netcode_addr_t dest, from;
+   uint8_t *buf = NULL;
+   size_t buflen = 0, rx_segment_size = 0, received = 0;
+   bool coalesced = false, ret = false;
+   int rxfd = -1;
+
+   netcode_addr_parse (&dest, "127.0.0.1");
+   netcode_addr_set_port (&dest, NETCODE_TEST_GRO_PORT);
+
+   if ((rxfd = netcode_udp_socket (NETCODE_TEST_GRO_PORT, NULL)) < 0) {
+      NETCODE_UTIL_LOG ("Failed to create the GRO socket\n");
+      goto errorexit;
+   }
+   if (!(netcode_udp_set_gro (rxfd, true)) || !(gso_available (txfd))) {
+      printf ("SEGMENT: UDP GRO or GSO is not supported, skipping the GRO test\n");
+      ret = true;
+      goto errorexit;
+   }
+
+   if (netcode_udp_send_segmented_addr (txfd, &dest, txbuf, len, segment_size) != len) {
+      NETCODE_UTIL_LOG ("Failed to send to the GRO socket\n");
+      goto errorexit;
+   }
+
+   while (received < len) {
+      size_t got = netcode_udp_wait_segmented_addr (rxfd, &from, &buf, &buflen,
+                                                    &rx_segment_size, 1);
+      if (got == 0 || got == (size_t)-1 || got != buflen || received + got > len ||
+          memcmp (buf, &txbuf[received], got) != 0) {
+         NETCODE_UTIL_LOG ("Coalesced buffer at offset %zu is wrong (%zu bytes)\n",
+                           received, got);
+         goto errorexit;
+      }
+      if (got > segment_size) {
+         coalesced = true;
+         if (rx_segment_size != segment_size) {
+            NETCODE_UTIL_LOG ("Coalesced buffer reported segments of %zu, not %zu\n",
+                              rx_segment_size, segment_size);
+            goto errorexit;
+         }
+      } else if (rx_segment_size != got) {
+         NETCODE_UTIL_LOG ("Single datagram reported segments of %zu, not %zu\n",
+                           rx_segment_size, got);
+         goto errorexit;
+      }
+      printf ("SEGMENT: GRO buffer of %zu bytes, segment size %zu\n", got, rx_segment_size);
+      received += got;
+      netcode_util_free (buf);
+      buf = NULL;
+   }
+
+   if (!coalesced) {
+      NETCODE_UTIL_LOG ("No datagrams were coalesced\n");
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_util_free (buf);
+   if (rxfd >= 0)
+      netcode_util_close (rxfd);
+   return ret;
+}
+
+/* Segments larger than the path MTU cannot go out in one GSO send, but
+ * they are valid datagrams and are sent (fragmented) one at a time.
+ * IPV6_MTU lowers the MTU of a socket on the IPv6 loopback, which stands
+ * in for an interface with a small MTU.
+ */
+static bool mtu_test (uint8_t *txbuf, uint8_t *rxbuf)
+{
+#ifdef __linux__
+   const size_t len = 8000, segment_size = 2000;
+   struct sockaddr_in6 sin6;
+   netcode_addr_t dest;
+   int mtu = 1280;
+   int rxfd = -1, txfd = -1;
+   bool ret = false;
+
+   memset (&sin6, 0, sizeof sin6);
+   sin6.sin6_family = AF_INET6;
+   sin6.sin6_addr = in6addr_loopback;
+   sin6.sin6_port = htons (NETCODE_TEST_SEGMENT_PORT2);
+
+   if ((rxfd = socket (AF_INET6, SOCK_DGRAM, 0)) < 0 ||
+       bind (rxfd, (struct sockaddr *)&sin6, sizeof sin6) != 0 ||
+       (txfd = socket (AF_INET6, SOCK_DGRAM, 0)) < 0 ||
+       setsockopt (txfd, IPPROTO_IPV6, IPV6_MTU, &mtu, sizeof mtu) != 0) {
+      printf ("SEGMENT: no IPv6 loopback with a settable MTU, skipping the MTU test\n");
+      ret = true;
+      goto errorexit;
+   }
+
+   netcode_addr_parse (&dest, "[::1]");
+   netcode_addr_set_port (&dest, NETCODE_TEST_SEGMENT_PORT2);
+
+   size_t sent = netcode_udp_send_segmented_addr (txfd, &dest, txbuf, len,
+                                                  (uint16_t)segment_size);
+   if (sent != len) {
+      NETCODE_UTIL_LOG ("Sent %zu of %zu bytes in segments of %zu over a %i byte MTU\n",
+                        sent, len, segment_size, mtu);
+      goto errorexit;
+   }
+   if (!(expect_segments (rxfd, txbuf, len, segment_size, rxbuf)))
+      goto errorexit;
+
+   printf ("SEGMENT: %zu bytes in segments of %zu over a %i byte MTU received intact\n",
+           len, segment_size, mtu);
+   ret = true;
+
+errorexit:
+   if (rxfd >= 0)
+      close (rxfd);
+   if (txfd >= 0)
+      close (txfd);
+   return ret;
+#else
+   (void)txbuf;
+   (void)rxbuf;
+   return true;
+#endif
+}
+
+static int segment_test (void)
+{
+   int ret = EXIT_FAILURE;
+   int rxfd = -1, txfd = -1;
+   uint8_t *txbuf = NULL, *rxbuf = NULL;
+   netcode_addr_t dest;
+
+   netcode_addr_parse (&dest, "127.0.0.1");
+   netcode_addr_set_port (&dest, NETCODE_TEST_SEGMENT_PORT);
+
+   if (!(txbuf = netcode_util_malloc (MAX_SEND)) || !(rxbuf = netcode_util_malloc (MAX_DGRAM))) {
+      NETCODE_UTIL_LOG ("OOM allocating buffers\n");
+      goto errorexit;
+   }
+   for (size_t i=0; i<MAX_SEND; i++) {
+      txbuf[i] = pattern (i);
+   }
+
+   if ((rxfd = netcode_udp_socket (NETCODE_TEST_SEGMENT_PORT, NULL)) < 0 ||
+       (txfd = netcode_udp_socket (0, NULL)) < 0) {
+      NETCODE_UTIL_LOG ("Failed to create sockets\n");
+      goto errorexit;
+   }
+
+   if (!(segmented_test (rxfd, txfd, &dest, txbuf, rxbuf)) ||
+       !(many_test (rxfd, txfd, &dest, txbuf, rxbuf)) ||
+       !(mtu_test (txbuf, rxbuf)) ||
+       !(gro_test (txfd, txbuf)))
+      goto errorexit;
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   if (rxfd >= 0)
+      netcode_util_close (rxfd);
+   if (txfd >= 0)
+      netcode_util_close (txfd);
+   netcode_util_free (txbuf);
+   netcode_util_free (rxbuf);
+   return ret;
+}
+
+int main (void)
+{
+   int ret = EXIT_FAILURE;
+
+   if (!(netcode_util_init ())) {
+      NETCODE_UTIL_LOG ("Failed to initialise netcode\n");
+      goto errorexit;
+   }
+
+   if ((ret = segment_test ())!=EXIT_SUCCESS) {
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      printf ("+++ +++ segment: Test FAILED +++ +++\n");
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      goto errorexit;
+   }
+
+   printf ("*********************************\n");
+   printf ("*** *** segment: Test passed *** ***\n");
+   printf ("*********************************\n");
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   return ret;
+}
@@ -0,0 +1,195 @@
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "netcode_util.h"
+#include "netcode_udp.h"
+
+#define NSHARDS         (4)
+#define NFLOWS          (64)
+
+/* Drains every shard and adds the number of datagrams each one had to
+ * 'counts'.
+ */
+static size_t drain (int *fds, size_t counts[NSHARDS])
+{
+   size_t total = 0;
+
+   for (size_t i=0; i<NSHARDS; i++) {
+      uint8_t *buf = NULL;
+      size_t buflen = 0;
+      netcode_addr_t from;
+
+      while (netcode_udp_wait_addr (fds[i], &from, &buf, &buflen, 0) != (size_t)-1 &&
+             netcode_addr_family (&from) != AF_UNSPEC) {
+         free (buf);
+         buf = NULL;
+         counts[i]++;
+         total++;
+      }
+   }
+   return total;
+}
+
+static bool send_one (uint16_t port)
+{
+   netcode_addr_t dest;
+   int fd = -1;
+   bool ret = false;
+
+   netcode_addr_parse (&dest, "127.0.0.1");
+   netcode_addr_set_port (&dest, port);
+
+   // A new socket per datagram gives each datagram a new source port,
+   // and so a new flow hash.
+   if ((fd = netcode_udp_socket (0, NULL)) < 0) {
+      NETCODE_UTIL_LOG ("Failed to create sender socket\n");
+      return false;
+   }
+   ret = netcode_udp_send_addr (fd, &dest, "shard", (size_t)5, NULL) == 5;
+   netcode_util_close (fd);
+   return ret;
+}
+
+static bool hash_test (void)
+{
+   size_t counts[NSHARDS] = { 0 };
+   size_t used = 0;
+   bool ret = false;
+   int *fds = netcode_udp_socket_group (NETCODE_TEST_SHARD_PORT, NSHARDS, false);
+
+   if (!fds) {
+      NETCODE_UTIL_LOG ("Failed to create socket group\n");
+      return false;
+   }
+
+   for (size_t i=0; i<NFLOWS; i++) {
+      if (!(send_one (NETCODE_TEST_SHARD_PORT)))
+         goto errorexit;
+   }
+
+   if (drain (fds, counts) != NFLOWS) {
+      NETCODE_UTIL_LOG ("Datagrams were lost\n");
+      goto errorexit;
+   }
+
+   for (size_t i=0; i<NSHARDS; i++) {
+      printf ("SHARD: hash: shard %zu received %zu datagrams\n", i, counts[i]);
+      used += counts[i] ? 1 : 0;
+   }
+   if (used < 2) {
+      NETCODE_UTIL_LOG ("%i flows all went to the same shard\n", NFLOWS);
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_udp_socket_group_del (fds, NSHARDS);
+   return ret;
+}
+
+#ifdef __linux__
+/* Loopback datagrams are received on the CPU that sent them, so pinning
+ * the sender to each CPU in turn must deliver its datagrams to the shard
+ * for that CPU.
+ */
+static bool cpu_test (void)
+{
+   cpu_set_t allowed, pinned;
+   bool ret = false;
+   int *fds = netcode_udp_socket_group (NETCODE_TEST_SHARD_PORT, NSHARDS, true);
+
+   if (!fds) {
+      NETCODE_UTIL_LOG ("Failed to create steered socket group\n");
+      return false;
+   }
+
+   if (sched_getaffinity (0, sizeof allowed, &allowed) != 0) {
+      NETCODE_UTIL_LOG ("Failed to get CPU affinity\n");
+      goto errorexit;
+   }
+
+   for (int cpu=0; cpu<CPU_SETSIZE; cpu++) {
+      size_t counts[NSHARDS] = { 0 };
+
+      if (!CPU_ISSET (cpu, &allowed))
+         continue;
+
+      CPU_ZERO (&pinned);
+      CPU_SET (cpu, &pinned);
+      if (sched_setaffinity (0, sizeof pinned, &pinned) != 0) {
+         NETCODE_UTIL_LOG ("Failed to pin to CPU %i\n", cpu);
+         goto errorexit;
+      }
+
+      for (size_t i=0; i<NSHARDS * 2; i++) {
+         if (!(send_one (NETCODE_TEST_SHARD_PORT)))
+            goto errorexit;
+      }
+
+      drain (fds, counts);
+      printf ("SHARD: cpu %i: shard %i received %zu of %i datagrams\n",
+              cpu, cpu % NSHARDS, counts[cpu % NSHARDS], NSHARDS * 2);
+      if (counts[cpu % NSHARDS] != NSHARDS * 2) {
+         NETCODE_UTIL_LOG ("Datagrams from CPU %i were not steered to shard %i\n",
+                           cpu, cpu % NSHARDS);
+         goto errorexit;
+      }
+   }
+
+   ret = true;
+
+errorexit:
+   sched_setaffinity (0, sizeof allowed, &allowed);
+   netcode_udp_socket_group_del (fds, NSHARDS);
+   return ret;
+}
+#endif
+
+static int shard_test (void)
+{
+   if (!(hash_test ()))
+      return EXIT_FAILURE;
+
+#ifdef __linux__
+   if (!(cpu_test ()))
+      return EXIT_FAILURE;
+#endif
+
+   return EXIT_SUCCESS;
+}
+
+int main (void)
+{
+   int ret = EXIT_FAILURE;
+
+   if (!(netcode_util_init ())) {
+      NETCODE_UTIL_LOG ("Failed to initialise netcode\n");
+      goto errorexit;
+   }
+
+   if ((ret = shard_test ())!=EXIT_SUCCESS) {
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      printf ("+++ +++ shard: Test FAILED +++ +++\n");
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      goto errorexit;
+   }
+
+   printf ("***********************************\n");
+   printf ("*** *** shard: Test passed *** ***\n");
+   printf ("***********************************\n");
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   return ret;
+}
+
@@ -6,7 +6,11 @@
 #include <inttypes.h>
 
 #include "netcode_util.h"
+#include "netcode_log.h"
+#include "netcode_addr.h"
 #include "netcode_tcp.h"
+#include "netcode_acl.h"
+#include "netcode_ratelimit.h"
 
 /* ***************************************************************** */
 #if defined (OSTYPE_Darwin)
@@ -100,30 +104,33 @@ int netcode_tcp_server (size_t port)
    }
    fd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
    if (fd<0) {
-      // NETCODE_UTIL_LOG ("socket() failed\n");
+      NETCODE_LOG (NETCODE_LOG_DEBUG, "socket() failed\n");
       return -1;
    }
 
    if (bind (fd, (struct sockaddr *)&addr, sizeof addr)!=0) {
-      // NETCODE_UTIL_LOG ("bind() failed\n");
+      NETCODE_LOG (NETCODE_LOG_DEBUG, "bind() failed\n");
       close (fd); fd = -1;
       return -1;
    }
    if (listen (fd, 1)!=0) {
-      // NETCODE_UTIL_LOG ("listen() failed\n");
+      NETCODE_LOG (NETCODE_LOG_DEBUG, "listen() failed\n");
       close (fd); fd = -1;
       return -1;
    }
    return fd;
 }
 
-int netcode_tcp_accept (int fd, size_t timeout, char **addr, uint16_t *port)
+int netcode_tcp_accept_addr (int fd, size_t timeout, netcode_addr_t *addr)
 {
-   struct sockaddr_in ret;
+   struct sockaddr_storage ret;
    socklen_t retlen = sizeof ret;
    int retval = -1;
 
-   memset(&ret, 0xff, sizeof ret);
+   memset(&ret, 0, sizeof ret);
+   if (addr) {
+      memset (addr, 0, sizeof *addr);
+   }
 
    struct timeval tv = { timeout , 0 };
    fd_set fds[3];
@@ -140,6 +147,15 @@ int netcode_tcp_accept (int fd, size_t timeout, char **addr, uint16_t *port)
       return -1;
    }
 
+   // Connections from sources that the installed ACL denies, or that
+   // are over their rate limit, are closed at once and reported as a
+   // timeout.
+   if (!(netcode_acl_permits ((const struct sockaddr *)&ret)) ||
+       !(netcode_ratelimit_permits ((const struct sockaddr *)&ret))) {
+      netcode_util_close (retval);
+      return 0;
+   }
+
    /* This should be performed by the caller on every accepted socket.
 #ifdef OSTYPE_Darwin
    int optval = SO_NOSIGPIPE;
@@ -152,43 +168,47 @@ int netcode_tcp_accept (int fd, size_t timeout, char **addr, uint16_t *port)
    */
 
    if (addr) {
-      *addr = netcode_util_sockaddr_to_str ((const struct sockaddr *)&ret);
+      netcode_addr_from_sockaddr (addr, (const struct sockaddr *)&ret, retlen);
+   }
+
+   return retval;
+}
+
+int netcode_tcp_accept (int fd, size_t timeout, char **addr, uint16_t *port)
+{
+   netcode_addr_t remote;
+
+   int retval = netcode_tcp_accept_addr (fd, timeout, &remote);
+   if (retval <= 0) {
+      return retval;
+   }
+
+   if (addr) {
+      *addr = netcode_util_sockaddr_to_str (netcode_addr_sockaddr (&remote, NULL));
    }
 
    if (port) {
-      *port = ntohs (ret.sin_port);
+      *port = netcode_addr_port (&remote);
    }
    return retval;
 }
 
-int netcode_tcp_connect (const char *server, size_t port)
+int netcode_tcp_connect_addr (const netcode_addr_t *addr)
 {
    /* ****************************************
-    * 0. Resolve the server name.
     * 1. Call socket() to create a new socket.
     * 2. Call connect() to connect to a remote server.
     */
    SAFETY_CHECK;
-   // Resolving server name
-   struct hostent *serv_addr = gethostbyname (server);
-   struct sockaddr_in addr;
-   addr.sin_family = AF_INET;
-   addr.sin_port = htons (port);
-   addr.sin_addr.s_addr = inet_addr (server);
-
-   if (!serv_addr) {
-      return -1;
-   }
-
-   memcpy (&addr.sin_addr.s_addr, serv_addr->h_addr_list[0],
-         sizeof addr.sin_addr.s_addr);
+   size_t salen = 0;
+   const struct sockaddr *sa = netcode_addr_sockaddr (addr, &salen);
 
    // Creating socket endpoint
-   int fd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+   int fd = socket (netcode_addr_family (addr), SOCK_STREAM | SOCK_CLOEXEC, 0);
    if (fd<0) return -1;
 
    // Connecting endpoint to the server
-   if (connect (fd, (struct sockaddr *)&addr, sizeof addr)!=0) {
+   if (connect (fd, sa, salen)!=0) {
       close (fd);
       return -1;
    }
@@ -197,10 +217,26 @@ int netcode_tcp_connect (const char *server, size_t port)
    return fd;
 }
 
+int netcode_tcp_connect (const char *server, size_t port)
+{
+   /* ****************************************
+    * 0. Resolve the server name.
+    * 1. Connect to the resolved address.
+    */
+   SAFETY_CHECK;
+   netcode_addr_t addr;
+
+   if (!(netcode_addr_resolve (&addr, server, (uint16_t)port))) {
+      return -1;
+   }
+
+   return netcode_tcp_connect_addr (&addr);
+}
+
 size_t netcode_tcp_write (int fd, const void *buf, size_t len)
 {
    SAFETY_CHECK;
-   // NETCODE_UTIL_LOG ("sending %zu bytes\n", len);
+   NETCODE_LOG (NETCODE_LOG_TRACE, "sending %zu bytes\n", len);
    ssize_t retval = SEND (fd, buf, len);
    if (retval<0) return (size_t)-1;
    return retval;
@@ -222,7 +258,7 @@ size_t netcode_tcp_read (int fd, void *buf, size_t len, size_t timeout)
 #endif
    if (error_code!=0) return (size_t)-1;
    SAFETY_CHECK;
-   // NETCODE_UTIL_LOG ("Attempting to read %zu bytes\n", len);
+   NETCODE_LOG (NETCODE_LOG_TRACE, "Attempting to read %zu bytes\n", len);
    do {
       fd_set fds;
       FD_ZERO (&fds);
@@ -244,7 +280,7 @@ size_t netcode_tcp_read (int fd, void *buf, size_t len, size_t timeout)
          if (r ==  0) return idx ? idx : (size_t)-1;
 
          idx += (size_t)r;
-         // NETCODE_UTIL_LOG ("read %zu bytes\n", idx);
+         NETCODE_LOG (NETCODE_LOG_TRACE, "read %zu bytes\n", idx);
       }
       if (selresult==0) {
          countdown--;
@@ -5,6 +5,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "netcode_addr.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -24,12 +26,24 @@ extern "C" {
     */
    int netcode_tcp_accept (int fd, size_t timeout, char **addr, uint16_t *port);
 
+   /* Identical to netcode_tcp_accept(), except that the address and port
+    * of the remote peer are stored in '*addr' (if 'addr' is not NULL)
+    * and no memory is allocated.
+    */
+   int netcode_tcp_accept_addr (int fd, size_t timeout, netcode_addr_t *addr);
+
    /* Make a connection to the specified server on the specified port.
     * On success the fd of the connected descriptor is returned. On error -1
     * is returned.
     */
    int netcode_tcp_connect (const char *server, size_t port);
 
+   /* Make a connection to the specified address, which may be an IPv4,
+    * IPv6 or Unix address. Return values are the same as for
+    * netcode_tcp_connect().
+    */
+   int netcode_tcp_connect_addr (const netcode_addr_t *addr);
+
    /* Write the given buffer to the given fd. On success the number
     * of bytes written is returned, which may be less than the specified
     * number of bytes.
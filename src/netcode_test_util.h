@@ -0,0 +1,66 @@
+#ifndef H_NETCODE_TEST_UTIL
+#define H_NETCODE_TEST_UTIL
+
+/* Helpers shared by the test programs. These are not part of the library
+ * and this header is not installed.
+ */
+
+#ifdef __linux__
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <net/if.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+/* Adds (or deletes) the IPv4 address 'addr'/32 on the loopback interface,
+ * which makes the kernel report an address change. Returns the errno from
+ * the kernel, so that the caller can tell a lack of privilege from a
+ * failure.
+ */
+static int netcode_test_lo_addr (const uint8_t addr[4], bool add)
+{
+   struct {
+      struct nlmsghdr   nh;
+      struct ifaddrmsg  ifa;
+      struct rtattr     rta;
+      uint8_t           addr[4];
+   } req;
+   struct {
+      struct nlmsghdr   nh;
+      struct nlmsgerr   err;
+   } resp;
+   int ret = EIO;
+   int fd = socket (AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+
+   if (fd < 0)
+      return errno;
+
+   memset (&req, 0, sizeof req);
+   req.nh.nlmsg_len = sizeof req;
+   req.nh.nlmsg_type = add ? RTM_NEWADDR : RTM_DELADDR;
+   req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | (add ? NLM_F_CREATE | NLM_F_EXCL : 0);
+   req.nh.nlmsg_seq = 1;
+   req.ifa.ifa_family = AF_INET;
+   req.ifa.ifa_prefixlen = 32;
+   req.ifa.ifa_scope = RT_SCOPE_HOST;
+   req.ifa.ifa_index = if_nametoindex ("lo");
+   req.rta.rta_type = IFA_LOCAL;
+   req.rta.rta_len = RTA_LENGTH (sizeof req.addr);
+   memcpy (req.addr, addr, sizeof req.addr);
+
+   if (send (fd, &req, sizeof req, 0) == (ssize_t)sizeof req &&
+       recv (fd, &resp, sizeof resp, 0) >= (ssize_t)sizeof resp &&
+       resp.nh.nlmsg_type == NLMSG_ERROR)
+      ret = -resp.err.error;
+
+   close (fd);
+   return ret;
+}
+#endif
+
+#endif
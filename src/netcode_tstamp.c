@@ -0,0 +1,266 @@
+/* This must come before any system header, otherwise strict C99 mode
+ * hides the control message macros from us.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "netcode_util.h"
+#include "netcode_log.h"
+#include "netcode_tstamp.h"
+
+/* ***************************************************************** */
+#ifdef PLATFORM_Windows
+#include <winsock2.h>
+#include <windows.h>
+
+#endif
+
+/* ***************************************************************** */
+#ifdef PLATFORM_POSIX
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+
+#define TIMESTAMPING_SUPPORTED   (1)
+#endif
+
+#endif
+
+#ifndef TIMESTAMPING_SUPPORTED
+#define TIMESTAMPING_SUPPORTED   (0)
+#endif
+
+#define NSEC_PER_SEC             (1000000000ULL)
+
+/* ***************************************************************** */
+#if TIMESTAMPING_SUPPORTED
+
+// Room for a timestamping message and an extended error message, which
+// is all that either the data or the error queue delivers here.
+#define CMSG_BUFLEN     (CMSG_SPACE (sizeof (struct scm_timestamping)) + \
+                         CMSG_SPACE (sizeof (struct sock_extended_err) + \
+                                     sizeof (struct sockaddr_in6)) + \
+                         CMSG_SPACE (sizeof (struct timespec)))
+
+static uint64_t timespec_ns (const struct timespec *ts)
+{
+   return (uint64_t)ts->tv_sec * NSEC_PER_SEC + (uint64_t)ts->tv_nsec;
+}
+
+static bool socket_is_stream (int fd)
+{
+   int type = 0;
+   socklen_t len = sizeof type;
+
+   if (getsockopt (fd, SOL_SOCKET, SO_TYPE, (void *)&type, &len) != 0)
+      return false;
+   return type == SOCK_STREAM;
+}
+
+/* Fills 'ts' from the timestamping control messages in 'msg', and
+ * returns the extended error (for the error queue) if there is one.
+ */
+static const struct sock_extended_err *parse_cmsgs (struct msghdr *msg,
+                                                    netcode_tstamp_t *ts)
+{
+   const struct sock_extended_err *ret = NULL;
+
+   memset (ts, 0, sizeof *ts);
+
+   for (struct cmsghdr *cmsg = CMSG_FIRSTHDR (msg); cmsg; cmsg = CMSG_NXTHDR (msg, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+         struct scm_timestamping tss;
+         memcpy (&tss, CMSG_DATA (cmsg), sizeof tss);
+         ts->software = timespec_ns (&tss.ts[0]);
+         ts->hardware = timespec_ns (&tss.ts[2]);
+      }
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+         struct timespec tmp;
+         memcpy (&tmp, CMSG_DATA (cmsg), sizeof tmp);
+         ts->software = timespec_ns (&tmp);
+      }
+      if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+          (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+         ret = (const struct sock_extended_err *)CMSG_DATA (cmsg);
+      }
+   }
+   return ret;
+}
+
+#endif
+
+/* ***************************************************************** */
+int netcode_tstamp_enable (int fd, int flags)
+{
+#if TIMESTAMPING_SUPPORTED
+   int ret = 0;
+   int val = SOF_TIMESTAMPING_SOFTWARE;
+
+   if (flags & NETCODE_TSTAMP_RX) {
+      val |= SOF_TIMESTAMPING_RX_SOFTWARE;
+   }
+   if (flags & NETCODE_TSTAMP_TX) {
+      val |= SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_TX_SCHED |
+             SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+      if (socket_is_stream (fd))
+         val |= SOF_TIMESTAMPING_TX_ACK;
+   }
+   if (flags & NETCODE_TSTAMP_HW) {
+      val |= SOF_TIMESTAMPING_RAW_HARDWARE;
+      if (flags & NETCODE_TSTAMP_RX)
+         val |= SOF_TIMESTAMPING_RX_HARDWARE;
+      if (flags & NETCODE_TSTAMP_TX)
+         val |= SOF_TIMESTAMPING_TX_HARDWARE;
+   }
+
+   if (setsockopt (fd, SOL_SOCKET, SO_TIMESTAMPING, (const void *)&val, sizeof val) == 0) {
+      return flags & (NETCODE_TSTAMP_RX | NETCODE_TSTAMP_TX | NETCODE_TSTAMP_HW);
+   }
+
+   NETCODE_LOG (NETCODE_LOG_WARN, "SO_TIMESTAMPING not available (%s), trying SO_TIMESTAMPNS\n",
+                                  netcode_util_strerror (netcode_util_errno ()));
+
+   val = 1;
+   if ((flags & NETCODE_TSTAMP_RX) &&
+         setsockopt (fd, SOL_SOCKET, SO_TIMESTAMPNS, (const void *)&val, sizeof val) == 0) {
+      ret = NETCODE_TSTAMP_RX;
+   }
+   return ret;
+#else
+   (void)fd;
+   (void)flags;
+   NETCODE_LOG (NETCODE_LOG_ERROR, "Timestamping is not supported on this platform\n");
+   return 0;
+#endif
+}
+
+size_t netcode_tstamp_recv (int fd, netcode_addr_t *remote_addr,
+                            void *buf, size_t len,
+                            netcode_tstamp_t *ts, size_t timeout)
+{
+   memset (ts, 0, sizeof *ts);
+   if (remote_addr)
+      memset (remote_addr, 0, sizeof *remote_addr);
+
+#if TIMESTAMPING_SUPPORTED
+   struct timeval tv = { (time_t)timeout, 0 };
+   fd_set fds;
+   struct sockaddr_storage from;
+   struct iovec iov = { buf, len };
+   union {
+      char              buf[CMSG_BUFLEN];
+      struct cmsghdr    align;
+   } control;
+   struct msghdr msg;
+
+   FD_ZERO (&fds);
+   FD_SET (fd, &fds);
+   int rc = select (fd + 1, &fds, NULL, NULL, &tv);
+   if (rc < 0) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "select() failure: %s\n", netcode_util_strerror (netcode_util_errno ()));
+      return (size_t)-1;
+   }
+   if (rc == 0) {
+      return 0;
+   }
+
+   memset (&msg, 0, sizeof msg);
+   msg.msg_name = &from;
+   msg.msg_namelen = sizeof from;
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control.buf;
+   msg.msg_controllen = sizeof control.buf;
+
+   ssize_t nbytes = recvmsg (fd, &msg, 0);
+   if (nbytes < 0) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "recvmsg() failure: %s\n", netcode_util_strerror (netcode_util_errno ()));
+      return (size_t)-1;
+   }
+
+   parse_cmsgs (&msg, ts);
+
+   if (remote_addr) {
+      // Stream sockets do not report the peer on every read.
+      socklen_t fromlen = msg.msg_namelen;
+      if (fromlen == 0) {
+         fromlen = sizeof from;
+         if (getpeername (fd, (struct sockaddr *)&from, &fromlen) != 0)
+            fromlen = 0;
+      }
+      if (fromlen)
+         netcode_addr_from_sockaddr (remote_addr, (const struct sockaddr *)&from, fromlen);
+   }
+
+   return (size_t)nbytes;
+#else
+   (void)fd;
+   (void)buf;
+   (void)len;
+   (void)timeout;
+   NETCODE_LOG (NETCODE_LOG_ERROR, "Timestamping is not supported on this platform\n");
+   return (size_t)-1;
+#endif
+}
+
+size_t netcode_tstamp_tx_read (int fd, netcode_tstamp_tx_t *dst, size_t max)
+{
+#if TIMESTAMPING_SUPPORTED
+   size_t ret = 0;
+
+   while (ret < max) {
+      union {
+         char              buf[CMSG_BUFLEN];
+         struct cmsghdr    align;
+      } control;
+      struct msghdr msg;
+
+      memset (&msg, 0, sizeof msg);
+      msg.msg_control = control.buf;
+      msg.msg_controllen = sizeof control.buf;
+
+      if (recvmsg (fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+         if (errno == EAGAIN || errno == EWOULDBLOCK)
+            break;
+         NETCODE_LOG (NETCODE_LOG_ERROR, "recvmsg(MSG_ERRQUEUE) failure: %s\n",
+                                         netcode_util_strerror (netcode_util_errno ()));
+         return ret ? ret : (size_t)-1;
+      }
+
+      const struct sock_extended_err *ee = parse_cmsgs (&msg, &dst[ret].ts);
+      // Anything else on the error queue (ICMP errors) is not ours.
+      if (!ee || ee->ee_errno != ENOMSG || ee->ee_origin != SO_EE_ORIGIN_TIMESTAMPING)
+         continue;
+
+      dst[ret].id = ee->ee_data;
+      switch (ee->ee_info) {
+         case SCM_TSTAMP_SCHED:  dst[ret].type = NETCODE_TSTAMP_SCHED;  break;
+         case SCM_TSTAMP_ACK:    dst[ret].type = NETCODE_TSTAMP_ACK;    break;
+         default:                dst[ret].type = NETCODE_TSTAMP_SND;    break;
+      }
+      ret++;
+   }
+
+   return ret;
+#else
+   (void)fd;
+   (void)dst;
+   (void)max;
+   NETCODE_LOG (NETCODE_LOG_ERROR, "Timestamping is not supported on this platform\n");
+   return (size_t)-1;
+#endif
+}
+
@@ -0,0 +1,96 @@
+
+#ifndef H_NETCODE_TSTAMP
+#define H_NETCODE_TSTAMP
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "netcode_addr.h"
+
+// Flags for netcode_tstamp_enable().
+#define NETCODE_TSTAMP_RX           (1 << 0)
+#define NETCODE_TSTAMP_TX           (1 << 1)
+#define NETCODE_TSTAMP_HW           (1 << 2)
+
+// The point in the send path at which a transmit timestamp was taken.
+#define NETCODE_TSTAMP_SCHED        (0)   // Entered the qdisc
+#define NETCODE_TSTAMP_SND          (1)   // Handed to the NIC driver (or NIC)
+#define NETCODE_TSTAMP_ACK          (2)   // Acknowledged by the peer (TCP)
+
+/* Timestamps are in nanoseconds since the epoch (CLOCK_REALTIME for
+ * software timestamps, the NIC's clock for hardware timestamps). Zero
+ * means that the timestamp is not available.
+ */
+typedef struct netcode_tstamp_t {
+   uint64_t    software;
+   uint64_t    hardware;
+} netcode_tstamp_t;
+
+/* A transmit timestamp read from a socket's error queue.
+ *
+ * 'id' identifies the data: for datagram sockets it counts the
+ * datagrams sent since transmit timestamps were enabled (the first is
+ * zero); for stream sockets it is the offset, counted from when
+ * timestamps were enabled, of the last byte of the write.
+ */
+typedef struct netcode_tstamp_tx_t {
+   uint32_t          id;
+   int               type;
+   netcode_tstamp_t  ts;
+} netcode_tstamp_tx_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Enables timestamping on the UDP or TCP socket 'fd'. 'flags' is a
+   // combination of:
+   //    NETCODE_TSTAMP_RX: timestamp received data, as returned by
+   //       netcode_tstamp_recv().
+   //    NETCODE_TSTAMP_TX: queue a timestamp for every send, to be read
+   //       with netcode_tstamp_tx_read().
+   //    NETCODE_TSTAMP_HW: also report hardware timestamps. The NIC must
+   //       already be configured to take them (SIOCSHWTSTAMP).
+   //
+   // SO_TIMESTAMPING is used where available; otherwise receive
+   // timestamps fall back to SO_TIMESTAMPNS (software only, no transmit
+   // timestamps).
+   //
+   // RETURNS: the flags that were enabled, which may be fewer than
+   // requested, or zero if timestamping is not supported.
+   int netcode_tstamp_enable (int fd, int flags);
+
+   // Receives from 'fd' into the caller's buffer, together with the time
+   // at which the data arrived. Works like netcode_udp_wait_addr() for
+   // datagram sockets (one datagram per call; a datagram longer than
+   // 'len' is truncated) and like netcode_tcp_read() for stream sockets
+   // (whatever is available, up to 'len' bytes, in a single read).
+   //
+   // The sender's address is stored in '*remote_addr' if 'remote_addr'
+   // is not NULL; on timeout its family is AF_UNSPEC. '*ts' is cleared
+   // when no timestamp was received. This can happen to the first
+   // datagrams after the first socket on the system enables receive
+   // timestamps, as the kernel turns the feature on asynchronously.
+   //
+   // RETURNS: the number of bytes received, zero on timeout (or end of
+   // stream), or (size_t)-1 on error.
+   size_t netcode_tstamp_recv (int fd, netcode_addr_t *remote_addr,
+                               void *buf, size_t len,
+                               netcode_tstamp_t *ts, size_t timeout);
+
+   // Reads up to 'max' transmit timestamps from the error queue of 'fd'
+   // into 'dst' without blocking. Timestamps are queued shortly after
+   // the send call returns, so a caller that needs every timestamp
+   // should poll until it has them.
+   //
+   // RETURNS: the number of timestamps read, which is zero if none are
+   // waiting, or (size_t)-1 on error.
+   size_t netcode_tstamp_tx_read (int fd, netcode_tstamp_tx_t *dst, size_t max);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
@@ -0,0 +1,211 @@
+#ifdef PLATFORM_POSIX
+#define _GNU_SOURCE
+#include <unistd.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "netcode_util.h"
+#include "netcode_tcp.h"
+#include "netcode_udp.h"
+#include "netcode_tstamp.h"
+
+#define PAYLOAD         ("timestamped")
+#define MAX_TX          (16)
+
+static const char *type_name (int type)
+{
+   switch (type) {
+      case NETCODE_TSTAMP_SCHED: return "sched";
+      case NETCODE_TSTAMP_SND:   return "snd";
+      case NETCODE_TSTAMP_ACK:   return "ack";
+   }
+   return "unknown";
+}
+
+// A software timestamp must be close to the current time.
+static bool plausible (uint64_t ns)
+{
+   uint64_t now = (uint64_t)time (NULL);
+   return ns / 1000000000ULL + 5 > now && ns / 1000000000ULL < now + 5;
+}
+
+/* Transmit timestamps arrive on the error queue shortly after the send;
+ * poll for up to a second for at least one with 'want_type'.
+ */
+static bool wait_tx (int fd, int want_type)
+{
+   netcode_tstamp_tx_t tx[MAX_TX];
+
+   for (int tries=0; tries<100; tries++) {
+      size_t n = netcode_tstamp_tx_read (fd, tx, MAX_TX);
+      if (n == (size_t)-1)
+         return false;
+
+      for (size_t i=0; i<n; i++) {
+         printf ("TSTAMP: tx id %" PRIu32 " %s at %" PRIu64 "\n",
+                 tx[i].id, type_name (tx[i].type), tx[i].ts.software);
+         if (tx[i].type == want_type && plausible (tx[i].ts.software))
+            return true;
+      }
+#ifdef PLATFORM_POSIX
+      usleep (10000);
+#endif
+   }
+   NETCODE_UTIL_LOG ("No %s timestamp received\n", type_name (want_type));
+   return false;
+}
+
+static bool udp_test (void)
+{
+   bool ret = false;
+   int rxfd = -1, txfd = -1;
+   netcode_addr_t dest, from;
+   netcode_tstamp_t ts;
+   char buf[64];
+
+   netcode_addr_parse (&dest, "127.0.0.1");
+   netcode_addr_set_port (&dest, NETCODE_TEST_TSTAMP_PORT);
+
+   if ((rxfd = netcode_udp_socket (NETCODE_TEST_TSTAMP_PORT, NULL)) < 0 ||
+       (txfd = netcode_udp_socket (0, NULL)) < 0) {
+      NETCODE_UTIL_LOG ("Failed to create sockets\n");
+      goto errorexit;
+   }
+
+   if (!(netcode_tstamp_enable (rxfd, NETCODE_TSTAMP_RX) & NETCODE_TSTAMP_RX) ||
+       !(netcode_tstamp_enable (txfd, NETCODE_TSTAMP_TX) & NETCODE_TSTAMP_TX)) {
+      NETCODE_UTIL_LOG ("Failed to enable timestamps\n");
+      goto errorexit;
+   }
+
+   // The kernel turns receive timestamping on asynchronously when the
+   // first socket asks for it, so the first few datagrams may arrive
+   // without a timestamp.
+   for (int tries=0; tries<10; tries++) {
+      if (netcode_udp_send_addr (txfd, &dest, PAYLOAD, strlen (PAYLOAD), NULL) != strlen (PAYLOAD)) {
+         NETCODE_UTIL_LOG ("Failed to send datagram\n");
+         goto errorexit;
+      }
+
+      size_t rc = netcode_tstamp_recv (rxfd, &from, buf, sizeof buf, &ts, 1);
+      if (rc != strlen (PAYLOAD) || memcmp (buf, PAYLOAD, rc) != 0) {
+         NETCODE_UTIL_LOG ("Failed to receive datagram\n");
+         goto errorexit;
+      }
+      if (ts.software)
+         break;
+#ifdef PLATFORM_POSIX
+      usleep (10000);
+#endif
+   }
+   printf ("TSTAMP: udp rx at %" PRIu64 "\n", ts.software);
+   if (!(plausible (ts.software))) {
+      NETCODE_UTIL_LOG ("Implausible receive timestamp\n");
+      goto errorexit;
+   }
+
+   if (!(wait_tx (txfd, NETCODE_TSTAMP_SND)))
+      goto errorexit;
+
+   ret = true;
+
+errorexit:
+   if (rxfd >= 0)
+      netcode_util_close (rxfd);
+   if (txfd >= 0)
+      netcode_util_close (txfd);
+   return ret;
+}
+
+static bool tcp_test (void)
+{
+   bool ret = false;
+   int listenfd = -1, clientfd = -1, serverfd = -1;
+   netcode_tstamp_t ts;
+   char buf[64];
+
+   if ((listenfd = netcode_tcp_server (NETCODE_TEST_TSTAMP_PORT)) < 0 ||
+       (clientfd = netcode_tcp_connect ("127.0.0.1", NETCODE_TEST_TSTAMP_PORT)) < 0 ||
+       (serverfd = netcode_tcp_accept (listenfd, 1, NULL, NULL)) <= 0) {
+      NETCODE_UTIL_LOG ("Failed to set up TCP connection\n");
+      goto errorexit;
+   }
+
+   if (!(netcode_tstamp_enable (serverfd, NETCODE_TSTAMP_RX) & NETCODE_TSTAMP_RX) ||
+       !(netcode_tstamp_enable (clientfd, NETCODE_TSTAMP_TX) & NETCODE_TSTAMP_TX)) {
+      NETCODE_UTIL_LOG ("Failed to enable timestamps\n");
+      goto errorexit;
+   }
+
+   if (netcode_tcp_write (clientfd, PAYLOAD, strlen (PAYLOAD)) != strlen (PAYLOAD)) {
+      NETCODE_UTIL_LOG ("Failed to write\n");
+      goto errorexit;
+   }
+
+   size_t rc = netcode_tstamp_recv (serverfd, NULL, buf, sizeof buf, &ts, 1);
+   if (rc != strlen (PAYLOAD) || memcmp (buf, PAYLOAD, rc) != 0) {
+      NETCODE_UTIL_LOG ("Failed to read\n");
+      goto errorexit;
+   }
+   printf ("TSTAMP: tcp rx at %" PRIu64 "\n", ts.software);
+   if (!(plausible (ts.software))) {
+      NETCODE_UTIL_LOG ("Implausible receive timestamp\n");
+      goto errorexit;
+   }
+
+   if (!(wait_tx (clientfd, NETCODE_TSTAMP_ACK)))
+      goto errorexit;
+
+   ret = true;
+
+errorexit:
+   // The client closes first so that the TIME_WAIT state is left on its
+   // ephemeral port and not on the test port.
+   if (clientfd >= 0)
+      netcode_util_close (clientfd);
+   if (serverfd > 0)
+      netcode_util_close (serverfd);
+   if (listenfd >= 0)
+      netcode_util_close (listenfd);
+   return ret;
+}
+
+static int tstamp_test (void)
+{
+   if (!(udp_test ()) || !(tcp_test ()))
+      return EXIT_FAILURE;
+
+   return EXIT_SUCCESS;
+}
+
+int main (void)
+{
+   int ret = EXIT_FAILURE;
+
+   if (!(netcode_util_init ())) {
+      NETCODE_UTIL_LOG ("Failed to initialise netcode\n");
+      goto errorexit;
+   }
+
+   if ((ret = tstamp_test ())!=EXIT_SUCCESS) {
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      printf ("+++ +++ tstamp: Test FAILED +++ +++\n");
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      goto errorexit;
+   }
+
+   printf ("************************************\n");
+   printf ("*** *** tstamp: Test passed *** ***\n");
+   printf ("************************************\n");
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   return ret;
+}
+
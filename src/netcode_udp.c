@@ -1,9 +1,17 @@
 
+/* This must come before any system header, otherwise strict C99 mode
+ * hides sendmmsg(), struct mmsghdr and IOV_MAX from us.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <limits.h>
 
 #include "netcode_util.h"
 #include "netcode_tcp.h"
@@ -57,14 +65,28 @@ static bool initialised = false;
 #include <netdb.h>
 #include <sys/select.h>
 
-#ifndef OSTYPE_Darwin
-/* GCC in strict mode leaves out some libraries it really shouldn't.
- * Rather than spend the next twenty minutes figuring out which set
- * of flags or pragmas will make GCC use the arpa/inet header, I'll
- * just put this here.
- */
-int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
+#ifdef __linux__
+#include <netinet/udp.h>
+#include <linux/filter.h>
+
+#ifndef SOL_UDP
+#define SOL_UDP            (17)
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT        (103)
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO            (104)
+#endif
+#ifndef SO_REUSEPORT
+#define SO_REUSEPORT       (15)
+#endif
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF (51)
+#endif
+#endif
 
+#ifndef OSTYPE_Darwin
 #define SEND(x,y,z)        send (x,y,z, MSG_NOSIGNAL)
 
 #endif
@@ -79,63 +101,236 @@ int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
 #error SAFETY_CHECK not defined - platform variable undefined?
 #endif
 
+#include "netcode_addr.h"
+#include "netcode_if.h"
+#include "netcode_bufpool.h"
+#include "netcode_log.h"
+#include "netcode_acl.h"
+#include "netcode_ratelimit.h"
 #include "netcode_udp.h"
 
-int netcode_udp_socket (uint16_t listen_port, const char *default_host)
+static int netcode_udp_socket_bound (uint16_t listen_port, bool reuseport)
 {
    int sockfd;
    struct sockaddr_in addr;
-   struct hostent *host_addr = NULL;
 
    memset (&addr, 0, sizeof(addr));
    addr.sin_family = AF_INET;
    addr.sin_port = htons (listen_port);
+   addr.sin_addr.s_addr = INADDR_ANY;
+
+   if ((sockfd = socket (AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0) {
+      return -1;
+   }
+
+#ifdef SO_REUSEPORT
+   int one = 1;
+   if (reuseport &&
+         setsockopt (sockfd, SOL_SOCKET, SO_REUSEPORT, (const void *)&one, sizeof one) != 0) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to set SO_REUSEPORT\n");
+      close (sockfd);
+      return -1;
+   }
+#else
+   if (reuseport) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "SO_REUSEPORT is not supported on this platform\n");
+      close (sockfd);
+      return -1;
+   }
+#endif
+
+   if ((bind (sockfd, (struct sockaddr*)&addr, sizeof (addr))) < 0) {
+      close (sockfd);
+      return -1;
+   }
+
+   return sockfd;
+}
+
+int netcode_udp_socket (uint16_t listen_port, const char *default_host)
+{
+   int sockfd;
+   netcode_addr_t peer;
+
+   SAFETY_CHECK;
 
    if (default_host) {
-      if ((host_addr = gethostbyname (default_host))!=NULL) {
-         memcpy (&addr.sin_addr.s_addr, host_addr->h_addr_list[0],
-                 sizeof (addr.sin_addr.s_addr));
-      } else {
+      if (!(netcode_addr_resolve (&peer, default_host, listen_port))) {
          return -1;
       }
-   } else {
-      addr.sin_addr.s_addr = INADDR_ANY;
    }
 
-   if ((sockfd = socket (AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0) {
+   if ((sockfd = netcode_udp_socket_bound (listen_port, false)) < 0) {
       return -1;
    }
 
-   if ((bind (sockfd, (struct sockaddr*)&addr, sizeof (addr))) < 0) {
+   if (default_host && !(netcode_udp_connect (sockfd, &peer))) {
+      close (sockfd);
       return -1;
    }
+
    return sockfd;
 }
 
+/* Loads the number of the CPU that the packet is being processed on and
+ * returns it, modulo the number of sockets, as the index of the socket
+ * in the group. Sockets are indexed in the order in which they were
+ * bound.
+ */
+static bool netcode_udp_steer_by_cpu (int fd, size_t n_shards)
+{
+#ifdef __linux__
+   struct sock_filter code[] = {
+      { BPF_LD  | BPF_W   | BPF_ABS,  0, 0, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU) },
+      { BPF_ALU | BPF_MOD | BPF_K,    0, 0, (uint32_t)n_shards },
+      { BPF_RET | BPF_A,              0, 0, 0 },
+   };
+   struct sock_fprog prog = { sizeof code / sizeof code[0], code };
+
+   if (setsockopt (fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                   (const void *)&prog, sizeof prog) != 0) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to attach the reuseport steering program: %s\n",
+                                      netcode_util_strerror (netcode_util_errno ()));
+      return false;
+   }
+   return true;
+#else
+   (void)fd;
+   (void)n_shards;
+   NETCODE_LOG (NETCODE_LOG_ERROR, "Steering by CPU is not supported on this platform\n");
+   return false;
+#endif
+}
 
-size_t netcode_udp_wait (int fd, char **remote_host, uint16_t *remote_port,
-                         uint8_t **buf, size_t *buflen,
-                         size_t timeout)
+int *netcode_udp_socket_group (uint16_t listen_port, size_t n_shards, bool steer_by_cpu)
 {
-   bool error = true;
-   size_t retval = (size_t)-1;
+   int *ret = NULL;
+   size_t i;
 
-   char rhost[21];
-   struct timeval tv = { timeout , 0 };
-   int error_code = 0;
-   socklen_t error_code_len = sizeof error_code;
-   struct sockaddr_in addr_remote;
-   socklen_t addr_remote_len = sizeof addr_remote;
-#ifdef PLATFORM_Windows
-   char *tmp = NULL;
-#endif
+   SAFETY_CHECK;
+
+   if (n_shards == 0 || (steer_by_cpu && n_shards > UINT32_MAX)) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Invalid number of shards: %zu\n", n_shards);
+      return NULL;
+   }
+
+   if (!(ret = netcode_util_malloc (sizeof *ret * n_shards))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating %zu sockets\n", n_shards);
+      return NULL;
+   }
+
+   for (i=0; i<n_shards; i++) {
+      if ((ret[i] = netcode_udp_socket_bound (listen_port, true)) < 0) {
+         NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to create socket %zu of group on port %u\n",
+                                         i, listen_port);
+         goto errorexit;
+      }
+   }
+
+   // The program is attached to the group as a whole; any member will do.
+   if (steer_by_cpu && !(netcode_udp_steer_by_cpu (ret[0], n_shards))) {
+      goto errorexit;
+   }
+
+   return ret;
+
+errorexit:
+   netcode_udp_socket_group_del (ret, i);
+   return NULL;
+}
+
+void netcode_udp_socket_group_del (int *fds, size_t n_shards)
+{
+   for (size_t i=0; fds && i<n_shards; i++) {
+      if (fds[i] >= 0)
+         close (fds[i]);
+   }
+   netcode_util_free (fds);
+}
 
-   memset (&addr_remote, 0xff, sizeof (addr_remote));
+bool netcode_udp_connect (int fd, const netcode_addr_t *peer)
+{
+   struct sockaddr unspec;
+   const struct sockaddr *sa = &unspec;
+   size_t salen = sizeof unspec;
 
    SAFETY_CHECK;
 
-   *buf = NULL;
-   *buflen = 0;
+   // Connecting to an AF_UNSPEC address dissolves the association.
+   memset (&unspec, 0, sizeof unspec);
+   unspec.sa_family = AF_UNSPEC;
+
+   if (peer) {
+      sa = netcode_addr_sockaddr (peer, &salen);
+   }
+
+   if (connect (fd, sa, salen) != 0) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "connect() failure\n");
+      return false;
+   }
+   return true;
+}
+
+/* ***************************************************************** */
+struct netcode_udp_dest_t {
+   netcode_addr_t  addr;
+   uint16_t        port;
+   char            host[];
+};
+
+netcode_udp_dest_t *netcode_udp_dest_new (const char *host, uint16_t port)
+{
+   netcode_udp_dest_t *ret = NULL;
+
+   if (!host)
+      return NULL;
+
+   if (!(ret = netcode_util_malloc (sizeof *ret + strlen (host) + 1))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Error: Out of memory\n");
+      return NULL;
+   }
+
+   strcpy (ret->host, host);
+   ret->port = port;
+
+   if (!(netcode_udp_dest_refresh (ret))) {
+      netcode_util_free (ret);
+      ret = NULL;
+   }
+   return ret;
+}
+
+void netcode_udp_dest_del (netcode_udp_dest_t *dest)
+{
+   netcode_util_free (dest);
+}
+
+bool netcode_udp_dest_refresh (netcode_udp_dest_t *dest)
+{
+   netcode_addr_t tmp;
+
+   if (!(netcode_addr_resolve (&tmp, dest->host, dest->port))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to resolve [%s]\n", dest->host);
+      return false;
+   }
+
+   dest->addr = tmp;
+   return true;
+}
+
+const netcode_addr_t *netcode_udp_dest_addr (const netcode_udp_dest_t *dest)
+{
+   return dest ? &dest->addr : NULL;
+}
+
+/* Returns -1 if the socket has a pending error or select() fails, zero
+ * on timeout and a positive value when a datagram is waiting.
+ */
+static int netcode_udp_select (int fd, size_t timeout)
+{
+   struct timeval tv = { timeout , 0 };
+   int error_code = 0;
+   socklen_t error_code_len = sizeof error_code;
 
 #ifdef PLATFORM_Windows
    getsockopt (fd, SOL_SOCKET, SO_ERROR,(char *)&error_code, (int *)&error_code_len);
@@ -143,17 +338,80 @@ size_t netcode_udp_wait (int fd, char **remote_host, uint16_t *remote_port,
    getsockopt (fd, SOL_SOCKET, SO_ERROR, &error_code, &error_code_len);
 #endif
    if (error_code!=0)
-      goto errorexit;
+      return -1;
 
    fd_set fds;
    FD_ZERO (&fds);
    FD_SET (fd, &fds);
-   int selresult = select (fd + 1, &fds, NULL, NULL, &tv);
+   return select (fd + 1, &fds, NULL, NULL, &tv);
+}
+
+/* Converts the binary address filled in by the *_addr() receive
+ * functions into the string and port that the older interface returns.
+ */
+static bool netcode_udp_addr_to_host (const netcode_addr_t *addr,
+                                      char **remote_host, uint16_t *remote_port)
+{
+   if (netcode_addr_family (addr) == AF_UNSPEC)
+      return true;
+
+   if (remote_host) {
+      if (!(*remote_host = netcode_util_sockaddr_to_str (netcode_addr_sockaddr (addr, NULL))))
+         return false;
+   }
+   if (remote_port) {
+      *remote_port = netcode_addr_port (addr);
+   }
+   return true;
+}
+
+/* Resolves the destination given to the string-based send functions
+ * into 'tmp'. On success '*dest' is either 'tmp', or NULL when the
+ * datagram must go to the peer that the socket is connected to.
+ */
+static bool netcode_udp_dest (const char *remote_host, uint16_t port,
+                              netcode_addr_t *tmp, const netcode_addr_t **dest)
+{
+   *dest = NULL;
+   if (remote_host && port) {
+      if (!(netcode_addr_resolve (tmp, remote_host, port))) {
+         NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to resolve [%s]\n", remote_host);
+         return false;
+      }
+      *dest = tmp;
+   }
+   return true;
+}
+
+// Receives into a buffer from 'pool', or from malloc() when 'pool' is
+// NULL.
+static size_t netcode_udp_wait_alloc (int fd, netcode_addr_t *remote_addr,
+                                      uint8_t **buf, size_t *buflen,
+                                      size_t timeout, netcode_bufpool_t *pool)
+{
+   bool error = true;
+   size_t retval = (size_t)-1;
+
+   struct sockaddr_storage addr_remote;
+   socklen_t addr_remote_len = sizeof addr_remote;
+#ifdef PLATFORM_Windows
+   char *tmp = NULL;
+#endif
+
+   memset (&addr_remote, 0, sizeof (addr_remote));
+   memset (remote_addr, 0, sizeof *remote_addr);
+
+   SAFETY_CHECK;
+
+   *buf = NULL;
+   *buflen = 0;
+
+   int selresult = netcode_udp_select (fd, timeout);
    if (selresult > 0) {
       netcode_util_clear_errno ();
 #ifdef PLATFORM_Windows
       size_t max_size = 70 * 1024;
-      tmp = malloc (max_size);
+      tmp = netcode_util_malloc (max_size);
       ssize_t r = recvfrom (fd, tmp, max_size, MSG_DONTWAIT | MSG_PEEK,
                             (struct sockaddr *)&addr_remote, (int *)&addr_remote_len);
 #else
@@ -163,22 +421,30 @@ size_t netcode_udp_wait (int fd, char **remote_host, uint16_t *remote_port,
 
       // An error occurred, return errorcode
       if (r < 0 ) {
-         NETCODE_UTIL_LOG ("First possible error: %i, %zi\n", errno, r);
+         NETCODE_LOG (NETCODE_LOG_ERROR, "First possible error: %i, %zi\n", errno, r);
          goto errorexit;
       }
 
-      // Copy the addr info
-
-      if (remote_host) {
-         *remote_host = netcode_util_sockaddr_to_str ((const struct sockaddr *)&addr_remote);
-      }
-      if (remote_port) {
-         *remote_port = ntohs (addr_remote.sin_port);
+      // Datagrams from sources that are denied or over their rate limit
+      // are consumed before anything is allocated for them, and reported
+      // as a timeout.
+      if (!(netcode_acl_permits ((const struct sockaddr *)&addr_remote)) ||
+          !(netcode_ratelimit_permits ((const struct sockaddr *)&addr_remote))) {
+         recvfrom (fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+         retval = 0;
+         error = false;
+         goto errorexit;
       }
 
+      // Copy the addr info
+      netcode_addr_from_sockaddr (remote_addr, (const struct sockaddr *)&addr_remote,
+                                  addr_remote_len);
+
       // Zero length datagram received. We're returning nothing except the
-      // remote peer's address info.
+      // remote peer's address info. The datagram is consumed so that it
+      // is not returned again on the next call.
       if (r == 0) {
+         recvfrom (fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
          retval = *buflen;
          error = false;
          goto errorexit;
@@ -186,7 +452,7 @@ size_t netcode_udp_wait (int fd, char **remote_host, uint16_t *remote_port,
 
       // Valid length in r. Reallocate the dst buffer and try again.
       *buflen = (size_t)r;
-      if (!(*buf = malloc (*buflen))) {
+      if (!(*buf = pool ? netcode_bufpool_alloc (pool, *buflen) : netcode_util_malloc (*buflen))) {
          goto errorexit;
       }
 #ifdef PLATFORM_Windows
@@ -214,154 +480,1037 @@ size_t netcode_udp_wait (int fd, char **remote_host, uint16_t *remote_port,
 errorexit:
 
 #ifdef PLATFORM_Windows
-   free (tmp);
+   netcode_util_free (tmp);
 #endif
 
    if (error) {
-      free (*buf);
+      if (pool)
+         netcode_buf_release (*buf);
+      else
+         netcode_util_free (*buf);
       *buf = NULL;
       *buflen = 0;
-      if (remote_host) {
-         free (*remote_host);
-         *remote_host = NULL;
-      }
+      memset (remote_addr, 0, sizeof *remote_addr);
       retval = (size_t)-1;
    }
 
    return retval;
 }
 
-static size_t netcode_udp_send_single (int fd, const char *remote_host, uint16_t port,
-                                       void *buf, size_t buflen)
+size_t netcode_udp_wait_addr (int fd, netcode_addr_t *remote_addr,
+                              uint8_t **buf, size_t *buflen,
+                              size_t timeout)
 {
-   ssize_t txed = 0;
-   int flags = 0;
-   struct sockaddr_in dest_addr;
-   struct hostent *host_addr = NULL;
+   return netcode_udp_wait_alloc (fd, remote_addr, buf, buflen, timeout, NULL);
+}
 
-   memset (&dest_addr, 0, sizeof dest_addr);
-   dest_addr.sin_family = AF_INET;
-   dest_addr.sin_port = htons (port);
+size_t netcode_udp_recv_into (int fd, netcode_addr_t *remote_addr,
+                              void *buf, size_t len, size_t timeout)
+{
+   struct sockaddr_storage ss;
+   socklen_t sslen = sizeof ss;
+   ssize_t r = -1;
 
-   if (remote_host && port) {
-      if ((host_addr = gethostbyname (remote_host))!=NULL) {
-         memcpy (&dest_addr.sin_addr.s_addr, host_addr->h_addr_list[0],
-                 sizeof dest_addr.sin_addr.s_addr);
-      } else {
-         NETCODE_UTIL_LOG ("gethostbyname(%s) failure\n", remote_host);
-         return (size_t)-1;
-      }
+   SAFETY_CHECK;
 
-#ifdef PLATFORM_Windows
-      if ((txed = sendto (fd, (char *)buf,  (int)buflen, flags,
-                          (const struct sockaddr *)&dest_addr, sizeof (dest_addr)))==-1) {
-#else
-      if ((txed = sendto (fd, buf, buflen, flags,
-                          (const struct sockaddr *)&dest_addr, sizeof (dest_addr)))==-1) {
+   if (remote_addr)
+      memset (remote_addr, 0, sizeof *remote_addr);
+
+#ifndef PLATFORM_Windows
+   // Try first, so that a busy socket costs one system call instead of
+   // a select() and a recvfrom().
+   netcode_util_clear_errno ();
+   r = recvfrom (fd, buf, len, MSG_DONTWAIT, (struct sockaddr *)&ss, &sslen);
+   if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "recvfrom() failure: %i\n", errno);
+      return (size_t)-1;
+   }
 #endif
-         NETCODE_UTIL_LOG ("sendto dest failure\n");
+
+   if (r < 0) {
+      int selresult = netcode_udp_select (fd, timeout);
+      if (selresult == 0)
+         return 0;
+      if (selresult < 0)
          return (size_t)-1;
-      }
-   } else {
+
+      sslen = sizeof ss;
 #ifdef PLATFORM_Windows
-      if ((txed = sendto (fd, (char *)buf,  (int)buflen, flags, NULL, 0))==-1) {
+      r = recvfrom (fd, buf, (int)len, 0, (struct sockaddr *)&ss, (int *)&sslen);
 #else
-      if ((txed = sendto (fd, buf,  buflen, flags, NULL, 0))==-1) {
+      r = recvfrom (fd, buf, len, MSG_DONTWAIT, (struct sockaddr *)&ss, &sslen);
 #endif
-         NETCODE_UTIL_LOG ("sendto() connected failure\n");
+      if (r < 0) {
+         NETCODE_LOG (NETCODE_LOG_ERROR, "recvfrom() failure: %i\n", netcode_util_errno ());
          return (size_t)-1;
       }
    }
 
-   return (size_t)txed;
+   // Datagrams from sources that are denied or over their rate limit
+   // are reported as a timeout.
+   if (!(netcode_acl_permits ((const struct sockaddr *)&ss)) ||
+       !(netcode_ratelimit_permits ((const struct sockaddr *)&ss)))
+      return 0;
+
+   if (remote_addr)
+      netcode_addr_from_sockaddr (remote_addr, (const struct sockaddr *)&ss, sslen);
+
+   return (size_t)r;
 }
 
-size_t netcode_udp_senda (int fd, const char *remote_host, uint16_t port,
-                          size_t nbuffers,
-                          void **buffers, size_t *buffer_lengths)
+size_t netcode_udp_wait_pool (int fd, netcode_bufpool_t *pool,
+                              netcode_addr_t *remote_addr,
+                              uint8_t **buf, size_t *buflen,
+                              size_t timeout)
+{
+   return netcode_udp_wait_alloc (fd, remote_addr, buf, buflen, timeout, pool);
+}
+
+size_t netcode_udp_wait (int fd, char **remote_host, uint16_t *remote_port,
+                         uint8_t **buf, size_t *buflen,
+                         size_t timeout)
+{
+   netcode_addr_t remote_addr;
+
+   if (remote_host) {
+      *remote_host = NULL;
+   }
+
+   size_t retval = netcode_udp_wait_addr (fd, &remote_addr, buf, buflen, timeout);
+   if (retval == (size_t)-1) {
+      return retval;
+   }
+
+   if (!(netcode_udp_addr_to_host (&remote_addr, remote_host, remote_port))) {
+      netcode_util_free (*buf);
+      *buf = NULL;
+      *buflen = 0;
+      return (size_t)-1;
+   }
+
+   return retval;
+}
+
+#ifndef IOV_MAX
+#define IOV_MAX         (1024)
+#endif
+
+// The iovec array that senda() and sendv() build lives on the stack up
+// to this many buffers, and is allocated beyond that.
+#define STACK_IOV       (64)
+
+/* Only used when the buffers cannot be gathered by the kernel: either
+ * there are more than IOV_MAX of them or the platform has no sendmsg().
+ */
+static size_t netcode_udp_send_coalesced (int fd, const netcode_addr_t *dest,
+                                          const struct iovec *iov, size_t niov)
 {
    uint8_t *txbuf = NULL;
    size_t txbuf_len = 0;
    size_t txbuf_idx = 0;
-   size_t nbytes = 0;
+   const struct sockaddr *sa = NULL;
+   size_t salen = 0;
 
-   for (size_t i=0; i<nbuffers; i++) {
-      txbuf_len += buffer_lengths[i];
+   for (size_t i=0; i<niov; i++) {
+      txbuf_len += iov[i].iov_len;
    }
-   if (!(txbuf = malloc (txbuf_len * (sizeof *txbuf)))) {
-      NETCODE_UTIL_LOG ("Error: Out of memory\n");
+   if (!(txbuf = netcode_util_malloc (txbuf_len + 1))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Error: Out of memory\n");
       return (size_t)-1;
    }
 
-   for (size_t i=0; i<nbuffers; i++) {
-      memcpy (&txbuf[txbuf_idx], buffers[i], buffer_lengths[i]);
-      txbuf_idx += buffer_lengths[i];
+   for (size_t i=0; i<niov; i++) {
+      memcpy (&txbuf[txbuf_idx], iov[i].iov_base, iov[i].iov_len);
+      txbuf_idx += iov[i].iov_len;
    }
 
-   nbytes = netcode_udp_send_single (fd, remote_host, port, txbuf, txbuf_len);
-   free (txbuf);
-   return nbytes;
-}
+   if (dest) {
+      sa = netcode_addr_sockaddr (dest, &salen);
+   }
 
-size_t netcode_udp_send (int fd, const char *remote_host, uint16_t port,
-                         void *buf1, size_t buflen1,
-                         ...)
-{
-   va_list ap;
-   va_start (ap, buflen1);
-   size_t nbytes = netcode_udp_sendv (fd, remote_host, port, buf1, buflen1, ap);
-   va_end (ap);
-   return nbytes;
+#ifdef PLATFORM_Windows
+   int txed = sendto (fd, (char *)txbuf, (int)txbuf_len, 0, sa, (int)salen);
+#else
+   ssize_t txed = sendto (fd, txbuf, txbuf_len, 0, sa, salen);
+#endif
+   netcode_util_free (txbuf);
+
+   if (txed < 0) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "sendto() failure\n");
+      return (size_t)-1;
+   }
+   return (size_t)txed;
 }
 
-size_t netcode_udp_sendv (int fd, const char *remote_host, uint16_t port,
-                          void *buf1, size_t buflen1,
-                          va_list ap)
+size_t netcode_udp_sendiov_addr (int fd, const netcode_addr_t *dest,
+                                 const struct iovec *iov, size_t niov)
 {
-   size_t nbytes = 0;
-   void **txbuffers = NULL;
-   size_t *txbuffer_lengths = NULL;
-   size_t nbuffers = 0;
-   va_list vc;
-   void *tmp = buf1;
-   size_t tmplen = 0;
+#ifdef PLATFORM_Windows
+   return netcode_udp_send_coalesced (fd, dest, iov, niov);
+#else
+   ssize_t txed = 0;
+   struct msghdr msg;
+   size_t salen = 0;
 
-   va_copy (vc, ap);
-   for (size_t i=0; tmp; i++) {
-      nbuffers++;
-      tmp = va_arg (vc, void *);
-      tmplen = va_arg (vc, size_t);
+   if (niov > IOV_MAX) {
+      return netcode_udp_send_coalesced (fd, dest, iov, niov);
    }
-   (void)tmplen;
-   va_end (vc);
 
-   if (!(txbuffers = calloc (nbuffers + 1, sizeof *txbuffers))) {
-      NETCODE_UTIL_LOG ("Error: Out of memory\n");
-      return (size_t)-1;
+   memset (&msg, 0, sizeof msg);
+   if (dest) {
+      msg.msg_name = (void *)netcode_addr_sockaddr (dest, &salen);
+      msg.msg_namelen = salen;
    }
+   msg.msg_iov = (struct iovec *)iov;
+   msg.msg_iovlen = niov;
 
-   if (!(txbuffer_lengths = calloc (nbuffers + 1, sizeof *txbuffer_lengths))) {
-      free (txbuffers);
-      NETCODE_UTIL_LOG ("Error: Out of memory\n");
+   if ((txed = sendmsg (fd, &msg, 0))==-1) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "sendmsg() failure\n");
       return (size_t)-1;
    }
 
-   va_copy (vc, ap);
-   for (size_t i=0; buf1; i++) {
-      txbuffers[i] = buf1;
-      txbuffer_lengths[i] = buflen1;
-      buf1 = va_arg (vc, void *);
-      buflen1 = va_arg (vc, size_t);
-   }
-   va_end (vc);
+   return (size_t)txed;
+#endif
+}
 
-   nbytes = netcode_udp_senda (fd, remote_host, port,
-                               nbuffers,
-                               txbuffers, txbuffer_lengths);
+size_t netcode_udp_sendiov (int fd, const char *remote_host, uint16_t port,
+                            const struct iovec *iov, size_t niov)
+{
+   netcode_addr_t tmp;
+   const netcode_addr_t *dest = NULL;
+
+   if (!(netcode_udp_dest (remote_host, port, &tmp, &dest))) {
+      return (size_t)-1;
+   }
+
+   return netcode_udp_sendiov_addr (fd, dest, iov, niov);
+}
+
+size_t netcode_udp_senda_addr (int fd, const netcode_addr_t *dest,
+                               size_t nbuffers,
+                               void **buffers, size_t *buffer_lengths)
+{
+   struct iovec iov[STACK_IOV];
+   struct iovec *txiov = iov;
+   size_t nbytes = 0;
+
+   // Only the first 'nbuffers' entries are sent. Setting the first one
+   // stops gcc, once LTO has inlined sendiov_addr(), from warning that
+   // the array may be read uninitialised when 'nbuffers' is zero.
+   iov[0].iov_base = NULL;
+   iov[0].iov_len = 0;
+
+   if (nbuffers > STACK_IOV) {
+      if (!(txiov = netcode_util_malloc (nbuffers * (sizeof *txiov)))) {
+         NETCODE_LOG (NETCODE_LOG_ERROR, "Error: Out of memory\n");
+         return (size_t)-1;
+      }
+   }
+
+   for (size_t i=0; i<nbuffers; i++) {
+      txiov[i].iov_base = buffers[i];
+      txiov[i].iov_len = buffer_lengths[i];
+   }
+
+   nbytes = netcode_udp_sendiov_addr (fd, dest, txiov, nbuffers);
+
+   if (txiov != iov) {
+      netcode_util_free (txiov);
+   }
+   return nbytes;
+}
+
+size_t netcode_udp_senda (int fd, const char *remote_host, uint16_t port,
+                          size_t nbuffers,
+                          void **buffers, size_t *buffer_lengths)
+{
+   netcode_addr_t tmp;
+   const netcode_addr_t *dest = NULL;
+
+   if (!(netcode_udp_dest (remote_host, port, &tmp, &dest))) {
+      return (size_t)-1;
+   }
+
+   return netcode_udp_senda_addr (fd, dest, nbuffers, buffers, buffer_lengths);
+}
+
+size_t netcode_udp_send_addr (int fd, const netcode_addr_t *dest,
+                              void *buf1, size_t buflen1,
+                              ...)
+{
+   va_list ap;
+   va_start (ap, buflen1);
+   size_t nbytes = netcode_udp_sendv_addr (fd, dest, buf1, buflen1, ap);
+   va_end (ap);
+   return nbytes;
+}
+
+size_t netcode_udp_send (int fd, const char *remote_host, uint16_t port,
+                         void *buf1, size_t buflen1,
+                         ...)
+{
+   va_list ap;
+   va_start (ap, buflen1);
+   size_t nbytes = netcode_udp_sendv (fd, remote_host, port, buf1, buflen1, ap);
+   va_end (ap);
+   return nbytes;
+}
+
+size_t netcode_udp_sendv_addr (int fd, const netcode_addr_t *dest,
+                               void *buf1, size_t buflen1,
+                               va_list ap)
+{
+   size_t nbytes = 0;
+   struct iovec iov[STACK_IOV];
+   struct iovec *txiov = iov;
+   size_t nbuffers = 0;
+   va_list vc;
+   void *tmp = buf1;
+   size_t tmplen = 0;
+
+   va_copy (vc, ap);
+   for (size_t i=0; tmp; i++) {
+      nbuffers++;
+      tmp = va_arg (vc, void *);
+      tmplen = va_arg (vc, size_t);
+   }
+   (void)tmplen;
+   va_end (vc);
+
+   if (nbuffers > STACK_IOV) {
+      if (!(txiov = netcode_util_malloc (nbuffers * (sizeof *txiov)))) {
+         NETCODE_LOG (NETCODE_LOG_ERROR, "Error: Out of memory\n");
+         return (size_t)-1;
+      }
+   }
+
+   va_copy (vc, ap);
+   for (size_t i=0; buf1; i++) {
+      txiov[i].iov_base = buf1;
+      txiov[i].iov_len = buflen1;
+      buf1 = va_arg (vc, void *);
+      buflen1 = va_arg (vc, size_t);
+   }
+   va_end (vc);
+
+   nbytes = netcode_udp_sendiov_addr (fd, dest, txiov, nbuffers);
+
+   if (txiov != iov) {
+      netcode_util_free (txiov);
+   }
+
+   return nbytes;
+}
+
+size_t netcode_udp_sendv (int fd, const char *remote_host, uint16_t port,
+                          void *buf1, size_t buflen1,
+                          va_list ap)
+{
+   netcode_addr_t tmp;
+   const netcode_addr_t *dest = NULL;
+
+   if (!(netcode_udp_dest (remote_host, port, &tmp, &dest))) {
+      return (size_t)-1;
+   }
+
+   return netcode_udp_sendv_addr (fd, dest, buf1, buflen1, ap);
+}
+
+/* ***************************************************************** */
+/* The kernel refuses more than this many segments in a single GSO
+ * send, and the whole super-datagram must fit in a single IP packet.
+ */
+#define GSO_MAX_SEGMENTS      (64)
+#define GSO_MAX_BYTES         (65000)
+#define SENDMMSG_BATCH        (64)
+
+// The largest payload of a single UDP datagram over IPv4.
+#define UDP_MAX_PAYLOAD       (65507)
+
+#ifdef __linux__
+// Zero until probed, then 1 if the kernel supports UDP_SEGMENT and -1
+// if it does not. A race between two threads probing at the same time
+// is harmless; both will store the same value. Only the probe and an
+// ENOPROTOOPT from a send latch -1: other errors may be particular to
+// one socket, destination or call.
+static int gso_supported = 0;
+
+static bool netcode_udp_gso_probe (int fd)
+{
+   if (gso_supported == 0) {
+      int gso_size = 0;
+      socklen_t gso_size_len = sizeof gso_size;
+      gso_supported =
+         getsockopt (fd, SOL_UDP, UDP_SEGMENT, &gso_size, &gso_size_len) == 0 ? 1 : -1;
+   }
+   return gso_supported > 0;
+}
+
+static size_t netcode_udp_sendmmsg (int fd,
+                                    const struct sockaddr *dest, socklen_t destlen,
+                                    const struct iovec *datagrams, size_t ndatagrams)
+{
+   struct mmsghdr msgs[SENDMMSG_BATCH];
+   size_t nsent = 0;
+
+   while (nsent < ndatagrams) {
+      size_t nbatch = ndatagrams - nsent;
+      if (nbatch > SENDMMSG_BATCH)
+         nbatch = SENDMMSG_BATCH;
+
+      memset (msgs, 0, nbatch * sizeof msgs[0]);
+      for (size_t i=0; i<nbatch; i++) {
+         msgs[i].msg_hdr.msg_name = (void *)dest;
+         msgs[i].msg_hdr.msg_namelen = dest ? destlen : 0;
+         msgs[i].msg_hdr.msg_iov = (struct iovec *)&datagrams[nsent + i];
+         msgs[i].msg_hdr.msg_iovlen = 1;
+      }
+
+      int rc = sendmmsg (fd, msgs, nbatch, 0);
+      if (rc <= 0) {
+         NETCODE_LOG (NETCODE_LOG_ERROR, "sendmmsg() failure after %zu datagrams\n", nsent);
+         return nsent ? nsent : (size_t)-1;
+      }
+      nsent += (size_t)rc;
+   }
+
+   return nsent;
+}
+
+static size_t netcode_udp_send_gso (int fd,
+                                    const struct sockaddr *dest, socklen_t destlen,
+                                    const uint8_t *buf, size_t len,
+                                    uint16_t segment_size)
+{
+   union {
+      char buf[CMSG_SPACE (sizeof (uint16_t))];
+      struct cmsghdr align;
+   } control;
+   size_t max_segments = GSO_MAX_BYTES / segment_size;
+   size_t nbytes = 0;
 
-   free (txbuffers);
-   free (txbuffer_lengths);
+   if (max_segments > GSO_MAX_SEGMENTS)
+      max_segments = GSO_MAX_SEGMENTS;
+   if (max_segments < 1)
+      max_segments = 1;
+
+   while (nbytes < len) {
+      struct msghdr msg;
+      struct iovec iov;
+      struct cmsghdr *cm;
+      size_t chunk = len - nbytes;
+
+      if (chunk > max_segments * segment_size)
+         chunk = max_segments * segment_size;
+
+      iov.iov_base = (void *)&buf[nbytes];
+      iov.iov_len = chunk;
+
+      memset (&msg, 0, sizeof msg);
+      memset (&control, 0, sizeof control);
+      msg.msg_name = (void *)dest;
+      msg.msg_namelen = dest ? destlen : 0;
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control.buf;
+      msg.msg_controllen = sizeof control.buf;
+
+      cm = CMSG_FIRSTHDR (&msg);
+      cm->cmsg_level = SOL_UDP;
+      cm->cmsg_type = UDP_SEGMENT;
+      cm->cmsg_len = CMSG_LEN (sizeof segment_size);
+      memcpy (CMSG_DATA (cm), &segment_size, sizeof segment_size);
+
+      ssize_t txed = sendmsg (fd, &msg, 0);
+      if (txed < 0) {
+         // EIO is returned when the egress device cannot offload the
+         // checksum, and EMSGSIZE or EINVAL when a segment does not fit
+         // the path MTU; the caller falls back to sendmmsg() for the
+         // rest, which sends (and, if need be, fragments) each datagram.
+         if (errno == EIO || errno == EMSGSIZE || errno == EINVAL ||
+             errno == ENOPROTOOPT) {
+            if (errno == ENOPROTOOPT) {
+               gso_supported = -1;
+            }
+            return nbytes;
+         }
+         NETCODE_LOG (NETCODE_LOG_ERROR, "sendmsg(UDP_SEGMENT) failure\n");
+         return nbytes ? nbytes : (size_t)-1;
+      }
+      nbytes += (size_t)txed;
+   }
 
    return nbytes;
 }
+#endif
+
+static size_t netcode_udp_send_many_to (int fd,
+                                        const struct sockaddr *dest, socklen_t destlen,
+                                        const struct iovec *datagrams, size_t ndatagrams)
+{
+#ifdef __linux__
+   return netcode_udp_sendmmsg (fd, dest, destlen, datagrams, ndatagrams);
+#else
+   size_t nsent = 0;
+   for (nsent=0; nsent<ndatagrams; nsent++) {
+#ifdef PLATFORM_Windows
+      int txed = sendto (fd, (char *)datagrams[nsent].iov_base,
+                             (int)datagrams[nsent].iov_len, 0, dest, dest ? destlen : 0);
+#else
+      ssize_t txed = sendto (fd, datagrams[nsent].iov_base,
+                                 datagrams[nsent].iov_len, 0, dest, dest ? destlen : 0);
+#endif
+      if (txed < 0) {
+         NETCODE_LOG (NETCODE_LOG_ERROR, "sendto() failure after %zu datagrams\n", nsent);
+         return nsent ? nsent : (size_t)-1;
+      }
+   }
+   return nsent;
+#endif
+}
+
+size_t netcode_udp_send_many_addr (int fd, const netcode_addr_t *dest,
+                                   const struct iovec *datagrams, size_t ndatagrams)
+{
+   const struct sockaddr *sa = NULL;
+   size_t salen = 0;
+
+   SAFETY_CHECK;
+
+   if (dest) {
+      sa = netcode_addr_sockaddr (dest, &salen);
+   }
+
+   return netcode_udp_send_many_to (fd, sa, salen, datagrams, ndatagrams);
+}
+
+size_t netcode_udp_send_many (int fd, const char *remote_host, uint16_t port,
+                              const struct iovec *datagrams, size_t ndatagrams)
+{
+   netcode_addr_t tmp;
+   const netcode_addr_t *dest = NULL;
+
+   if (!(netcode_udp_dest (remote_host, port, &tmp, &dest))) {
+      return (size_t)-1;
+   }
+
+   return netcode_udp_send_many_addr (fd, dest, datagrams, ndatagrams);
+}
+
+size_t netcode_udp_send_segmented_addr (int fd, const netcode_addr_t *dest,
+                                        const void *buf, size_t len,
+                                        uint16_t segment_size)
+{
+   const struct sockaddr *sa = NULL;
+   size_t salen = 0;
+   const uint8_t *src = buf;
+   size_t nbytes = 0;
+
+   SAFETY_CHECK;
+
+   if (segment_size == 0 || segment_size > UDP_MAX_PAYLOAD) {
+      return (size_t)-1;
+   }
+
+   if (dest) {
+      sa = netcode_addr_sockaddr (dest, &salen);
+   }
+
+#ifdef __linux__
+   // GSO is only worth it when at least two segments fit in one send.
+   if (len > segment_size && segment_size <= GSO_MAX_BYTES / 2 &&
+       netcode_udp_gso_probe (fd)) {
+      if ((nbytes = netcode_udp_send_gso (fd, sa, salen,
+                                          src, len, segment_size)) == (size_t)-1) {
+         return (size_t)-1;
+      }
+   }
+#endif
+
+   // Whatever GSO did not send (all of it, if GSO is unavailable) goes
+   // out as individual datagrams, SENDMMSG_BATCH at a time.
+   while (nbytes < len) {
+      struct iovec datagrams[SENDMMSG_BATCH];
+      size_t ndatagrams = 0;
+      size_t batch_bytes = 0;
+
+      while (ndatagrams < SENDMMSG_BATCH && nbytes + batch_bytes < len) {
+         size_t dlen = len - nbytes - batch_bytes;
+         if (dlen > segment_size)
+            dlen = segment_size;
+         datagrams[ndatagrams].iov_base = (void *)&src[nbytes + batch_bytes];
+         datagrams[ndatagrams].iov_len = dlen;
+         batch_bytes += dlen;
+         ndatagrams++;
+      }
+
+      size_t nsent = netcode_udp_send_many_to (fd, sa, salen, datagrams, ndatagrams);
+      if (nsent == (size_t)-1) {
+         return nbytes ? nbytes : (size_t)-1;
+      }
+      for (size_t i=0; i<nsent; i++) {
+         nbytes += datagrams[i].iov_len;
+      }
+      if (nsent < ndatagrams) {
+         break;
+      }
+   }
+
+   return nbytes;
+}
+
+size_t netcode_udp_send_segmented (int fd, const char *remote_host, uint16_t port,
+                                   const void *buf, size_t len,
+                                   uint16_t segment_size)
+{
+   netcode_addr_t tmp;
+   const netcode_addr_t *dest = NULL;
+
+   if (!(netcode_udp_dest (remote_host, port, &tmp, &dest))) {
+      return (size_t)-1;
+   }
+
+   return netcode_udp_send_segmented_addr (fd, dest, buf, len, segment_size);
+}
+
+/* ***************************************************************** */
+bool netcode_udp_set_gro (int fd, bool enable)
+{
+#ifdef __linux__
+   int optval = enable ? 1 : 0;
+   if (setsockopt (fd, SOL_UDP, UDP_GRO, &optval, sizeof optval)!=0) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "setsockopt(UDP_GRO) failure\n");
+      return false;
+   }
+   return true;
+#else
+   (void)fd;
+   return !enable;
+#endif
+}
+
+size_t netcode_udp_wait_segmented_addr (int fd, netcode_addr_t *remote_addr,
+                                        uint8_t **buf, size_t *buflen,
+                                        size_t *segment_size,
+                                        size_t timeout)
+{
+#ifndef __linux__
+   size_t retval = netcode_udp_wait_addr (fd, remote_addr, buf, buflen, timeout);
+   *segment_size = *buflen;
+   return retval;
+#else
+   bool error = true;
+   size_t retval = (size_t)-1;
+
+   struct sockaddr_storage addr_remote;
+   socklen_t addr_remote_len = sizeof addr_remote;
+   union {
+      char buf[CMSG_SPACE (sizeof (int))];
+      struct cmsghdr align;
+   } control;
+
+   SAFETY_CHECK;
+
+   *buf = NULL;
+   *buflen = 0;
+   *segment_size = 0;
+   memset (remote_addr, 0, sizeof *remote_addr);
+
+   int selresult = netcode_udp_select (fd, timeout);
+   if (selresult < 0) {
+      goto errorexit;
+   }
+   if (selresult == 0) {
+      retval = 0;
+      error = false;
+      goto errorexit;
+   }
+
+   netcode_util_clear_errno ();
+
+   // With GRO enabled the peeked length is that of all the coalesced
+   // segments together, so a single allocation holds them all.
+   memset (&addr_remote, 0, sizeof addr_remote);
+   ssize_t r = recvfrom (fd, NULL, 0, MSG_DONTWAIT | MSG_PEEK | MSG_TRUNC,
+                         (struct sockaddr *)&addr_remote, &addr_remote_len);
+   if (r < 0) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "recvfrom(MSG_PEEK) failure: %i\n", errno);
+      goto errorexit;
+   }
+
+   if (!(netcode_acl_permits ((const struct sockaddr *)&addr_remote)) ||
+       !(netcode_ratelimit_permits ((const struct sockaddr *)&addr_remote))) {
+      recvfrom (fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+      retval = 0;
+      error = false;
+      goto errorexit;
+   }
+
+   netcode_addr_from_sockaddr (remote_addr, (const struct sockaddr *)&addr_remote,
+                               addr_remote_len);
+
+   if (r == 0) {
+      // Consume the empty datagram so that it is not returned again.
+      recvfrom (fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+      retval = 0;
+      error = false;
+      goto errorexit;
+   }
+
+   *buflen = (size_t)r;
+   if (!(*buf = netcode_util_malloc (*buflen))) {
+      goto errorexit;
+   }
+
+   struct iovec iov = { *buf, *buflen };
+   struct msghdr msg;
+   memset (&msg, 0, sizeof msg);
+   memset (&control, 0, sizeof control);
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control.buf;
+   msg.msg_controllen = sizeof control.buf;
+
+   r = recvmsg (fd, &msg, MSG_DONTWAIT);
+   if (r < 0 || (size_t)r != *buflen) {
+      goto errorexit;
+   }
+
+   *segment_size = *buflen;
+   for (struct cmsghdr *cm = CMSG_FIRSTHDR (&msg); cm; cm = CMSG_NXTHDR (&msg, cm)) {
+      if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+         int gso_size = 0;
+         memcpy (&gso_size, CMSG_DATA (cm), sizeof gso_size);
+         if (gso_size > 0) {
+            *segment_size = (size_t)gso_size;
+         }
+      }
+   }
+
+   retval = *buflen;
+   error = false;
+
+errorexit:
+
+   if (error) {
+      netcode_util_free (*buf);
+      *buf = NULL;
+      *buflen = 0;
+      *segment_size = 0;
+      memset (remote_addr, 0, sizeof *remote_addr);
+      retval = (size_t)-1;
+   }
+
+   return retval;
+#endif
+}
+
+size_t netcode_udp_wait_segmented (int fd, char **remote_host, uint16_t *remote_port,
+                                   uint8_t **buf, size_t *buflen,
+                                   size_t *segment_size,
+                                   size_t timeout)
+{
+   netcode_addr_t remote_addr;
+
+   if (remote_host) {
+      *remote_host = NULL;
+   }
+
+   size_t retval = netcode_udp_wait_segmented_addr (fd, &remote_addr, buf, buflen,
+                                                    segment_size, timeout);
+   if (retval == (size_t)-1) {
+      return retval;
+   }
+
+   if (!(netcode_udp_addr_to_host (&remote_addr, remote_host, remote_port))) {
+      netcode_util_free (*buf);
+      *buf = NULL;
+      *buflen = 0;
+      *segment_size = 0;
+      return (size_t)-1;
+   }
+
+   return retval;
+}
+
+/* ***************************************************************** */
+/* Multicast. The protocol-independent MCAST_* options (RFC 3678) are
+ * used for joining and leaving, so IPv4 and IPv6 groups go through the
+ * same code.
+ */
+
+// Returns the address family that the socket was created with.
+static int netcode_udp_family (int fd)
+{
+   struct sockaddr_storage ss;
+   socklen_t sslen = sizeof ss;
+
+   memset (&ss, 0, sizeof ss);
+#ifdef PLATFORM_Windows
+   if (getsockname (fd, (struct sockaddr *)&ss, (int *)&sslen) != 0)
+#else
+   if (getsockname (fd, (struct sockaddr *)&ss, &sslen) != 0)
+#endif
+      return AF_UNSPEC;
+
+   return ss.ss_family;
+}
+
+static bool netcode_udp_group_op (int fd, bool join,
+                                  const char *group, const char *source,
+                                  const netcode_if_t *iface)
+{
+   netcode_addr_t group_addr, source_addr;
+   const struct sockaddr *sa = NULL;
+   int level = 0, optname = 0, rc = -1;
+   size_t salen = 0;
+
+   SAFETY_CHECK;
+
+   if (!(netcode_addr_parse (&group_addr, group))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Invalid multicast group [%s]\n", group);
+      return false;
+   }
+
+   switch (netcode_addr_family (&group_addr)) {
+      case AF_INET:  level = IPPROTO_IP;     break;
+      case AF_INET6: level = IPPROTO_IPV6;   break;
+      default:
+         NETCODE_LOG (NETCODE_LOG_ERROR, "Invalid multicast group [%s]\n", group);
+         return false;
+   }
+
+   if (source) {
+      struct group_source_req req;
+
+      if (!(netcode_addr_parse (&source_addr, source)) ||
+            netcode_addr_family (&source_addr) != netcode_addr_family (&group_addr)) {
+         NETCODE_LOG (NETCODE_LOG_ERROR, "Invalid multicast source [%s]\n", source);
+         return false;
+      }
+
+      memset (&req, 0, sizeof req);
+      req.gsr_interface = netcode_if_index (iface);
+      sa = netcode_addr_sockaddr (&group_addr, &salen);
+      memcpy (&req.gsr_group, sa, salen);
+      sa = netcode_addr_sockaddr (&source_addr, &salen);
+      memcpy (&req.gsr_source, sa, salen);
+      optname = join ? MCAST_JOIN_SOURCE_GROUP : MCAST_LEAVE_SOURCE_GROUP;
+      rc = setsockopt (fd, level, optname, (const void *)&req, sizeof req);
+   } else {
+      struct group_req req;
+
+      memset (&req, 0, sizeof req);
+      req.gr_interface = netcode_if_index (iface);
+      sa = netcode_addr_sockaddr (&group_addr, &salen);
+      memcpy (&req.gr_group, sa, salen);
+      optname = join ? MCAST_JOIN_GROUP : MCAST_LEAVE_GROUP;
+      rc = setsockopt (fd, level, optname, (const void *)&req, sizeof req);
+   }
+
+   if (rc != 0) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to %s multicast group [%s]: %s\n",
+                                      join ? "join" : "leave", group,
+                                      netcode_util_strerror (netcode_util_errno ()));
+      return false;
+   }
+   return true;
+}
+
+bool netcode_udp_join_group (int fd, const char *group, const char *source,
+                             const netcode_if_t *iface)
+{
+   return netcode_udp_group_op (fd, true, group, source, iface);
+}
+
+bool netcode_udp_leave_group (int fd, const char *group, const char *source,
+                              const netcode_if_t *iface)
+{
+   return netcode_udp_group_op (fd, false, group, source, iface);
+}
+
+bool netcode_udp_multicast_if (int fd, const netcode_if_t *iface)
+{
+   int rc = -1;
+   uint32_t ifindex = netcode_if_index (iface);
+
+   SAFETY_CHECK;
+
+   if (iface && !ifindex) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Interface has no index\n");
+      return false;
+   }
+
+   switch (netcode_udp_family (fd)) {
+      case AF_INET: {
+#ifdef __linux__
+         // With only the index the kernel picks a source address of
+         // global scope, which need not be on the interface (lo has
+         // none); the entry's own address is used as the source.
+         const struct sockaddr *sa = netcode_if_addr_sa (iface, NULL);
+         struct ip_mreqn req;
+         memset (&req, 0, sizeof req);
+         req.imr_ifindex = (int)ifindex;
+         if (sa && sa->sa_family == AF_INET)
+            req.imr_address = ((const struct sockaddr_in *)sa)->sin_addr;
+         rc = setsockopt (fd, IPPROTO_IP, IP_MULTICAST_IF, &req, sizeof req);
+#else
+         // Windows accepts an interface index (in network byte order)
+         // in place of the interface address.
+         uint32_t idx = htonl (ifindex);
+         rc = setsockopt (fd, IPPROTO_IP, IP_MULTICAST_IF, (const void *)&idx, sizeof idx);
+#endif
+         break;
+      }
+
+      case AF_INET6: {
+         unsigned int idx = ifindex;
+         rc = setsockopt (fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, (const void *)&idx, sizeof idx);
+         break;
+      }
+
+      default:
+         break;
+   }
+
+   if (rc != 0) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to set the outbound multicast interface\n");
+      return false;
+   }
+   return true;
+}
+
+bool netcode_udp_multicast_ttl (int fd, int ttl)
+{
+   int rc = -1;
+
+   SAFETY_CHECK;
+
+   switch (netcode_udp_family (fd)) {
+      case AF_INET:
+         rc = setsockopt (fd, IPPROTO_IP, IP_MULTICAST_TTL, (const void *)&ttl, sizeof ttl);
+         break;
+
+      case AF_INET6:
+         rc = setsockopt (fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, (const void *)&ttl, sizeof ttl);
+         break;
 
+      default:
+         break;
+   }
+
+   if (rc != 0) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to set the multicast TTL to %i\n", ttl);
+      return false;
+   }
+   return true;
+}
+
+bool netcode_udp_multicast_loop (int fd, bool enable)
+{
+   int rc = -1;
+   int optval = enable ? 1 : 0;
+
+   SAFETY_CHECK;
+
+   switch (netcode_udp_family (fd)) {
+      case AF_INET:
+         rc = setsockopt (fd, IPPROTO_IP, IP_MULTICAST_LOOP, (const void *)&optval, sizeof optval);
+         break;
+
+      case AF_INET6:
+         rc = setsockopt (fd, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, (const void *)&optval, sizeof optval);
+         break;
+
+      default:
+         break;
+   }
+
+   if (rc != 0) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to %s multicast loopback\n", enable ? "enable" : "disable");
+      return false;
+   }
+   return true;
+}
+
+bool netcode_udp_set_pmtud (int fd, bool enable)
+{
+   int rc = -1;
+
+   SAFETY_CHECK;
+
+#if defined (IP_MTU_DISCOVER) && defined (IPV6_MTU_DISCOVER)
+   int optval;
+   switch (netcode_udp_family (fd)) {
+      case AF_INET:
+         optval = enable ? IP_PMTUDISC_DO : IP_PMTUDISC_DONT;
+         rc = setsockopt (fd, IPPROTO_IP, IP_MTU_DISCOVER, (const void *)&optval, sizeof optval);
+         break;
+
+      case AF_INET6:
+         optval = enable ? IPV6_PMTUDISC_DO : IPV6_PMTUDISC_DONT;
+         rc = setsockopt (fd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, (const void *)&optval, sizeof optval);
+         break;
+
+      default:
+         break;
+   }
+#else
+   (void)fd;
+   (void)enable;
+#endif
+
+   if (rc != 0) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to %s path MTU discovery\n", enable ? "enable" : "disable");
+      return false;
+   }
+   return true;
+}
+
+size_t netcode_udp_path_mtu (int fd, const netcode_addr_t *dest)
+{
+   size_t ret = 0;
+
+   SAFETY_CHECK;
+
+#if defined (IP_MTU) && defined (IPV6_MTU)
+   int probe = -1;
+   int family = AF_UNSPEC;
+   int mtu = 0;
+   int rc = -1;
+   socklen_t mtulen = sizeof mtu;
+
+   if (dest) {
+      // The kernel only reports the path MTU of a connected socket, so
+      // connect a throwaway one to the destination. Nothing is sent.
+      family = netcode_addr_family (dest);
+      size_t salen = 0;
+      const struct sockaddr *sa = netcode_addr_sockaddr (dest, &salen);
+      if ((probe = socket (family, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0 ||
+          connect (probe, sa, (socklen_t)salen) != 0) {
+         NETCODE_LOG (NETCODE_LOG_ERROR, "Failed to connect the path MTU probe\n");
+         goto errorexit;
+      }
+      fd = probe;
+   } else {
+      family = netcode_udp_family (fd);
+   }
+
+   if (family == AF_INET)
+      rc = getsockopt (fd, IPPROTO_IP, IP_MTU, (void *)&mtu, &mtulen);
+   if (family == AF_INET6)
+      rc = getsockopt (fd, IPPROTO_IPV6, IPV6_MTU, (void *)&mtu, &mtulen);
+
+   if (rc == 0 && mtu > 0)
+      ret = (size_t)mtu;
+
+errorexit:
+   if (probe >= 0)
+      close (probe);
+#else
+   (void)fd;
+   (void)dest;
+#endif
+
+   return ret;
+}
@@ -5,11 +5,27 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdbool.h>
+
+#include "netcode_addr.h"
+#include "netcode_if.h"
+#include "netcode_bufpool.h"
+
+#ifdef PLATFORM_Windows
+struct iovec {
+   void   *iov_base;
+   size_t  iov_len;
+};
+#else
+#include <sys/uio.h>
+#endif
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+   typedef struct netcode_udp_dest_t netcode_udp_dest_t;
+
    // Returns a datagram socket that, on receiving, will receive on
    // the port specified and, on sending, will send to the host
    // specified on the port specified.
@@ -18,11 +34,67 @@ extern "C" {
    // can be NULL. If no host is specified _udp_send() will fail unless
    // a host is provided.
    //
-   // On sending, a different host may be specified.
+   // When default_host is specified the socket is connected (see
+   // netcode_udp_connect()) to default_host on the same port, and only
+   // datagrams from that host will be received.
+   //
+   // On sending, pass a NULL host to send to default_host. Linux and
+   // Windows also accept a different host on a connected socket, but
+   // BSD and macOS fail such a send with EISCONN; use a socket with no
+   // default host to send to several hosts.
+   //
    // On error will return -1 and the error and error message can be
    // retrieved using the _errno() and _strerror() functions.
    int netcode_udp_socket (uint16_t listen_port, const char *default_host);
 
+   // Connects the datagram socket 'fd' to a single peer. Datagrams sent
+   // with a NULL host (or a NULL 'dest' for the *_addr() functions) go
+   // to this peer with no per-datagram address lookup, and the kernel
+   // reuses the route it cached on connecting. Only datagrams from the
+   // peer are received while connected.
+   //
+   // Passing a NULL 'peer' disconnects the socket.
+   //
+   // RETURNS: true on success, false on error.
+   bool netcode_udp_connect (int fd, const netcode_addr_t *peer);
+
+   // Returns an array of 'n_shards' datagram sockets that are all bound
+   // to 'listen_port' with SO_REUSEPORT. The kernel spreads incoming
+   // datagrams across the sockets, so each can be drained by its own
+   // thread. Datagrams from one peer (source address and port) always
+   // go to the same socket.
+   //
+   // When 'steer_by_cpu' is true a classic BPF program is attached to
+   // the group (SO_ATTACH_REUSEPORT_CBPF, Linux 4.5 and later) that
+   // sends each datagram to socket number (CPU % n_shards), where CPU
+   // is the CPU that received it. A worker thread pinned to CPU 'i'
+   // that reads socket 'i' then touches no data shared with the other
+   // workers. This works best when 'n_shards' equals the number of
+   // CPUs handling the NIC's receive queues.
+   //
+   // The array must be released with netcode_udp_socket_group_del(),
+   // which also closes the sockets.
+   //
+   // RETURNS: NULL on error, or if SO_REUSEPORT (or, when requested,
+   // the steering program) is not supported.
+   int *netcode_udp_socket_group (uint16_t listen_port, size_t n_shards,
+                                  bool steer_by_cpu);
+   void netcode_udp_socket_group_del (int *fds, size_t n_shards);
+
+   // A destination that is resolved once, when it is created, and then
+   // reused for every datagram sent to it. Use netcode_udp_dest_addr()
+   // with the *_addr() send functions, eg:
+   //    netcode_udp_send_addr (fd, netcode_udp_dest_addr (dest), ...);
+   //
+   // netcode_udp_dest_new() returns NULL if 'host' cannot be resolved.
+   // netcode_udp_dest_refresh() resolves the host again (for example
+   // when its DNS record may have changed) and returns false, leaving
+   // the previous address in place, if that fails.
+   netcode_udp_dest_t *netcode_udp_dest_new (const char *host, uint16_t port);
+   void netcode_udp_dest_del (netcode_udp_dest_t *dest);
+   bool netcode_udp_dest_refresh (netcode_udp_dest_t *dest);
+   const netcode_addr_t *netcode_udp_dest_addr (const netcode_udp_dest_t *dest);
+
    // Will wait not less than 'timeout' seconds for a datagram
    // on the port that the socket fd is connected on. When a datagram
    // is received the peer's IP address will be copied into the
@@ -59,6 +131,35 @@ extern "C" {
                             uint8_t **buf, size_t *buflen,
                             size_t timeout);
 
+   // Identical to netcode_udp_wait(), except that the peer's address and
+   // port are stored in '*remote_addr' instead of an allocated string.
+   // On timeout the family of '*remote_addr' is AF_UNSPEC, which
+   // distinguishes a timeout from an empty datagram.
+   size_t netcode_udp_wait_addr (int fd, netcode_addr_t *remote_addr,
+                                 uint8_t **buf, size_t *buflen,
+                                 size_t timeout);
+
+   // Receives one datagram into the caller's buffer 'buf' of 'len'
+   // bytes; a longer datagram is truncated. No memory is allocated, so
+   // this is the function to use in a receive loop. 'timeout' is as for
+   // netcode_udp_wait().
+   //
+   // The sender's address is stored in '*remote_addr' if 'remote_addr'
+   // is not NULL; on timeout its family is AF_UNSPEC.
+   //
+   // RETURNS: the number of bytes received, zero on timeout (or for an
+   // empty datagram), or (size_t)-1 on error.
+   size_t netcode_udp_recv_into (int fd, netcode_addr_t *remote_addr,
+                                 void *buf, size_t len, size_t timeout);
+
+   // Identical to netcode_udp_wait_addr(), except that '*buf' is a
+   // buffer from 'pool', which the caller must release with
+   // netcode_buf_release() instead of free().
+   size_t netcode_udp_wait_pool (int fd, netcode_bufpool_t *pool,
+                                 netcode_addr_t *remote_addr,
+                                 uint8_t **buf, size_t *buflen,
+                                 size_t timeout);
+
    // Will send the data in the buffers specified on the datagram socket
    // 'fd'. If the parameter 'remote_host' is not NULL, then the datagram
    // will be sent to the host specified in 'remote_host'.
@@ -80,6 +181,13 @@ extern "C" {
    //    sendv() takes { buffer, buffer_length } parameters, repeated
    //       for each buffer, terminated with a NULL pointer, using the
    //       va_list pointer instead of literal parameters.
+   //    sendiov() takes an array of 'niov' iovec structures.
+   //
+   // The buffers are gathered by the kernel (sendmsg()) and are not
+   // copied. senda() and sendv() allocate the array that describes
+   // them when more than 64 buffers are specified. Only when more than
+   // IOV_MAX buffers are specified is a temporary buffer allocated to
+   // assemble the datagram.
    size_t netcode_udp_senda (int fd, const char *remote_host, uint16_t port,
                              size_t nbuffers,
                              void **buffers, size_t *buffer_lengths);
@@ -92,6 +200,141 @@ extern "C" {
                              void *buf1, size_t buflen1,
                              va_list ap);
 
+   size_t netcode_udp_sendiov (int fd, const char *remote_host, uint16_t port,
+                               const struct iovec *iov, size_t niov);
+
+   // The *_addr() variants of the send functions take the destination
+   // as an already-resolved address instead of a host and port, so no
+   // name resolution is done per datagram. When 'dest' is NULL the
+   // datagram is sent to the peer that the socket is connected to.
+   size_t netcode_udp_senda_addr (int fd, const netcode_addr_t *dest,
+                                  size_t nbuffers,
+                                  void **buffers, size_t *buffer_lengths);
+
+   size_t netcode_udp_send_addr (int fd, const netcode_addr_t *dest,
+                                 void *buf1, size_t buflen1,
+                                 ...);
+
+   size_t netcode_udp_sendv_addr (int fd, const netcode_addr_t *dest,
+                                  void *buf1, size_t buflen1,
+                                  va_list ap);
+
+   size_t netcode_udp_sendiov_addr (int fd, const netcode_addr_t *dest,
+                                    const struct iovec *iov, size_t niov);
+
+   // Sends 'ndatagrams' separate datagrams, one per iovec in
+   // 'datagrams', to the same destination. The destination is resolved
+   // once for the whole batch and, on Linux, the datagrams are handed to
+   // the kernel with sendmmsg() to save a system call per datagram.
+   //
+   // RETURNS: the number of datagrams sent, which may be fewer than
+   // 'ndatagrams' if an error occurred part-way. (size_t)-1 is returned
+   // if no datagram could be sent.
+   size_t netcode_udp_send_many (int fd, const char *remote_host, uint16_t port,
+                                 const struct iovec *datagrams, size_t ndatagrams);
+
+   size_t netcode_udp_send_many_addr (int fd, const netcode_addr_t *dest,
+                                      const struct iovec *datagrams, size_t ndatagrams);
+
+   // Sends 'buf' as a sequence of datagrams of 'segment_size' bytes
+   // each; the last datagram holds whatever remains and may be shorter.
+   // The receiver sees ordinary, separate datagrams.
+   //
+   // On Linux kernels that support it (4.18 and later) the whole buffer
+   // is passed down with a UDP_SEGMENT control message and split by the
+   // kernel or the NIC (GSO). Support is detected at runtime; when it is
+   // missing, or a segment does not fit the path MTU, the datagrams are
+   // sent with netcode_udp_send_many().
+   //
+   // RETURNS: the number of bytes sent, which may be less than 'len' if
+   // an error occurred part-way. (size_t)-1 is returned if nothing could
+   // be sent, or if 'segment_size' is zero or larger than the largest
+   // UDP payload (65507 bytes).
+   size_t netcode_udp_send_segmented (int fd, const char *remote_host, uint16_t port,
+                                      const void *buf, size_t len,
+                                      uint16_t segment_size);
+
+   size_t netcode_udp_send_segmented_addr (int fd, const netcode_addr_t *dest,
+                                           const void *buf, size_t len,
+                                           uint16_t segment_size);
+
+   // Enables (or disables) UDP GRO on the socket 'fd'. With GRO enabled
+   // the kernel may coalesce consecutive datagrams of the same size from
+   // the same peer into a single buffer, which must then be read with
+   // netcode_udp_wait_segmented(); netcode_udp_wait() would see the
+   // coalesced datagrams as one.
+   //
+   // RETURNS: true on success, false if the platform or kernel (Linux
+   // 5.0 and later) does not support GRO for UDP sockets.
+   bool netcode_udp_set_gro (int fd, bool enable);
+
+   // Identical to netcode_udp_wait(), except that the returned buffer
+   // may hold several datagrams back to back. Every datagram is
+   // '*segment_size' bytes long, except for the last which may be
+   // shorter. Datagram 'i' starts at offset 'i * (*segment_size)'.
+   //
+   // When no coalescing took place (or GRO is not enabled) a single
+   // datagram is returned and '*segment_size' equals '*buflen'.
+   size_t netcode_udp_wait_segmented (int fd, char **remote_host, uint16_t *remote_port,
+                                      uint8_t **buf, size_t *buflen,
+                                      size_t *segment_size,
+                                      size_t timeout);
+
+   size_t netcode_udp_wait_segmented_addr (int fd, netcode_addr_t *remote_addr,
+                                           uint8_t **buf, size_t *buflen,
+                                           size_t *segment_size,
+                                           size_t timeout);
+
+   // Joins (or leaves) the multicast group 'group' on the interface
+   // 'iface', which is an entry from netcode_if_list_new(). When 'iface'
+   // is NULL the kernel picks the interface from the routing table.
+   //
+   // 'group' and 'source' are numeric addresses. When 'source' is not
+   // NULL the membership is source-specific: only datagrams to 'group'
+   // from 'source' are received (SSM, typically 232.0.0.0/8 or ff3x::).
+   // To receive from several sources join once per source.
+   //
+   // The socket still needs to be bound (netcode_udp_socket() does this)
+   // to the port that the group's datagrams are sent to.
+   //
+   // RETURNS: true on success, false on error.
+   bool netcode_udp_join_group (int fd, const char *group, const char *source,
+                                const netcode_if_t *iface);
+   bool netcode_udp_leave_group (int fd, const char *group, const char *source,
+                                 const netcode_if_t *iface);
+
+   // Settings for sending multicast datagrams on the socket 'fd':
+   //    multicast_if() selects the outbound interface; NULL restores the
+   //       default of using the routing table. On Linux the address of
+   //       the entry 'iface', when it is IPv4, is also the source
+   //       address of the datagrams sent.
+   //    multicast_ttl() sets the TTL (hop limit for IPv6) of outbound
+   //       multicast datagrams. The default is 1, which keeps them on
+   //       the local network.
+   //    multicast_loop() controls whether datagrams sent are also
+   //       delivered to group members on the sending host.
+   //
+   // RETURNS: true on success, false on error.
+   bool netcode_udp_multicast_if (int fd, const netcode_if_t *iface);
+   bool netcode_udp_multicast_ttl (int fd, int ttl);
+   bool netcode_udp_multicast_loop (int fd, bool enable);
+
+   // Enables path MTU discovery on 'fd': datagrams are sent with the
+   // Don't Fragment bit set and a send larger than the known path MTU
+   // fails with EMSGSIZE instead of being fragmented by IP. Disabling it
+   // lets the kernel fragment oversized datagrams again.
+   //
+   // RETURNS: true on success, false on error.
+   bool netcode_udp_set_pmtud (int fd, bool enable);
+
+   // Returns the kernel's current path MTU towards 'dest' (the interface
+   // MTU, lowered by any ICMP "packet too big" reports received), or
+   // towards the connected peer of 'fd' when 'dest' is NULL. The MTU
+   // counts the IP and UDP headers.
+   //
+   // RETURNS: the MTU in bytes, or zero if it is unknown.
+   size_t netcode_udp_path_mtu (int fd, const netcode_addr_t *dest);
+
 #ifdef __cplusplus
 };
 #endif
@@ -0,0 +1,362 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "netcode_util.h"
+#include "netcode_log.h"
+#include "netcode_udp.h"
+#include "netcode_udp_batcher.h"
+
+/* ***************************************************************** */
+#ifdef PLATFORM_Windows
+#include <winsock2.h>
+#include <windows.h>
+
+#endif
+
+/* ***************************************************************** */
+#ifdef PLATFORM_POSIX
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#endif
+
+// How many slots are probed to find a destination before the least
+// recently used of them is flushed and reused.
+#define BATCH_PROBES       (8)
+
+#define IPV4_HDRLEN        (20)
+#define IPV6_HDRLEN        (40)
+#define UDP_HDRLEN         (8)
+#define MAX_UDP_PAYLOAD    (65507)
+#define MAX_MSG            (MAX_UDP_PAYLOAD - NETCODE_UDP_BATCHER_PREFIX)
+
+// The datagram size used when a destination's path MTU is unknown: what
+// fits in the minimum IPv6 MTU.
+#define DEFAULT_SIZE       (1280 - IPV6_HDRLEN - UDP_HDRLEN)
+
+struct slot_t {
+   netcode_addr_t    dest;
+   bool              used;
+   uint64_t          last;          // ns of the last message added
+   uint64_t          deadline;      // ns; zero when nothing is waiting
+   size_t            limit;         // Largest datagram for this destination
+   size_t            len;           // Bytes waiting
+   size_t            capacity;
+   uint8_t          *buf;
+};
+
+// The datagram limit last worked out for a destination, so that a slot
+// claimed again for it does not probe the path MTU again.
+struct limit_t {
+   netcode_addr_t    dest;
+   size_t            limit;
+};
+
+struct netcode_udp_batcher_t {
+   int               fd;
+   size_t            max_size;
+   uint64_t          delay_ns;
+   uint64_t          earliest;      // No deadline expires before this
+   struct slot_t     slots[NETCODE_UDP_BATCHER_DESTS];
+   struct limit_t    limits[NETCODE_UDP_BATCHER_DESTS];   // By destination hash
+   netcode_udp_batcher_stats_t stats;
+};
+
+static const netcode_addr_t connected;
+
+static const netcode_addr_t *slot_dest (const struct slot_t *s)
+{
+   return netcode_addr_family (&s->dest) == AF_UNSPEC ? NULL : &s->dest;
+}
+
+static size_t dest_limit (const netcode_udp_batcher_t *b, const netcode_addr_t *dest)
+{
+   if (b->max_size)
+      return b->max_size;
+
+   size_t mtu = netcode_udp_path_mtu (b->fd, dest);
+   if (!mtu)
+      return DEFAULT_SIZE;
+
+   int family = AF_INET;
+   if (dest) {
+      family = netcode_addr_family (dest);
+   } else {
+      struct sockaddr_storage ss;
+      socklen_t sslen = sizeof ss;
+      memset (&ss, 0, sizeof ss);
+#ifdef PLATFORM_Windows
+      if (getpeername (b->fd, (struct sockaddr *)&ss, (int *)&sslen) == 0)
+#else
+      if (getpeername (b->fd, (struct sockaddr *)&ss, &sslen) == 0)
+#endif
+         family = ss.ss_family;
+   }
+
+   size_t overhead = (family == AF_INET6 ? IPV6_HDRLEN : IPV4_HDRLEN) + UDP_HDRLEN;
+   if (mtu <= overhead + NETCODE_UDP_BATCHER_PREFIX)
+      return DEFAULT_SIZE;
+
+   mtu -= overhead;
+   return mtu > MAX_UDP_PAYLOAD ? MAX_UDP_PAYLOAD : mtu;
+}
+
+static size_t cached_limit (netcode_udp_batcher_t *b, const netcode_addr_t *dest,
+                            const netcode_addr_t *key, uint32_t hash)
+{
+   struct limit_t *l = &b->limits[hash % NETCODE_UDP_BATCHER_DESTS];
+
+   if (!l->limit || netcode_addr_cmp (&l->dest, key) != 0) {
+      l->dest = *key;
+      l->limit = dest_limit (b, dest);
+   }
+   return l->limit;
+}
+
+static bool send_slot (netcode_udp_batcher_t *b, struct slot_t *s, uint64_t *counter)
+{
+   struct iovec iov = { s->buf, s->len };
+
+   if (!s->len)
+      return true;
+
+   size_t rc = netcode_udp_sendiov_addr (b->fd, slot_dest (s), &iov, 1);
+   bool ret = rc == s->len;
+
+   s->len = 0;
+   s->deadline = 0;
+   b->stats.datagrams++;
+   (*counter)++;
+   return ret;
+}
+
+/* Finds the slot for 'dest', claiming a free or the least recently used
+ * slot in its probe window (sending whatever it holds) when it has none.
+ */
+static struct slot_t *find_slot (netcode_udp_batcher_t *b, const netcode_addr_t *dest,
+                                 uint64_t now, bool *ok)
+{
+   struct slot_t *victim = NULL;
+   const netcode_addr_t *key = dest ? dest : &connected;
+
+   uint32_t hash = netcode_addr_hash (key);
+   for (size_t i=0; i<BATCH_PROBES; i++) {
+      struct slot_t *s = &b->slots[(hash + i) % NETCODE_UDP_BATCHER_DESTS];
+      if (s->used && netcode_addr_cmp (&s->dest, key) == 0)
+         return s;
+      if (!victim || !s->used || (victim->used && s->last < victim->last))
+         victim = s;
+   }
+
+   if (victim->used && !(send_slot (b, victim, &b->stats.full)))
+      *ok = false;
+
+   size_t limit = cached_limit (b, dest, key, hash);
+   if (limit > victim->capacity) {
+      uint8_t *tmp = netcode_util_realloc (victim->buf, limit);
+      if (!tmp) {
+         NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating %zu byte batch\n", limit);
+         victim->used = false;
+         return NULL;
+      }
+      victim->buf = tmp;
+      victim->capacity = limit;
+   }
+
+   victim->dest = *key;
+   victim->used = true;
+   victim->limit = limit;
+   victim->last = now;
+   return victim;
+}
+
+static bool poll_at (netcode_udp_batcher_t *b, uint64_t now)
+{
+   bool ret = true;
+
+   if (now < b->earliest)
+      return true;
+
+   b->earliest = UINT64_MAX;
+   for (size_t i=0; i<NETCODE_UDP_BATCHER_DESTS; i++) {
+      struct slot_t *s = &b->slots[i];
+      if (!s->len)
+         continue;
+      if (s->deadline <= now) {
+         ret = send_slot (b, s, &b->stats.expired) && ret;
+      } else if (s->deadline < b->earliest) {
+         b->earliest = s->deadline;
+      }
+   }
+   return ret;
+}
+
+/* ***************************************************************** */
+netcode_udp_batcher_t *netcode_udp_batcher_new (int fd, size_t max_size,
+                                                uint64_t delay_us)
+{
+   netcode_udp_batcher_t *ret = NULL;
+
+   if (max_size && (max_size <= NETCODE_UDP_BATCHER_PREFIX || max_size > MAX_UDP_PAYLOAD)) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Invalid batch size %zu\n", max_size);
+      return NULL;
+   }
+
+   if (!(ret = netcode_util_calloc (1, sizeof *ret))) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "OOM allocating batcher\n");
+      return NULL;
+   }
+
+   ret->fd = fd;
+   ret->max_size = max_size;
+   ret->delay_ns = delay_us * 1000;
+   ret->earliest = UINT64_MAX;
+   return ret;
+}
+
+void netcode_udp_batcher_del (netcode_udp_batcher_t *batcher)
+{
+   if (!batcher)
+      return;
+
+   for (size_t i=0; i<NETCODE_UDP_BATCHER_DESTS; i++) {
+      netcode_util_free (batcher->slots[i].buf);
+   }
+   netcode_util_free (batcher);
+}
+
+bool netcode_udp_batcher_add (netcode_udp_batcher_t *batcher,
+                              const netcode_addr_t *dest,
+                              const void *msg, size_t len)
+{
+   bool ret = true;
+   uint64_t now = netcode_util_time_ns ();
+   uint8_t prefix[NETCODE_UDP_BATCHER_PREFIX];
+
+   if (len > MAX_MSG) {
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Message of %zu bytes is too large to batch\n", len);
+      return false;
+   }
+
+   ret = poll_at (batcher, now);
+
+   struct slot_t *s = find_slot (batcher, dest, now, &ret);
+   if (!s)
+      return false;
+
+   prefix[0] = (uint8_t)(len >> 8);
+   prefix[1] = (uint8_t)len;
+   size_t need = sizeof prefix + len;
+   batcher->stats.messages++;
+   s->last = now;
+
+   if (need > s->limit) {
+      // Too large to share: send what is waiting, then this on its own.
+      struct iovec iov[2] = {
+         { prefix, sizeof prefix },
+         { (void *)msg, len },
+      };
+      ret = send_slot (batcher, s, &batcher->stats.full) && ret;
+      if (netcode_udp_sendiov_addr (batcher->fd, slot_dest (s), iov, 2) != need)
+         ret = false;
+      batcher->stats.datagrams++;
+      batcher->stats.full++;
+      return ret;
+   }
+
+   if (s->len + need > s->limit)
+      ret = send_slot (batcher, s, &batcher->stats.full) && ret;
+
+   if (!s->len) {
+      s->deadline = now + batcher->delay_ns;
+      if (s->deadline < batcher->earliest)
+         batcher->earliest = s->deadline;
+   }
+
+   memcpy (&s->buf[s->len], prefix, sizeof prefix);
+   memcpy (&s->buf[s->len + sizeof prefix], msg, len);
+   s->len += need;
+
+   // Send at once if not even an empty message would fit any more.
+   if (s->len + sizeof prefix > s->limit)
+      ret = send_slot (batcher, s, &batcher->stats.full) && ret;
+
+   return ret;
+}
+
+bool netcode_udp_batcher_poll (netcode_udp_batcher_t *batcher)
+{
+   return poll_at (batcher, netcode_util_time_ns ());
+}
+
+uint64_t netcode_udp_batcher_timeout (const netcode_udp_batcher_t *batcher)
+{
+   uint64_t earliest = UINT64_MAX;
+
+   // The cached earliest deadline may belong to a datagram that has
+   // since been sent, so look at the slots themselves.
+   for (size_t i=0; i<NETCODE_UDP_BATCHER_DESTS; i++) {
+      const struct slot_t *s = &batcher->slots[i];
+      if (s->len && s->deadline < earliest)
+         earliest = s->deadline;
+   }
+
+   if (earliest == UINT64_MAX)
+      return UINT64_MAX;
+
+   uint64_t now = netcode_util_time_ns ();
+   return earliest <= now ? 0 : (earliest - now + 999) / 1000;
+}
+
+bool netcode_udp_batcher_flush (netcode_udp_batcher_t *batcher)
+{
+   bool ret = true;
+
+   for (size_t i=0; i<NETCODE_UDP_BATCHER_DESTS; i++) {
+      ret = send_slot (batcher, &batcher->slots[i], &batcher->stats.flushed) && ret;
+   }
+   batcher->earliest = UINT64_MAX;
+   return ret;
+}
+
+void netcode_udp_batcher_stats (const netcode_udp_batcher_t *batcher,
+                                netcode_udp_batcher_stats_t *dst)
+{
+   *dst = batcher->stats;
+}
+
+/* ***************************************************************** */
+void netcode_udp_splitter_init (netcode_udp_splitter_t *splitter,
+                                const void *dgram, size_t len)
+{
+   splitter->pos = dgram;
+   splitter->end = splitter->pos + len;
+   splitter->error = false;
+}
+
+bool netcode_udp_splitter_next (netcode_udp_splitter_t *splitter,
+                                const uint8_t **msg, size_t *len)
+{
+   size_t remaining = (size_t)(splitter->end - splitter->pos);
+
+   if (!remaining)
+      return false;
+
+   size_t mlen = remaining < NETCODE_UDP_BATCHER_PREFIX
+               ? 0
+               : ((size_t)splitter->pos[0] << 8) | splitter->pos[1];
+   if (remaining < NETCODE_UDP_BATCHER_PREFIX ||
+       mlen > remaining - NETCODE_UDP_BATCHER_PREFIX) {
+      splitter->error = true;
+      splitter->pos = splitter->end;
+      return false;
+   }
+
+   *msg = splitter->pos + NETCODE_UDP_BATCHER_PREFIX;
+   *len = mlen;
+   splitter->pos += NETCODE_UDP_BATCHER_PREFIX + mlen;
+   return true;
+}
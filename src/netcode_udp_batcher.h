@@ -0,0 +1,122 @@
+
+#ifndef H_NETCODE_UDP_BATCHER
+#define H_NETCODE_UDP_BATCHER
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "netcode_addr.h"
+
+// Each message in a batch is preceded by its length in this many bytes
+// (network byte order).
+#define NETCODE_UDP_BATCHER_PREFIX  (2)
+
+// Destinations that a batcher holds partly-filled datagrams for at once.
+#define NETCODE_UDP_BATCHER_DESTS   (64)
+
+/* Coalescing of small messages into larger datagrams (a user-space
+ * Nagle algorithm for UDP).
+ *
+ * Messages for the same destination are appended, each prefixed with
+ * its length, to a datagram that is sent when:
+ *    - the next message would not fit (or this one fills it),
+ *    - the first message in it has waited for the batcher's delay, or
+ *    - netcode_udp_batcher_flush() is called.
+ *
+ * The delay is only enforced when the batcher is called, so a caller
+ * that may go quiet should call netcode_udp_batcher_poll() (for example
+ * from its event loop, with netcode_udp_batcher_timeout() as the wait).
+ *
+ * The receiver walks the messages in each datagram with a
+ * netcode_udp_splitter_t, which returns pointers into the datagram
+ * without copying it.
+ *
+ * A batcher is not thread-safe.
+ */
+typedef struct netcode_udp_batcher_t netcode_udp_batcher_t;
+
+typedef struct netcode_udp_batcher_stats_t {
+   uint64_t    messages;         // Messages added
+   uint64_t    datagrams;        // Datagrams sent
+   uint64_t    full;             // Datagrams sent because they were full
+   uint64_t    expired;          // Datagrams sent because of the delay
+   uint64_t    flushed;          // Datagrams sent by netcode_udp_batcher_flush()
+} netcode_udp_batcher_stats_t;
+
+/* The receiving side: a cursor over the messages in one datagram. It
+ * holds no resources and may live on the stack.
+ */
+typedef struct netcode_udp_splitter_t {
+   const uint8_t    *pos;
+   const uint8_t    *end;
+   bool              error;
+} netcode_udp_splitter_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+   // Creates a batcher that sends on the datagram socket 'fd'. Datagrams
+   // carry at most 'max_size' bytes of UDP payload; when 'max_size' is
+   // zero, each destination's limit is worked out from its path MTU
+   // (see netcode_udp_path_mtu()). A datagram is sent at the latest
+   // 'delay_us' microseconds after its first message was added.
+   //
+   // RETURNS: NULL on error.
+   netcode_udp_batcher_t *netcode_udp_batcher_new (int fd, size_t max_size,
+                                                   uint64_t delay_us);
+   void netcode_udp_batcher_del (netcode_udp_batcher_t *batcher);
+
+   // Adds the message 'msg' of 'len' bytes to the datagram for 'dest'
+   // (NULL for the peer that the socket is connected to). The message is
+   // copied. Datagrams for any destination whose delay has expired are
+   // sent first.
+   //
+   // A message too large to share a datagram is sent in a datagram of
+   // its own.
+   //
+   // RETURNS: false on a send error, or if the message (with its length
+   // prefix) does not fit in a UDP datagram.
+   bool netcode_udp_batcher_add (netcode_udp_batcher_t *batcher,
+                                 const netcode_addr_t *dest,
+                                 const void *msg, size_t len);
+
+   // Sends the datagrams whose delay has expired.
+   //
+   // RETURNS: false if any send failed.
+   bool netcode_udp_batcher_poll (netcode_udp_batcher_t *batcher);
+
+   // Returns the number of microseconds until the next datagram's delay
+   // expires, zero if one already has, or UINT64_MAX if no datagram is
+   // waiting.
+   uint64_t netcode_udp_batcher_timeout (const netcode_udp_batcher_t *batcher);
+
+   // Sends every partly-filled datagram now.
+   //
+   // RETURNS: false if any send failed.
+   bool netcode_udp_batcher_flush (netcode_udp_batcher_t *batcher);
+
+   void netcode_udp_batcher_stats (const netcode_udp_batcher_t *batcher,
+                                   netcode_udp_batcher_stats_t *dst);
+
+   // Starts walking the messages in the received datagram 'dgram' of
+   // 'len' bytes. The datagram must stay valid while the splitter is
+   // used.
+   void netcode_udp_splitter_init (netcode_udp_splitter_t *splitter,
+                                   const void *dgram, size_t len);
+
+   // Stores a pointer to the next message (within the datagram) in
+   // '*msg' and its length in '*len'.
+   //
+   // RETURNS: false when there are no more messages. If the datagram is
+   // malformed, false is also returned and 'splitter->error' is set.
+   bool netcode_udp_splitter_next (netcode_udp_splitter_t *splitter,
+                                   const uint8_t **msg, size_t *len);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
+
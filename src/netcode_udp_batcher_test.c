@@ -0,0 +1,278 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "netcode_util.h"
+#include "netcode_udp.h"
+#include "netcode_udp_batcher.h"
+
+#define BATCH_SIZE      (1400)
+#define DELAY_US        (2000)
+#define NMSGS           (2000)
+
+static int rxfd[2] = { -1, -1 }, txfd = -1;
+static netcode_addr_t dest[2];
+
+// Messages of 20 to 100 bytes carry their sequence number and are
+// otherwise filled with a pattern derived from it.
+static size_t make_msg (uint8_t *dst, uint32_t seq)
+{
+   size_t len = 20 + seq % 81;
+   memcpy (dst, &seq, sizeof seq);
+   for (size_t i=sizeof seq; i<len; i++) {
+      dst[i] = (uint8_t)(seq + i);
+   }
+   return len;
+}
+
+/* Receives whatever is waiting on 'fd' and checks that the messages are
+ * the next ones in the sequence '*next'.
+ */
+static bool drain (int fd, uint32_t *next, size_t *ndgrams)
+{
+   static uint8_t dgram[65536];
+   netcode_addr_t from;
+   size_t len;
+
+   while ((len = netcode_udp_recv_into (fd, &from, dgram, sizeof dgram, 0)) != (size_t)-1 &&
+          netcode_addr_family (&from) != AF_UNSPEC) {
+      netcode_udp_splitter_t sp;
+      const uint8_t *msg;
+      size_t mlen;
+      uint8_t expected[128];
+
+      (*ndgrams)++;
+      if (len > BATCH_SIZE) {
+         NETCODE_UTIL_LOG ("Datagram of %zu bytes exceeds the batch size\n", len);
+         return false;
+      }
+
+      netcode_udp_splitter_init (&sp, dgram, len);
+      while (netcode_udp_splitter_next (&sp, &msg, &mlen)) {
+         size_t elen = make_msg (expected, *next);
+         if (mlen != elen || memcmp (msg, expected, elen) != 0) {
+            NETCODE_UTIL_LOG ("Message %" PRIu32 " is wrong\n", *next);
+            return false;
+         }
+         (*next)++;
+      }
+      if (sp.error) {
+         NETCODE_UTIL_LOG ("Malformed batch\n");
+         return false;
+      }
+   }
+   return len != (size_t)-1;
+}
+
+static bool coalesce_test (void)
+{
+   bool ret = false;
+   netcode_udp_batcher_t *b = netcode_udp_batcher_new (txfd, BATCH_SIZE, DELAY_US);
+   netcode_udp_batcher_stats_t stats;
+   uint32_t next[2] = { 0, 0 };
+   size_t ndgrams = 0, nbytes = 0;
+   uint8_t msg[128];
+
+   if (!b) {
+      NETCODE_UTIL_LOG ("Failed to create batcher\n");
+      return false;
+   }
+
+   // Interleaved messages for two destinations.
+   for (uint32_t i=0; i<NMSGS; i++) {
+      size_t len = make_msg (msg, i / 2);
+      nbytes += len;
+      if (!(netcode_udp_batcher_add (b, &dest[i % 2], msg, len))) {
+         NETCODE_UTIL_LOG ("Failed to add message %" PRIu32 "\n", i);
+         goto errorexit;
+      }
+      if (!(drain (rxfd[0], &next[0], &ndgrams)) || !(drain (rxfd[1], &next[1], &ndgrams)))
+         goto errorexit;
+   }
+   if (!(netcode_udp_batcher_flush (b)) ||
+       !(drain (rxfd[0], &next[0], &ndgrams)) || !(drain (rxfd[1], &next[1], &ndgrams)))
+      goto errorexit;
+
+   netcode_udp_batcher_stats (b, &stats);
+   printf ("BATCHER: %i messages (%zu bytes) in %zu datagrams "
+           "(%" PRIu64 " full, %" PRIu64 " expired, %" PRIu64 " flushed)\n",
+           NMSGS, nbytes, ndgrams, stats.full, stats.expired, stats.flushed);
+   if (next[0] != NMSGS / 2 || next[1] != NMSGS / 2 || ndgrams != stats.datagrams ||
+       ndgrams > 2 * (nbytes / (BATCH_SIZE - 128) + 1) + stats.expired) {
+      NETCODE_UTIL_LOG ("Messages were lost or not coalesced\n");
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_udp_batcher_del (b);
+   return ret;
+}
+
+static bool deadline_test (void)
+{
+   bool ret = false;
+   netcode_udp_batcher_t *b = netcode_udp_batcher_new (txfd, 0, DELAY_US);
+   uint32_t next = 0;
+   size_t ndgrams = 0;
+   uint8_t msg[128];
+   size_t len = make_msg (msg, 0);
+
+   if (!b || !(netcode_udp_batcher_add (b, &dest[0], msg, len))) {
+      NETCODE_UTIL_LOG ("Failed to add a message\n");
+      goto errorexit;
+   }
+
+   uint64_t timeout = netcode_udp_batcher_timeout (b);
+   if (!(netcode_udp_batcher_poll (b)) || !(drain (rxfd[0], &next, &ndgrams)) ||
+       ndgrams || timeout == 0 || timeout > DELAY_US) {
+      NETCODE_UTIL_LOG ("Message was sent before its deadline (timeout %" PRIu64 ")\n",
+                        timeout);
+      goto errorexit;
+   }
+
+   netcode_util_sleep_ns (timeout * 1000);
+   if (netcode_udp_batcher_timeout (b) != 0 || !(netcode_udp_batcher_poll (b)) ||
+       !(drain (rxfd[0], &next, &ndgrams)) || ndgrams != 1 || next != 1 ||
+       netcode_udp_batcher_timeout (b) != UINT64_MAX) {
+      NETCODE_UTIL_LOG ("Message was not sent at its deadline\n");
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_udp_batcher_del (b);
+   return ret;
+}
+
+/* A destination is matched by address, not by its bytes: a copy of it
+ * with junk in the unused part of the address storage must share its
+ * batch.
+ */
+static bool same_dest_test (void)
+{
+   bool ret = false;
+   netcode_udp_batcher_t *b = netcode_udp_batcher_new (txfd, BATCH_SIZE, DELAY_US);
+   netcode_addr_t alias = dest[0];
+   uint32_t next = 0;
+   size_t ndgrams = 0;
+   uint8_t msg[128];
+
+   memset ((uint8_t *)&alias.sa + sizeof alias.sa - 16, 0xa5, 16);
+
+   if (!b ||
+       !(netcode_udp_batcher_add (b, &dest[0], msg, make_msg (msg, 0))) ||
+       !(netcode_udp_batcher_add (b, &alias, msg, make_msg (msg, 1))) ||
+       !(netcode_udp_batcher_flush (b)) ||
+       !(drain (rxfd[0], &next, &ndgrams))) {
+      NETCODE_UTIL_LOG ("Failed to send to the same destination twice\n");
+      goto errorexit;
+   }
+
+   if (next != 2 || ndgrams != 1) {
+      NETCODE_UTIL_LOG ("Two messages to one destination took %zu datagrams\n", ndgrams);
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_udp_batcher_del (b);
+   return ret;
+}
+
+static bool splitter_test (void)
+{
+   static const uint8_t good[] = { 0, 3, 'a', 'b', 'c', 0, 0, 0, 1, 'd' };
+   static const uint8_t bad[] = { 0, 3, 'a', 'b', 'c', 0, 9, 'e' };
+   netcode_udp_splitter_t sp;
+   const uint8_t *msg;
+   size_t len, n = 0;
+
+   netcode_udp_splitter_init (&sp, good, sizeof good);
+   while (netcode_udp_splitter_next (&sp, &msg, &len)) {
+      if (msg < good || msg + len > good + sizeof good) {
+         NETCODE_UTIL_LOG ("Splitter copied or overran the datagram\n");
+         return false;
+      }
+      n++;
+   }
+   if (sp.error || n != 3) {
+      NETCODE_UTIL_LOG ("Split %zu messages from a good datagram\n", n);
+      return false;
+   }
+
+   n = 0;
+   netcode_udp_splitter_init (&sp, bad, sizeof bad);
+   while (netcode_udp_splitter_next (&sp, &msg, &len))
+      n++;
+   if (!sp.error || n != 1 || netcode_udp_splitter_next (&sp, &msg, &len)) {
+      NETCODE_UTIL_LOG ("Malformed datagram was not detected\n");
+      return false;
+   }
+   return true;
+}
+
+static int batcher_test (void)
+{
+   int ret = EXIT_FAILURE;
+   uint16_t ports[2] = { NETCODE_TEST_BATCH_PORT1, NETCODE_TEST_BATCH_PORT2 };
+
+   for (size_t i=0; i<2; i++) {
+      netcode_addr_parse (&dest[i], "127.0.0.1");
+      netcode_addr_set_port (&dest[i], ports[i]);
+      if ((rxfd[i] = netcode_udp_socket (ports[i], NULL)) < 0) {
+         NETCODE_UTIL_LOG ("Failed to create receiving socket\n");
+         goto errorexit;
+      }
+   }
+   if ((txfd = netcode_udp_socket (0, NULL)) < 0) {
+      NETCODE_UTIL_LOG ("Failed to create sending socket\n");
+      goto errorexit;
+   }
+
+   if (!(splitter_test ()) || !(coalesce_test ()) || !(deadline_test ()) ||
+       !(same_dest_test ()))
+      goto errorexit;
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   for (size_t i=0; i<2; i++) {
+      if (rxfd[i] >= 0)
+         netcode_util_close (rxfd[i]);
+   }
+   if (txfd >= 0)
+      netcode_util_close (txfd);
+   return ret;
+}
+
+int main (void)
+{
+   int ret = EXIT_FAILURE;
+
+   if (!(netcode_util_init ())) {
+      NETCODE_UTIL_LOG ("Failed to initialise netcode\n");
+      goto errorexit;
+   }
+
+   if ((ret = batcher_test ())!=EXIT_SUCCESS) {
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      printf ("+++ +++ udp_batcher: Test FAILED +++ +++\n");
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      goto errorexit;
+   }
+
+   printf ("*********************************\n");
+   printf ("*** *** udp_batcher: Test passed *** ***\n");
+   printf ("*********************************\n");
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   return ret;
+}
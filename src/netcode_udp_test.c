@@ -0,0 +1,252 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "netcode_util.h"
+#include "netcode_udp.h"
+
+/* Receives one datagram on 'fd' and checks that it holds 'msg' and, if
+ * 'sender' is not NULL, that it came from 'sender'.
+ */
+static bool expect (int fd, const char *msg, const netcode_addr_t *sender)
+{
+   netcode_addr_t from;
+   char buf[64];
+   size_t len = strlen (msg);
+   size_t got = netcode_udp_recv_into (fd, &from, buf, sizeof buf, 1);
+
+   if (got != len || memcmp (buf, msg, len) != 0) {
+      NETCODE_UTIL_LOG ("Expected [%s], received %zu bytes\n", msg, got);
+      return false;
+   }
+   if (sender && netcode_addr_cmp (&from, sender) != 0) {
+      char str[NETCODE_ADDR_STRLEN] = "";
+      netcode_addr_format (&from, str, sizeof str);
+      NETCODE_UTIL_LOG ("Received [%s] from the wrong sender [%s]\n", msg, str);
+      return false;
+   }
+   return true;
+}
+
+/* A socket created with a default host is connected to that host on the
+ * same port, so one that names its own address sends to itself. Another
+ * source is filtered out: were it not, its datagram, sent first, would
+ * be received in place of the second one.
+ */
+static bool default_host_test (int strayfd)
+{
+   bool ret = false;
+   int fd = netcode_udp_socket (NETCODE_TEST_CONNECT_PORT1, "127.0.0.1");
+
+   if (fd < 0) {
+      NETCODE_UTIL_LOG ("Failed to create a socket with a default host\n");
+      return false;
+   }
+
+   if (netcode_udp_send (fd, NULL, 0, "self 1", (size_t)6, NULL) != 6 ||
+       !(expect (fd, "self 1", NULL))) {
+      NETCODE_UTIL_LOG ("Send to the default host failed\n");
+      goto errorexit;
+   }
+
+   netcode_udp_send (strayfd, "127.0.0.1", NETCODE_TEST_CONNECT_PORT1, "stray", (size_t)5, NULL);
+   if (netcode_udp_send (fd, NULL, 0, "self 2", (size_t)6, NULL) != 6 ||
+       !(expect (fd, "self 2", NULL))) {
+      NETCODE_UTIL_LOG ("Datagram from another source was not filtered out\n");
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_util_close (fd);
+   return ret;
+}
+
+/* Two sockets connected to each other with netcode_udp_connect() send
+ * with no destination and receive only from each other, until the
+ * receiver is disconnected.
+ */
+static bool connect_test (int strayfd)
+{
+   bool ret = false;
+   int rxfd = -1, txfd = -1;
+   netcode_addr_t rxaddr, txaddr;
+
+   netcode_addr_parse (&rxaddr, "127.0.0.1");
+   netcode_addr_set_port (&rxaddr, NETCODE_TEST_CONNECT_PORT1);
+   netcode_addr_parse (&txaddr, "127.0.0.1");
+   netcode_addr_set_port (&txaddr, NETCODE_TEST_CONNECT_PORT2);
+
+   if ((rxfd = netcode_udp_socket (NETCODE_TEST_CONNECT_PORT1, NULL)) < 0 ||
+       (txfd = netcode_udp_socket (NETCODE_TEST_CONNECT_PORT2, NULL)) < 0 ||
+       !(netcode_udp_connect (rxfd, &txaddr)) ||
+       !(netcode_udp_connect (txfd, &rxaddr))) {
+      NETCODE_UTIL_LOG ("Failed to create connected sockets\n");
+      goto errorexit;
+   }
+
+   netcode_udp_send_addr (strayfd, &rxaddr, "stray", (size_t)5, NULL);
+   if (netcode_udp_send_addr (txfd, NULL, "peer", (size_t)4, NULL) != 4 ||
+       !(expect (rxfd, "peer", &txaddr))) {
+      NETCODE_UTIL_LOG ("Connected send failed or another source got through\n");
+      goto errorexit;
+   }
+
+   if (!(netcode_udp_connect (rxfd, NULL)) ||
+       netcode_udp_send_addr (strayfd, &rxaddr, "stray", (size_t)5, NULL) != 5 ||
+       !(expect (rxfd, "stray", NULL))) {
+      NETCODE_UTIL_LOG ("Disconnected socket did not receive from another source\n");
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   if (rxfd >= 0)
+      netcode_util_close (rxfd);
+   if (txfd >= 0)
+      netcode_util_close (txfd);
+   return ret;
+}
+
+/* A destination resolved once is sent to through its address, and is
+ * the same after it is refreshed.
+ */
+static bool dest_test (int txfd)
+{
+   bool ret = false;
+   int rxfd = -1;
+   netcode_udp_dest_t *dest = NULL;
+   netcode_addr_t before;
+
+   if (netcode_udp_dest_new (NULL, NETCODE_TEST_CONNECT_PORT1) != NULL ||
+       netcode_udp_dest_addr (NULL) != NULL) {
+      NETCODE_UTIL_LOG ("A NULL destination was accepted\n");
+      return false;
+   }
+
+   if ((rxfd = netcode_udp_socket (NETCODE_TEST_CONNECT_PORT1, NULL)) < 0 ||
+       !(dest = netcode_udp_dest_new ("127.0.0.1", NETCODE_TEST_CONNECT_PORT1))) {
+      NETCODE_UTIL_LOG ("Failed to create the destination\n");
+      goto errorexit;
+   }
+
+   before = *netcode_udp_dest_addr (dest);
+   if (netcode_udp_send_addr (txfd, netcode_udp_dest_addr (dest), "dest 1", (size_t)6, NULL) != 6 ||
+       !(expect (rxfd, "dest 1", NULL))) {
+      NETCODE_UTIL_LOG ("Send to the destination failed\n");
+      goto errorexit;
+   }
+
+   if (!(netcode_udp_dest_refresh (dest)) ||
+       netcode_addr_cmp (&before, netcode_udp_dest_addr (dest)) != 0 ||
+       netcode_udp_send_addr (txfd, netcode_udp_dest_addr (dest), "dest 2", (size_t)6, NULL) != 6 ||
+       !(expect (rxfd, "dest 2", NULL))) {
+      NETCODE_UTIL_LOG ("Send to the refreshed destination failed\n");
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_udp_dest_del (dest);
+   if (rxfd >= 0)
+      netcode_util_close (rxfd);
+   return ret;
+}
+
+/* More buffers than senda() describes on the stack are gathered into
+ * one datagram, in order.
+ */
+static bool gather_test (int txfd)
+{
+   bool ret = false;
+   int rxfd = netcode_udp_socket (NETCODE_TEST_CONNECT_PORT1, NULL);
+   char data[100], *buffers[sizeof data];
+   size_t lengths[sizeof data];
+
+   for (size_t i=0; i<sizeof data; i++) {
+      data[i] = (char)('a' + i % 26);
+      buffers[i] = &data[i];
+      lengths[i] = 1;
+   }
+
+   if (rxfd < 0) {
+      NETCODE_UTIL_LOG ("Failed to create a socket\n");
+      return false;
+   }
+
+   if (netcode_udp_senda (txfd, "127.0.0.1", NETCODE_TEST_CONNECT_PORT1, sizeof data,
+                          (void **)buffers, lengths) != sizeof data ||
+       netcode_udp_send (txfd, "127.0.0.1", NETCODE_TEST_CONNECT_PORT1,
+                         "gather", (size_t)3, "ed", (size_t)2, NULL) != 5) {
+      NETCODE_UTIL_LOG ("Failed to send the gathered buffers\n");
+      goto errorexit;
+   }
+
+   // expect() takes a string, so the first datagram is compared here.
+   char buf[sizeof data + 1];
+   if (netcode_udp_recv_into (rxfd, NULL, buf, sizeof buf, 1) != sizeof data ||
+       memcmp (buf, data, sizeof data) != 0 ||
+       !(expect (rxfd, "gated", NULL))) {
+      NETCODE_UTIL_LOG ("Gathered buffers were not received in order\n");
+      goto errorexit;
+   }
+
+   ret = true;
+
+errorexit:
+   netcode_util_close (rxfd);
+   return ret;
+}
+
+static int udp_test (void)
+{
+   int ret = EXIT_FAILURE;
+   int strayfd = netcode_udp_socket (0, NULL);
+
+   if (strayfd < 0) {
+      NETCODE_UTIL_LOG ("Failed to create a socket\n");
+      return EXIT_FAILURE;
+   }
+
+   if (!(default_host_test (strayfd)) ||
+       !(connect_test (strayfd)) ||
+       !(dest_test (strayfd)) ||
+       !(gather_test (strayfd)))
+      goto errorexit;
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   netcode_util_close (strayfd);
+   return ret;
+}
+
+int main (void)
+{
+   int ret = EXIT_FAILURE;
+
+   if (!(netcode_util_init ())) {
+      NETCODE_UTIL_LOG ("Failed to initialise netcode\n");
+      goto errorexit;
+   }
+
+   if ((ret = udp_test ())!=EXIT_SUCCESS) {
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      printf ("+++ +++ udp: Test FAILED +++ +++\n");
+      printf ("+++++++++++++++++++++++++++++++++++++++\n");
+      goto errorexit;
+   }
+
+   printf ("*********************************\n");
+   printf ("*** *** udp: Test passed *** ***\n");
+   printf ("*********************************\n");
+
+   ret = EXIT_SUCCESS;
+
+errorexit:
+   return ret;
+}
@@ -1,3 +1,10 @@
+/* This must come before any system header, otherwise strict C99 mode
+ * hides clock_gettime() and nanosleep() from us.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
@@ -5,6 +12,8 @@
 #include <inttypes.h>
 
 #include "netcode_util.h"
+#include "netcode_log.h"
+#include "netcode_addr.h"
 
 /* ***************************************************************** */
 #if defined (OSTYPE_Darwin)
@@ -175,7 +184,7 @@ static bool wsa_netcode_init (void)
 
    int result = WSAStartup (MAKEWORD(2,2), &xp_wsaData);
    if (result!=0) {
-      NETCODE_UTIL_LOG ("Critical: winsock could not be initiliased - %i\n", result);
+      NETCODE_LOG (NETCODE_LOG_ERROR, "Critical: winsock could not be initiliased - %i\n", result);
       return false;
    }
 
@@ -195,11 +204,14 @@ static bool wsa_netcode_init (void)
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <sys/select.h>
+#include <sched.h>
+#include <time.h>
 
 
 #ifndef OSTYPE_Darwin
@@ -208,7 +220,6 @@ static bool wsa_netcode_init (void)
  * of flags, pragmas or -D... will make GCC use the arpa/inet header,
  * I'll just put this here.
  */
-int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
 const char *hstrerror (int err);
 
 #define SEND(x,y,z)        send (x,y,z, MSG_NOSIGNAL)
@@ -274,6 +285,170 @@ int netcode_util_close (int fd)
    return close (fd);
 }
 
+#define NSEC_PER_SEC       (1000000000ULL)
+
+uint64_t netcode_util_time_ns (void)
+{
+#ifdef PLATFORM_Windows
+   static LARGE_INTEGER freq;
+   LARGE_INTEGER count;
+   if (!freq.QuadPart)
+      QueryPerformanceFrequency (&freq);
+   QueryPerformanceCounter (&count);
+   return (uint64_t)((double)count.QuadPart * NSEC_PER_SEC / freq.QuadPart);
+#else
+   struct timespec ts;
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+void netcode_util_sleep_ns (uint64_t ns)
+{
+#ifdef PLATFORM_Windows
+   Sleep ((DWORD)((ns + 999999) / 1000000));
+#else
+   struct timespec ts = { (time_t)(ns / NSEC_PER_SEC), (long)(ns % NSEC_PER_SEC) };
+   while (nanosleep (&ts, &ts) != 0 && errno == EINTR)
+      ;
+#endif
+}
+
+/* ***************************************************************** */
+/* A reader counts itself in for the parity of the current epoch and then
+ * checks that the epoch has not moved on; if it has, a writer may
+ * already have waited for that count to drain, so the reader backs out
+ * and tries again. A reader that gets past the check is either waited
+ * for by the next writer, or loads the pointer after the writer has
+ * replaced it.
+ *
+ * The writer moves to the next epoch and waits for the count of the
+ * previous one to drain. Any reader counted in the new epoch entered
+ * after the pointer was replaced.
+ */
+uint32_t netcode_util_epoch_enter (netcode_util_epoch_t *ep)
+{
+   for (;;) {
+      uint32_t e = __atomic_load_n (&ep->epoch, __ATOMIC_SEQ_CST);
+      __atomic_add_fetch (&ep->readers[e & 1], 1, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n (&ep->epoch, __ATOMIC_SEQ_CST) == e)
+         return e & 1;
+      __atomic_sub_fetch (&ep->readers[e & 1], 1, __ATOMIC_RELEASE);
+   }
+}
+
+void netcode_util_epoch_exit (netcode_util_epoch_t *ep, uint32_t token)
+{
+   __atomic_sub_fetch (&ep->readers[token], 1, __ATOMIC_RELEASE);
+}
+
+static void yield (void)
+{
+#ifdef PLATFORM_Windows
+   SwitchToThread ();
+#else
+   sched_yield ();
+#endif
+}
+
+void netcode_util_epoch_sync (netcode_util_epoch_t *ep)
+{
+   while (__atomic_test_and_set (&ep->lock, __ATOMIC_ACQUIRE))
+      yield ();
+
+   uint32_t e = __atomic_fetch_add (&ep->epoch, 1, __ATOMIC_SEQ_CST) & 1;
+   while (__atomic_load_n (&ep->readers[e], __ATOMIC_SEQ_CST))
+      yield ();
+
+   __atomic_clear (&ep->lock, __ATOMIC_RELEASE);
+}
+
+/* ***************************************************************** */
+static void *default_malloc (void *ctx, size_t size)
+{
+   (void)ctx;
+   return malloc (size);
+}
+
+static void *default_realloc (void *ctx, void *ptr, size_t size)
+{
+   (void)ctx;
+   return realloc (ptr, size);
+}
+
+static void default_free (void *ctx, void *ptr)
+{
+   (void)ctx;
+   free (ptr);
+}
+
+static netcode_malloc_fn_t   *alloc_malloc = default_malloc;
+static netcode_realloc_fn_t  *alloc_realloc = default_realloc;
+static netcode_free_fn_t     *alloc_free = default_free;
+static void                  *alloc_ctx = NULL;
+
+static bool alloc_debug = false;
+static __thread uint64_t alloc_count = 0;
+
+void netcode_set_allocator (netcode_malloc_fn_t *malloc_fn,
+                            netcode_realloc_fn_t *realloc_fn,
+                            netcode_free_fn_t *free_fn,
+                            void *ctx)
+{
+   if (!malloc_fn || !realloc_fn || !free_fn) {
+      malloc_fn = default_malloc;
+      realloc_fn = default_realloc;
+      free_fn = default_free;
+      ctx = NULL;
+   }
+
+   alloc_malloc = malloc_fn;
+   alloc_realloc = realloc_fn;
+   alloc_free = free_fn;
+   alloc_ctx = ctx;
+}
+
+void *netcode_util_malloc (size_t size)
+{
+   if (alloc_debug)
+      alloc_count++;
+   return alloc_malloc (alloc_ctx, size);
+}
+
+void *netcode_util_calloc (size_t nelems, size_t size)
+{
+   if (size && nelems > (size_t)-1 / size)
+      return NULL;
+
+   void *ret = netcode_util_malloc (nelems * size);
+   if (ret)
+      memset (ret, 0, nelems * size);
+   return ret;
+}
+
+void *netcode_util_realloc (void *ptr, size_t size)
+{
+   if (alloc_debug)
+      alloc_count++;
+   return alloc_realloc (alloc_ctx, ptr, size);
+}
+
+void netcode_util_free (void *ptr)
+{
+   if (ptr)
+      alloc_free (alloc_ctx, ptr);
+}
+
+void netcode_util_alloc_debug (bool enable)
+{
+   alloc_debug = enable;
+}
+
+uint64_t netcode_util_alloc_count (void)
+{
+   return alloc_count;
+}
+
 #ifdef PLATFORM_Windows
 
 char *netcode_util_sockaddr_to_str (const struct sockaddr *sa)
@@ -305,7 +480,7 @@ char *netcode_util_sockaddr_to_str (const struct sockaddr *sa)
    }
 
 
-   if (!(ret = malloc (1)))
+   if (!(ret = netcode_util_malloc (1)))
       return NULL;
    ret_len = 1;
 
@@ -317,7 +492,7 @@ char *netcode_util_sockaddr_to_str (const struct sockaddr *sa)
    if (rc!=-1 || ret_len==0 || (WSAGetLastError ()!=WSAEFAULT))
       return NULL;
 
-   if (!(ret = malloc (ret_len + 1)))
+   if (!(ret = netcode_util_malloc (ret_len + 1)))
       return NULL;
 
    rc = WSAAddressToStringA (local_sa,
@@ -326,7 +501,7 @@ char *netcode_util_sockaddr_to_str (const struct sockaddr *sa)
                              ret,
                              &ret_len);
    if (rc != 0) {
-      free (ret);
+      netcode_util_free (ret);
       ret = NULL;
    }
 
@@ -341,28 +516,28 @@ char *netcode_util_sockaddr_to_str (const struct sockaddr *sa)
 #define UNKNOWN_AF      ("Unknown Address Family")
    char *ret = NULL;
    if (!sa) {
-      ret = calloc (1, 2);
+      ret = netcode_util_calloc (1, 2);
       ret[0] = 0;
       return ret;
    }
 
    switch (sa->sa_family) {
       case AF_INET:
-         if (!(ret = calloc (1, INET_ADDRSTRLEN + 1)))
+         if (!(ret = netcode_util_calloc (1, INET_ADDRSTRLEN + 1)))
             return NULL;
          inet_ntop (AF_INET, &(((struct sockaddr_in *)sa)->sin_addr),
                     ret, INET_ADDRSTRLEN);
          break;
 
       case AF_INET6:
-         if (!(ret = calloc (1, INET6_ADDRSTRLEN + 1)))
+         if (!(ret = netcode_util_calloc (1, INET6_ADDRSTRLEN + 1)))
             return NULL;
          inet_ntop (AF_INET6, &(((struct sockaddr_in6 *)sa)->sin6_addr),
                     ret, INET6_ADDRSTRLEN);
          break;
 
       default:
-         if (!(ret = calloc (1, strlen (UNKNOWN_AF) + 1)))
+         if (!(ret = netcode_util_calloc (1, strlen (UNKNOWN_AF) + 1)))
             return NULL;
          strcpy (ret, UNKNOWN_AF);
          break;
@@ -371,3 +546,258 @@ char *netcode_util_sockaddr_to_str (const struct sockaddr *sa)
    return ret;
 }
 #endif
+
+/* ***************************************************************** */
+/* Address formatting and parsing without allocations or the C library.
+ *
+ * Both are on the path of every accepted connection and, for servers
+ * that log or key on their peers, every received datagram; inet_ntop()
+ * and inet_pton() are general enough to be several times slower than
+ * they need to be for the common case of a dotted IPv4 address.
+ */
+
+// "00" to "99", so that two digits are written at a time.
+static const char digit_pairs[] =
+   "00010203040506070809"
+   "10111213141516171819"
+   "20212223242526272829"
+   "30313233343536373839"
+   "40414243444546474849"
+   "50515253545556575859"
+   "60616263646566676869"
+   "70717273747576777879"
+   "80818283848586878889"
+   "90919293949596979899";
+
+// The value of each decimal digit plus one; zero for anything else.
+static const uint8_t digit_values[256] = {
+   ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+   ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+};
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static char *fmt_dec (char *dst, uint32_t value)
+{
+   char tmp[10];
+   char *p = &tmp[sizeof tmp];
+
+   while (value >= 100) {
+      uint32_t pair = (value % 100) * 2;
+      value /= 100;
+      *--p = digit_pairs[pair + 1];
+      *--p = digit_pairs[pair];
+   }
+   if (value >= 10) {
+      *--p = digit_pairs[value * 2 + 1];
+      *--p = digit_pairs[value * 2];
+   } else {
+      *--p = (char)('0' + value);
+   }
+
+   size_t len = (size_t)(&tmp[sizeof tmp] - p);
+   memcpy (dst, p, len);
+   return dst + len;
+}
+
+static char *fmt_ipv4 (char *dst, const uint8_t *bytes)
+{
+   for (size_t i=0; i<4; i++) {
+      uint32_t b = bytes[i];
+      if (b >= 100) {
+         *dst++ = (char)('0' + b / 100);
+         b %= 100;
+         *dst++ = digit_pairs[b * 2];
+         *dst++ = digit_pairs[b * 2 + 1];
+      } else if (b >= 10) {
+         *dst++ = digit_pairs[b * 2];
+         *dst++ = digit_pairs[b * 2 + 1];
+      } else {
+         *dst++ = (char)('0' + b);
+      }
+      *dst++ = '.';
+   }
+   return dst - 1;
+}
+
+/* RFC 5952 text, the same as inet_ntop() produces: lowercase, no
+ * leading zeros, the longest (first if tied) run of two or more zero
+ * words replaced by "::", and IPv4-compatible and -mapped addresses
+ * ending in dotted decimal.
+ */
+static char *fmt_ipv6 (char *dst, const uint8_t *bytes)
+{
+   uint16_t words[8];
+   int best = -1, bestlen = 0, cur = -1, curlen = 0;
+
+   for (int i=0; i<8; i++) {
+      words[i] = (uint16_t)(bytes[i * 2] << 8 | bytes[i * 2 + 1]);
+      if (words[i] == 0) {
+         if (cur < 0)
+            cur = i;
+         if (++curlen > bestlen) {
+            best = cur;
+            bestlen = curlen;
+         }
+      } else {
+         cur = -1;
+         curlen = 0;
+      }
+   }
+   if (bestlen < 2)
+      best = -1;
+
+   for (int i=0; i<8; i++) {
+      if (i == best) {
+         *dst++ = ':';
+         if (i + bestlen == 8)
+            *dst++ = ':';
+         i += bestlen - 1;
+         continue;
+      }
+      if (i)
+         *dst++ = ':';
+      if (i == 6 && best == 0 &&
+          (bestlen == 6 || (bestlen == 5 && words[5] == 0xffff)))
+         return fmt_ipv4 (dst, &bytes[12]);
+
+      uint16_t w = words[i];
+      int shift = w >= 0x1000 ? 12 : w >= 0x100 ? 8 : w >= 0x10 ? 4 : 0;
+      for (; shift >= 0; shift -= 4) {
+         *dst++ = hex_digits[(w >> shift) & 0xf];
+      }
+   }
+   return dst;
+}
+
+size_t netcode_util_addr_format (const struct sockaddr *sa, char *dst, size_t cap)
+{
+   // Long enough for a bracketed IPv6 address with scope and port.
+   char tmp[80];
+   const char *src = tmp;
+   char *p = tmp;
+   size_t len;
+
+   if (!dst || !cap)
+      return 0;
+
+   dst[0] = 0;
+
+   if (!sa)
+      return 0;
+
+   switch (sa->sa_family) {
+      case AF_INET: {
+         const struct sockaddr_in *sin = (const struct sockaddr_in *)sa;
+         p = fmt_ipv4 (p, (const uint8_t *)&sin->sin_addr);
+         *p++ = ':';
+         p = fmt_dec (p, ntohs (sin->sin_port));
+         len = (size_t)(p - tmp);
+         break;
+      }
+
+      case AF_INET6: {
+         const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)sa;
+         *p++ = '[';
+         p = fmt_ipv6 (p, (const uint8_t *)&sin6->sin6_addr);
+         if (sin6->sin6_scope_id) {
+            *p++ = '%';
+            p = fmt_dec (p, (uint32_t)sin6->sin6_scope_id);
+         }
+         *p++ = ']';
+         *p++ = ':';
+         p = fmt_dec (p, ntohs (sin6->sin6_port));
+         len = (size_t)(p - tmp);
+         break;
+      }
+
+#ifdef PLATFORM_POSIX
+      case AF_UNIX: {
+         const struct sockaddr_un *sun = (const struct sockaddr_un *)sa;
+         size_t pathlen = 0;
+         while (pathlen < sizeof sun->sun_path && sun->sun_path[pathlen])
+            pathlen++;
+         if (cap < 5 + pathlen + 1)
+            return 0;
+         memcpy (dst, "unix:", 5);
+         memcpy (&dst[5], sun->sun_path, pathlen);
+         dst[5 + pathlen] = 0;
+         return 5 + pathlen;
+      }
+#endif
+
+      default:
+         return 0;
+   }
+
+   if (len >= cap)
+      return 0;
+
+   memcpy (dst, src, len);
+   dst[len] = 0;
+   return len;
+}
+
+/* Dotted IPv4, with an optional port, in one pass: four decimal octets
+ * of at most three digits and no leading zeros (as inet_pton() insists),
+ * then optionally ':' and up to five digits.
+ */
+static bool parse_ipv4_fast (const char *str, uint8_t *bytes, uint16_t *port)
+{
+   const uint8_t *s = (const uint8_t *)str;
+
+   for (size_t i=0; i<4; i++) {
+      uint32_t v = digit_values[*s];
+      if (!v--)
+         return false;
+      s++;
+      for (size_t n=1; n<3 && digit_values[*s]; n++, s++) {
+         if (v == 0)
+            return false;
+         v = v * 10 + digit_values[*s] - 1;
+      }
+      if (v > 255)
+         return false;
+      bytes[i] = (uint8_t)v;
+      if (i < 3 && *s++ != '.')
+         return false;
+   }
+
+   *port = 0;
+   if (*s == 0)
+      return true;
+   if (*s++ != ':' || !digit_values[*s])
+      return false;
+
+   uint32_t p = 0;
+   for (size_t n=0; digit_values[*s]; n++, s++) {
+      if (n == 5)
+         return false;
+      p = p * 10 + digit_values[*s] - 1;
+   }
+   if (*s || p > 0xffff)
+      return false;
+
+   *port = (uint16_t)p;
+   return true;
+}
+
+bool netcode_util_addr_parse (const char *str, struct netcode_addr_t *dst)
+{
+   uint8_t bytes[4];
+   uint16_t port;
+
+   if (!dst)
+      return false;
+
+   if (!str || !(parse_ipv4_fast (str, bytes, &port)))
+      return netcode_addr_parse (dst, str);
+
+   struct sockaddr_in *sin = (struct sockaddr_in *)&dst->sa;
+   memset (dst, 0, sizeof *dst);
+   sin->sin_family = AF_INET;
+   sin->sin_port = htons (port);
+   memcpy (&sin->sin_addr, bytes, sizeof bytes);
+   dst->salen = sizeof *sin;
+   return true;
+}
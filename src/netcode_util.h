@@ -2,6 +2,8 @@
 #define H_NETCODE_UTIL
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
 
 #ifdef PLATFORM_Windows
 #include <winsock2.h>
@@ -30,6 +32,53 @@
 #define NETCODE_TEST_UDP_RESPONSE1     ("UDP response data 1")
 #define NETCODE_TEST_UDP_REQUEST2      ("UDP request data 2")
 #define NETCODE_TEST_UDP_RESPONSE2     ("UDP response data 2")
+#define NETCODE_TEST_MCAST_PORT        (55158)
+#define NETCODE_TEST_MCAST_GROUP       ("239.255.55.158")
+#define NETCODE_TEST_MCAST_SSM_GROUP   ("232.255.55.158")
+#define NETCODE_TEST_MCAST_DATA        ("Multicast data")
+#define NETCODE_TEST_SHARD_PORT        (55159)
+#define NETCODE_TEST_PACE_PORT         (55160)
+#define NETCODE_TEST_TSTAMP_PORT       (55162)
+#define NETCODE_TEST_RUDP_PORT1        (55163)
+#define NETCODE_TEST_RUDP_PORT2        (55164)
+#define NETCODE_TEST_FEC_PORT          (55165)
+#define NETCODE_TEST_FRAG_PORT         (55166)
+#define NETCODE_TEST_BUFPOOL_PORT      (55167)
+#define NETCODE_TEST_ALLOC_PORT        (55168)
+#define NETCODE_TEST_BATCH_PORT1       (55169)
+#define NETCODE_TEST_BATCH_PORT2       (55170)
+#define NETCODE_TEST_ACL_PORT          (55171)
+#define NETCODE_TEST_RATELIMIT_PORT    (55172)
+#define NETCODE_TEST_BENCH_PORT        (55173)
+#define NETCODE_TEST_SEGMENT_PORT      (55174)
+#define NETCODE_TEST_GRO_PORT          (55175)
+#define NETCODE_TEST_BENCH_PORT2       (55176)
+#define NETCODE_TEST_SEGMENT_PORT2     (55177)
+#define NETCODE_TEST_CONNECT_PORT1     (55178)
+#define NETCODE_TEST_CONNECT_PORT2     (55179)
+
+struct netcode_addr_t;
+
+// The allocator used for all of the library's memory; see
+// netcode_set_allocator().
+typedef void *(netcode_malloc_fn_t) (void *ctx, size_t size);
+typedef void *(netcode_realloc_fn_t) (void *ctx, void *ptr, size_t size);
+typedef void (netcode_free_fn_t) (void *ctx, void *ptr);
+
+/* An epoch protects a pointer that one thread replaces while others read
+ * it. Readers bracket their use of the pointer with
+ * netcode_util_epoch_enter() and netcode_util_epoch_exit(), which take
+ * no lock; after replacing the pointer, the writer calls
+ * netcode_util_epoch_sync(), which returns once no reader can still be
+ * using the old one, so that it can be freed.
+ */
+typedef struct netcode_util_epoch_t {
+   uint32_t    epoch;
+   uint64_t    readers[2];       // By the parity of the epoch
+   char        lock;             // Serialises writers
+} netcode_util_epoch_t;
+
+#define NETCODE_UTIL_EPOCH_INIT     { 0, { 0, 0 }, 0 }
 
 #ifdef __cplusplus
 extern "C" {
@@ -45,6 +94,73 @@ extern "C" {
    // Caller must free the returned value
    char *netcode_util_sockaddr_to_str (const struct sockaddr *sa);
 
+   // Writes 'sa' as text, including the port, into 'dst', which holds
+   // 'cap' bytes: "192.0.2.1:80", "[2001:db8::1]:80", "[fe80::1%2]:80"
+   // or "unix:/path". Nothing is allocated. NETCODE_ADDR_STRLEN bytes
+   // are always enough.
+   //
+   // RETURNS: the length of the text, or 0 (with 'dst' emptied) if the
+   // family is not supported or 'dst' is too small.
+   size_t netcode_util_addr_format (const struct sockaddr *sa, char *dst, size_t cap);
+
+   // Parses 'str' into 'dst' as netcode_addr_parse() does, but takes a
+   // fast path that does not use the C library for dotted IPv4
+   // addresses (with or without a port).
+   //
+   // RETURNS: false if 'str' is not a valid address.
+   bool netcode_util_addr_parse (const char *str, struct netcode_addr_t *dst);
+
+   // Returns the time, in nanoseconds, of a monotonic clock. Only the
+   // difference between two values is meaningful.
+   uint64_t netcode_util_time_ns (void);
+
+   // Sleeps for not less than 'ns' nanoseconds.
+   void netcode_util_sleep_ns (uint64_t ns);
+
+   // Routes every allocation that the library makes through the given
+   // functions, each of which is passed 'ctx'. Passing NULL for any
+   // function restores the C library's malloc(), realloc() and free().
+   //
+   // Call this before any other library function, and do not change the
+   // allocator while memory from the previous one is still held: memory
+   // is always freed with the allocator in place at the time.
+   //
+   // Memory that the library returns for the caller to free (such as
+   // the buffers from netcode_udp_wait() and the strings from
+   // netcode_if_extract()) comes from this allocator too; with a custom
+   // allocator it must be freed with netcode_util_free(), not free().
+   void netcode_set_allocator (netcode_malloc_fn_t *malloc_fn,
+                               netcode_realloc_fn_t *realloc_fn,
+                               netcode_free_fn_t *free_fn,
+                               void *ctx);
+
+   // The library's allocation functions. They behave like their C
+   // library counterparts, but use the allocator that was set with
+   // netcode_set_allocator().
+   void *netcode_util_malloc (size_t size);
+   void *netcode_util_calloc (size_t nelems, size_t size);
+   void *netcode_util_realloc (void *ptr, size_t size);
+   void netcode_util_free (void *ptr);
+
+   // For testing that a code path does not allocate: while enabled,
+   // every allocation (malloc, calloc or realloc) made through the
+   // library is counted against the thread that made it. Compare
+   // netcode_util_alloc_count() before and after a call to find out how
+   // many allocations the call made.
+   void netcode_util_alloc_debug (bool enable);
+   uint64_t netcode_util_alloc_count (void);
+
+   // Enters a read-side section of 'ep'. Load the protected pointer
+   // after this call, and do not use it after netcode_util_epoch_exit().
+   //
+   // RETURNS: the token to pass to netcode_util_epoch_exit().
+   uint32_t netcode_util_epoch_enter (netcode_util_epoch_t *ep);
+   void netcode_util_epoch_exit (netcode_util_epoch_t *ep, uint32_t token);
+
+   // Waits until every reader that could have loaded the pointer that
+   // was replaced before this call has left its section.
+   void netcode_util_epoch_sync (netcode_util_epoch_t *ep);
+
 
 #ifdef __cplusplus
 };